@@ -0,0 +1,91 @@
+/**
+ * @file bench.h
+ *
+ * @brief Native micro-benchmarks of the corelib hot paths. Results are printed as CSV
+ * rows of `suite,case,metric,value,unit` so they can be tracked across releases.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <Arduino.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+namespace bench {
+
+typedef std::chrono::steady_clock Clock;
+
+/// Monotonic time in nanoseconds
+inline uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+/// Keeps the optimiser from discarding benchmarked results
+extern volatile uint32_t sink;
+
+/// Prints the CSV header
+inline void header() {
+    printf("suite,case,metric,value,unit\n");
+}
+
+/// Prints one CSV result row
+inline void report(const char* suite, const char* name, const char* metric, double value, const char* unit) {
+    printf("%s,%s,%s,%.3f,%s\n", suite, name, metric, value, unit);
+}
+
+/**
+ * @brief Collects latency samples in nanoseconds and reports their percentiles
+ */
+class Samples
+{
+public:
+    explicit Samples(size_t expected = 0) {
+        values.reserve(expected);
+    }
+
+    void add(uint64_t ns) {
+        values.push_back(ns);
+    }
+
+    size_t size() const {
+        return values.size();
+    }
+
+    /// The p-th percentile (0.0 - 1.0) of the samples
+    uint64_t percentile(double p) {
+        if(values.empty()){
+            return 0;
+        }
+        size_t rank = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+        std::nth_element(values.begin(), values.begin() + rank, values.end());
+        return values[rank];
+    }
+
+    /// Prints p50/p99/p999 rows
+    void report(const char* suite, const char* name, const char* prefix) {
+        char metric[48];
+        snprintf(metric, sizeof(metric), "%s_p50", prefix);
+        bench::report(suite, name, metric, percentile(0.50), "ns");
+        snprintf(metric, sizeof(metric), "%s_p99", prefix);
+        bench::report(suite, name, metric, percentile(0.99), "ns");
+        snprintf(metric, sizeof(metric), "%s_p999", prefix);
+        bench::report(suite, name, metric, percentile(0.999), "ns");
+    }
+
+private:
+    std::vector<uint64_t> values;
+};
+
+// Suites
+void runIntegrity();
+void runPipeline();
+void runDelta();
+void runCan();
+void runUdp();
+
+} // NAMESPACE
+#endif // BENCH_H
@@ -0,0 +1,88 @@
+#include "bench.h"
+#include "can.h"
+
+namespace {
+
+const uint32_t messageCount = 2000;
+// Full speed USB moves one 64 byte packet each millisecond
+const double usbBytesPerSecond = 64000.0;
+
+typedef corelib::SimulatedCanBus<2, 64> Bus;
+
+uint8_t message[128];
+size_t messageLength = 0;
+bool pending = false;
+uint32_t delivered = 0;
+
+bool publish(corelib::Buffer* b) {
+    if(!pending){
+        return false;
+    }
+    memcpy(b->outBuffer, message, messageLength);
+    b->outMessageLength = messageLength;
+    pending = false;
+    return true;
+}
+
+corelib::HandleMessageState count(corelib::Buffer* b) {
+    delivered++;
+    bench::sink ^= b->inBuffer[0];
+    return corelib::HandleMessageState::OK;
+}
+
+/**
+ * Sends `messageCount` messages of `length` bytes from one node to another and reports
+ * the message bytes moved each second of bus time, with the bus bit rates in bits/s
+ */
+template<uint8_t DataSize>
+void measure(const char* name, size_t length, uint32_t nominalRate, uint32_t dataRate) {
+    Bus bus;
+    corelib::SimulatedCanComm<Bus, corelib::CommConfig<>, DataSize> sender(bus, 0x02, 0x01);
+    corelib::SimulatedCanComm<Bus, corelib::CommConfig<>, DataSize> receiver(bus, 0x01, 0x02);
+    sender.setPublishCallback(etl::delegate<bool(corelib::Buffer*)>::template create<&publish>());
+    receiver.setHandleMessageCallback(etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::template create<&count>());
+    sender.initialise();
+    receiver.initialise();
+
+    // Messages of a protobuf encoding, no long runs of zeros
+    for(size_t i = 0; i < sizeof(message); i++){
+        message[i] = 0x08 + (i * 7) % 0xF0;
+    }
+    messageLength = length;
+    delivered = 0;
+    for(uint32_t i = 0; i < messageCount; i++){
+        pending = true;
+        sender.iterate();
+        // The receiver reframes the message and reads a frame each iteration
+        for(uint8_t j = 0; j < corelib::CommConfig<>::fragmentsPerMessage; j++){
+            receiver.iterate();
+        }
+    }
+    const double seconds = bus.seconds(nominalRate, dataRate);
+    const double bytes = static_cast<double>(length) * delivered;
+    bench::report("can", name, "payload_rate", bytes / seconds, "bytes/s");
+    bench::report("can", name, "wire_efficiency", bytes * 8 / (bus.bits.nominal + bus.bits.data), "ratio");
+    bench::report("can", name, "can_frames", static_cast<double>(bus.frames) / messageCount, "frames/message");
+    bench::report("can", name, "lost", messageCount - delivered + bus.overruns, "messages");
+}
+
+// The same messages as whole 64 byte frames over full speed USB
+void measureUsb(const char* name, size_t length) {
+    const size_t frames = (length + sizeof(corelib::Frame::payload) - 1) / sizeof(corelib::Frame::payload);
+    const double wire = static_cast<double>(frames * sizeof(corelib::Frame));
+    bench::report("can", name, "payload_rate", length * usbBytesPerSecond / wire, "bytes/s");
+    bench::report("can", name, "wire_efficiency", length / wire, "ratio");
+}
+
+} // NAMESPACE
+
+void bench::runCan() {
+    // A two frame TransactionMessage and a short one
+    measureUsb("usb_99", 99);
+    measure<corelib::CanFdSize>("fd_1m_5m_99", 99, 1000000, 5000000);
+    measure<corelib::CanFdSize>("fd_500k_2m_99", 99, 500000, 2000000);
+    measure<corelib::CanClassicSize>("classic_1m_99", 99, 1000000, 1000000);
+    measureUsb("usb_12", 12);
+    measure<corelib::CanFdSize>("fd_1m_5m_12", 12, 1000000, 5000000);
+    measure<corelib::CanClassicSize>("classic_1m_12", 12, 1000000, 1000000);
+}
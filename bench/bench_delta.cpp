@@ -0,0 +1,70 @@
+#include "bench.h"
+#include "shares.h"
+
+namespace {
+
+const uint32_t updates = 10000;
+
+// Publish traffic of a tuning struct, published whole and as deltas
+struct DeltaBench {
+    CommStats1 share = CommStats1_init_zero;
+    corelib::ShareRegistry<2> full;
+    corelib::ShareRegistry<2> delta;
+    corelib::DeltaShadow shadow;
+
+    DeltaBench() {
+        full.addShare<CommStats1_size>(1, share, CommStats1_fields);
+        delta.addShare<CommStats1_size>(1, share, CommStats1_fields);
+        delta.trackDelta(1, shadow);
+        for(uint8_t i = 0; i < 13; i++){
+            (&share.readOk)[i] = 1000 + i;
+        }
+    }
+};
+
+// Bytes on the wire of a message, whole frames
+size_t wireBytes(size_t length) {
+    return (length + sizeof(corelib::Frame::payload) - 1) / sizeof(corelib::Frame::payload) * sizeof(corelib::Frame);
+}
+
+/**
+ * Publishes `updates` updates, each changing `changed` of the 13 counters, and reports
+ * the mean bytes on the wire with and without deltas
+ */
+void measure(const char* name, uint8_t changed) {
+    DeltaBench bench;
+    uint8_t out[128];
+    uint64_t fullBytes = 0;
+    uint64_t deltaBytes = 0;
+    uint64_t deltaData = 0;
+    bench::Samples latency(updates);
+    for(uint32_t update = 0; update < updates; update++){
+        for(uint8_t i = 0; i < changed; i++){
+            // Counters tick by small amounts, the low bytes change
+            (&bench.share.readOk)[(update + i * 5) % 13] += 1 + (update & 3);
+        }
+        size_t length = 0;
+        bench.full.encodePublish(1, update, out, sizeof(out), length);
+        fullBytes += wireBytes(length);
+        const uint64_t start = bench::nowNs();
+        bench.delta.encodePublish(1, update, out, sizeof(out), length);
+        latency.add(bench::nowNs() - start);
+        deltaBytes += wireBytes(length);
+        deltaData += length;
+        bench::sink ^= out[length - 1];
+    }
+    bench::report("delta", name, "full_wire", static_cast<double>(fullBytes) / updates, "bytes/update");
+    bench::report("delta", name, "delta_wire", static_cast<double>(deltaBytes) / updates, "bytes/update");
+    bench::report("delta", name, "delta_message", static_cast<double>(deltaData) / updates, "bytes/update");
+    latency.report("delta", name, "encode");
+}
+
+} // NAMESPACE
+
+void bench::runDelta() {
+    measure("idle", 0);
+    measure("one_gauge", 1);
+    measure("three_gauges", 3);
+    measure("half_changed", 6);
+    measure("all_changed", 13);
+}
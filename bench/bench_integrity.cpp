@@ -0,0 +1,53 @@
+#include "bench.h"
+#include "integrity.h"
+#include "frame.h"
+
+namespace {
+
+const uint64_t durationNs = 200000000; // 200ms per case
+
+template<typename Policy>
+void measure(const char* name, uint8_t* data, size_t length, const char* caseSuffix) {
+    Policy policy;
+    uint64_t bytes = 0;
+    uint32_t result = 0;
+    const uint64_t start = bench::nowNs();
+    uint64_t elapsed = 0;
+    do {
+        for(uint16_t i = 0; i < 256; i++){
+            // Chain each result into the next input so no iteration can be hoisted
+            data[0] = static_cast<uint8_t>(result);
+            result += policy.compute(data, length);
+        }
+        bytes += 256 * length;
+        elapsed = bench::nowNs() - start;
+    } while(elapsed < durationNs);
+    bench::sink ^= result;
+
+    char label[64];
+    snprintf(label, sizeof(label), "%s_%s", name, caseSuffix);
+    bench::report("integrity", label, "throughput", bytes * 1e9 / elapsed, "bytes/s");
+}
+
+template<typename Policy>
+void measureAll(const char* name, uint8_t* frame, uint8_t* block, size_t blockLength) {
+    // A frame check covers every byte of the frame but the crc
+    measure<Policy>(name, frame, sizeof(corelib::Frame) - sizeof(corelib::Frame::crc), "frame");
+    measure<Policy>(name, block, blockLength, "4k");
+}
+
+} // NAMESPACE
+
+void bench::runIntegrity() {
+    static uint8_t block[4096];
+    for(size_t i = 0; i < sizeof(block); i++){
+        block[i] = (i * 31 + 7) & 0xFF;
+    }
+    corelib::Frame frame;
+    memcpy(&frame, block, sizeof(frame));
+
+    measureAll<corelib::FastCrc32Integrity>("fastcrc", (uint8_t*)&frame, block, sizeof(block));
+    measureAll<corelib::Crc32SliceBy8>("slice_by_8", (uint8_t*)&frame, block, sizeof(block));
+    measureAll<corelib::Crc32Nibble>("nibble", (uint8_t*)&frame, block, sizeof(block));
+    measureAll<corelib::NoIntegrity>("none", (uint8_t*)&frame, block, sizeof(block));
+}
@@ -0,0 +1,232 @@
+#include "bench.h"
+#include "comm.h"
+#include "router.h"
+
+namespace {
+
+const uint32_t messageCount = 20000;
+
+/**
+ * @brief Comm over an in-memory loopback, frames queued with `push` are returned by
+ * `read` and written frames are counted
+ */
+class BenchComm : public corelib::Comm
+{
+public:
+    BenchComm() : corelib::Comm() {
+        setHandleMessageCallback(etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::create<BenchComm, &BenchComm::echo>(*this));
+    }
+
+    // Queues a frame to be read by the pipeline
+    void push(const corelib::Frame& frame) {
+        memcpy(rxFrames[rxTail % RxDepth], &frame, sizeof(frame));
+        rxTail++;
+    }
+
+    // Switches between the Buffer callback and the zero copy view callback
+    void useView(bool enabled) {
+        if(enabled){
+            setHandleMessageViewCallback(etl::delegate<corelib::HandleMessageState(const corelib::MessageView&, corelib::Buffer*)>::create<BenchComm, &BenchComm::echoView>(*this));
+        }else{
+            viewCallbackFunction = etl::delegate<corelib::HandleMessageState(const corelib::MessageView&, corelib::Buffer*)>();
+        }
+    }
+
+    uint32_t written() const {
+        return txCount;
+    }
+
+    auto stageRead() { return processRead(); }
+    auto stageIncoming() { return processIncomingMessage(); }
+    auto stageCallback() { return callback(&buffer); }
+    auto stageOutgoing() { return processOutgoingMessage(); }
+    auto stageWrite() { return processWrite(); }
+
+    void reset() {
+        inFrames.clear();
+        outFrames.clear();
+        buffer.inIndex = 0;
+        buffer.outMessageLength = 0;
+        rxHead = rxTail = 0;
+        txCount = 0;
+    }
+
+protected:
+    static const uint32_t RxDepth = 64;
+    uint8_t rxFrames[RxDepth][64];
+    uint32_t rxHead = 0;
+    uint32_t rxTail = 0;
+    uint32_t txCount = 0;
+
+    // Echoes each message back to the sender
+    corelib::HandleMessageState echo(corelib::Buffer* b) {
+        if(b->inIndex == 0){
+            return corelib::HandleMessageState::NO_DATA;
+        }
+        memcpy(b->outBuffer, b->inBuffer, b->inIndex);
+        b->outMessageLength = b->inIndex;
+        b->inIndex = 0;
+        return corelib::HandleMessageState::OK;
+    }
+
+    // Echoes each message back to the sender, reading it in place
+    corelib::HandleMessageState echoView(const corelib::MessageView& message, corelib::Buffer* b) {
+        b->outMessageLength = message.copyTo(b->outBuffer, sizeof(b->outBuffer));
+        return corelib::HandleMessageState::OK;
+    }
+
+    // Function.h interface
+    void performInitialise() {
+        initialised = true;
+    }
+
+    // Comms.h interface
+    bool read(uint8_t* frame) {
+        if(rxHead == rxTail){
+            return false;
+        }
+        memcpy(frame, rxFrames[rxHead % RxDepth], 64);
+        rxHead++;
+        return true;
+    }
+    bool write(const uint8_t* frame) {
+        bench::sink ^= frame[10];
+        txCount++;
+        return true;
+    }
+};
+
+/**
+ * @brief Builds the frames of a request message as the PC would send them
+ */
+void makeMessage(corelib::Frame* frames, uint8_t frameTotal, uint32_t frameId) {
+    static corelib::Crc32SliceBy8 crc;
+    for(uint8_t i = 0; i < frameTotal; i++){
+        corelib::Frame& frame = frames[i];
+        frame = corelib::Frame();
+        frame.preamble = corelib::Preamble::DATA;
+        frame.destinationAddress = 0x02;
+        frame.sourceAddress = 0x01;
+        frame.frameID = frameId;
+        frame.frameOrder = i + 1;
+        frame.frameTotal = frameTotal;
+        memset(frame.payload, 0x40 + i, sizeof(frame.payload));
+        frame.crc = crc.compute((uint8_t*)&frame, sizeof(corelib::Frame) - 4);
+    }
+}
+
+/**
+ * @brief Times each pipeline stage on its own and reports the mean ns per call
+ */
+void measureStages(BenchComm& comm, const char* name, uint8_t frameTotal) {
+    corelib::Frame frames[3];
+    uint64_t readNs = 0, incomingNs = 0, outgoingNs = 0, writeNs = 0;
+    uint32_t frameCount = 0, writeCount = 0;
+    comm.reset();
+    for(uint32_t m = 0; m < messageCount; m++){
+        makeMessage(frames, frameTotal, m);
+        for(uint8_t i = 0; i < frameTotal; i++){
+            comm.push(frames[i]);
+            uint64_t start = bench::nowNs();
+            comm.stageRead();
+            readNs += bench::nowNs() - start;
+            frameCount++;
+        }
+        uint64_t start = bench::nowNs();
+        comm.stageIncoming();
+        incomingNs += bench::nowNs() - start;
+
+        comm.stageCallback();
+
+        start = bench::nowNs();
+        comm.stageOutgoing();
+        outgoingNs += bench::nowNs() - start;
+
+        start = bench::nowNs();
+        comm.stageWrite();
+        writeNs += bench::nowNs() - start;
+        writeCount++;
+    }
+    bench::report("pipeline", name, "processRead", (double)readNs / frameCount, "ns/frame");
+    bench::report("pipeline", name, "processIncomingMessage", (double)incomingNs / messageCount, "ns/message");
+    bench::report("pipeline", name, "processOutgoingMessage", (double)outgoingNs / messageCount, "ns/message");
+    bench::report("pipeline", name, "processWrite", (double)writeNs / writeCount, "ns/call");
+}
+
+/**
+ * @brief Drives full performIterate round trips, from the first request frame read to
+ * the last response frame written, and reports throughput and latency percentiles
+ */
+void measureRoundTrip(BenchComm& comm, const char* name, uint8_t frameTotal) {
+    corelib::Frame frames[3];
+    bench::Samples latency(messageCount);
+    uint64_t iterations = 0;
+    comm.reset();
+    const uint64_t begin = bench::nowNs();
+    for(uint32_t m = 0; m < messageCount; m++){
+        makeMessage(frames, frameTotal, m);
+        for(uint8_t i = 0; i < frameTotal; i++){
+            comm.push(frames[i]);
+        }
+        const uint32_t expected = comm.written() + frameTotal;
+        const uint64_t start = bench::nowNs();
+        while(comm.written() < expected){
+            comm.iterate();
+            iterations++;
+        }
+        latency.add(bench::nowNs() - start);
+    }
+    const double seconds = (bench::nowNs() - begin) / 1e9;
+    bench::report("pipeline", name, "frames_in", messageCount * frameTotal / seconds, "frames/s");
+    bench::report("pipeline", name, "messages", messageCount / seconds, "messages/s");
+    bench::report("pipeline", name, "performIterate", seconds * 1e9 / iterations, "ns/iteration");
+    latency.report("pipeline", name, "round_trip");
+}
+
+/**
+ * @brief Forwards frames for another address from one interface to the other and
+ * reports the latency from the frame being read to it being written
+ */
+void measureRelay(BenchComm& in, BenchComm& out) {
+    static corelib::Router<2> router;
+    router.attach(in);
+    router.attach(out);
+    router.addRoute(0x10, 1);
+    corelib::Frame frame;
+    bench::Samples latency(messageCount);
+    in.reset();
+    out.reset();
+    for(uint32_t m = 0; m < messageCount; m++){
+        makeMessage(&frame, 1, m);
+        frame.destinationAddress = 0x10;
+        frame.crc = corelib::Crc32SliceBy8().compute((uint8_t*)&frame, sizeof(corelib::Frame) - 4);
+        in.push(frame);
+        const uint64_t start = bench::nowNs();
+        in.iterate();
+        out.iterate();
+        latency.add(bench::nowNs() - start);
+    }
+    bench::report("pipeline", "relay", "forwarded", router.getStats().forwarded, "frames");
+    bench::report("pipeline", "relay", "dropped", router.getStats().noRoute + router.getStats().queueFull, "frames");
+    latency.report("pipeline", "relay", "forward");
+}
+
+} // NAMESPACE
+
+void bench::runPipeline() {
+    static BenchComm comm;
+    comm.initialise();
+
+    measureStages(comm, "single_frame", 1);
+    measureRoundTrip(comm, "single_frame", 1);
+    measureStages(comm, "three_frame", 3);
+    measureRoundTrip(comm, "three_frame", 3);
+    comm.useView(true);
+    measureRoundTrip(comm, "single_frame_view", 1);
+    measureRoundTrip(comm, "three_frame_view", 3);
+    comm.useView(false);
+
+    static BenchComm gateway;
+    gateway.initialise();
+    measureRelay(comm, gateway);
+}
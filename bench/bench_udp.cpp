@@ -0,0 +1,151 @@
+#include "bench.h"
+#include "udp.h"
+
+#if defined (__linux__)
+#include <sched.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+namespace {
+
+const uint32_t roundTrips = 2000;
+const uint32_t pipelined = 20000;
+// Messages in flight at once, within the socket buffers
+const uint32_t window = 8;
+// A window with no answer this long is taken as lost
+const uint64_t stallNs = 50000000;
+
+uint8_t message[128];
+size_t messageLength = 0;
+uint32_t toSend = 0;
+uint32_t received = 0;
+
+bool publish(corelib::Buffer* b) {
+    if(toSend == 0){
+        return false;
+    }
+    memcpy(b->outBuffer, message, messageLength);
+    b->outMessageLength = messageLength;
+    toSend--;
+    return true;
+}
+
+corelib::HandleMessageState count(corelib::Buffer* b) {
+    received++;
+    bench::sink ^= b->inBuffer[0];
+    return corelib::HandleMessageState::OK;
+}
+
+corelib::HandleMessageState echo(corelib::Buffer* b) {
+    memcpy(b->outBuffer, b->inBuffer, b->inMessageLength);
+    b->outMessageLength = b->inMessageLength;
+    return corelib::HandleMessageState::OK;
+}
+
+// Echoes messages back until it is killed
+void serve(corelib::LinuxUdpComm& device) {
+    device.setHandleMessageCallback(etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::create<&echo>());
+    device.initialise();
+    while(true){
+        const uint32_t before = device.receiveCalls();
+        device.iterate();
+        if(device.receiveCalls() == before){
+            sched_yield();
+        }
+    }
+}
+
+/**
+ * Times single round trips, then echoes of `pipelined` messages sent a window at a
+ * time, of `length` bytes between this process and the device process
+ */
+void measure(corelib::LinuxUdpComm& host, const char* name, size_t length) {
+    for(size_t i = 0; i < length; i++){
+        message[i] = 0x08 + (i * 7) % 0xF0;
+    }
+    messageLength = length;
+
+    bench::Samples latency(roundTrips);
+    uint32_t lost = 0;
+    for(uint32_t i = 0; i < roundTrips; i++){
+        const uint32_t expected = received + 1;
+        toSend = 1;
+        const uint64_t start = bench::nowNs();
+        while(received < expected){
+            host.iterate();
+            if(received < expected){
+                sched_yield();
+            }
+            if(bench::nowNs() - start > stallNs){
+                lost++;
+                received = expected;
+            }
+        }
+        latency.add(bench::nowNs() - start);
+    }
+    latency.report("udp", name, "round_trip");
+
+    const uint32_t sendCalls = host.sendCalls();
+    const uint32_t receiveCalls = host.receiveCalls();
+    const uint32_t start = received;
+    uint32_t sent = 0;
+    uint64_t progress = bench::nowNs();
+    const uint64_t begin = progress;
+    while(received - start + lost < pipelined){
+        const uint32_t answered = received;
+        if(toSend == 0 && sent < pipelined && sent - (received - start) - lost < window){
+            toSend = 1;
+            sent++;
+        }
+        host.iterate();
+        if(received != answered){
+            progress = bench::nowNs();
+        }else{
+            sched_yield();
+            if(bench::nowNs() - progress > stallNs){
+                // Datagrams dropped by a full socket buffer
+                lost += sent - (received - start) - lost;
+                progress = bench::nowNs();
+            }
+        }
+    }
+    const double seconds = (bench::nowNs() - begin) / 1e9;
+    const uint32_t echoed = received - start;
+    const uint32_t frames = (length + sizeof(corelib::Frame::payload) - 1) / sizeof(corelib::Frame::payload);
+    bench::report("udp", name, "messages", echoed / seconds, "messages/s");
+    bench::report("udp", name, "payload_rate", echoed * length / seconds, "bytes/s");
+    bench::report("udp", name, "frames_per_send_call", static_cast<double>(echoed * frames) / (host.sendCalls() - sendCalls), "frames");
+    bench::report("udp", name, "frames_per_receive_call", static_cast<double>(echoed * frames) / (host.receiveCalls() - receiveCalls), "frames");
+    bench::report("udp", name, "lost", lost, "messages");
+}
+
+} // NAMESPACE
+
+void bench::runUdp() {
+    corelib::LinuxUdpComm host(0x01, 0x02);
+    corelib::LinuxUdpComm device(0x02, 0x01);
+    if(!host.open(0) || !device.open(0) || !host.setPeer("127.0.0.1", device.localPort())){
+        printf("udp,loopback,error,1,socket\n");
+        return;
+    }
+    fflush(stdout);
+    const pid_t child = fork();
+    if(child == 0){
+        host.close();
+        serve(device);
+    }
+    device.close();
+    host.setPublishCallback(etl::delegate<bool(corelib::Buffer*)>::create<&publish>());
+    host.setHandleMessageCallback(etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::create<&count>());
+    host.initialise();
+
+    measure(host, "loopback_12", 12);
+    measure(host, "loopback_99", 99);
+    measure(host, "loopback_120", 120);
+
+    kill(child, SIGTERM);
+    waitpid(child, nullptr, 0);
+}
+#else
+void bench::runUdp() {}
+#endif
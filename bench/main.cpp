@@ -0,0 +1,13 @@
+#include "bench.h"
+
+volatile uint32_t bench::sink = 0;
+
+int main(int argc, char **argv) {
+  bench::header();
+  bench::runIntegrity();
+  bench::runPipeline();
+  bench::runDelta();
+  bench::runCan();
+  bench::runUdp();
+  return 0;
+}
@@ -0,0 +1,250 @@
+#ifndef ARP_H
+#define ARP_H
+
+#include <Arduino.h>
+#include "frame.h"
+
+#include "transaction.pb.h"
+
+namespace corelib {
+
+/**
+ * ARP resolves devices on a shared bus to their addresses, so messages can be sent to
+ * a device's address rather than broadcast to 0x00.
+ *
+ * An ARP_REQUEST is a single frame, usually to 0x00, whose payload holds the query:
+ *  0  registryId   (uint32, 0 matches any)
+ *  4  serialNumber (uint32, 0 matches any)
+ * Each matching device answers with an ARP_RESPONSE from its address, whose payload
+ * holds its identity from Common1:
+ *  0  id, 4 registryId, 8 serialNumber, 12 sharesVersion, 16 firmwareVersion (uint32)
+ *  20 deviceName   (30 bytes, zero padded, truncated)
+ * All values are little endian.
+ */
+
+static constexpr uint8_t NoAddress = 0x00;
+static constexpr size_t ArpNameSize = sizeof(Frame::payload) - 20;
+
+/**
+ * @brief The devices an ARP request is looking for
+ */
+struct ArpQuery {
+    uint32_t registryId = 0;
+    uint32_t serialNumber = 0;
+
+    bool matches(const Common1& identity) const {
+        return (registryId == 0 || registryId == identity.registryId) &&
+               (serialNumber == 0 || serialNumber == identity.serialNumber);
+    }
+};
+
+inline void arpPut(uint8_t* data, uint32_t value) {
+    data[0] = value & 0xFF;
+    data[1] = (value >> 8) & 0xFF;
+    data[2] = (value >> 16) & 0xFF;
+    data[3] = value >> 24;
+}
+
+inline uint32_t arpGet(const uint8_t* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+inline void encodeArpQuery(const ArpQuery& query, uint8_t* payload) {
+    memset(payload, 0, sizeof(Frame::payload));
+    arpPut(payload, query.registryId);
+    arpPut(payload + 4, query.serialNumber);
+}
+
+inline ArpQuery decodeArpQuery(const uint8_t* payload) {
+    ArpQuery query;
+    query.registryId = arpGet(payload);
+    query.serialNumber = arpGet(payload + 4);
+    return query;
+}
+
+inline void encodeArpIdentity(const Common1& identity, uint8_t* payload) {
+    memset(payload, 0, sizeof(Frame::payload));
+    arpPut(payload, identity.id);
+    arpPut(payload + 4, identity.registryId);
+    arpPut(payload + 8, identity.serialNumber);
+    arpPut(payload + 12, identity.sharesVersion);
+    arpPut(payload + 16, identity.firmwareVersion);
+    strncpy(reinterpret_cast<char*>(payload + 20), identity.deviceName, ArpNameSize);
+}
+
+inline Common1 decodeArpIdentity(const uint8_t* payload) {
+    Common1 identity = Common1_init_zero;
+    identity.id = arpGet(payload);
+    identity.registryId = arpGet(payload + 4);
+    identity.serialNumber = arpGet(payload + 8);
+    identity.sharesVersion = arpGet(payload + 12);
+    identity.firmwareVersion = arpGet(payload + 16);
+    memcpy(identity.deviceName, payload + 20, ArpNameSize);
+    return identity;
+}
+
+/**
+ * @brief A device learnt through ARP
+ */
+struct Neighbour {
+    uint8_t address = NoAddress;
+    // @brief Time the device was last heard from
+    uint32_t lastSeen = 0;
+    uint32_t id = 0;
+    uint32_t registryId = 0;
+    uint32_t serialNumber = 0;
+};
+
+/**
+ * @brief A bounded cache of neighbours by address. Entries age out when the device
+ * has not been heard from within the timeout, and the least recently heard from
+ * entry is replaced when the cache is full.
+ *
+ * @tparam Size Number of neighbours cached
+ */
+template<size_t Size>
+class NeighbourTable
+{
+public:
+    explicit NeighbourTable(uint32_t timeout) : timeout(timeout) {}
+
+    /**
+     * @brief Records a device and its identity
+     */
+    void learn(uint8_t address, const Common1& identity, uint32_t now) {
+        Neighbour* neighbour = entry(address, now);
+        neighbour->id = identity.id;
+        neighbour->registryId = identity.registryId;
+        neighbour->serialNumber = identity.serialNumber;
+    }
+
+    /**
+     * @brief Refreshes a device which is already known
+     */
+    void touch(uint8_t address, uint32_t now) {
+        Neighbour* neighbour = find(address, now);
+        if(neighbour != nullptr){
+            neighbour->lastSeen = now;
+        }
+    }
+
+    /**
+     * @brief The address of the device with a serial number
+     *
+     * @return uint8_t The address or NoAddress when not known
+     */
+    uint8_t resolve(uint32_t serialNumber, uint32_t now) const {
+        for(size_t i = 0; i < Size; i++){
+            if(live(neighbours[i], now) && neighbours[i].serialNumber == serialNumber){
+                return neighbours[i].address;
+            }
+        }
+        return NoAddress;
+    }
+
+    /**
+     * @brief The neighbour at an address, nullptr when not known or aged out
+     */
+    const Neighbour* get(uint8_t address, uint32_t now) const {
+        for(size_t i = 0; i < Size; i++){
+            if(neighbours[i].address == address && live(neighbours[i], now)){
+                return &neighbours[i];
+            }
+        }
+        return nullptr;
+    }
+
+    /// Number of neighbours which have not aged out
+    size_t size(uint32_t now) const {
+        size_t count = 0;
+        for(size_t i = 0; i < Size; i++){
+            count += live(neighbours[i], now);
+        }
+        return count;
+    }
+
+    constexpr size_t max_size() const {
+        return Size;
+    }
+
+    void clear() {
+        for(size_t i = 0; i < Size; i++){
+            neighbours[i] = Neighbour();
+        }
+    }
+
+private:
+    Neighbour neighbours[Size];
+    uint32_t timeout;
+
+    bool live(const Neighbour& neighbour, uint32_t now) const {
+        return neighbour.address != NoAddress && now - neighbour.lastSeen < timeout;
+    }
+
+    Neighbour* find(uint8_t address, uint32_t now) {
+        for(size_t i = 0; i < Size; i++){
+            if(neighbours[i].address == address && live(neighbours[i], now)){
+                return &neighbours[i];
+            }
+        }
+        return nullptr;
+    }
+
+    // The entry of an address, reusing an aged out or the least recently heard from entry
+    Neighbour* entry(uint8_t address, uint32_t now) {
+        Neighbour* neighbour = find(address, now);
+        if(neighbour == nullptr){
+            neighbour = &neighbours[0];
+            for(size_t i = 0; i < Size; i++){
+                if(!live(neighbours[i], now)){
+                    neighbour = &neighbours[i];
+                    break;
+                }
+                // Wrap safe comparison of age
+                if(static_cast<int32_t>(neighbours[i].lastSeen - neighbour->lastSeen) < 0){
+                    neighbour = &neighbours[i];
+                }
+            }
+            *neighbour = Neighbour();
+            neighbour->address = address;
+        }
+        neighbour->lastSeen = now;
+        return neighbour;
+    }
+};
+
+/**
+ * @brief Token bucket limiting how often something may happen, e.g. broadcasts.
+ * Allows `burst` events at once, then one per `interval`.
+ */
+class RateLimiter
+{
+public:
+    RateLimiter(uint32_t interval, uint8_t burst) : interval(interval), burst(burst), tokens(burst) {}
+
+    bool allow(uint32_t now) {
+        const uint32_t elapsed = now - last;
+        if(elapsed >= interval){
+            const uint32_t refill = elapsed / interval;
+            tokens = refill >= static_cast<uint32_t>(burst - tokens) ? burst : tokens + refill;
+            last += refill * interval;
+        }
+        if(tokens == 0){
+            return false;
+        }
+        if(tokens == burst){
+            // A full bucket starts timing from now
+            last = now;
+        }
+        tokens--;
+        return true;
+    }
+
+private:
+    uint32_t interval;
+    uint8_t burst;
+    uint8_t tokens;
+    uint32_t last = 0;
+};
+} // NAMESPACE
+#endif // ARP_H
@@ -0,0 +1,578 @@
+#ifndef CAN_H
+#define CAN_H
+
+#include <Arduino.h>
+#include "comm.h"
+#include "integrity.h"
+
+#include <etl/queue.h>
+
+namespace corelib {
+
+/**
+ * Frames travel a CAN bus with the addressing in the 29 bit extended identifier
+ *
+ *  bits 28-26 preamble
+ *  bits 25-18 destinationAddress
+ *  bits 17-10 sourceAddress
+ *  bits  9-0  the tag of the unit
+ *
+ * so a lower preamble wins arbitration and a receiver filters on its address without
+ * reading the data. The tag stands in for the frameID, which does not fit, and is
+ * unique among the units an interface is sending, the receiver takes it as the frameID
+ * of the unit's frames. NA is never sent, its code 0 carries PING_RESPONSE, which then
+ * wins arbitration and waits least on a busy bus. A DATA message is sent as one unit,
+ * its frameTotal then the payloads of its frames joined, trailing zeros left off and
+ * cut into segments of the CAN data length less one, so a message spans at most
+ * fragmentsPerMessage frames (see CommConfig), a frame of a longer one is dropped and
+ * counted in unitDrops. A frame of another preamble is a unit of its own, its
+ * frameOrder and frameTotal (a stream's fragment index) in the two bytes before its
+ * payload. Each segment starts with one header byte
+ *
+ *  bit  7   the last segment of the unit
+ *  bits 6-0 the segment index within the unit
+ *
+ * The receiver joins the segments of each identifier and frames the unit again, zero
+ * padded, so the Comm sees the frames it would over USB. A unit missing a segment is
+ * dropped, as a message missing a frame. CAN checks every frame itself, the software
+ * frame check is left out (see NoIntegrity) and frames received for this device carry
+ * no crc. Frames for the devices a Router attached to the interface routes elsewhere
+ * are taken from the bus and given the check of RelayIntegrity, so they are forwarded as
+ * they would arrive over USB.
+ */
+
+static constexpr uint8_t CanClassicSize = 8;
+static constexpr uint8_t CanFdSize = 64;
+// @brief Marks the last segment of a unit in the header byte
+static constexpr uint8_t CanLastSegment = 0x80;
+static constexpr uint8_t CanMaxSegments = 0x80;
+// @brief Mask of the tag carried in the identifier
+static constexpr uint32_t CanTagMask = 0x3FF;
+
+/**
+ * @brief A CAN or CAN FD frame with an extended identifier
+ */
+struct CanFrame {
+    uint32_t id = 0;
+    // @brief Data bytes, a valid CAN FD length when fd is set
+    uint8_t length = 0;
+    bool fd = false;
+    uint8_t data[CanFdSize] = {0};
+};
+
+inline uint32_t canIdentifier(Preamble preamble, uint8_t destination, uint8_t source, uint32_t tag) {
+    const uint32_t code = preamble == Preamble::PING_RESPONSE ? 0 : static_cast<uint32_t>(preamble);
+    return (code & 0x7) << 26 | static_cast<uint32_t>(destination) << 18 |
+        static_cast<uint32_t>(source) << 10 | (tag & CanTagMask);
+}
+
+inline Preamble canPreamble(uint32_t id) {
+    const uint32_t code = (id >> 26) & 0x7;
+    return code == 0 ? Preamble::PING_RESPONSE : static_cast<Preamble>(code);
+}
+
+inline uint8_t canDestination(uint32_t id) {
+    return (id >> 18) & 0xFF;
+}
+
+inline uint8_t canSource(uint32_t id) {
+    return (id >> 10) & 0xFF;
+}
+
+/// The smallest CAN FD data length holding length bytes
+inline uint8_t canFdLength(uint8_t length) {
+    static const uint8_t lengths[] = {12, 16, 20, 24, 32, 48, 64};
+    if(length <= 8){
+        return length;
+    }
+    for(uint8_t candidate : lengths){
+        if(length <= candidate){
+            return candidate;
+        }
+    }
+    return CanFdSize;
+}
+
+/**
+ * @brief Bits of a frame on the bus, before bit stuffing, at the nominal rate and at
+ * the data rate of CAN FD's switched data phase
+ */
+struct CanBits {
+    uint32_t nominal = 0;
+    uint32_t data = 0;
+};
+
+inline CanBits canFrameBits(uint8_t length, bool fd) {
+    CanBits bits;
+    if(!fd){
+        // SOF, identifier, SRR, IDE, RTR, reserved, DLC, data, CRC, ACK, EOF and IFS
+        bits.nominal = 67 + 8 * length;
+        return bits;
+    }
+    // SOF to BRS and ACK to IFS at the nominal rate, ESI to the CRC delimiter switched
+    const uint32_t crc = length <= 16 ? 17 : 21;
+    bits.nominal = 36 + 12;
+    bits.data = 1 + 4 + 8 * length + 4 + crc + crc / 4 + 1;
+    return bits;
+}
+
+/**
+ * @brief CAN and CAN FD - Comms Implementation, see the mapping above.
+ * A hardware driver derives from it and moves CanFrames with canRead and canWrite.
+ * Only frames for this device's address or broadcast are taken from the bus, and the
+ * frames an attached Router forwards elsewhere (see router.h).
+ *
+ * @tparam Config The capacities of the interface, see CommConfig
+ * @tparam DataSize CanFdSize for CAN FD, CanClassicSize for classic CAN
+ * @tparam RelayIntegrity The frame check of the interfaces frames are forwarded to,
+ * see integrity.h. Every enabled policy computes the same CRC-32.
+ */
+template<typename Config = CommConfig<>, uint8_t DataSize = CanFdSize, typename RelayIntegrity = FastCrc32Integrity>
+class BasicCanComm : public BasicComm<Config, NoIntegrity>
+{
+    static_assert(DataSize == CanClassicSize || DataSize == CanFdSize, "CAN data size must be 8 or 64");
+
+public:
+    // @brief Largest unit, a whole message with its frame count or a frame with its index
+    static constexpr size_t UnitSize = Config::fragmentsPerMessage * sizeof(Frame::payload) + 2;
+    static constexpr uint8_t SegmentSize = DataSize - 1;
+    // @brief Units being sent at once, the messages relayed and a message of each transmit
+    // lane waiting for their next frame, and a frame of another preamble
+    static constexpr size_t TxUnits = Config::relayDepth + TxLaneCount + 1;
+    // @brief Writes a unit may wait for its next frame before it is taken as abandoned,
+    // when the queue it was written from was cleared
+    static constexpr uint32_t TxUnitTimeout = 256;
+
+    static_assert((UnitSize + SegmentSize - 1) / SegmentSize <= CanMaxSegments,
+        "CAN units must fit the segment index");
+    static_assert(TxUnits <= CanTagMask, "CAN units must have a tag of their own");
+
+    /// Units received which lost a segment or had no room, frames written of a message
+    /// longer than fragmentsPerMessage and units abandoned before they were sent
+    uint32_t unitDrops() const {
+        return drops;
+    }
+
+protected:
+    /**
+     * @brief Physical Write Interface
+     *
+     * @return false The controller has no room, the frame is written again later
+     */
+    virtual bool canWrite(const CanFrame& frame) = 0;
+
+    /**
+     * @brief Physical Read Interface
+     *
+     * @return false No frame was received
+     */
+    virtual bool canRead(CanFrame& frame) = 0;
+
+    // Comms.h interface
+    bool read(uint8_t* buffer) {
+        CanFrame frame;
+        while(ready.empty()){
+            if(!canRead(frame)){
+                return false;
+            }
+            receiveSegment(frame);
+        }
+        memcpy(buffer, &ready.front(), sizeof(Frame));
+        ready.pop();
+        return true;
+    }
+
+    bool write(const uint8_t* buffer) {
+        const Frame& frame = *reinterpret_cast<const Frame*>(buffer);
+        const bool data = frame.preamble == Preamble::DATA;
+        const uint8_t order = data ? frame.frameOrder : 1;
+        if(data && (order == 0 || order > frame.frameTotal || frame.frameTotal > Config::fragmentsPerMessage)){
+            // Not a frame of a message a unit holds
+            drops++;
+            return true;
+        }
+        const uint16_t index = data ? 0 : frame.frameOrder | (frame.frameTotal << 8);
+        clock++;
+        TxUnit* unit = findTx(frame, index);
+        if(unit == nullptr){
+            unit = allocateTx();
+            if(unit == nullptr){
+                // Written again once a unit was sent
+                return false;
+            }
+            unit->tag = freeTag();
+            unit->used = true;
+            unit->preamble = frame.preamble;
+            unit->destinationAddress = frame.destinationAddress;
+            unit->sourceAddress = frame.sourceAddress;
+            unit->frameID = frame.frameID;
+            unit->index = index;
+            unit->total = data ? frame.frameTotal : 1;
+            unit->received = 0;
+            unit->sent = 0;
+            unit->segment = 0;
+        }
+        unit->age = clock;
+        // A frame written again after a refused segment is already staged
+        const uint8_t bit = 1 << (order - 1);
+        if((unit->received & bit) == 0){
+            if(data){
+                unit->data[0] = frame.frameTotal;
+                memcpy(unit->data + 1 + (order - 1) * sizeof(Frame::payload), frame.payload, sizeof(Frame::payload));
+            }else{
+                unit->data[0] = frame.frameOrder;
+                unit->data[1] = frame.frameTotal;
+                memcpy(unit->data + 2, frame.payload, sizeof(Frame::payload));
+            }
+            unit->received |= bit;
+        }
+        return sendUnit(*unit);
+    }
+
+private:
+    static constexpr size_t RxUnits = Config::concurrentMessages + 1;
+
+    struct TxUnit {
+        bool used = false;
+        Preamble preamble = Preamble::NA;
+        uint8_t destinationAddress = 0;
+        uint8_t sourceAddress = 0;
+        uint32_t frameID = 0;
+        // @brief Carried in the identifier in place of the frameID
+        uint16_t tag = 0;
+        // @brief The fragment index of a frame which is not DATA
+        uint16_t index = 0;
+        uint8_t total = 0;
+        // @brief Frames staged, by order
+        uint8_t received = 0;
+        // @brief Bytes and segments sent
+        size_t sent = 0;
+        uint8_t segment = 0;
+        uint32_t age = 0;
+        uint8_t data[UnitSize] = {0};
+    };
+
+    struct RxUnit {
+        bool used = false;
+        uint32_t id = 0;
+        size_t length = 0;
+        uint8_t segment = 0;
+        uint32_t age = 0;
+        uint8_t data[UnitSize] = {0};
+    };
+
+    TxUnit txUnits[TxUnits];
+    RxUnit rxUnits[RxUnits];
+    // @brief Computes the check of frames handed to the relay callback
+    RelayIntegrity relayIntegrity;
+    // @brief Frames of the last unit received, read one at a time
+    etl::queue<Frame, Config::fragmentsPerMessage> ready;
+    uint32_t clock = 0;
+    uint32_t drops = 0;
+    // @brief The tag given to the last unit
+    uint16_t lastTag = 0;
+
+    TxUnit* findTx(const Frame& frame, uint16_t index) {
+        for(TxUnit& unit : txUnits){
+            if(unit.used && unit.preamble == frame.preamble && unit.frameID == frame.frameID && unit.index == index &&
+               unit.destinationAddress == frame.destinationAddress && unit.sourceAddress == frame.sourceAddress){
+                return &unit;
+            }
+        }
+        return nullptr;
+    }
+
+    // A free unit, or the one left longest once it is abandoned, nullptr while every
+    // unit is still in use
+    TxUnit* allocateTx() {
+        TxUnit* oldest = &txUnits[0];
+        for(TxUnit& unit : txUnits){
+            if(!unit.used){
+                return &unit;
+            }
+            if(static_cast<int32_t>(unit.age - oldest->age) < 0){
+                oldest = &unit;
+            }
+        }
+        if(clock - oldest->age < TxUnitTimeout){
+            return nullptr;
+        }
+        oldest->used = false;
+        drops++;
+        return oldest;
+    }
+
+    // The next tag no unit in use carries
+    uint16_t freeTag() {
+        while(true){
+            lastTag = (lastTag + 1) & CanTagMask;
+            bool taken = false;
+            for(const TxUnit& unit : txUnits){
+                taken |= unit.used && unit.tag == lastTag;
+            }
+            if(!taken){
+                return lastTag;
+            }
+        }
+    }
+
+    // Sends the segments which are ready, all of them once every frame is staged
+    bool sendUnit(TxUnit& unit) {
+        const uint8_t all = (1 << unit.total) - 1;
+        const bool complete = unit.received == all;
+        // The frame count or index goes before the payloads
+        const size_t header = unit.preamble == Preamble::DATA ? 1 : 2;
+        size_t available = header;
+        if(complete){
+            // Trailing zeros are left off, the receiver pads them back
+            available += unit.total * sizeof(Frame::payload);
+            while(available > header && unit.data[available - 1] == 0){
+                available--;
+            }
+        }else{
+            for(uint8_t staged = 0; unit.received & (1 << staged); staged++){
+                available += sizeof(Frame::payload);
+            }
+        }
+        while(true){
+            // Zeros already sent may be beyond the end of the trimmed unit
+            const size_t remaining = available > unit.sent ? available - unit.sent : 0;
+            const bool last = complete && remaining <= SegmentSize;
+            if(!last && remaining < SegmentSize){
+                // Wait for the next frame of the message
+                return true;
+            }
+            const uint8_t count = last ? remaining : SegmentSize;
+            CanFrame frame;
+            frame.id = canIdentifier(unit.preamble, unit.destinationAddress, unit.sourceAddress, unit.tag);
+            frame.fd = DataSize == CanFdSize;
+            frame.length = frame.fd ? canFdLength(count + 1) : count + 1;
+            frame.data[0] = unit.segment | (last ? CanLastSegment : 0);
+            memcpy(frame.data + 1, unit.data + unit.sent, count);
+            if(!canWrite(frame)){
+                return false;
+            }
+            unit.sent += count;
+            unit.segment++;
+            if(last){
+                unit.used = false;
+                return true;
+            }
+        }
+    }
+
+    // Joins a segment to its unit, framing the unit when it is complete
+    void receiveSegment(const CanFrame& frame) {
+        const uint8_t destination = canDestination(frame.id);
+        if(frame.length == 0 || (destination != this->address && destination != 0x00 && !this->relays(destination))){
+            // For a device on this bus, or not routed at all
+            return;
+        }
+        const uint8_t segment = frame.data[0] & ~CanLastSegment;
+        RxUnit* unit = nullptr;
+        for(RxUnit& candidate : rxUnits){
+            if(candidate.used && candidate.id == frame.id){
+                unit = &candidate;
+            }
+        }
+        if(segment == 0){
+            if(unit != nullptr){
+                // The last unit of this identifier lost its end
+                drops++;
+            }else{
+                unit = allocateRx();
+            }
+            unit->used = true;
+            unit->id = frame.id;
+            unit->length = 0;
+            unit->segment = 0;
+            memset(unit->data, 0, sizeof(unit->data));
+        }else if(unit == nullptr || unit->segment != segment){
+            // A segment was lost
+            if(unit != nullptr){
+                unit->used = false;
+            }
+            drops++;
+            return;
+        }
+        unit->age = ++clock;
+        // Padding of the last segment beyond the unit is zeros
+        size_t count = frame.length - 1;
+        if(count > UnitSize - unit->length){
+            count = UnitSize - unit->length;
+        }
+        memcpy(unit->data + unit->length, frame.data + 1, count);
+        unit->length += count;
+        unit->segment++;
+        if(frame.data[0] & CanLastSegment){
+            deliver(*unit);
+            unit->used = false;
+        }
+    }
+
+    RxUnit* allocateRx() {
+        RxUnit* oldest = &rxUnits[0];
+        for(RxUnit& unit : rxUnits){
+            if(!unit.used){
+                return &unit;
+            }
+            if(static_cast<int32_t>(unit.age - oldest->age) < 0){
+                oldest = &unit;
+            }
+        }
+        // The unit waiting longest has most likely lost a segment
+        drops++;
+        return oldest;
+    }
+
+    // Frames a unit as it was written
+    void deliver(const RxUnit& unit) {
+        Frame frame;
+        frame.preamble = canPreamble(unit.id);
+        frame.destinationAddress = canDestination(unit.id);
+        frame.sourceAddress = canSource(unit.id);
+        frame.frameID = unit.id & CanTagMask;
+        frame.crc = 0;
+        // A frame for another device is forwarded, it needs the check it has elsewhere
+        const bool relayed = frame.destinationAddress != this->address && frame.destinationAddress != 0x00;
+        if(frame.preamble != Preamble::DATA){
+            frame.frameOrder = unit.data[0];
+            frame.frameTotal = unit.data[1];
+            memcpy(frame.payload, unit.data + 2, sizeof(frame.payload));
+            push(frame, relayed);
+            return;
+        }
+        const uint8_t frames = unit.data[0];
+        if(frames == 0 || frames > Config::fragmentsPerMessage){
+            drops++;
+            return;
+        }
+        for(uint8_t i = 0; i < frames; i++){
+            frame.frameOrder = i + 1;
+            frame.frameTotal = frames;
+            memcpy(frame.payload, unit.data + 1 + i * sizeof(Frame::payload), sizeof(frame.payload));
+            push(frame, relayed);
+        }
+    }
+
+    void push(Frame& frame, bool relayed) {
+        if(relayed && RelayIntegrity::enabled){
+            frame.crc = relayIntegrity.compute(reinterpret_cast<const uint8_t*>(&frame), sizeof(Frame) - sizeof(Frame::crc));
+        }
+        ready.push(frame);
+    }
+};
+
+#if defined (NATIVE)
+/**
+ * @brief A CAN bus in memory, for native tests and benchmarks. Every frame sent is
+ * received by every other node, a node whose receive queue is full misses it. The
+ * bits sent are counted to work out the time the traffic took on the bus.
+ *
+ * @tparam Nodes Maximum number of nodes
+ * @tparam Depth Frames each node may have waiting
+ */
+template<size_t Nodes = 4, size_t Depth = 64>
+class SimulatedCanBus
+{
+public:
+    /**
+     * @return int The node number, -1 when the bus is full
+     */
+    int attach() {
+        return nodes < Nodes ? nodes++ : -1;
+    }
+
+    bool send(uint8_t node, const CanFrame& frame) {
+        const CanBits frameBits = canFrameBits(frame.length, frame.fd);
+        bits.nominal += frameBits.nominal;
+        bits.data += frameBits.data;
+        frames++;
+        for(uint8_t i = 0; i < nodes; i++){
+            if(i == node){
+                continue;
+            }
+            if(queues[i].full()){
+                overruns++;
+            }else{
+                queues[i].push(frame);
+            }
+        }
+        return true;
+    }
+
+    bool receive(uint8_t node, CanFrame& frame) {
+        if(queues[node].empty()){
+            return false;
+        }
+        frame = queues[node].front();
+        queues[node].pop();
+        return true;
+    }
+
+    /// Seconds the frames sent took, at the nominal and data bit rates
+    double seconds(uint32_t nominalRate, uint32_t dataRate) const {
+        return static_cast<double>(bits.nominal) / nominalRate + static_cast<double>(bits.data) / dataRate;
+    }
+
+    void reset() {
+        for(uint8_t i = 0; i < nodes; i++){
+            queues[i].clear();
+        }
+        bits = CanBits64();
+        frames = 0;
+        overruns = 0;
+    }
+
+    struct CanBits64 {
+        uint64_t nominal = 0;
+        uint64_t data = 0;
+    };
+
+    CanBits64 bits;
+    uint32_t frames = 0;
+    // @brief Frames a node missed with a full queue
+    uint32_t overruns = 0;
+
+private:
+    etl::queue<CanFrame, Depth> queues[Nodes];
+    uint8_t nodes = 0;
+};
+
+/**
+ * @brief A CAN Comm on a SimulatedCanBus
+ */
+template<typename Bus, typename Config = CommConfig<>, uint8_t DataSize = CanFdSize>
+class SimulatedCanComm : public BasicCanComm<Config, DataSize>
+{
+public:
+    /**
+     * @param address This device's address
+     * @param destination The address messages are sent to
+     */
+    SimulatedCanComm(Bus& bus, uint8_t address, uint8_t destination = 0x01) : bus(bus), node(bus.attach()) {
+        this->address = address;
+        this->destinationDeviceAddress = destination;
+    }
+
+protected:
+    Bus& bus;
+    int node;
+
+    // Function.h interface
+    void performInitialise() {
+        this->initialised = node >= 0;
+    }
+
+    bool canWrite(const CanFrame& frame) {
+        return bus.send(node, frame);
+    }
+
+    bool canRead(CanFrame& frame) {
+        return bus.receive(node, frame);
+    }
+};
+#endif
+
+} // NAMESPACE
+#endif // CAN_H
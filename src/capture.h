@@ -0,0 +1,318 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <Arduino.h>
+#include "frame.h"
+
+#include <etl/delegate.h>
+
+#if defined (NATIVE)
+#include <chrono>
+#include <cstdio>
+#endif
+
+namespace corelib {
+
+/**
+ * A capture records every frame a Comm reads and writes, to reproduce a unit's traffic
+ * or profile the Comm with it, see replay.h. A capture file starts with a header
+ *
+ *  0 magic      (4 bytes) "CLCP"
+ *  4 version    (uint16)  CaptureVersion
+ *  6 recordSize (uint16)  CaptureRecordSize
+ *
+ * and is followed by records, appended as the frames pass
+ *
+ *  0 timestamp  (uint32) microseconds, wrapping
+ *  4 direction  (uint8)  CaptureDirection
+ *  5 interface  (uint8)  set when the Comm was attached
+ *  6 frame      (64 bytes) as read or written, before any check
+ *
+ * Values are little endian.
+ */
+
+static constexpr uint8_t CaptureMagic[4] = {'C', 'L', 'C', 'P'};
+static constexpr uint16_t CaptureVersion = 1;
+static constexpr size_t CaptureHeaderSize = 8;
+static constexpr size_t CaptureRecordSize = 6 + sizeof(Frame);
+
+/**
+ * @brief Whether a frame was read or written
+ */
+enum class CaptureDirection : uint8_t {
+    IN = 0,
+    OUT = 1
+};
+
+/**
+ * @brief A captured frame
+ */
+struct CaptureRecord {
+    uint32_t timestamp = 0;
+    CaptureDirection direction = CaptureDirection::IN;
+    uint8_t interface = 0;
+    Frame frame;
+};
+
+inline void encodeCaptureHeader(uint8_t* data) {
+    memcpy(data, CaptureMagic, sizeof(CaptureMagic));
+    data[4] = CaptureVersion & 0xFF;
+    data[5] = CaptureVersion >> 8;
+    data[6] = CaptureRecordSize & 0xFF;
+    data[7] = CaptureRecordSize >> 8;
+}
+
+/// False when the header is not of a capture this version reads
+inline bool decodeCaptureHeader(const uint8_t* data) {
+    return memcmp(data, CaptureMagic, sizeof(CaptureMagic)) == 0 &&
+        (data[4] | (data[5] << 8)) == CaptureVersion && (data[6] | (data[7] << 8)) == CaptureRecordSize;
+}
+
+inline void encodeCaptureRecord(const CaptureRecord& record, uint8_t* data) {
+    data[0] = record.timestamp & 0xFF;
+    data[1] = (record.timestamp >> 8) & 0xFF;
+    data[2] = (record.timestamp >> 16) & 0xFF;
+    data[3] = record.timestamp >> 24;
+    data[4] = static_cast<uint8_t>(record.direction);
+    data[5] = record.interface;
+    memcpy(data + 6, &record.frame, sizeof(Frame));
+}
+
+inline void decodeCaptureRecord(const uint8_t* data, CaptureRecord& record) {
+    record.timestamp = data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+    record.direction = static_cast<CaptureDirection>(data[4]);
+    record.interface = data[5];
+    memcpy(&record.frame, data + 6, sizeof(Frame));
+}
+
+/**
+ * @brief Keeps the latest records in RAM, the oldest are overwritten when it is full
+ *
+ * @tparam Records Number of records kept
+ */
+template<size_t Records>
+class CaptureRing
+{
+public:
+    void record(const CaptureRecord& record) {
+        records[(first + count) % Records] = record;
+        if(count < Records){
+            count++;
+        }else{
+            first = (first + 1) % Records;
+            overwrites++;
+        }
+    }
+
+    /// Number of records kept
+    size_t size() const {
+        return count;
+    }
+
+    /// The records kept, oldest first
+    const CaptureRecord& at(size_t index) const {
+        return records[(first + index) % Records];
+    }
+
+    /// Records overwritten since the ring was cleared
+    uint32_t overwritten() const {
+        return overwrites;
+    }
+
+    /**
+     * @brief Encodes the records kept as a capture file, oldest first
+     *
+     * @return size_t Bytes written, 0 when size is too small
+     */
+    size_t encode(uint8_t* data, size_t size) const {
+        const size_t length = CaptureHeaderSize + count * CaptureRecordSize;
+        if(length > size){
+            return 0;
+        }
+        encodeCaptureHeader(data);
+        for(size_t i = 0; i < count; i++){
+            encodeCaptureRecord(at(i), data + CaptureHeaderSize + i * CaptureRecordSize);
+        }
+        return length;
+    }
+
+    void clear() {
+        first = 0;
+        count = 0;
+        overwrites = 0;
+    }
+
+private:
+    CaptureRecord records[Records];
+    size_t first = 0;
+    size_t count = 0;
+    uint32_t overwrites = 0;
+};
+
+#if defined (NATIVE)
+/**
+ * @brief Appends records to a capture file
+ */
+class CaptureFile
+{
+public:
+    ~CaptureFile() {
+        close();
+    }
+
+    /**
+     * @brief Creates the file, replacing one of the same name
+     *
+     * @return false The file could not be created
+     */
+    bool open(const char* path) {
+        close();
+        file = fopen(path, "wb");
+        if(file == nullptr){
+            return false;
+        }
+        uint8_t header[CaptureHeaderSize];
+        encodeCaptureHeader(header);
+        return fwrite(header, 1, sizeof(header), file) == sizeof(header);
+    }
+
+    void record(const CaptureRecord& record) {
+        if(file == nullptr){
+            return;
+        }
+        uint8_t data[CaptureRecordSize];
+        encodeCaptureRecord(record, data);
+        if(fwrite(data, 1, sizeof(data), file) != sizeof(data)){
+            failures++;
+        }
+    }
+
+    /// Records which could not be written
+    uint32_t failed() const {
+        return failures;
+    }
+
+    void close() {
+        if(file != nullptr){
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+private:
+    FILE* file = nullptr;
+    uint32_t failures = 0;
+};
+
+/**
+ * @brief Reads the records of a capture file in order
+ */
+class CaptureReader
+{
+public:
+    ~CaptureReader() {
+        close();
+    }
+
+    /**
+     * @return false The file could not be opened or is not a capture
+     */
+    bool open(const char* path) {
+        close();
+        file = fopen(path, "rb");
+        if(file == nullptr){
+            return false;
+        }
+        uint8_t header[CaptureHeaderSize];
+        if(fread(header, 1, sizeof(header), file) != sizeof(header) || !decodeCaptureHeader(header)){
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @return false There are no more records, a partly written last record is ignored
+     */
+    bool next(CaptureRecord& record) {
+        uint8_t data[CaptureRecordSize];
+        if(file == nullptr || fread(data, 1, sizeof(data), file) != sizeof(data)){
+            return false;
+        }
+        decodeCaptureRecord(data, record);
+        return true;
+    }
+
+    void close() {
+        if(file != nullptr){
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+private:
+    FILE* file = nullptr;
+};
+#endif
+
+/**
+ * @brief Timestamps the frames of one or more Comms into a sink, a CaptureRing or on
+ * native a CaptureFile, or any class with record(const CaptureRecord&).
+ *
+ *  CaptureRing<256> ring;
+ *  Capture<CaptureRing<256>> capture(ring);
+ *  capture.attach(usb, 0);
+ *
+ * @tparam Sink Where the records go
+ */
+template<typename Sink>
+class Capture
+{
+public:
+    typedef etl::delegate<uint32_t()> Clock;
+    typedef etl::delegate<void(uint8_t, CaptureDirection, const uint8_t*)> Tap;
+
+    /**
+     * @param clock Returns the time in microseconds
+     */
+    explicit Capture(Sink& sink, Clock clock = Clock::template create<&Capture::defaultClock>())
+        : sink(sink), clock(clock) {}
+
+    /**
+     * @brief Records a frame, see BasicComm::setCaptureCallback
+     */
+    void tap(uint8_t interface, CaptureDirection direction, const uint8_t* frame) {
+        CaptureRecord record;
+        record.timestamp = clock();
+        record.direction = direction;
+        record.interface = interface;
+        memcpy(&record.frame, frame, sizeof(Frame));
+        sink.record(record);
+    }
+
+    /**
+     * @brief Records the frames of a Comm
+     *
+     * @param interface Identifies the Comm in the records
+     */
+    template<typename TComm>
+    void attach(TComm& comm, uint8_t interface) {
+        comm.setCaptureCallback(Tap::template create<Capture, &Capture::tap>(*this), interface);
+    }
+
+private:
+    Sink& sink;
+    Clock clock;
+
+    // The default clock, microseconds
+    static uint32_t defaultClock() {
+        #if defined (NATIVE)
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+        #else
+        return ::micros();
+        #endif
+    }
+};
+} // NAMESPACE
+#endif // CAPTURE_H
@@ -4,69 +4,136 @@
 #include <Arduino.h>
 #include "function.h"
 #include "frame.h"
+#include "framepool.h"
+#include "reassembler.h"
+#include "message.h"
+#include "stream.h"
+#include "arp.h"
+#include "integrity.h"
+#include "states.h"
+#include "stats.h"
+#include "txqueue.h"
+#include "capture.h"
+#include "wire.h"
+#include "responsecache.h"
+#include "timesync.h"
 
 #include <pb_decode.h>
 #include <pb_encode.h>
-#include <FastCRC.h>
-#include <etl/map.h>
-#include <etl/vector.h>
+#include <etl/queue.h>
 #include <etl/delegate.h>
 
+#include "transaction.pb.h"
+
+#if defined (NATIVE)
+#include <chrono>
+#endif
+
+#ifndef NUMBER_FRAME_SETS
 #define NUMBER_FRAME_SETS 3
+#endif
 
 namespace corelib {
 
-struct Buffer {
+/**
+ * @brief Compile time capacities of a Comm interface.
+ *
+ * @tparam MessageSize Size in bytes of the incoming and outgoing message buffers
+ * @tparam FragmentsPerMessage Maximum number of frames a single message may span
+ * @tparam ConcurrentMessages Number of messages which may be in flight per direction
+ * @tparam ReassemblyTimeout Iterations a partial message may wait for its next fragment
+ * before it is evicted
+ * @tparam RelayDepth Frames for other devices which may wait to be written, see router.h
+ *
+ * Frames of both directions and of relay come from one pool, see framepool.h.
+ *
+ * The ARP, transmit and pool settings may be changed by deriving from CommConfig:
+ *  struct MyConfig : CommConfig<> { static constexpr size_t neighbours = 32; };
+ */
+template<size_t MessageSize = 128, size_t FragmentsPerMessage = 3, size_t ConcurrentMessages = NUMBER_FRAME_SETS,
+         uint32_t ReassemblyTimeout = 10000, size_t RelayDepth = 4>
+struct CommConfig {
+    static constexpr size_t messageSize = MessageSize;
+    static constexpr size_t fragmentsPerMessage = FragmentsPerMessage;
+    static constexpr size_t concurrentMessages = ConcurrentMessages;
+    static constexpr uint32_t reassemblyTimeout = ReassemblyTimeout;
+    static constexpr size_t relayDepth = RelayDepth;
+    // @brief Devices cached by ARP
+    static constexpr size_t neighbours = 8;
+    // @brief Iterations a neighbour stays cached without being heard from
+    static constexpr uint32_t neighbourTimeout = 100000;
+    // @brief ARP requests and answers sent at once, then one per interval iterations
+    static constexpr uint8_t arpBurst = 2;
+    static constexpr uint32_t arpInterval = 1000;
+    // @brief Queued frames written per iteration at most, a long message is written
+    // over several iterations so reading and handling keep up
+    static constexpr size_t framesPerIteration = 4;
+    // @brief Frames read per iteration at most, more than one for a transport which
+    // buffers frames between iterations, see ring.h
+    static constexpr size_t framesReadPerIteration = 1;
+    // @brief The wire format of the transport, V1 for a transport which sends only the
+    // payload in use (see wire.h) has the last frame of a message carry its length
+    static constexpr WireFormat wireFormat = WireFormat::FIXED;
+    // @brief Frames shared by reassembly, the transmit queue and relay. By default
+    // either direction may have all its messages in flight while the other is idle.
+    static constexpr size_t poolFrames = FragmentsPerMessage * (ConcurrentMessages + 1) + 1;
+    // @brief Frames only reassembly may take, a message and the receive buffer
+    static constexpr size_t rxReservedFrames = FragmentsPerMessage + 1;
+    // @brief Frames only the transmit queue may take, a message
+    static constexpr size_t txReservedFrames = FragmentsPerMessage;
+    // @brief Responses kept for requests with a token, a repeated request is answered
+    // from them without the handler, see responsecache.h. 0 handles every request.
+    static constexpr size_t responseCacheEntries = 2;
+    // @brief Iterations a kept response answers repeats of its request
+    static constexpr uint32_t responseCacheExpiry = 10000;
+};
+
+template<size_t Size>
+struct BasicBuffer {
     // In data
-    uint8_t inBuffer[128] = {0};
+    uint8_t inBuffer[Size] = {0};
     int inIndex = 0;
     int inMessageLength = 0;
     // Out data
-    uint8_t outBuffer[128] = {0};
+    uint8_t outBuffer[Size] = {0};
     int outMessageLength = 0;
 };
 
-enum class HandleMessageState : uint8_t {
-    OK = 0,
-    ERROR = 1,
-    NO_DATA = 2,
-    FAILED_DECODE = 3,
-    FAILED_ENCODE = 4
-};
-
-enum class ReadState : uint8_t {
-    OK = 0,
-    ERROR = 1,
-    IN_FRAMES_FULL = 2,
-    NO_DATA = 3,
-    MISMATCH_CRC = 4
-};
-
-enum class WriteState : uint8_t {
-    OK = 0,
-    ERROR = 1,
-    OUT_FRAMES_EMPTY = 2
-};
-
-enum class ProcessState : uint8_t {
-    OK = 0,
-    ERROR = 1
-};
+typedef BasicBuffer<CommConfig<>::messageSize> Buffer;
 
 /**
  * @brief The Comms class provides a base set of communication functions to interface with
  * other hardware and the PC.
  * Comms is a base class.
+ *
+ * @tparam Config The capacities of the interface, see CommConfig
+ * @tparam Integrity The frame check policy, see integrity.h
  */
-class Comm : public Function
+template<typename Config = CommConfig<>, typename Integrity = FastCrc32Integrity>
+class BasicComm : public Function
 {
+    static_assert(Config::messageSize >= TransactionMessage_size,
+        "Comm message buffers must hold an encoded TransactionMessage");
+    static_assert(Config::fragmentsPerMessage * sizeof(Frame::payload) >= Config::messageSize,
+        "Comm fragments per message must be able to carry a full message buffer");
+    static_assert(Config::rxReservedFrames > 0 && Config::rxReservedFrames + Config::txReservedFrames <= Config::poolFrames,
+        "Comm frame pool must hold its reservations and a frame to receive into");
+
 public:
+    typedef BasicBuffer<Config::messageSize> Buffer;
+    typedef TxQueue<Config::concurrentMessages, Config::fragmentsPerMessage> FrameQueue;
+    typedef etl::delegate<uint32_t()> Clock;
+
     /**
      * @brief Construct a new Comms object
      * 
      */
-    Comm(): CRC32(), inFrames(), outFrames() {
+    BasicComm(): integrity(), framePool(), inFrames(framePool), outFrames(framePool),
+        responseCache(Config::responseCacheExpiry), neighbours(Config::neighbourTimeout),
+        arpRequests(Config::arpInterval, Config::arpBurst), arpReplies(Config::arpInterval, Config::arpBurst) {
         initialised = false;
+        (void) framePool.reserve(PoolOwner::RX, Config::rxReservedFrames);
+        (void) framePool.reserve(PoolOwner::TX, Config::txReservedFrames);
     }
 
     /**
@@ -77,25 +144,304 @@ public:
         callbackFunction = fn;
     }
 
+    /**
+     * @brief Register a callback function which reads each incoming message in place,
+     * through a view over the frames it arrived in, instead of a copy in the buffer.
+     * The view is valid until the callback returns. Any response is written to the
+     * buffer's out data as with setHandleMessageCallback. Takes precedence over it.
+     */
+    void setHandleMessageViewCallback(etl::delegate<HandleMessageState(const MessageView&, Buffer*)> fn) {
+        viewCallbackFunction = fn;
+    }
+
+    /**
+     * @brief Register a function which fills the buffer's out data with a message this
+     * device sends unprompted, e.g. a publish, see publisher.h. It is called once an
+     * iteration, after the incoming messages were handled, while there is room for it.
+     *
+     * @param fn Returns true when it wrote a message
+     */
+    void setPublishCallback(etl::delegate<bool(Buffer*)> fn) {
+        publishFunction = fn;
+    }
+
+    /**
+     * @brief Register the sink which receives incoming streams, see stream.h.
+     * Streams are ignored while no sink is set.
+     */
+    void setStreamSink(StreamSink* sink) {
+        streamIn.setSink(sink);
+    }
+
+    /**
+     * @brief Starts sending a stream to the destination device. Its frames are produced
+     * from the source as they are written, whenever no message frames are waiting.
+     *
+     * @param source Provides the data, it must stay valid until its end() is called
+     * @param length The stream length in bytes
+     * @param channel Tells the receiver what the stream holds
+     * @return false A stream is already being sent or it is too long
+     */
+    bool sendStream(StreamSource* source, uint32_t length, uint16_t channel = 0) {
+        return streamOut.begin(source, random(), length, channel);
+    }
+
+    /// True while an outgoing stream still has frames to write
+    bool streaming() const {
+        return streamOut.active() || streamFramePending;
+    }
+
+    /**
+     * @brief Register the function which forwards frames for other addresses,
+     * normally set by Router::attach
+     *
+     * @param fn Receives the frame and the port of this interface
+     * @param port The number of this interface within the router
+     */
+    void setRelayCallback(etl::delegate<bool(const Frame&, uint8_t)> fn, uint8_t port) {
+        relayFunction = fn;
+        relayPort = port;
+    }
+
+    /**
+     * @brief Register the function which tells whether frames for an address are
+     * forwarded off this interface, normally set by Router::attach. A transport which
+     * sees the traffic of other devices, as a bus, only takes the frames it routes.
+     *
+     * @param fn Receives the destination address and the port of this interface
+     */
+    void setRouteCallback(etl::delegate<bool(uint8_t, uint8_t)> fn) {
+        routeFunction = fn;
+    }
+
+    /**
+     * @brief Register a function which receives every frame read or written, as it
+     * was read or written, see capture.h
+     *
+     * @param interface Identifies this interface to the function
+     */
+    void setCaptureCallback(etl::delegate<void(uint8_t, CaptureDirection, const uint8_t*)> fn, uint8_t interface) {
+        captureFunction = fn;
+        captureInterface = interface;
+    }
+
+    /**
+     * @brief Queues a frame from another interface to be written as is. A frame from
+     * a V1 interface written in the FIXED format has its `payloadLength` cleared and its
+     * check recomputed, as a FIXED frame's length is always zero, see wire.h.
+     *
+     * @return false The relay queue or the frame pool is full, the frame is dropped
+     */
+    bool enqueueRelay(const Frame& frame) {
+        if(relayFrames.full()){
+            return false;
+        }
+        const FrameHandle handle = framePool.acquire(PoolOwner::RELAY);
+        if(handle == NoFrame){
+            return false;
+        }
+        Frame& relayed = framePool[handle];
+        relayed = frame;
+        if(Config::wireFormat == WireFormat::FIXED && relayed.payloadLength != 0){
+            // Checked when it was read, so the check is only restated
+            relayed.payloadLength = 0;
+            relayed.crc = frameCheck(relayed);
+        }
+        relayFrames.push(handle);
+        return true;
+    }
+
+    /**
+     * @brief Sets the identity this device answers ARP requests with
+     */
+    void setIdentity(const Common1& common) {
+        identity = common;
+    }
+
+    const Common1& getIdentity() const {
+        return identity;
+    }
+
+    /**
+     * @brief Broadcasts an ARP request, matching devices answer with their address
+     * and identity which is then cached, see getNeighbour. Rate limited.
+     *
+     * @param query The devices to look for, zero values match any
+     * @return false The request was not sent, rate limited or outFrames full
+     */
+    bool discover(const ArpQuery& query = ArpQuery()) {
+        if(!arpRequests.allow(iteration)){
+            return false;
+        }
+        Frame frame;
+        frame.preamble = Preamble::ARP_REQUEST;
+        encodeArpQuery(query, frame.payload);
+        return queueControlFrame(frame, 0x00);
+    }
+
+    /**
+     * @brief The address of a device, from the neighbour cache. A device which is
+     * not cached is looked for with a (rate limited) ARP request, try again later.
+     *
+     * @return uint8_t The address or NoAddress
+     */
+    uint8_t resolve(uint32_t serialNumber) {
+        const uint8_t found = neighbours.resolve(serialNumber, iteration);
+        if(found == NoAddress){
+            ArpQuery query;
+            query.serialNumber = serialNumber;
+            (void) discover(query);
+        }
+        return found;
+    }
+
+    /**
+     * @brief A cached device, nullptr when not known or aged out
+     */
+    const Neighbour* getNeighbour(uint8_t deviceAddress) const {
+        return neighbours.get(deviceAddress, iteration);
+    }
+
+    /// Number of cached devices
+    size_t neighbourCount() const {
+        return neighbours.size(iteration);
+    }
+
+    /**
+     * @brief Sets the clock of ping times, in microseconds. By default micros(), or
+     * the steady clock on native.
+     */
+    void setClock(Clock fn) {
+        clock = fn;
+    }
+
+    /**
+     * @brief Pings a device, which answers straight away without its message handler.
+     * The answer adds its round trip to the statistics and a sample to the estimate
+     * of the device's clock, see getClockSync. Pinging another device starts a new
+     * estimate once the ping is queued. A ping not yet answered is forgotten by the next
+     * one. A ping is answered by one device, so the catch all address 0x00 is refused.
+     *
+     * @return false The ping was not sent, outFrames full or the destination is 0x00
+     */
+    bool ping(uint8_t destination) {
+        if(destination == 0x00){
+            return false;
+        }
+        PingTimes times;
+        times.sequence = pingSequence + 1;
+        Frame frame;
+        frame.preamble = Preamble::PING_REQUEST;
+        encodePingTimes(times, frame.payload);
+        if(!queueControlFrame(frame, destination)){
+            return false;
+        }
+        if(destination != clockSync.peer()){
+            clockSync.reset(destination);
+        }
+        pingSequence = times.sequence;
+        pingPending = true;
+        stats.pingSent();
+        return true;
+    }
+
+    /// Pings the destination device
+    bool ping() {
+        return ping(destinationDeviceAddress);
+    }
+
+    /**
+     * @brief The estimate of the clock of the device last pinged, e.g. to put a
+     * timestamp of this device into its time
+     */
+    const ClockSync& getClockSync() const {
+        return clockSync;
+    }
+
+    /// Number of messages queued for transmit
+    size_t txQueueDepth() const {
+        return outFrames.size();
+    }
+
+    /**
+     * @brief The frames of this interface, with their use by direction
+     */
+    const FramePool& getFramePool() const {
+        return framePool;
+    }
+
+    /**
+     * @brief The statistics of this interface, see stats.h
+     */
+    const CommStats& getStats() const {
+        return stats.get();
+    }
+
+    void resetStats() {
+        stats.reset();
+    }
+
 protected:
     // @brief Incoming/Outgoing Message Buffer
     Buffer buffer;
     // @brief Set when the Comms Interface is initialised
     bool initialised;
-    // @brief The CRC Interface
-    FastCRC32 CRC32;
+    // @brief The frame check (CRC) Interface
+    Integrity integrity;
     // @brief This Device's Address
     uint8_t address = 0x02;
     // @brief  The destination address to communicate with
     uint8_t destinationDeviceAddress = 0x01; // Sending to PC
 
-    // @brief  List of in Frames by FrameId
-    etl::map<uint32_t, etl::vector<Frame, 3>, NUMBER_FRAME_SETS> inFrames;
-    // @brief  List of out Frames by FrameId
-    etl::map<uint32_t, etl::vector<Frame, 3>, NUMBER_FRAME_SETS> outFrames;
+    // @brief Frames of inFrames, outFrames and relayFrames
+    StaticFramePool<Config::poolFrames> framePool;
+    // @brief  Incoming messages being reassembled by (sourceAddress, frameID)
+    Reassembler<Config::concurrentMessages, Config::fragmentsPerMessage> inFrames;
+    // @brief  Outgoing messages, written a frame at a time by priority, see txqueue.h
+    FrameQueue outFrames;
+    // @brief Responses to recent requests by (sourceAddress, token)
+    ResponseCache<Config::responseCacheEntries, Config::messageSize> responseCache;
+    // @brief The incoming stream
+    StreamReceiver streamIn;
+    // @brief The outgoing stream
+    StreamSender streamOut;
+    // @brief The stream frame being written, kept until the transport accepts it
+    Frame streamFrame;
+    bool streamFramePending = false;
+    // @brief Pool frames from other interfaces waiting to be written
+    etl::queue<FrameHandle, Config::relayDepth> relayFrames;
+    // @brief Forwards frames for other addresses
+    etl::delegate<bool(const Frame&, uint8_t)> relayFunction;
+    uint8_t relayPort = 0;
+    // @brief Whether frames for an address are forwarded off this interface
+    etl::delegate<bool(uint8_t, uint8_t)> routeFunction;
+    // @brief Records the frames read and written
+    etl::delegate<void(uint8_t, CaptureDirection, const uint8_t*)> captureFunction;
+    uint8_t captureInterface = 0;
+    // @brief Time of ping timestamps in microseconds
+    Clock clock = Clock::template create<&BasicComm::defaultClock>();
+    // @brief The clock of the device last pinged and the ping waiting for its answer
+    ClockSync clockSync;
+    uint32_t pingSequence = 0;
+    bool pingPending = false;
+    // @brief This device's identity, given in ARP responses
+    Common1 identity = Common1_init_zero;
+    // @brief Devices learnt through ARP
+    NeighbourTable<Config::neighbours> neighbours;
+    // @brief Limits ARP broadcasts and answers
+    RateLimiter arpRequests;
+    RateLimiter arpReplies;
+    // @brief Counters and stage timing
+    CommStatistics stats;
+    // @brief Number of iterations performed, the time base of reassembly timeouts
+    uint32_t iteration = 0;
     
     // Callback function
     etl::delegate<HandleMessageState(Buffer*)> callbackFunction;
+    // Zero copy callback function
+    etl::delegate<HandleMessageState(const MessageView&, Buffer*)> viewCallbackFunction;
+    // Unprompted message function
+    etl::delegate<bool(Buffer*)> publishFunction;
 
     /**
      * @brief A callback function which Handles the incoming message, and 
@@ -105,95 +451,166 @@ protected:
      * @return HandleMessageState 
      */
     HandleMessageState callback(Buffer* buffer) {
+        if(!callbackFunction.is_valid()){
+            return HandleMessageState::ERROR;
+        }
         return callbackFunction(buffer);
     }
 
     /**
-     * @brief Processes the incoming message from the using proto function
-     * to a set of Frames
+     * @brief A callback function which handles the incoming message in place, and
+     * may provide an outgoing message.
+     *
+     * @param message The incoming message
+     * @param buffer Holds the outgoing message
+     * @return HandleMessageState
+     */
+    HandleMessageState callback(const MessageView& message, Buffer* buffer) {
+        if(!viewCallbackFunction.is_valid()){
+            return HandleMessageState::ERROR;
+        }
+        return viewCallbackFunction(message, buffer);
+    }
+
+    /**
+     * @brief Computes the check value of a frame, covering everything but the crc itself
+     */
+    uint32_t frameCheck(const Frame& frame) {
+        return integrity.compute(reinterpret_cast<const uint8_t*>(&frame), sizeof(Frame) - sizeof(Frame::crc));
+    }
+
+    /**
+     * @brief Copies the earliest complete message into the buffer for the
+     * Buffer callback
      */
     ProcessState processIncomingMessage() {
-        for(auto uniquePair : inFrames){
-            auto frames = uniquePair.second;
-            auto frame = frames.front();
-            // Reset in buffer
-            buffer.inIndex=0;
-            // Single frame message
-            if(frame.frameTotal == 1){
-                memcpy(buffer.inBuffer, frame.payload, sizeof(frame.payload));
-                buffer.inIndex=sizeof(frame.payload);
-                // Remove this frameId from the map
-                inFrames.erase(uniquePair.first);
-                // Multiple frame message
+        const int slot = inFrames.nextComplete();
+        if(slot == inFrames.NoSlot){
+            return ProcessState::OK;
+        }
+        // Copy out the earliest complete message
+        const size_t length = inFrames.view(slot).copyTo(buffer.inBuffer, sizeof(buffer.inBuffer));
+        buffer.inIndex = length;
+        buffer.inMessageLength = length;
+        // Free the slot for the next message
+        inFrames.release(slot);
+        return ProcessState::OK;
+    }
+
+    /**
+     * @brief Hands every complete message to the callback in the order they completed,
+     * turning each response into a set of outgoing frames in the same pass.
+     * Messages wait in the queue while there is no room for their response. A request
+     * repeated with the same token is answered from the response cache instead.
+     *
+     * @return size_t The number of messages handled
+     */
+    size_t processMessages() {
+        size_t handled = 0;
+        while(inFrames.nextComplete() != inFrames.NoSlot && !outFrames.full(TxLane::PRIORITY)){
+            uint32_t start;
+            const int slot = inFrames.nextComplete();
+            const uint8_t source = inFrames.slot(slot).sourceAddress;
+            uint32_t token = 0;
+            uint32_t check = 0;
+            const bool keyed = responseCache.enabled && requestKey(inFrames.view(slot), token, check);
+            if(keyed && responseCache.find(source, token, check, iteration, buffer.outBuffer, buffer.outMessageLength)){
+                // A retry, answered as before without handling it again
+                stats.responseCacheHit();
+                inFrames.release(slot);
             }else{
-                // Check if we have the remaining data..
-                if(frames.size() == frame.frameTotal){
-                    for (uint8_t order = 1; order <= frame.frameTotal; order++){
-                        // Search for a frame with order
-                        auto frame = etl::find_if(frames.begin(), frames.end(), [order](Frame frame){
-                            return frame.frameOrder == order;
-                        });
-                        // A frame has been found
-                        if(frame != frames.end()){
-                            const uint32_t frameSize = sizeof(frame->payload);
-                            memcpy(buffer.inBuffer+buffer.inIndex, frame->payload, frameSize);
-                            buffer.inIndex+=frameSize;
-                        }else{
-                            // Something went wrong...
-                            // Cancel out of this search
-                            buffer.inIndex = 0;
-                        }
-                    }
-                    // Remove this frameId from the map
-                    inFrames.erase(uniquePair.first);
-                    break; // Exit for loop & Process this message
+                if(viewCallbackFunction.is_valid()){
+                    // Handle message where it was received, its frames are freed afterwards
+                    start = stats.startStage();
+                    stats.count(callback(inFrames.view(slot), &buffer));
+                    stats.endStage(Stage::CALLBACK, start);
+                    inFrames.release(slot);
+                }else{
+                    start = stats.startStage();
+                    (void) processIncomingMessage();
+                    stats.endStage(Stage::INCOMING, start);
+                    // Handle message
+                    start = stats.startStage();
+                    stats.count(callback(&buffer));
+                    stats.endStage(Stage::CALLBACK, start);
+                    // The message has been consumed
+                    buffer.inIndex = 0;
+                    buffer.inMessageLength = 0;
+                }
+                if(keyed){
+                    stats.responseCacheMiss();
+                    responseCache.store(source, token, check, buffer.outBuffer, buffer.outMessageLength, iteration);
                 }
             }
+            // Process the response as a set of frames
+            start = stats.startStage();
+            (void) processOutgoingMessage(TxLane::PRIORITY);
+            stats.endStage(Stage::OUTGOING, start);
+            handled++;
         }
-        return ProcessState::OK;
+        return handled;
+    }
+
+    /**
+     * @brief Frames a message from the publish function, when there is room for it
+     */
+    ProcessState processPublish() {
+        if(!publishFunction.is_valid() || outFrames.full(TxLane::BULK) || buffer.outMessageLength != 0){
+            return ProcessState::OK;
+        }
+        if(!publishFunction(&buffer)){
+            return ProcessState::OK;
+        }
+        return processOutgoingMessage(TxLane::BULK);
     }
 
     /**
      * @brief Processes the outgoing message from the using proto function
      * to a set of Frames
+     *
+     * @param lane The priority of the message, responses go before publishes
      */
-    ProcessState processOutgoingMessage() {
+    ProcessState processOutgoingMessage(TxLane lane = TxLane::PRIORITY) {
         // Transmit output buffer
         if(buffer.outMessageLength == 0){
             // The outgoing buffer is empty
             return ProcessState::ERROR;
         }
-        if(outFrames.full()){
-            // Cannot process the outgoing buffer since the outFrames are full
-            return ProcessState::ERROR;
-        }
-        // New frame
-        etl::vector<Frame, 3> newFrames;
         // determine how many frames are required for the output message.
         uint8_t requiredFrames = ceil((double)buffer.outMessageLength/sizeof(Frame::payload));
-        if(requiredFrames > newFrames.max_size()){
+        if(requiredFrames > Config::fragmentsPerMessage){
+            return ProcessState::ERROR;
+        }
+        // The frames are built where they are queued
+        const int entry = outFrames.push(lane, requiredFrames, iteration);
+        if(entry == FrameQueue::NoEntry){
+            // Cannot process the outgoing buffer since the outFrames are full
             return ProcessState::ERROR;
         }
         // share id between frames for the message
         uint32_t frameId = random();
         for(uint8_t i = 0; i < requiredFrames; i++){
             // Send out the message over `requiredFrames` times
-            Frame frame;
+            Frame& frame = outFrames.frame(entry, i);
             frame.preamble = Preamble::DATA;
             frame.sourceAddress = address;
             frame.destinationAddress = destinationDeviceAddress;
             frame.frameTotal = requiredFrames;
             frame.frameOrder = i+1;
             frame.frameID = frameId;
-            memcpy(frame.payload, buffer.outBuffer+(i*sizeof(Frame::payload)), sizeof(Frame::payload));
+            // The last frame holds what is left of the message, zero padded
+            const size_t offset = i*sizeof(Frame::payload);
+            const size_t part = buffer.outMessageLength - offset < sizeof(Frame::payload) ?
+                buffer.outMessageLength - offset : sizeof(Frame::payload);
+            memcpy(frame.payload, buffer.outBuffer+offset, part);
+            memset(frame.payload+part, 0, sizeof(Frame::payload)-part);
+            frame.payloadLength = Config::wireFormat == WireFormat::V1 && part < sizeof(Frame::payload) ? part : 0;
             // Check that the frame arrived correctly
-            frame.crc = CRC32.crc32((uint8_t*)&frame, sizeof(Frame)-4);
-            newFrames.push_back(frame);
+            frame.crc = frameCheck(frame);
         }
         // Clear
         buffer.outMessageLength = 0;
-        // Save frames to the outFrames
-        outFrames.insert(etl::pair<uint32_t, etl::vector<Frame, 3>>{frameId, newFrames});
+        stats.outFramesUsed(outFrames.size());
         return ProcessState::OK;
     }
 
@@ -203,25 +620,35 @@ protected:
      * @return ReadState 
      */
     ReadState processRead() {
-        uint8_t incoming[64] = {0}; // incoming frame in bytes
-
-        if(inFrames.full()){
+        // Leave frames with the transport until a complete message is processed.
+        // A table full of partial messages is not a reason to stop, see below.
+        if(inFrames.completeCount() == inFrames.max_size()){
             return ReadState::IN_FRAMES_FULL;
         }
 
-        if(read(incoming) == 0){
+        // The transport reads straight into a pool frame. With none to spare the
+        // oldest partial message gives its frames up, or the frame waits for them.
+        uint8_t* into = inFrames.receiveBuffer();
+        if(into == nullptr && inFrames.evictOldest()){
+            stats.evicted(1);
+            into = inFrames.receiveBuffer();
+        }
+        if(into == nullptr){
+            return ReadState::IN_FRAMES_FULL;
+        }
+        if(read(into) == 0){
             return ReadState::NO_DATA;
         }
 
-        // Frame arrived
-        Frame frame;
-        memcpy(&frame, incoming, 64);
+        // Frame arrived, a ping is timed as it arrives
+        const Frame& frame = inFrames.received();
+        const bool ping = frame.preamble == Preamble::PING_REQUEST || frame.preamble == Preamble::PING_RESPONSE;
+        const uint32_t readAt = ping ? clock() : 0;
+        stats.frameIn(sizeof(Frame));
+        captured(CaptureDirection::IN, frame);
 
         // Check that the frame arrived correctly
-        uint32_t crc = CRC32.crc32((uint8_t*)&frame, sizeof(Frame)-4);
-
-        // Frame integrity safe
-        if(crc != frame.crc){
+        if(Integrity::enabled && frameCheck(frame) != frame.crc){
             return ReadState::MISMATCH_CRC;
         }
 
@@ -229,67 +656,238 @@ protected:
         if(frame.preamble == Preamble::DATA){
             // Check if the frame is for this device
             if(frame.destinationAddress == address || frame.destinationAddress == 0x00){
-            // Add frame to device frame list
-
-            auto it = inFrames.find(frame.frameID);
-
-            if(it != inFrames.end()){
-                // Found existing frameId
-                it->second.push_back(frame);
-            }else{
-                // New frame
-                etl::vector<Frame, 3> newFrames;
-                newFrames.push_back(frame);
-                inFrames.insert(etl::pair<uint32_t, etl::vector<Frame, 3>>{frame.frameID, newFrames});
+            // Add frame to its message slot
+            ReassemblyState state = inFrames.insert(iteration);
+            if(state == ReassemblyState::FULL && inFrames.evictOldest()){
+                // A fragment of the oldest partial message has most likely been lost
+                stats.evicted(1);
+                state = inFrames.insert(iteration);
             }
-
+            if(state == ReassemblyState::COMPLETE){
+                stats.completion();
+                neighbours.touch(frame.sourceAddress, iteration);
+            }
+            stats.inFramesUsed(inFrames.size());
             }else{
             // Relay message
-            // todo: Implement this in a new feature
+            relay(frame);
+            }
+        }else if(frame.preamble == Preamble::STREAM){
+            // Stream fragments go straight to the sink
+            if(frame.destinationAddress == address || frame.destinationAddress == 0x00){
+                (void) streamIn.receive(frame, iteration);
+            }else{
+                relay(frame);
             }
         }else if(frame.preamble == Preamble::PROGRAMMOR_COMPATIBLE_REQUEST){
-            // Save frames to the outFrames
-            uint32_t frameId = random();
-            Frame frameResponse = frame; // copy over frame
-            frameResponse.preamble = Preamble::PROGRAMMOR_COMPATIBLE_RESPONSE;
-            frameResponse.sourceAddress = frame.destinationAddress;
-            frameResponse.destinationAddress = address;
-            frameResponse.frameTotal = 1;
-            frameResponse.frameOrder = 1;
-            frameResponse.frameID = frameId;
-            frameResponse.crc = CRC32.crc32((uint8_t*)&frameResponse, sizeof(Frame)-4);
-            etl::vector<Frame, 3> newFrames;
-            newFrames.push_back(frameResponse);
-            outFrames.insert(etl::pair<uint32_t, etl::vector<Frame, 3>>{frameId, newFrames});
+            // Save frames to the outFrames, the handshake goes before queued publishes
+            const int entry = outFrames.push(TxLane::PRIORITY, 1, iteration);
+            if(entry != FrameQueue::NoEntry){
+                Frame* frameResponse = &outFrames.frame(entry, 0);
+                *frameResponse = frame; // copy over frame
+                frameResponse->preamble = Preamble::PROGRAMMOR_COMPATIBLE_RESPONSE;
+                frameResponse->sourceAddress = frame.destinationAddress;
+                frameResponse->destinationAddress = address;
+                frameResponse->frameTotal = 1;
+                frameResponse->frameOrder = 1;
+                frameResponse->frameID = random();
+                frameResponse->crc = frameCheck(*frameResponse);
+                stats.outFramesUsed(outFrames.size());
+            }
+        }else if(frame.preamble == Preamble::PING_REQUEST){
+            // Answered here, the times go back in the response
+            if(frame.destinationAddress == address || frame.destinationAddress == 0x00){
+                PingTimes times = decodePingTimes(frame.payload);
+                times.received = readAt;
+                Frame frameResponse;
+                frameResponse.preamble = Preamble::PING_RESPONSE;
+                encodePingTimes(times, frameResponse.payload);
+                if(queueControlFrame(frameResponse, frame.sourceAddress)){
+                    stats.pingAnswered();
+                }
+            }else{
+                relay(frame);
+            }
+        }else if(frame.preamble == Preamble::PING_RESPONSE){
+            // The answer to the last ping adds a sample of the device's clock
+            if(frame.destinationAddress == address){
+                const PingTimes times = decodePingTimes(frame.payload);
+                if(pingPending && times.sequence == pingSequence && frame.sourceAddress == clockSync.peer()){
+                    pingPending = false;
+                    (void) clockSync.add(times, readAt);
+                    stats.pingResponse(clockSync.rtt(), clockSync.offset(), clockSync.drift());
+                }
+            }else{
+                relay(frame);
+            }
         }else if(frame.preamble == Preamble::ARP_REQUEST){
             // ARP request
-            // todo: Implement this in a new feature    
+            if(frame.destinationAddress == address || frame.destinationAddress == 0x00){
+                neighbours.touch(frame.sourceAddress, iteration);
+                if(decodeArpQuery(frame.payload).matches(identity) && arpReplies.allow(iteration)){
+                    Frame frameResponse;
+                    frameResponse.preamble = Preamble::ARP_RESPONSE;
+                    encodeArpIdentity(identity, frameResponse.payload);
+                    (void) queueControlFrame(frameResponse, frame.sourceAddress);
+                }
+            }else{
+                relay(frame);
+            }
+        }else if(frame.preamble == Preamble::ARP_RESPONSE){
+            // ARP response, cache the device
+            if(frame.destinationAddress == address || frame.destinationAddress == 0x00){
+                neighbours.learn(frame.sourceAddress, decodeArpIdentity(frame.payload), iteration);
+            }else{
+                relay(frame);
+            }
         }
         return ReadState::OK;
     }
 
     /**
-     * @brief Processes any outgoing frames
-     * 
+     * @brief Processes any outgoing frames, up to limit frames by priority. A frame
+     * the transport does not accept stays at the front of the queue and is written
+     * again next time, the frames of its message before it are not.
+     *
+     * @param limit Frames which may be written
      * @return WriteState 
      */
-    WriteState processWrite() {
+    WriteState processWrite(size_t limit = Config::framesPerIteration) {
         if(outFrames.empty()){
-            return WriteState::OUT_FRAMES_EMPTY;
-        }
-        auto frameSetIt = outFrames.begin();
-        auto frames = frameSetIt->second;
-        auto it_frames = frames.begin();
-        while(it_frames != frames.end()){
-            Frame frame = *it_frames;
-            if(!write((uint8_t*)&frame)){
+            return limit == 0 ? WriteState::OK : processStreamWrite();
+        }
+        size_t written = 0;
+        while(written < limit && !outFrames.empty()){
+            if(outFrames.starting()){
+                stats.txWaited(iteration - outFrames.queuedAt());
+            }
+            Frame* frame = outFrames.front();
+            stampPing(*frame);
+            if(!write((const uint8_t*)frame)){
+                return WriteState::ERROR;
+            }
+            stats.frameOut(sizeof(Frame));
+            captured(CaptureDirection::OUT, *frame);
+            written++;
+            if(outFrames.pop()){
+                stats.outFramesUsed(outFrames.size());
+            }
+        }
+        // The stream takes what the queue left of the iteration
+        if(written < limit && processStreamWrite() == WriteState::ERROR){
             return WriteState::ERROR;
+        }
+        return WriteState::OK;
+    }
+
+    /**
+     * @brief Puts the time a ping frame is written into it, as late as possible
+     */
+    void stampPing(Frame& frame) {
+        if(frame.preamble != Preamble::PING_REQUEST && frame.preamble != Preamble::PING_RESPONSE){
+            return;
+        }
+        PingTimes times = decodePingTimes(frame.payload);
+        if(frame.preamble == Preamble::PING_REQUEST){
+            times.sent = clock();
+        }else{
+            times.answered = clock();
+        }
+        encodePingTimes(times, frame.payload);
+        frame.crc = frameCheck(frame);
+    }
+
+    /**
+     * @brief Queues a single frame message from this device, e.g. for ARP
+     *
+     * @return false The outFrames are full
+     */
+    bool queueControlFrame(Frame& frame, uint8_t destination) {
+        const int entry = outFrames.push(TxLane::PRIORITY, 1, iteration);
+        if(entry == FrameQueue::NoEntry){
+            return false;
+        }
+        frame.sourceAddress = address;
+        frame.destinationAddress = destination;
+        frame.frameTotal = 1;
+        frame.frameOrder = 1;
+        frame.frameID = random();
+        frame.crc = frameCheck(frame);
+        outFrames.frame(entry, 0) = frame;
+        stats.outFramesUsed(outFrames.size());
+        return true;
+    }
+
+    /**
+     * @brief Hands a frame to the capture function, when there is one
+     */
+    void captured(CaptureDirection direction, const Frame& frame) {
+        if(captureFunction.is_valid()){
+            captureFunction(captureInterface, direction, reinterpret_cast<const uint8_t*>(&frame));
+        }
+    }
+
+    /**
+     * @brief Whether a frame for another address would be forwarded, every one while
+     * there is a relay function but no route function
+     */
+    bool relays(uint8_t destination) {
+        if(!relayFunction.is_valid()){
+            return false;
+        }
+        return !routeFunction.is_valid() || routeFunction(destination, relayPort);
+    }
+
+    /**
+     * @brief Forwards a frame for another address, unchanged
+     */
+    void relay(const Frame& frame) {
+        if(relayFunction.is_valid() && !relayFunction(frame, relayPort)){
+            stats.relayDropped();
+        }
+    }
+
+    /**
+     * @brief Writes the frames queued by other interfaces, as they were received
+     *
+     * @return WriteState
+     */
+    WriteState processRelay() {
+        while(!relayFrames.empty()){
+            const Frame& frame = framePool[relayFrames.front()];
+            if(!write((const uint8_t*)&frame)){
+                return WriteState::ERROR;
             }
-            frames.erase(it_frames);
-            if(frames.empty()){
-            outFrames.erase(frameSetIt);
+            stats.frameOut(sizeof(Frame));
+            captured(CaptureDirection::OUT, frame);
+            framePool.release(PoolOwner::RELAY, relayFrames.front());
+            relayFrames.pop();
+            stats.relayed();
+        }
+        return WriteState::OK;
+    }
+
+    /**
+     * @brief Writes the next frame of the outgoing stream, produced on demand
+     *
+     * @return WriteState
+     */
+    WriteState processStreamWrite() {
+        if(!streamFramePending){
+            if(!streamOut.produce(streamFrame)){
+                return WriteState::OUT_FRAMES_EMPTY;
             }
+            streamFrame.sourceAddress = address;
+            streamFrame.destinationAddress = destinationDeviceAddress;
+            streamFrame.crc = frameCheck(streamFrame);
+            streamFramePending = true;
         }
+        if(!write((uint8_t*)&streamFrame)){
+            return WriteState::ERROR;
+        }
+        streamFramePending = false;
+        stats.frameOut(sizeof(Frame));
+        captured(CaptureDirection::OUT, streamFrame);
         return WriteState::OK;
     }
 
@@ -316,18 +914,49 @@ protected:
         if(!initialised) {
             return;
         }
-        // Read an individual frame
-        (void) processRead();
-        // Process a set of frames as a message
-        (void) processIncomingMessage();
-        // Handle message
-        (void) callback(&buffer);
-        // Process a message as a set of frames
-        (void) processOutgoingMessage();
-        // Write out individual frames
-        (void) processWrite();
+        iteration++;
+        // Drop partial messages which stopped receiving fragments
+        stats.evicted(inFrames.evictStale(iteration, Config::reassemblyTimeout));
+        if(streamIn.expire(iteration, Config::reassemblyTimeout)){
+            stats.evicted(1);
+        }
+        // Read the frames waiting, up to the read limit
+        uint32_t start = stats.startStage();
+        for(size_t i = 0; i < Config::framesReadPerIteration; i++){
+            const ReadState state = processRead();
+            stats.count(state);
+            if(state == ReadState::NO_DATA || state == ReadState::IN_FRAMES_FULL){
+                break;
+            }
+        }
+        stats.endStage(Stage::READ, start);
+        // Handle every complete message and frame the responses
+        (void) processMessages();
+        // Responses take precedence over publishes
+        (void) processPublish();
+        // Write out forwarded frames first, then individual frames
+        start = stats.startStage();
+        if(!relayFrames.empty()){
+            stats.count(processRelay());
+        }
+        stats.count(processWrite());
+        stats.endStage(Stage::WRITE, start);
     }
 
+private:
+    // The default clock, microseconds
+    static uint32_t defaultClock() {
+        #if defined (NATIVE)
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+        #else
+        return ::micros();
+        #endif
+    }
 };
+
+/// The default Comm capacities, 128 byte messages of up to 3 frames with 3 messages in flight
+typedef BasicComm<> Comm;
+
 } // NAMESPACE
 #endif // COMM_H
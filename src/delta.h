@@ -0,0 +1,206 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <Arduino.h>
+
+#include <pb_decode.h>
+
+#include "transaction.pb.h"
+
+namespace corelib {
+
+/**
+ * A delta carries only the bytes of an encoded share which changed since it was last
+ * sent, in the data of a SHARE_DELTA. Both ends keep a shadow of the encoded share and
+ * its version, the device's updated as each delta is made, the host's as it is applied.
+ *
+ *  0 baseVersion (uint16) the version the delta applies to, 0 replaces the share
+ *  2 version     (uint16) the version after applying, never 0
+ *  4 length      (uint8)  the encoded length of the share after applying
+ *  5 ranges, each an offset (uint8) and a count (uint8) followed by count bytes
+ * Values are little endian.
+ *
+ * A host whose shadow is not at the base version lost a delta, it asks for a full
+ * delta (base 0, one range covering the share) with a SHARE_DELTA of the share.
+ *
+ * The data of a SHARE_DELTA is only as long as the delta, not padded to the fixed
+ * length of TransactionMessage's data, so a nanopb host reads it with decodeDeltaMessage.
+ */
+
+static constexpr size_t DeltaHeaderSize = 5;
+static constexpr size_t DeltaRangeHeaderSize = 2;
+static constexpr size_t DeltaMaxSize = sizeof(TransactionMessage::data);
+// @brief Largest encoded share which fits a full delta
+static constexpr size_t DeltaMaxShare = DeltaMaxSize - DeltaHeaderSize - DeltaRangeHeaderSize;
+
+/**
+ * @brief An encoded share as last sent or applied
+ */
+struct DeltaShadow {
+    uint8_t data[DeltaMaxShare] = {0};
+    uint8_t length = 0;
+    // @brief 0 until the first delta
+    uint16_t version = 0;
+};
+
+inline void deltaPut(uint8_t* data, uint16_t value) {
+    data[0] = value & 0xFF;
+    data[1] = value >> 8;
+}
+
+inline uint16_t deltaGet(const uint8_t* data) {
+    return data[0] | (data[1] << 8);
+}
+
+/**
+ * @brief Makes a delta replacing the whole share, and updates the shadow
+ *
+ * @return size_t The length of the delta, 0 when the share is too large
+ */
+inline size_t encodeFullDelta(DeltaShadow& shadow, const uint8_t* share, size_t length, uint8_t* delta) {
+    if(length > DeltaMaxShare){
+        return 0;
+    }
+    const uint16_t version = shadow.version == 0xFFFF ? 1 : shadow.version + 1;
+    deltaPut(delta, 0);
+    deltaPut(delta + 2, version);
+    delta[4] = length;
+    delta[5] = 0;
+    delta[6] = length;
+    memcpy(delta + DeltaHeaderSize + DeltaRangeHeaderSize, share, length);
+    memcpy(shadow.data, share, length);
+    shadow.length = length;
+    shadow.version = version;
+    return DeltaHeaderSize + DeltaRangeHeaderSize + length;
+}
+
+/**
+ * @brief Makes the delta from the shadow to the share, and updates the shadow.
+ * Ranges separated by fewer unchanged bytes than a range header are merged. A full
+ * delta is made instead when there is no shadow yet or it would be no larger.
+ *
+ * @param delta Receives the delta, DeltaMaxSize bytes
+ * @return size_t The length of the delta, 0 when the share is too large
+ */
+inline size_t encodeDelta(DeltaShadow& shadow, const uint8_t* share, size_t length, uint8_t* delta) {
+    if(length > DeltaMaxShare){
+        return 0;
+    }
+    if(shadow.version == 0){
+        return encodeFullDelta(shadow, share, length, delta);
+    }
+    const size_t fullLength = DeltaHeaderSize + DeltaRangeHeaderSize + length;
+    size_t used = DeltaHeaderSize;
+    size_t i = 0;
+    while(i < length){
+        if(i < shadow.length && share[i] == shadow.data[i]){
+            i++;
+            continue;
+        }
+        // Extend the range until a gap too long to carry
+        const size_t start = i;
+        size_t end = i + 1;
+        for(size_t j = end; j < length && j - end <= DeltaRangeHeaderSize; j++){
+            if(j >= shadow.length || share[j] != shadow.data[j]){
+                end = j + 1;
+            }
+        }
+        const size_t count = end - start;
+        if(used + DeltaRangeHeaderSize + count >= fullLength){
+            return encodeFullDelta(shadow, share, length, delta);
+        }
+        delta[used] = start;
+        delta[used + 1] = count;
+        memcpy(delta + used + DeltaRangeHeaderSize, share + start, count);
+        used += DeltaRangeHeaderSize + count;
+        i = end;
+    }
+    const bool changed = used > DeltaHeaderSize || length != shadow.length;
+    const uint16_t version = !changed ? shadow.version : (shadow.version == 0xFFFF ? 1 : shadow.version + 1);
+    deltaPut(delta, shadow.version);
+    deltaPut(delta + 2, version);
+    delta[4] = length;
+    memcpy(shadow.data, share, length);
+    shadow.length = length;
+    shadow.version = version;
+    return used;
+}
+
+/**
+ * @brief Applies a delta to the host's shadow
+ *
+ * @return false The shadow is not at the delta's base version, or the delta is
+ * malformed, the shadow is unchanged and a full delta should be asked for
+ */
+inline bool applyDelta(DeltaShadow& shadow, const uint8_t* delta, size_t length) {
+    if(length < DeltaHeaderSize){
+        return false;
+    }
+    const uint16_t base = deltaGet(delta);
+    const uint16_t version = deltaGet(delta + 2);
+    const size_t shareLength = delta[4];
+    if((base != 0 && base != shadow.version) || version == 0 || shareLength > DeltaMaxShare){
+        return false;
+    }
+    // Check every range before changing anything
+    for(size_t i = DeltaHeaderSize; i < length; ){
+        if(i + DeltaRangeHeaderSize > length){
+            return false;
+        }
+        const size_t offset = delta[i];
+        const size_t count = delta[i + 1];
+        if(offset + count > shareLength || i + DeltaRangeHeaderSize + count > length){
+            return false;
+        }
+        i += DeltaRangeHeaderSize + count;
+    }
+    for(size_t i = DeltaHeaderSize; i < length; ){
+        const size_t count = delta[i + 1];
+        memcpy(shadow.data + delta[i], delta + i + DeltaRangeHeaderSize, count);
+        i += DeltaRangeHeaderSize + count;
+    }
+    shadow.length = shareLength;
+    shadow.version = version;
+    return true;
+}
+
+/**
+ * @brief Reads a SHARE_DELTA message field by field
+ *
+ * @param delta Receives the delta, DeltaMaxSize bytes
+ * @param length Set to the length of the delta
+ * @return false The message is not a SHARE_DELTA or is malformed
+ */
+inline bool decodeDeltaMessage(pb_istream_t& in, uint32_t& token, uint32_t& shareId, uint8_t* delta, size_t& length) {
+    uint64_t action = TransactionMessage_Action_NA;
+    length = 0;
+    pb_wire_type_t type;
+    uint32_t tag;
+    bool eof;
+    while(pb_decode_tag(&in, &type, &tag, &eof)){
+        bool ok;
+        if(tag == 1 && type == PB_WT_32BIT){
+            ok = pb_decode_fixed32(&in, &token);
+        }else if(tag == 2 && type == PB_WT_VARINT){
+            ok = pb_decode_varint(&in, &action);
+        }else if(tag == 3 && type == PB_WT_32BIT){
+            ok = pb_decode_fixed32(&in, &shareId);
+        }else if(tag == 5 && type == PB_WT_STRING){
+            pb_istream_t data;
+            ok = pb_make_string_substream(&in, &data) && data.bytes_left <= DeltaMaxSize;
+            if(ok){
+                length = data.bytes_left;
+                ok = pb_read(&data, delta, length);
+                ok = pb_close_string_substream(&in, &data) && ok;
+            }
+        }else{
+            ok = pb_skip_field(&in, type);
+        }
+        if(!ok){
+            return false;
+        }
+    }
+    return eof && action == TransactionMessage_Action_SHARE_DELTA;
+}
+} // NAMESPACE
+#endif // DELTA_H
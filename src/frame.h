@@ -2,6 +2,7 @@
 #define FRAME_H
 
 #include <Arduino.h>
+#include <stddef.h>
 
 namespace corelib {
 
@@ -9,13 +10,16 @@ namespace corelib {
  * @brief Frame Preamble
  */
 
-enum class Preamble : uint16_t {
+enum class Preamble : uint8_t {
     NA = 0x00,
     DATA = 0x01,
     PROGRAMMOR_COMPATIBLE_REQUEST = 0x02,
     PROGRAMMOR_COMPATIBLE_RESPONSE = 0x03,
     ARP_REQUEST = 0x04,
-    ARP_RESPONSE = 0x05
+    ARP_RESPONSE = 0x05,
+    STREAM = 0x06,
+    PING_REQUEST = 0x07,
+    PING_RESPONSE = 0x08
 };
 
 
@@ -28,11 +32,14 @@ enum class Preamble : uint16_t {
  * stored value against the calculated one. Additionally, the frame's 
  * preamble property allows for device handshake communication.
  * 
- * The `preamble` states the protocol of the packet. The MSB must be zero (0).
+ * The `preamble` states the protocol of the packet, one byte.
  *  Null = 0x00
  *  Data packet = 0x01
  *  ARP Request packet = 0x02
  *  ARP Response packet = 0x03
+ *  Stream packet = 0x06, see stream.h
+ *  Ping Request packet = 0x07, see timesync.h
+ *  Ping Response packet = 0x08
  * 
  * The `destinationAddress` denotes the destination device for the packet. 
  *  0x00 = A catch all address, first receiving device to respond
@@ -53,14 +60,24 @@ enum class Preamble : uint16_t {
  * The `frameTotal` denotes the total amount of packets required to complete
  * a message.
  * 
- * The `payload` includes the part or whole of the message data up to 47 bytes
+ * The `payloadLength` denotes the bytes of the payload in use, 1 - 50. Zero (0)
+ * means the whole payload, as sent by devices before it was introduced, when it was
+ * the zero high byte of a 16 bit `preamble`. Only the last frame of a message has
+ * a payload shorter than 50 bytes.
+ * 
+ * The `payload` includes the part or whole of the message data up to 50 bytes
  * for the single packet.
  * 
- * The `crc` includes the checksum of the payload.
+ * The `crc` includes the checksum of the frame.
+ *
+ * In memory the frame is the 64 byte USB layout, little endian with no padding, and
+ * transports exchanging it as is send that layout. Transports which send only the
+ * payload in use serialize the frame explicitly, see wire.h.
  */
 
 struct Frame {
     Preamble preamble = Preamble::NA;
+    uint8_t payloadLength = 0;
     uint8_t destinationAddress = 0x01;
     uint8_t sourceAddress;
     uint32_t frameID;
@@ -69,5 +86,18 @@ struct Frame {
     uint8_t payload[50] = {0};
     uint32_t crc;
 };
+
+static_assert(sizeof(Frame) == 64, "Frame must be the 64 byte USB layout");
+static_assert(offsetof(Frame, payloadLength) == 1 && offsetof(Frame, frameID) == 4 &&
+    offsetof(Frame, payload) == 10 && offsetof(Frame, crc) == 60, "Frame fields must be at their USB offsets");
+#if defined (__BYTE_ORDER__)
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "Frame is stored little endian");
+#endif
+
+/// The bytes of a frame's payload in use
+inline uint8_t payloadSize(const Frame& frame) {
+    return frame.payloadLength == 0 || frame.payloadLength > sizeof(Frame::payload) ?
+        sizeof(Frame::payload) : frame.payloadLength;
+}
 } // NAMESPACE
 #endif // FRAME_H
\ No newline at end of file
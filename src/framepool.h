@@ -0,0 +1,196 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <Arduino.h>
+#include "frame.h"
+
+namespace corelib {
+
+/**
+ * @brief The users of a FramePool, each with its own reservation and counts
+ */
+enum class PoolOwner : uint8_t {
+    // @brief Incoming fragments being reassembled and the receive buffer
+    RX = 0,
+    // @brief Outgoing messages waiting to be written
+    TX = 1,
+    // @brief Frames from other interfaces waiting to be written
+    RELAY = 2
+};
+
+static constexpr size_t PoolOwnerCount = static_cast<size_t>(PoolOwner::RELAY) + 1;
+
+/// Index of a frame in a FramePool
+typedef uint16_t FrameHandle;
+
+static constexpr FrameHandle NoFrame = 0xFFFF;
+
+/**
+ * @brief A fixed number of frames shared by the receive, transmit and relay paths of
+ * a Comm, handed out by index. Storage is given by StaticFramePool.
+ *
+ * Each owner may reserve frames. Reserved frames can only be taken by their owner, the
+ * rest are shared by whoever asks first. A burst of outgoing publishes then uses what
+ * is idle on the receive side, but never the frames a response or the next incoming
+ * message needs.
+ */
+class FramePool
+{
+public:
+    /**
+     * @brief Keeps frames for an owner, the reservations together must fit the pool
+     *
+     * @return false The reservation does not fit, it is unchanged
+     */
+    bool reserve(PoolOwner owner, size_t frames) {
+        size_t total = frames;
+        for(size_t i = 0; i < PoolOwnerCount; i++){
+            if(i != static_cast<size_t>(owner)){
+                total += reserved[i];
+            }
+        }
+        if(total > capacity){
+            return false;
+        }
+        reserved[static_cast<size_t>(owner)] = frames;
+        return true;
+    }
+
+    /**
+     * @brief Takes a frame for an owner
+     *
+     * @return FrameHandle The frame or NoFrame when the owner may not take one
+     */
+    FrameHandle acquire(PoolOwner owner) {
+        if(available(owner) == 0){
+            return NoFrame;
+        }
+        const FrameHandle handle = freeFrames[--freeCount];
+        const size_t index = static_cast<size_t>(owner);
+        if(++used[index] > highWaters[index]){
+            highWaters[index] = used[index];
+        }
+        if(capacity - freeCount > highWaterTotal){
+            highWaterTotal = capacity - freeCount;
+        }
+        return handle;
+    }
+
+    /**
+     * @brief Gives back a frame taken by acquire
+     */
+    void release(PoolOwner owner, FrameHandle handle) {
+        if(handle == NoFrame){
+            return;
+        }
+        used[static_cast<size_t>(owner)]--;
+        freeFrames[freeCount++] = handle;
+    }
+
+    /**
+     * @brief Frames the owner could take now, its own reservation then what is free
+     * beyond the frames reserved for the others
+     */
+    size_t available(PoolOwner owner) const {
+        size_t held = 0;
+        for(size_t i = 0; i < PoolOwnerCount; i++){
+            if(i != static_cast<size_t>(owner) && used[i] < reserved[i]){
+                held += reserved[i] - used[i];
+            }
+        }
+        return freeCount > held ? freeCount - held : 0;
+    }
+
+    Frame& operator[](FrameHandle handle) {
+        return frames[handle];
+    }
+
+    const Frame& operator[](FrameHandle handle) const {
+        return frames[handle];
+    }
+
+    /// The frames, for a MessageView over handles
+    const Frame* data() const {
+        return frames;
+    }
+
+    /// Frames held by an owner
+    size_t size(PoolOwner owner) const {
+        return used[static_cast<size_t>(owner)];
+    }
+
+    /// Frames held by all owners
+    size_t size() const {
+        return capacity - freeCount;
+    }
+
+    size_t max_size() const {
+        return capacity;
+    }
+
+    /// Most frames an owner held at once
+    size_t highWater(PoolOwner owner) const {
+        return highWaters[static_cast<size_t>(owner)];
+    }
+
+    /// Most frames held at once
+    size_t highWater() const {
+        return highWaterTotal;
+    }
+
+    void resetHighWater() {
+        for(size_t i = 0; i < PoolOwnerCount; i++){
+            highWaters[i] = used[i];
+        }
+        highWaterTotal = size();
+    }
+
+protected:
+    FramePool(Frame* frames, FrameHandle* freeFrames, size_t capacity) :
+        frames(frames), freeFrames(freeFrames), capacity(capacity), freeCount(0) {}
+
+    // Fills the free stack once the storage exists, handing out low handles first
+    void fill() {
+        freeCount = 0;
+        for(size_t i = capacity; i > 0; i--){
+            freeFrames[freeCount++] = i - 1;
+        }
+    }
+
+    // The pool is shared by reference, copies would hand out the same frames
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+private:
+    Frame* frames;
+    // @brief Stack of unused frames
+    FrameHandle* freeFrames;
+    uint16_t capacity;
+    uint16_t freeCount;
+    uint16_t reserved[PoolOwnerCount] = {0};
+    uint16_t used[PoolOwnerCount] = {0};
+    uint16_t highWaters[PoolOwnerCount] = {0};
+    uint16_t highWaterTotal = 0;
+};
+
+/**
+ * @brief A FramePool with its storage
+ *
+ * @tparam Capacity Number of frames (max 65534)
+ */
+template<size_t Capacity>
+class StaticFramePool : public FramePool
+{
+    static_assert(Capacity > 0 && Capacity < NoFrame, "StaticFramePool supports 1 to 65534 frames");
+
+public:
+    StaticFramePool() : FramePool(storage, freeStorage, Capacity) {
+        fill();
+    }
+
+private:
+    Frame storage[Capacity];
+    FrameHandle freeStorage[Capacity];
+};
+} // NAMESPACE
+#endif // FRAMEPOOL_H
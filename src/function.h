@@ -24,7 +24,7 @@ protected:
     /// Called during setup
     virtual void performInitialise() = 0;
 
-    /// Called every x Hz selected by setting the variable
+    /// Called by the main loop, or at a fixed rate when registered with a Scheduler
     virtual void performIterate() = 0;
 
 };
@@ -0,0 +1,151 @@
+#ifndef INTEGRITY_H
+#define INTEGRITY_H
+
+#include <Arduino.h>
+#include <FastCRC.h>
+
+namespace corelib {
+
+/**
+ * Integrity policies compute the check value stored in `Frame::crc`. Every policy
+ * which is enabled produces the standard CRC-32 (reflected 0xEDB88320, initial and
+ * final xor 0xFFFFFFFF) used by the frame wire format, so the policies only differ
+ * in speed and flash usage.
+ *
+ * A policy provides:
+ *  `static constexpr bool enabled` - false when the frame check is skipped
+ *  `uint32_t compute(const uint8_t* data, size_t length)`
+ */
+
+/**
+ * @brief CRC-32 using the FastCRC library, hardware accelerated on boards with a
+ * CRC peripheral (Teensy 3.x). The default policy.
+ */
+class FastCrc32Integrity
+{
+public:
+    static constexpr bool enabled = true;
+
+    uint32_t compute(const uint8_t* data, size_t length) {
+        return crc.crc32(data, length);
+    }
+
+private:
+    FastCRC32 crc;
+};
+
+/**
+ * @brief Eight lookup tables of 256 entries (8 KiB), generated at compile time
+ */
+struct Crc32SliceTables {
+    uint32_t table[8][256];
+
+    constexpr Crc32SliceTables() : table() {
+        for(uint32_t i = 0; i < 256; i++){
+            uint32_t crc = i;
+            for(uint8_t bit = 0; bit < 8; bit++){
+                crc = (crc >> 1) ^ (0xEDB88320UL & (0UL - (crc & 1)));
+            }
+            table[0][i] = crc;
+        }
+        for(uint32_t i = 0; i < 256; i++){
+            for(uint8_t slice = 1; slice < 8; slice++){
+                const uint32_t previous = table[slice - 1][i];
+                table[slice][i] = (previous >> 8) ^ table[0][previous & 0xFF];
+            }
+        }
+    }
+};
+
+/**
+ * @brief A single lookup table of 16 entries (64 bytes), generated at compile time
+ */
+struct Crc32NibbleTable {
+    uint32_t table[16];
+
+    constexpr Crc32NibbleTable() : table() {
+        for(uint32_t i = 0; i < 16; i++){
+            uint32_t crc = i;
+            for(uint8_t bit = 0; bit < 4; bit++){
+                crc = (crc >> 1) ^ (0xEDB88320UL & (0UL - (crc & 1)));
+            }
+            table[i] = crc;
+        }
+    }
+};
+
+// Holds the tables as templated statics so the header can define them once
+template<typename T = void>
+struct Crc32Tables {
+    static constexpr Crc32SliceTables slices{};
+    static constexpr Crc32NibbleTable nibbles{};
+};
+template<typename T> constexpr Crc32SliceTables Crc32Tables<T>::slices;
+template<typename T> constexpr Crc32NibbleTable Crc32Tables<T>::nibbles;
+
+/**
+ * @brief Table driven CRC-32 processing 8 bytes per step (slice-by-8). The fastest
+ * software policy on boards with flash to spare for its 8 KiB table.
+ */
+class Crc32SliceBy8
+{
+public:
+    static constexpr bool enabled = true;
+
+    uint32_t compute(const uint8_t* data, size_t length) {
+        const uint32_t (&t)[8][256] = Crc32Tables<>::slices.table;
+        uint32_t crc = 0xFFFFFFFFUL;
+        while(length >= 8){
+            // Assemble words byte by byte, the result does not depend on endianness or alignment
+            const uint32_t one = crc ^ (data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24));
+            const uint32_t two = data[4] | (data[5] << 8) | (data[6] << 16) | (static_cast<uint32_t>(data[7]) << 24);
+            crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+                  t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+            data += 8;
+            length -= 8;
+        }
+        while(length--){
+            crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF];
+        }
+        return ~crc;
+    }
+};
+
+/**
+ * @brief CRC-32 processing 4 bits per step from a 64 byte table, for flash constrained
+ * boards such as the Teensy LC.
+ */
+class Crc32Nibble
+{
+public:
+    static constexpr bool enabled = true;
+
+    uint32_t compute(const uint8_t* data, size_t length) {
+        const uint32_t (&t)[16] = Crc32Tables<>::nibbles.table;
+        uint32_t crc = 0xFFFFFFFFUL;
+        while(length--){
+            crc = (crc >> 4) ^ t[(crc ^ *data) & 0x0F];
+            crc = (crc >> 4) ^ t[(crc ^ (*data >> 4)) & 0x0F];
+            data++;
+        }
+        return ~crc;
+    }
+};
+
+/**
+ * @brief Skips the frame check, for transports which already guarantee integrity
+ * (e.g. CAN). Outgoing frames carry a zero crc and incoming crcs are not checked.
+ */
+class NoIntegrity
+{
+public:
+    static constexpr bool enabled = false;
+
+    uint32_t compute(const uint8_t* data, size_t length) {
+        (void) data;
+        (void) length;
+        return 0;
+    }
+};
+} // NAMESPACE
+#endif // INTEGRITY_H
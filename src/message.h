@@ -0,0 +1,139 @@
+#ifndef MESSAGE_H
+#define MESSAGE_H
+
+#include <Arduino.h>
+#include "frame.h"
+
+#include <pb_decode.h>
+
+namespace corelib {
+
+/**
+ * @brief A read-only view of a reassembled message, valid while its handler runs.
+ *
+ * The payloads stay in the frames the transport read them into, so a message of
+ * several fragments is not contiguous in memory. The view walks the fragments in
+ * order, either byte-wise, by copying them out, or through a nanopb input stream.
+ */
+class MessageView
+{
+public:
+    static constexpr size_t FragmentSize = sizeof(Frame::payload);
+
+    MessageView() {}
+
+    /**
+     * @param frames The frame storage the fragment indexes refer to
+     * @param fragments Index of the frame holding each fragment, in order
+     * @param fragmentCount Number of fragments in the message
+     */
+    MessageView(const Frame* frames, const uint16_t* fragments, uint8_t fragmentCount) :
+        frames(frames), fragments(fragments), count(fragmentCount) {}
+
+    /// Number of fragments
+    uint8_t fragmentCount() const {
+        return count;
+    }
+
+    /// The payload of a fragment, 0 based
+    const uint8_t* fragment(uint8_t fragmentIndex) const {
+        return frames[fragments[fragmentIndex]].payload;
+    }
+
+    /// The frame a fragment arrived in
+    const Frame& frame(uint8_t fragmentIndex) const {
+        return frames[fragments[fragmentIndex]];
+    }
+
+    /// The message length in bytes, the last fragment may be shorter, see Frame::payloadLength
+    size_t size() const {
+        return count == 0 ? 0 : (count - 1) * FragmentSize + payloadSize(frame(count - 1));
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    /// The byte at an offset of the message
+    uint8_t at(size_t offset) const {
+        return fragment(offset / FragmentSize)[offset % FragmentSize];
+    }
+
+    /**
+     * @brief Copies the message into a contiguous buffer
+     *
+     * @return size_t The number of bytes copied, at most `length`
+     */
+    size_t copyTo(uint8_t* destination, size_t length) const {
+        const size_t total = size();
+        if(length > total){
+            length = total;
+        }
+        size_t copied = 0;
+        for(uint8_t i = 0; i < count && copied < length; i++){
+            const size_t part = length - copied < FragmentSize ? length - copied : FragmentSize;
+            memcpy(destination + copied, fragment(i), part);
+            copied += part;
+        }
+        return copied;
+    }
+
+    /**
+     * @brief A nanopb input stream over the message. A single fragment is read
+     * directly, otherwise the stream walks the fragments through this view, which
+     * must outlive the stream. Creating a new stream restarts the previous one.
+     */
+    pb_istream_t istream() const {
+        if(count == 1){
+            return pb_istream_from_buffer(fragment(0), size());
+        }
+        cursor.fragment = 0;
+        cursor.offset = 0;
+        pb_istream_t stream;
+        stream.callback = &MessageView::read;
+        stream.state = const_cast<MessageView*>(this);
+        stream.bytes_left = size();
+        #ifndef PB_NO_ERRMSG
+        stream.errmsg = NULL;
+        #endif
+        return stream;
+    }
+
+private:
+    const Frame* frames = nullptr;
+    const uint16_t* fragments = nullptr;
+    uint8_t count = 0;
+
+    // @brief Read position of the stream
+    struct Cursor {
+        uint8_t fragment = 0;
+        uint8_t offset = 0;
+    };
+    mutable Cursor cursor;
+
+    // nanopb stream callback, copies (or skips when buf is NULL) across fragment boundaries
+    static bool read(pb_istream_t* stream, pb_byte_t* buf, size_t length) {
+        const MessageView* view = static_cast<const MessageView*>(stream->state);
+        Cursor& cursor = view->cursor;
+        while(length > 0){
+            if(cursor.fragment >= view->count){
+                return false;
+            }
+            const size_t available = FragmentSize - cursor.offset;
+            const size_t part = length < available ? length : available;
+            if(buf != NULL){
+                memcpy(buf, view->fragment(cursor.fragment) + cursor.offset, part);
+                buf += part;
+            }
+            length -= part;
+            cursor.offset += part;
+            if(cursor.offset == FragmentSize){
+                cursor.fragment++;
+                cursor.offset = 0;
+            }
+        }
+        return true;
+    }
+};
+} // NAMESPACE
+#endif // MESSAGE_H
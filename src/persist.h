@@ -0,0 +1,404 @@
+#ifndef PERSIST_H
+#define PERSIST_H
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "function.h"
+#include "integrity.h"
+#include "shares.h"
+
+#include <pb_decode.h>
+#include <pb_encode.h>
+
+namespace corelib {
+
+/**
+ * @brief Storage on the Arduino EEPROM, eeprom-fake on native. A write of a byte which
+ * already holds the value is skipped.
+ *
+ * A storage provides:
+ *  `uint8_t read(size_t address)`
+ *  `void write(size_t address, uint8_t value)`
+ *  `size_t size()` - the bytes of storage
+ */
+class EepromStorage
+{
+public:
+    uint8_t read(size_t address) {
+        return EEPROM.read(address);
+    }
+
+    void write(size_t address, uint8_t value) {
+        EEPROM.update(address, value);
+    }
+
+    size_t size() {
+        return EEPROM.length();
+    }
+};
+
+// @brief First byte of a persisted record
+static constexpr uint8_t PersistMarker = 0x5C;
+// @brief Record bytes before the data, marker, share id, sequence and data length
+static constexpr size_t PersistHeaderSize = 7;
+static constexpr size_t PersistCrcSize = 4;
+
+/**
+ * @brief Keeps registered shares in storage, saving those which changed a few bytes
+ * at a time from performIterate and loading them all again at initialise.
+ *
+ * The region is a ring of fixed size slots, each holding one record
+ *
+ *  byte  0      PersistMarker
+ *  byte  1      share id
+ *  bytes 2-5    sequence, one more than the record written before it
+ *  byte  6      data length
+ *  bytes 7-     the share, protobuf encoded
+ *  last 4 bytes CRC-32 of the bytes before it
+ *
+ * A record goes into the next slot of the ring which does not hold a share's latest
+ * record, so the writes move around the whole region and the latest record of every
+ * share survives a record cut short by a power loss, the cut record fails its crc.
+ * Loading takes the valid record with the highest sequence of each share.
+ *
+ * A share marked dirty is saved once it has been dirty for holdoff iterations, so a
+ * burst of changes is one write. It is compared with a RAM shadow of its last record
+ * first, a change which was undone is not written. The write budget bounds the bytes
+ * written each iteration, an EEPROM byte taking milliseconds to write on some boards.
+ *
+ *  CommStats2 tuning;
+ *  EepromStorage eeprom;
+ *  SharePersistence<8> persist(eeprom, 0, 1024);
+ *  persist.addShare<CommStats2_size>(3, tuning, CommStats2_fields);
+ *  shares.addShare<CommStats2_size>(3, tuning, CommStats2_fields, persist.hook());
+ *  persist.initialise(); // loads tuning
+ *
+ * @tparam Shares Number of share ids, shares use ids 0 to Shares - 1
+ * @tparam RecordData Largest encoded share
+ * @tparam Storage The storage, see EepromStorage
+ * @tparam Integrity The record check, see integrity.h
+ */
+template<size_t Shares, size_t RecordData = 64, typename Storage = EepromStorage, typename Integrity = Crc32Nibble>
+class SharePersistence : public Function
+{
+    static_assert(Shares > 0 && Shares <= 0xFF, "SharePersistence supports 1 to 255 shares");
+    static_assert(RecordData <= 0xFF, "Persisted shares are at most 255 bytes");
+
+public:
+    static constexpr size_t SlotSize = PersistHeaderSize + RecordData + PersistCrcSize;
+    static constexpr size_t NoSlot = SIZE_MAX;
+
+    /**
+     * @param storage Holds the records, it must outlive the persistence
+     * @param start The first byte of the region
+     * @param size The bytes of the region, room for more slots than shares
+     */
+    SharePersistence(Storage& storage, size_t start, size_t size) : storage(storage), start(start),
+        slots(size / SlotSize) {}
+
+    /**
+     * @brief Registers a share, before initialise
+     *
+     * @tparam EncodedSize The largest encoding of the share, its nanopb `<Message>_size`
+     * @return false The id is out of range or already registered
+     */
+    template<size_t EncodedSize, typename T>
+    bool addShare(uint32_t shareId, T& share, const pb_msgdesc_t* fields) {
+        static_assert(EncodedSize <= RecordData, "A persisted share must fit a record");
+        if(shareId >= Shares || entries[shareId].data != nullptr){
+            return false;
+        }
+        entries[shareId] = Entry();
+        entries[shareId].data = &share;
+        entries[shareId].fields = fields;
+        return true;
+    }
+
+    /**
+     * @brief Sets how writes are paced
+     *
+     * @param bytesPerIteration Bytes written each iteration at most
+     * @param holdoff Iterations a share is dirty before it is saved
+     */
+    void setPacing(size_t bytesPerIteration, uint32_t holdoff) {
+        budget = bytesPerIteration > 0 ? bytesPerIteration : 1;
+        holdoffIterations = holdoff;
+    }
+
+    /// Saves a share which changed, see the holdoff
+    void markDirty(uint32_t shareId) {
+        if(shareId < Shares && entries[shareId].data != nullptr && !entries[shareId].dirty){
+            entries[shareId].dirty = true;
+            entries[shareId].dirtyAt = iteration;
+        }
+    }
+
+    bool dirty(uint32_t shareId) const {
+        return shareId < Shares && entries[shareId].dirty;
+    }
+
+    /// True while a share is dirty or a record is being written
+    bool busy() const {
+        if(writing){
+            return true;
+        }
+        for(const Entry& entry : entries){
+            if(entry.dirty){
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief A ShareHook which marks a share dirty when the host publishes it, to give
+     * ShareRegistry::addShare
+     */
+    ShareHook hook() {
+        return ShareHook::create<SharePersistence, &SharePersistence::published>(*this);
+    }
+
+    /**
+     * @brief Writes every dirty share now, without the budget or holdoff, e.g. before
+     * a reset. Nothing is written before initialise, the records are not loaded yet.
+     */
+    void flush() {
+        if(!initialised){
+            return;
+        }
+        while(busy()){
+            if(!writing && !stageNext(true)){
+                break;
+            }
+            writeStaged(SIZE_MAX);
+        }
+    }
+
+    /// True when the share was found in storage at initialise
+    bool loaded(uint32_t shareId) const {
+        return shareId < Shares && entries[shareId].slot != NoSlot;
+    }
+
+    /// Records written since initialise
+    uint32_t recordsWritten() const {
+        return records;
+    }
+
+    /// Slots of the region
+    size_t slotCount() const {
+        return slots;
+    }
+
+protected:
+    // Function.h interface
+    void performInitialise() {
+        initialised = slots > Shares;
+        if(initialised){
+            load();
+        }
+    }
+
+    void performIterate() {
+        if(!initialised){
+            return;
+        }
+        iteration++;
+        if(!writing && !stageNext(false)){
+            return;
+        }
+        writeStaged(budget);
+    }
+
+private:
+    struct Entry {
+        void* data = nullptr;
+        const pb_msgdesc_t* fields = nullptr;
+        bool dirty = false;
+        uint32_t dirtyAt = 0;
+        // @brief Slot of the latest record, NoSlot when there is none
+        size_t slot = NoSlot;
+        // @brief The data of the latest record
+        uint8_t shadow[RecordData];
+        uint8_t length = 0;
+    };
+
+    Storage& storage;
+    Integrity integrity;
+    bool initialised = false;
+    size_t start;
+    size_t slots;
+    Entry entries[Shares];
+    uint32_t iteration = 0;
+    size_t budget = 16;
+    uint32_t holdoffIterations = 100;
+    uint32_t records = 0;
+    // @brief Sequence and slot of the next record
+    uint32_t sequence = 0;
+    size_t head = 0;
+    // @brief The record being written
+    bool writing = false;
+    uint8_t staged[SlotSize];
+    size_t stagedLength = 0;
+    size_t stagedSlot = 0;
+    size_t written = 0;
+    uint8_t stagedShare = 0;
+
+    void published(uint32_t shareId, TransactionMessage_Action action) {
+        if(action == TransactionMessage_Action_SHARE_PUBLISH){
+            markDirty(shareId);
+        }
+    }
+
+    size_t address(size_t slot) const {
+        return start + slot * SlotSize;
+    }
+
+    // Takes the latest valid record of each share from the region
+    void load() {
+        uint32_t newest = 0;
+        bool found = false;
+        uint32_t latest[Shares] = {0};
+        for(size_t slot = 0; slot < slots; slot++){
+            uint8_t record[SlotSize];
+            uint32_t recordSequence;
+            if(!readRecord(slot, record, recordSequence)){
+                continue;
+            }
+            const uint8_t shareId = record[1];
+            if(!found || static_cast<int32_t>(recordSequence - newest) > 0){
+                newest = recordSequence;
+                head = slot;
+                found = true;
+            }
+            if(shareId >= Shares || entries[shareId].data == nullptr){
+                continue;
+            }
+            Entry& entry = entries[shareId];
+            if(entry.slot == NoSlot || static_cast<int32_t>(recordSequence - latest[shareId]) > 0){
+                entry.slot = slot;
+                entry.length = record[6];
+                memcpy(entry.shadow, record + PersistHeaderSize, entry.length);
+                latest[shareId] = recordSequence;
+            }
+        }
+        if(found){
+            sequence = newest + 1;
+            head = (head + 1) % slots;
+        }
+        for(Entry& entry : entries){
+            if(entry.slot == NoSlot){
+                continue;
+            }
+            pb_istream_t stream = pb_istream_from_buffer(entry.shadow, entry.length);
+            if(!pb_decode(&stream, entry.fields, entry.data)){
+                // Saved by firmware with another layout, saved again as it is now
+                entry.length = 0;
+                markDirty(&entry - entries);
+            }
+        }
+    }
+
+    // Reads the record in a slot, false when it is not a whole record
+    bool readRecord(size_t slot, uint8_t* record, uint32_t& recordSequence) {
+        const size_t base = address(slot);
+        record[0] = storage.read(base);
+        if(record[0] != PersistMarker){
+            return false;
+        }
+        for(size_t i = 1; i < PersistHeaderSize; i++){
+            record[i] = storage.read(base + i);
+        }
+        const uint8_t length = record[6];
+        if(length > RecordData){
+            return false;
+        }
+        const size_t checked = PersistHeaderSize + length;
+        for(size_t i = PersistHeaderSize; i < checked + PersistCrcSize; i++){
+            record[i] = storage.read(base + i);
+        }
+        const uint32_t crc = record[checked] | (record[checked + 1] << 8) | (record[checked + 2] << 16) |
+            (static_cast<uint32_t>(record[checked + 3]) << 24);
+        if(integrity.compute(record, checked) != crc){
+            return false;
+        }
+        recordSequence = record[2] | (record[3] << 8) | (record[4] << 16) | (static_cast<uint32_t>(record[5]) << 24);
+        return true;
+    }
+
+    // The next slot not holding the latest record of a share
+    size_t freeSlot() const {
+        size_t slot = head;
+        while(true){
+            bool live = false;
+            for(const Entry& entry : entries){
+                live |= entry.slot == slot;
+            }
+            if(!live){
+                return slot;
+            }
+            slot = (slot + 1) % slots;
+        }
+    }
+
+    // Stages the record of the next share due, false when none is
+    bool stageNext(bool now) {
+        for(size_t shareId = 0; shareId < Shares; shareId++){
+            Entry& entry = entries[shareId];
+            if(!entry.dirty || (!now && iteration - entry.dirtyAt < holdoffIterations)){
+                continue;
+            }
+            entry.dirty = false;
+            uint8_t* data = staged + PersistHeaderSize;
+            pb_ostream_t stream = pb_ostream_from_buffer(data, RecordData);
+            if(!pb_encode(&stream, entry.fields, entry.data)){
+                continue;
+            }
+            const uint8_t length = stream.bytes_written;
+            if(entry.slot != NoSlot && length == entry.length && memcmp(data, entry.shadow, length) == 0){
+                // Changed back to what is saved
+                continue;
+            }
+            staged[0] = PersistMarker;
+            staged[1] = shareId;
+            staged[2] = sequence & 0xFF;
+            staged[3] = (sequence >> 8) & 0xFF;
+            staged[4] = (sequence >> 16) & 0xFF;
+            staged[5] = sequence >> 24;
+            staged[6] = length;
+            const uint32_t crc = integrity.compute(staged, PersistHeaderSize + length);
+            uint8_t* check = data + length;
+            check[0] = crc & 0xFF;
+            check[1] = (crc >> 8) & 0xFF;
+            check[2] = (crc >> 16) & 0xFF;
+            check[3] = crc >> 24;
+            stagedLength = PersistHeaderSize + length + PersistCrcSize;
+            stagedSlot = freeSlot();
+            stagedShare = shareId;
+            written = 0;
+            writing = true;
+            return true;
+        }
+        return false;
+    }
+
+    // Writes up to limit bytes of the staged record, the record counts once all are
+    void writeStaged(size_t limit) {
+        const size_t base = address(stagedSlot);
+        for(size_t i = 0; i < limit && written < stagedLength; i++, written++){
+            storage.write(base + written, staged[written]);
+        }
+        if(written < stagedLength){
+            return;
+        }
+        Entry& entry = entries[stagedShare];
+        entry.slot = stagedSlot;
+        entry.length = staged[6];
+        memcpy(entry.shadow, staged + PersistHeaderSize, entry.length);
+        sequence++;
+        head = (stagedSlot + 1) % slots;
+        records++;
+        writing = false;
+    }
+};
+} // NAMESPACE
+#endif // PERSIST_H
@@ -0,0 +1,342 @@
+#ifndef PUBLISHER_H
+#define PUBLISHER_H
+
+#include <Arduino.h>
+#include "frame.h"
+#include "comm.h"
+#include "shares.h"
+#include "states.h"
+
+#include <etl/delegate.h>
+
+#include "transaction.pb.h"
+
+#if defined (NATIVE)
+#include <chrono>
+#endif
+
+namespace corelib {
+
+/**
+ * @brief Counters of a subscription
+ */
+struct PublishStats {
+    // @brief Publishes sent
+    uint32_t published = 0;
+    // @brief Publishes replaced by a later value before they could be sent
+    uint32_t dropped = 0;
+    // @brief Publishes the share could not be encoded for
+    uint32_t failed = 0;
+    // @brief Achieved publishes per 1000 seconds since subscribing
+    uint32_t rate = 0;
+};
+
+/**
+ * @brief The Publisher pushes shares to the host as SHARE_PUBLISH at the rate the host
+ * subscribed them at, so live values need not be polled.
+ *
+ * The host subscribes a share with SHARE_SUBSCRIBE, its data a Subscription1 giving the
+ * period, and cancels it with a period of 0. Each subscription is due once a period and
+ * publishes are sent from the Comm's iteration, one at a time when there is room, within
+ * a bandwidth budget. A publish is encoded from the share when it is sent, so a share
+ * which is due again before its last publish could be sent is sent once with its latest
+ * value, the replaced publish is counted as dropped. Publishes carry a sequence number
+ * in their token. A publish is charged the frames it is written in, so shares published
+ * as deltas (see ShareRegistry::trackDelta) are sent more often within the same budget.
+ *
+ *  ShareRegistry<8> shares;
+ *  Publisher<ShareRegistry<8>> publisher(shares, 4000); // 4000 bytes per second
+ *  shares.attach(usb);
+ *  publisher.attach(usb);
+ *
+ * @tparam Registry The ShareRegistry the shares are encoded by
+ * @tparam Subscriptions Maximum number of subscriptions
+ */
+template<typename Registry, size_t Subscriptions = 8>
+class Publisher
+{
+public:
+    typedef etl::delegate<uint32_t()> Clock;
+
+    // @brief Bytes written for a publish at most, a full TransactionMessage in frames
+    static constexpr uint32_t PublishCost =
+        (TransactionMessage_size + sizeof(Frame::payload) - 1) / sizeof(Frame::payload) * sizeof(Frame);
+
+    /**
+     * @param registry Encodes the shares
+     * @param budget Bytes per second publishes may use
+     * @param clock Returns the time in milliseconds
+     */
+    Publisher(Registry& registry, uint32_t budget, Clock clock = Clock::template create<&Publisher::defaultClock>())
+        : registry(registry), clock(clock) {
+        setBudget(budget);
+    }
+
+    /**
+     * @brief Sets the bytes per second publishes may use. At most a tenth of a second
+     * of unused budget is saved up, so an idle period does not turn into a burst.
+     */
+    void setBudget(uint32_t bytesPerSecond) {
+        budget = bytesPerSecond;
+        const uint32_t saved = bytesPerSecond / 10;
+        capacity = saved > PublishCost ? saved : PublishCost;
+        credit = Milli * capacity;
+        lastRefill = clock();
+    }
+
+    /**
+     * @brief Subscribes a share, or changes the period of a subscription
+     *
+     * @param period Milliseconds between publishes, 0 cancels the subscription
+     * @return false The share is not registered or there is no room
+     */
+    bool subscribe(uint32_t shareId, uint32_t period) {
+        if(period == 0){
+            unsubscribe(shareId);
+            return true;
+        }
+        if(!registry.contains(shareId)){
+            return false;
+        }
+        Subscription* subscription = find(shareId);
+        if(subscription == nullptr){
+            subscription = find(NoShare);
+            if(subscription == nullptr){
+                return false;
+            }
+            *subscription = Subscription();
+            subscription->shareId = shareId;
+            subscription->since = clock();
+            subscription->due = subscription->since;
+        }
+        subscription->period = period;
+        return true;
+    }
+
+    /**
+     * @brief Cancels a subscription
+     *
+     * @return false The share was not subscribed
+     */
+    bool unsubscribe(uint32_t shareId) {
+        Subscription* subscription = find(shareId);
+        if(subscription == nullptr){
+            return false;
+        }
+        *subscription = Subscription();
+        return true;
+    }
+
+    void clear() {
+        for(size_t i = 0; i < Subscriptions; i++){
+            subscriptions[i] = Subscription();
+        }
+    }
+
+    /// Number of subscriptions
+    size_t size() const {
+        size_t count = 0;
+        for(size_t i = 0; i < Subscriptions; i++){
+            count += subscriptions[i].shareId != NoShare;
+        }
+        return count;
+    }
+
+    /**
+     * @brief The counters of a subscription
+     *
+     * @return false The share is not subscribed
+     */
+    bool getStats(uint32_t shareId, PublishStats& stats) const {
+        const Subscription* subscription = find(shareId);
+        if(subscription == nullptr){
+            return false;
+        }
+        stats = subscription->stats;
+        const uint32_t elapsed = clock() - subscription->since;
+        stats.rate = elapsed == 0 ? 0 : static_cast<uint64_t>(stats.published) * 1000000ULL / elapsed;
+        return true;
+    }
+
+    /**
+     * @brief Applies a SHARE_SUBSCRIBE, see ShareRegistry::setSubscribeCallback
+     */
+    bool handleSubscription(uint32_t shareId, Subscription1& request) {
+        PublishStats stats;
+        (void) getStats(shareId, stats);
+        if(!subscribe(shareId, request.period)){
+            return false;
+        }
+        request.published = stats.published;
+        request.dropped = stats.dropped;
+        request.rate = stats.rate;
+        return true;
+    }
+
+    /**
+     * @brief Encodes the next publish, when one is due and the budget allows
+     *
+     * @param out Receives the encoded SHARE_PUBLISH
+     * @param length Set to the length of the publish, 0 when there is none
+     * @return true A publish was encoded
+     */
+    bool publish(uint8_t* out, size_t size, size_t& length) {
+        length = 0;
+        const uint32_t now = clock();
+        refill(now);
+        for(size_t i = 0; i < Subscriptions; i++){
+            if(subscriptions[i].shareId != NoShare){
+                mark(subscriptions[i], now);
+            }
+        }
+        Subscription* next = nullptr;
+        while(true){
+            next = oldestPending();
+            if(next == nullptr || credit < Milli * PublishCost){
+                return false;
+            }
+            if(registry.encodePublish(next->shareId, sequence, out, size, length) == HandleMessageState::OK){
+                break;
+            }
+            length = 0;
+            if(!registry.contains(next->shareId)){
+                // The share is no longer registered
+                *next = Subscription();
+            }else{
+                // Given up until it is due again, so it does not hold up the others
+                next->pending = false;
+                next->stats.failed++;
+            }
+        }
+        sequence++;
+        const uint32_t frames = (length + sizeof(Frame::payload) - 1) / sizeof(Frame::payload);
+        credit -= Milli * frames * sizeof(Frame);
+        next->pending = false;
+        next->stats.published++;
+        return true;
+    }
+
+    /**
+     * @brief Comm publish callback, see attach
+     */
+    template<typename TBuffer>
+    bool publishMessage(TBuffer* buffer) {
+        size_t length = 0;
+        if(!publish(buffer->outBuffer, sizeof(buffer->outBuffer), length)){
+            return false;
+        }
+        buffer->outMessageLength = length;
+        return true;
+    }
+
+    /**
+     * @brief Sends the publishes on a Comm and takes subscriptions from its registry.
+     * The registry answers the Comm's transactions, see ShareRegistry::attach.
+     */
+    template<typename Config, typename Integrity>
+    void attach(BasicComm<Config, Integrity>& comm) {
+        typedef typename BasicComm<Config, Integrity>::Buffer TBuffer;
+        comm.setPublishCallback(
+            etl::delegate<bool(TBuffer*)>::template create<Publisher, &Publisher::template publishMessage<TBuffer>>(*this));
+        registry.setSubscribeCallback(SubscribeHook::create<Publisher, &Publisher::handleSubscription>(*this));
+    }
+
+private:
+    static constexpr uint32_t NoShare = 0xFFFFFFFFUL;
+    static constexpr uint64_t Milli = 1000;
+
+    struct Subscription {
+        uint32_t shareId = NoShare;
+        uint32_t period = 0;
+        // @brief Time the next publish is due
+        uint32_t due = 0;
+        // @brief Time the subscription was made, the base of the achieved rate
+        uint32_t since = 0;
+        // @brief A publish is waiting for room or budget, since when
+        bool pending = false;
+        uint32_t pendingSince = 0;
+        PublishStats stats;
+    };
+
+    Registry& registry;
+    Subscription subscriptions[Subscriptions];
+    Clock clock;
+    uint32_t budget = 0;
+    // @brief Thousandths of a byte which may be written now, at most capacity bytes
+    uint64_t credit = 0;
+    uint32_t capacity = 0;
+    uint32_t lastRefill = 0;
+    uint32_t sequence = 0;
+
+    // The default clock, milliseconds
+    static uint32_t defaultClock() {
+        #if defined (NATIVE)
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+        #else
+        return ::millis();
+        #endif
+    }
+
+    Subscription* find(uint32_t shareId) {
+        for(size_t i = 0; i < Subscriptions; i++){
+            if(subscriptions[i].shareId == shareId){
+                return &subscriptions[i];
+            }
+        }
+        return nullptr;
+    }
+
+    const Subscription* find(uint32_t shareId) const {
+        return const_cast<Publisher*>(this)->find(shareId);
+    }
+
+    // The pending subscription waiting longest, or nullptr
+    Subscription* oldestPending() {
+        Subscription* oldest = nullptr;
+        for(size_t i = 0; i < Subscriptions; i++){
+            Subscription& subscription = subscriptions[i];
+            // Wrap safe comparison of time
+            if(subscription.shareId != NoShare && subscription.pending &&
+               (oldest == nullptr || static_cast<int32_t>(subscription.pendingSince - oldest->pendingSince) < 0)){
+                oldest = &subscription;
+            }
+        }
+        return oldest;
+    }
+
+    // Adds the budget earned since the last refill
+    void refill(uint32_t now) {
+        uint32_t elapsed = now - lastRefill;
+        lastRefill = now;
+        if(elapsed > 1000){
+            elapsed = 1000;
+        }
+        credit += static_cast<uint64_t>(elapsed) * budget;
+        if(credit > Milli * capacity){
+            credit = Milli * capacity;
+        }
+    }
+
+    // Makes a subscription pending when due, a publish still pending is replaced
+    void mark(Subscription& subscription, uint32_t now) {
+        if(static_cast<int32_t>(now - subscription.due) < 0){
+            return;
+        }
+        if(subscription.pending){
+            subscription.stats.dropped++;
+        }else{
+            subscription.pending = true;
+            subscription.pendingSince = subscription.due;
+        }
+        subscription.due += subscription.period;
+        if(static_cast<int32_t>(now - subscription.due) >= 0){
+            // Periods which passed without an iteration are replaced by this one
+            const uint32_t behind = (now - subscription.due) / subscription.period + 1;
+            subscription.stats.dropped += behind;
+            subscription.due += behind * subscription.period;
+        }
+    }
+};
+} // NAMESPACE
+#endif // PUBLISHER_H
@@ -0,0 +1,414 @@
+#ifndef REASSEMBLER_H
+#define REASSEMBLER_H
+
+#include <Arduino.h>
+#include "frame.h"
+#include "framepool.h"
+#include "message.h"
+
+namespace corelib {
+
+enum class ReassemblyState : uint8_t {
+    OK = 0,
+    COMPLETE = 1,
+    DUPLICATE = 2,
+    FULL = 3,
+    INVALID = 4
+};
+
+/**
+ * @brief The Reassembler collects the fragments (Frames) of incoming messages into
+ * a fixed number of slots keyed by the frame's (sourceAddress, frameID).
+ *
+ * A slot is found through a small open addressing index, so the lookup cost does not
+ * depend on the amount of messages in flight.
+ *
+ * Frames are taken from a FramePool as PoolOwner::RX, shared with the rest of the
+ * Comm. The transport reads the next frame straight into a pool frame (see
+ * receiveBuffer) and an accepted fragment is linked into its slot by frame order, so
+ * payloads are never copied. A pool of FrameCount frames is always enough, a smaller
+ * one runs out of frames to receive into before it runs out of slots. Arrivals are
+ * recorded in a bitmap and a message is complete when the bitmap matches the expected
+ * mask.
+ *
+ * Complete messages are queued in the order they completed and stay in their frames
+ * until released, a MessageView reads them in place.
+ *
+ * Slots also record when their last fragment arrived (in the caller's time base, e.g.
+ * iterations) so partial messages whose remaining fragments were lost can be evicted.
+ *
+ * @tparam Slots Number of messages which may be reassembled at the same time (max 32)
+ * @tparam MaxFragments Maximum number of frames per message (max 32)
+ */
+template<size_t Slots, size_t MaxFragments>
+class Reassembler
+{
+    static_assert(Slots > 0 && Slots <= 32, "Reassembler supports 1 to 32 slots");
+    static_assert(MaxFragments > 0 && MaxFragments <= 32, "Reassembler supports 1 to 32 fragments per message");
+
+public:
+    static constexpr size_t PayloadSize = sizeof(Frame::payload);
+    static constexpr size_t MessageSize = PayloadSize * MaxFragments;
+    // @brief Frames of a full set of slots plus the receive buffer
+    static constexpr size_t FrameCount = Slots * MaxFragments + 1;
+    static constexpr int NoSlot = -1;
+
+    /**
+     * @brief A single message being reassembled
+     */
+    struct Slot {
+        uint32_t frameID = 0;
+        // @brief Bitmap of received fragments, bit n is frameOrder n+1
+        uint32_t received = 0;
+        // @brief Bitmap which `received` must equal for the message to be complete
+        uint32_t expected = 0;
+        // @brief Time of the last accepted fragment
+        uint32_t lastArrival = 0;
+        // @brief Order of the last accepted fragment among all slots
+        uint32_t lastSequence = 0;
+        uint8_t sourceAddress = 0;
+        uint8_t frameTotal = 0;
+        // @brief Pool frame holding each received fragment
+        FrameHandle fragments[MaxFragments] = {0};
+    };
+
+    /**
+     * @param pool The frames of the reassembler, it must outlive the reassembler
+     */
+    explicit Reassembler(FramePool& pool) : pool(pool) {
+        clear();
+    }
+
+    /**
+     * @brief The pool frame the transport should read the next frame into (64 bytes).
+     * It is reused until a frame read into it is accepted by insert.
+     *
+     * @return uint8_t* The frame, nullptr while the pool has none to spare
+     */
+    uint8_t* receiveBuffer() {
+        if(receiving == NoFrame){
+            receiving = pool.acquire(PoolOwner::RX);
+            if(receiving == NoFrame){
+                return nullptr;
+            }
+        }
+        return reinterpret_cast<uint8_t*>(&pool[receiving]);
+    }
+
+    /**
+     * @brief The frame last read into the receive buffer
+     */
+    const Frame& received() const {
+        return pool[receiving];
+    }
+
+    /**
+     * @brief Copies a fragment into the receive buffer and stores it into its slot
+     *
+     * @param frame An incoming data frame
+     * @param now The current time, used to age partial messages
+     * @return ReassemblyState COMPLETE when this fragment completed the message
+     */
+    ReassemblyState insert(const Frame& frame, uint32_t now = 0) {
+        uint8_t* into = receiveBuffer();
+        if(into == nullptr){
+            return ReassemblyState::FULL;
+        }
+        if(&frame != &pool[receiving]){
+            pool[receiving] = frame;
+        }
+        return insert(now);
+    }
+
+    /**
+     * @brief Stores the frame in the receive buffer into its slot, without copying
+     *
+     * @param now The current time, used to age partial messages
+     * @return ReassemblyState COMPLETE when this fragment completed the message
+     */
+    ReassemblyState insert(uint32_t now = 0) {
+        if(receiving == NoFrame){
+            return ReassemblyState::FULL;
+        }
+        const Frame& frame = pool[receiving];
+        if(frame.frameTotal == 0 || frame.frameTotal > MaxFragments ||
+           frame.frameOrder == 0 || frame.frameOrder > frame.frameTotal){
+            return ReassemblyState::INVALID;
+        }
+        int index = find(frame.sourceAddress, frame.frameID);
+        if(index == NoSlot){
+            index = allocate(frame);
+            if(index == NoSlot){
+                return ReassemblyState::FULL;
+            }
+        }
+        Slot& slot = slots[index];
+        if(slot.frameTotal != frame.frameTotal){
+            return ReassemblyState::INVALID;
+        }
+        const uint32_t bit = 1UL << (frame.frameOrder - 1);
+        if(slot.received & bit){
+            return ReassemblyState::DUPLICATE;
+        }
+        // Keep the frame and receive into a free one, or into the first frame released
+        slot.fragments[frame.frameOrder - 1] = receiving;
+        receiving = pool.acquire(PoolOwner::RX);
+        slot.received |= bit;
+        slot.lastArrival = now;
+        slot.lastSequence = ++sequence;
+        if(slot.received != slot.expected){
+            return ReassemblyState::OK;
+        }
+        completeQueue[(completeHead + completeCount()) % Slots] = index;
+        completeSlots |= 1UL << index;
+        return ReassemblyState::COMPLETE;
+    }
+
+    /**
+     * @brief Finds the slot of a message
+     *
+     * @return int The slot index or NoSlot
+     */
+    int find(uint8_t sourceAddress, uint32_t frameID) const {
+        size_t position = hash(sourceAddress, frameID);
+        while(index[position] != EmptyIndex){
+            const Slot& slot = slots[index[position]];
+            if(slot.frameID == frameID && slot.sourceAddress == sourceAddress){
+                return index[position];
+            }
+            position = (position + 1) & IndexMask;
+        }
+        return NoSlot;
+    }
+
+    /**
+     * @brief Returns the slot of the earliest completed message
+     *
+     * @return int The slot index or NoSlot
+     */
+    int nextComplete() const {
+        if(completeSlots == 0){
+            return NoSlot;
+        }
+        return completeQueue[completeHead];
+    }
+
+    /**
+     * @brief Frees a slot and its frames, typically once its message has been processed
+     */
+    void release(int slotIndex) {
+        if(slotIndex < 0 || (size_t)slotIndex >= Slots || !(usedSlots & (1UL << slotIndex))){
+            return;
+        }
+        const Slot& slot = slots[slotIndex];
+        uint32_t received = slot.received;
+        while(received){
+            pool.release(PoolOwner::RX, slot.fragments[__builtin_ctz(received)]);
+            received &= received - 1;
+        }
+        unlink(slot);
+        if(completeSlots & (1UL << slotIndex)){
+            dequeue(slotIndex);
+        }
+        usedSlots &= ~(1UL << slotIndex);
+    }
+
+    /**
+     * @brief Evicts the partial message which has waited longest for a fragment,
+     * to make room for a new message
+     *
+     * @return true A partial message was evicted
+     */
+    bool evictOldest() {
+        uint32_t partial = usedSlots & ~completeSlots;
+        if(partial == 0){
+            return false;
+        }
+        int oldest = NoSlot;
+        while(partial){
+            const int slotIndex = __builtin_ctz(partial);
+            partial &= partial - 1;
+            // Wrap safe comparison of arrival order
+            if(oldest == NoSlot || static_cast<int32_t>(slots[slotIndex].lastSequence - slots[oldest].lastSequence) < 0){
+                oldest = slotIndex;
+            }
+        }
+        release(oldest);
+        return true;
+    }
+
+    /**
+     * @brief Evicts partial messages which received no fragment within the timeout
+     *
+     * @return size_t The number of messages evicted
+     */
+    size_t evictStale(uint32_t now, uint32_t timeout) {
+        uint32_t partial = usedSlots & ~completeSlots;
+        size_t evicted = 0;
+        while(partial){
+            const int slotIndex = __builtin_ctz(partial);
+            partial &= partial - 1;
+            if(now - slots[slotIndex].lastArrival >= timeout){
+                release(slotIndex);
+                evicted++;
+            }
+        }
+        return evicted;
+    }
+
+    const Slot& slot(int slotIndex) const {
+        return slots[slotIndex];
+    }
+
+    /**
+     * @brief A view of the message in a complete slot, valid until the slot is released
+     */
+    MessageView view(int slotIndex) const {
+        const Slot& slot = slots[slotIndex];
+        return MessageView(pool.data(), slot.fragments, slot.frameTotal);
+    }
+
+    /**
+     * @brief The reassembled message length of a slot in bytes
+     */
+    size_t length(int slotIndex) const {
+        return view(slotIndex).size();
+    }
+
+    /**
+     * @brief The number of fragments received by a slot
+     */
+    uint8_t fragments(int slotIndex) const {
+        return __builtin_popcount(slots[slotIndex].received);
+    }
+
+    /// Number of slots in use
+    size_t size() const {
+        return __builtin_popcount(usedSlots);
+    }
+
+    /// Number of slots holding a complete message
+    size_t completeCount() const {
+        return __builtin_popcount(completeSlots);
+    }
+
+    constexpr size_t max_size() const {
+        return Slots;
+    }
+
+    bool empty() const {
+        return usedSlots == 0;
+    }
+
+    bool full() const {
+        return size() == Slots;
+    }
+
+    /// Releases every slot, their frames go back to the pool
+    void clear() {
+        while(usedSlots){
+            release(__builtin_ctz(usedSlots));
+        }
+        completeSlots = 0;
+        completeHead = 0;
+        memset(index, EmptyIndex, sizeof(index));
+    }
+
+private:
+    // Index is at least twice the slot count and a power of two so probe chains stay short
+    static constexpr size_t IndexSize = Slots <= 2 ? 4 : Slots <= 4 ? 8 : Slots <= 8 ? 16 : Slots <= 16 ? 32 : 64;
+    static constexpr size_t IndexMask = IndexSize - 1;
+    static constexpr uint8_t EmptyIndex = 0xFF;
+
+    Slot slots[Slots];
+    // @brief Frames of the slots and the receive buffer
+    FramePool& pool;
+    // @brief Pool frame the transport reads into, NoFrame until one is free
+    FrameHandle receiving = NoFrame;
+    // @brief Open addressing index of slot numbers
+    uint8_t index[IndexSize];
+    // @brief Bitmap of slots in use
+    uint32_t usedSlots = 0;
+    // @brief Bitmap of slots holding a complete message
+    uint32_t completeSlots = 0;
+    // @brief Ring of complete slots in completion order
+    uint8_t completeQueue[Slots];
+    uint8_t completeHead;
+    // @brief Counts accepted fragments to order slots by their last progress
+    uint32_t sequence = 0;
+
+    // A mask with the lowest `bits` set
+    static constexpr uint32_t bitmask(size_t bits) {
+        return bits >= 32 ? 0xFFFFFFFFUL : ((1UL << bits) - 1);
+    }
+
+    static size_t hash(uint8_t sourceAddress, uint32_t frameID) {
+        uint32_t key = frameID ^ (static_cast<uint32_t>(sourceAddress) << 24);
+        key *= 0x9E3779B1UL; // Fibonacci hashing
+        return (key >> 24) & IndexMask;
+    }
+
+    int allocate(const Frame& frame) {
+        const uint32_t freeSlots = ~usedSlots & bitmask(Slots);
+        if(freeSlots == 0){
+            return NoSlot;
+        }
+        const int slotIndex = __builtin_ctz(freeSlots);
+        Slot& slot = slots[slotIndex];
+        slot.frameID = frame.frameID;
+        slot.sourceAddress = frame.sourceAddress;
+        slot.frameTotal = frame.frameTotal;
+        slot.received = 0;
+        slot.expected = bitmask(frame.frameTotal);
+        usedSlots |= 1UL << slotIndex;
+
+        size_t position = hash(frame.sourceAddress, frame.frameID);
+        while(index[position] != EmptyIndex){
+            position = (position + 1) & IndexMask;
+        }
+        index[position] = slotIndex;
+        return slotIndex;
+    }
+
+    // Removes a complete slot from the completion queue, normally its head
+    void dequeue(int slotIndex) {
+        size_t position = 0;
+        while(completeQueue[(completeHead + position) % Slots] != slotIndex){
+            position++;
+        }
+        // Close the gap by moving the earlier entries up one place
+        while(position > 0){
+            completeQueue[(completeHead + position) % Slots] = completeQueue[(completeHead + position - 1) % Slots];
+            position--;
+        }
+        completeHead = (completeHead + 1) % Slots;
+        completeSlots &= ~(1UL << slotIndex);
+    }
+
+    // Removes a slot from the index, shifting back any entries of its probe chain
+    void unlink(const Slot& slot) {
+        size_t position = hash(slot.sourceAddress, slot.frameID);
+        while(&slots[index[position]] != &slot){
+            position = (position + 1) & IndexMask;
+        }
+        index[position] = EmptyIndex;
+        size_t next = position;
+        while(true){
+            next = (next + 1) & IndexMask;
+            if(index[next] == EmptyIndex){
+                return;
+            }
+            const Slot& other = slots[index[next]];
+            const size_t home = hash(other.sourceAddress, other.frameID);
+            const bool inPlace = position <= next ? (position < home && home <= next)
+                                                  : (position < home || home <= next);
+            if(!inPlace){
+                index[position] = index[next];
+                index[next] = EmptyIndex;
+                position = next;
+            }
+        }
+    }
+};
+} // NAMESPACE
+#endif // REASSEMBLER_H
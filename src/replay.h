@@ -0,0 +1,193 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <Arduino.h>
+#include "comm.h"
+#include "capture.h"
+
+#if defined (NATIVE)
+#include <chrono>
+#include <vector>
+
+namespace corelib {
+
+/**
+ * @brief The outcome of a replay
+ */
+struct ReplayReport {
+    // @brief Frames fed to the Comm
+    uint32_t framesIn = 0;
+    // @brief Frames the Comm wrote, and the capture holds
+    uint32_t framesOut = 0;
+    uint32_t expectedOut = 0;
+    // @brief Written frames which differ from the captured frame in their place
+    uint32_t divergent = 0;
+    // @brief The first of them, -1 when there is none
+    int32_t firstDivergence = -1;
+    // @brief Captured frames not written, or frames written beyond the capture
+    uint32_t missing = 0;
+    uint32_t extra = 0;
+    uint32_t iterations = 0;
+    double seconds = 0;
+};
+
+/**
+ * @brief Feeds a capture (see capture.h) back through a Comm, on native.
+ *
+ * The frames the captured interface read are read again, at their original timing or as
+ * fast as the Comm takes them, and each frame the Comm writes is compared with the frame
+ * it wrote in the capture. Frames are compared without their frame id and check, which
+ * are picked at random when a message is framed, nor the times in a ping, which are
+ * those of the run. Register the message handlers of the unit under test as with any
+ * Comm before running.
+ *
+ *  ReplayComm comm;
+ *  registry.attach(comm);
+ *  comm.load("unit.cap", 0);
+ *  comm.initialise();
+ *  ReplayReport report = comm.run(false);
+ *
+ * @tparam Config The capacities of the interface, see CommConfig
+ * @tparam Integrity The frame check policy, see integrity.h
+ */
+template<typename Config = CommConfig<>, typename Integrity = FastCrc32Integrity>
+class BasicReplayComm : public BasicComm<Config, Integrity>
+{
+public:
+    // @brief Iterations without traffic after the last frame before a replay ends
+    static constexpr uint32_t DrainIterations = 64;
+
+    /**
+     * @brief Loads the records of one interface from a capture file
+     *
+     * @return false The file could not be read
+     */
+    bool load(const char* path, uint8_t interface) {
+        CaptureReader reader;
+        if(!reader.open(path)){
+            return false;
+        }
+        CaptureRecord record;
+        while(reader.next(record)){
+            add(record, interface);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Adds a record, ignored when it is of another interface
+     */
+    void add(const CaptureRecord& record, uint8_t interface) {
+        if(record.interface != interface){
+            return;
+        }
+        if(record.direction == CaptureDirection::IN){
+            inputs.push_back(record.frame);
+            times.push_back(record.timestamp);
+        }else{
+            expected.push_back(record.frame);
+        }
+    }
+
+    void clear() {
+        inputs.clear();
+        times.clear();
+        expected.clear();
+    }
+
+    /**
+     * @brief Replays the loaded records
+     *
+     * @param realtime Reads each frame when it was read in the capture, otherwise as
+     * soon as the Comm reads
+     */
+    ReplayReport run(bool realtime) {
+        report = ReplayReport();
+        report.expectedOut = expected.size();
+        next = 0;
+        pacing = realtime;
+        start = std::chrono::steady_clock::now();
+        uint32_t idle = 0;
+        while(next < inputs.size() || idle < DrainIterations){
+            const size_t read = next;
+            const uint32_t written = report.framesOut;
+            this->iterate();
+            report.iterations++;
+            const bool quiet = next == read && report.framesOut == written && this->txQueueDepth() == 0;
+            idle = next < inputs.size() || !quiet ? 0 : idle + 1;
+        }
+        report.framesIn = next;
+        report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if(report.framesOut < report.expectedOut){
+            report.missing = report.expectedOut - report.framesOut;
+        }
+        return report;
+    }
+
+    /// Compares frames without their frame id and check, and pings without their times
+    static bool sameFrame(const Frame& a, const Frame& b) {
+        if(!(a.preamble == b.preamble && a.destinationAddress == b.destinationAddress &&
+             a.sourceAddress == b.sourceAddress && a.frameOrder == b.frameOrder && a.frameTotal == b.frameTotal)){
+            return false;
+        }
+        if(a.preamble != Preamble::PING_REQUEST && a.preamble != Preamble::PING_RESPONSE){
+            return memcmp(a.payload, b.payload, sizeof(a.payload)) == 0;
+        }
+        // The sequence and what follows the times, see PingTimes
+        static constexpr size_t TimesStart = sizeof(uint32_t);
+        static constexpr size_t TimesEnd = 4 * sizeof(uint32_t);
+        return memcmp(a.payload, b.payload, TimesStart) == 0 &&
+            memcmp(a.payload + TimesEnd, b.payload + TimesEnd, sizeof(a.payload) - TimesEnd) == 0;
+    }
+
+protected:
+    std::vector<Frame> inputs;
+    std::vector<uint32_t> times;
+    std::vector<Frame> expected;
+    size_t next = 0;
+    bool pacing = false;
+    std::chrono::steady_clock::time_point start;
+    ReplayReport report;
+
+    // Function.h interface
+    void performInitialise() {
+        this->initialised = true;
+    }
+
+    // Comms.h interface
+    bool read(uint8_t* buffer) {
+        if(next >= inputs.size()){
+            return false;
+        }
+        if(pacing){
+            // Wrap safe offset of the frame from the first in the capture
+            const uint32_t due = times[next] - times[0];
+            const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            if(static_cast<uint64_t>(elapsed) < due){
+                return false;
+            }
+        }
+        memcpy(buffer, &inputs[next++], sizeof(Frame));
+        return true;
+    }
+    bool write(const uint8_t* buffer) {
+        const Frame& frame = *reinterpret_cast<const Frame*>(buffer);
+        const uint32_t index = report.framesOut++;
+        if(index >= expected.size()){
+            report.extra++;
+        }else if(!sameFrame(frame, expected[index])){
+            if(report.divergent++ == 0){
+                report.firstDivergence = index;
+            }
+        }
+        return true;
+    }
+};
+
+/// Replays through a Comm with the default capacities
+typedef BasicReplayComm<> ReplayComm;
+
+} // NAMESPACE
+#endif
+#endif // REPLAY_H
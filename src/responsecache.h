@@ -0,0 +1,182 @@
+#ifndef RESPONSECACHE_H
+#define RESPONSECACHE_H
+
+#include <Arduino.h>
+#include "message.h"
+
+#include <pb_decode.h>
+
+namespace corelib {
+
+/**
+ * @brief Finds the token of a request and a check value over all of its bytes
+ *
+ * @param token Set to the TransactionMessage token
+ * @param check Set to an FNV-1a hash of the message, it tells apart two requests
+ * given the same token
+ * @return false The message has no token, or a zero one, it is not cached
+ */
+inline bool requestKey(const MessageView& view, uint32_t& token, uint32_t& check) {
+    static constexpr uint32_t TokenTag = 1;
+    token = 0;
+    pb_istream_t in = view.istream();
+    pb_wire_type_t type;
+    uint32_t tag;
+    bool eof;
+    while(token == 0 && pb_decode_tag(&in, &type, &tag, &eof)){
+        const bool ok = tag == TokenTag ? type == PB_WT_32BIT && pb_decode_fixed32(&in, &token)
+                                        : pb_skip_field(&in, type);
+        if(!ok){
+            return false;
+        }
+    }
+    if(token == 0){
+        return false;
+    }
+    check = 0x811C9DC5UL;
+    const size_t size = view.size();
+    for(uint8_t i = 0; i < view.fragmentCount(); i++){
+        const uint8_t* fragment = view.fragment(i);
+        const size_t end = size - i * MessageView::FragmentSize < MessageView::FragmentSize ?
+            size - i * MessageView::FragmentSize : MessageView::FragmentSize;
+        for(size_t j = 0; j < end; j++){
+            check = (check ^ fragment[j]) * 0x01000193UL;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief The responses to the last few requests, by (source address, token).
+ *
+ * A host which times out sends the same request again with the same token. Answered
+ * from the cache, the handler does not run twice, a write is not applied twice and
+ * the response is the one the first request was given. A response answers repeats of
+ * its request until it expires, it is then replaced by the next request. When every
+ * entry is live the oldest one is replaced.
+ *
+ * @tparam Entries Number of responses kept, 0 keeps none
+ * @tparam MessageSize Largest response in bytes
+ */
+template<size_t Entries, size_t MessageSize>
+class ResponseCache
+{
+public:
+    static constexpr bool enabled = true;
+
+    /**
+     * @param expiry Time a response answers repeats of its request, in the caller's
+     * time base, e.g. iterations
+     */
+    explicit ResponseCache(uint32_t expiry) : expiry(expiry) {}
+
+    /**
+     * @brief Copies out the response to a repeated request
+     *
+     * @param check The check value of the request, see requestKey
+     * @return true The response was copied, length is set
+     */
+    bool find(uint8_t source, uint32_t token, uint32_t check, uint32_t now, uint8_t* out, int& length) const {
+        for(size_t i = 0; i < Entries; i++){
+            const Entry& entry = entries[i];
+            if(entry.length != 0 && entry.token == token && entry.source == source &&
+               entry.check == check && now - entry.storedAt < expiry){
+                memcpy(out, entry.response, entry.length);
+                length = entry.length;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Keeps the response to a request, an empty response is not kept
+     */
+    void store(uint8_t source, uint32_t token, uint32_t check, const uint8_t* response, size_t length, uint32_t now) {
+        if(length == 0 || length > MessageSize){
+            return;
+        }
+        // A free or expired entry, else the oldest
+        size_t oldest = 0;
+        for(size_t i = 0; i < Entries; i++){
+            const Entry& entry = entries[i];
+            if(entry.length == 0 || now - entry.storedAt >= expiry){
+                oldest = i;
+                break;
+            }
+            if(static_cast<int32_t>(entry.storedAt - entries[oldest].storedAt) < 0){
+                oldest = i;
+            }
+        }
+        Entry& entry = entries[oldest];
+        entry.source = source;
+        entry.token = token;
+        entry.check = check;
+        entry.storedAt = now;
+        entry.length = length;
+        memcpy(entry.response, response, length);
+    }
+
+    /// Number of responses kept, expired or not
+    size_t size() const {
+        size_t used = 0;
+        for(size_t i = 0; i < Entries; i++){
+            used += entries[i].length != 0;
+        }
+        return used;
+    }
+
+    constexpr size_t max_size() const {
+        return Entries;
+    }
+
+    void clear() {
+        for(size_t i = 0; i < Entries; i++){
+            entries[i].length = 0;
+        }
+    }
+
+private:
+    struct Entry {
+        uint32_t token = 0;
+        uint32_t check = 0;
+        uint32_t storedAt = 0;
+        // @brief Bytes of the response, 0 when the entry is free
+        uint16_t length = 0;
+        uint8_t source = 0;
+        uint8_t response[MessageSize];
+    };
+
+    Entry entries[Entries];
+    uint32_t expiry;
+};
+
+/**
+ * @brief No response cache, every request is handled
+ */
+template<size_t MessageSize>
+class ResponseCache<0, MessageSize>
+{
+public:
+    static constexpr bool enabled = false;
+
+    explicit ResponseCache(uint32_t) {}
+
+    bool find(uint8_t, uint32_t, uint32_t, uint32_t, uint8_t*, int&) const {
+        return false;
+    }
+
+    void store(uint8_t, uint32_t, uint32_t, const uint8_t*, size_t, uint32_t) {}
+
+    size_t size() const {
+        return 0;
+    }
+
+    constexpr size_t max_size() const {
+        return 0;
+    }
+
+    void clear() {}
+};
+} // NAMESPACE
+#endif // RESPONSECACHE_H
@@ -0,0 +1,230 @@
+#ifndef RING_H
+#define RING_H
+
+#include <Arduino.h>
+#include <atomic>
+#include "frame.h"
+#include "comm.h"
+
+namespace corelib {
+
+#if defined (NATIVE)
+// @brief Producer and consumer indexes are kept a cache line apart
+static constexpr size_t RingLineSize = 64;
+#else
+static constexpr size_t RingLineSize = 4;
+#endif
+
+/**
+ * @brief A single producer, single consumer ring of frames without locks. One side,
+ * e.g. a receive interrupt, pushes frames while the other, e.g. performIterate, pops
+ * them. Only push/reserve/commit may be called from the producer and only
+ * peek/pop from the consumer.
+ *
+ * The indexes run freely and are masked into the slots. The producer publishes a
+ * frame by storing the tail with release order after copying it, the consumer loads
+ * the tail with acquire order before reading it, and frees the slot the same way
+ * through the head. Each side keeps a copy of the other's index and only loads it
+ * again when the ring looks full or empty. Only loads and stores are used, which are
+ * lock free on every Cortex-M.
+ *
+ * @tparam Slots Number of frames, a power of two
+ */
+template<size_t Slots>
+class FrameRing
+{
+    static_assert(Slots >= 2 && (Slots & (Slots - 1)) == 0, "FrameRing slots must be a power of two");
+
+public:
+    // Producer
+
+    /**
+     * @brief The slot for the next frame, fill it in then commit
+     *
+     * @return uint8_t* The slot, nullptr when the ring is full
+     */
+    uint8_t* reserve() {
+        const uint32_t position = tail.load(std::memory_order_relaxed);
+        if(position - producerHead == Slots){
+            producerHead = head.load(std::memory_order_acquire);
+            if(position - producerHead == Slots){
+                return nullptr;
+            }
+        }
+        return reinterpret_cast<uint8_t*>(&slots[position & Mask]);
+    }
+
+    /// Publishes the reserved slot to the consumer
+    void commit() {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Copies a frame into the ring
+     *
+     * @return false The ring is full, the frame is counted as dropped
+     */
+    bool push(const uint8_t* frame) {
+        uint8_t* slot = reserve();
+        if(slot == nullptr){
+            drops.store(drops.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        memcpy(slot, frame, sizeof(Frame));
+        commit();
+        return true;
+    }
+
+    // Consumer
+
+    /**
+     * @brief The oldest frame, valid until pop
+     *
+     * @return const uint8_t* The frame, nullptr when the ring is empty
+     */
+    const uint8_t* peek() {
+        const uint32_t position = head.load(std::memory_order_relaxed);
+        if(position == consumerTail){
+            consumerTail = tail.load(std::memory_order_acquire);
+            if(position == consumerTail){
+                return nullptr;
+            }
+        }
+        return reinterpret_cast<const uint8_t*>(&slots[position & Mask]);
+    }
+
+    /// Frees the oldest frame for the producer
+    void pop() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Copies out and frees the oldest frame
+     *
+     * @return false The ring is empty
+     */
+    bool pop(uint8_t* frame) {
+        const uint8_t* slot = peek();
+        if(slot == nullptr){
+            return false;
+        }
+        memcpy(frame, slot, sizeof(Frame));
+        pop();
+        return true;
+    }
+
+    // Either side, a snapshot which may be stale by the time it is used
+
+    size_t size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    constexpr size_t max_size() const {
+        return Slots;
+    }
+
+    /// Frames refused by push since the ring was made
+    uint32_t dropped() const {
+        return drops.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr uint32_t Mask = Slots - 1;
+
+    Frame slots[Slots];
+    // @brief Written by the consumer, with its copy of the tail
+    alignas(RingLineSize) std::atomic<uint32_t> head{0};
+    uint32_t consumerTail = 0;
+    // @brief Written by the producer, with its copy of the head and its drops
+    alignas(RingLineSize) std::atomic<uint32_t> tail{0};
+    uint32_t producerHead = 0;
+    std::atomic<uint32_t> drops{0};
+};
+
+/**
+ * @brief Reads several frames an iteration, see BasicRingComm
+ */
+struct RingCommConfig : CommConfig<> {
+    static constexpr size_t framesReadPerIteration = 8;
+};
+
+/**
+ * @brief A Comm whose transport runs apart from the main loop, e.g. in interrupts.
+ * Received frames are pushed into a ring with receive() and read in batches by
+ * performIterate, so frames arriving while the loop is busy wait in the ring rather
+ * than being lost by the transport. Written frames go into a second ring which the
+ * transport takes them from with transmit(). A full transmit ring refuses the write,
+ * the frame is written again on a later iteration.
+ *
+ *  RingComm comm;
+ *  void onReceive(const uint8_t* frame) { comm.receive(frame); } // interrupt
+ *  void onSendReady() { uint8_t frame[64]; if(comm.transmit(frame)) send(frame); }
+ *
+ * @tparam Config The capacities of the interface, see CommConfig
+ * @tparam Integrity The frame check policy, see integrity.h
+ * @tparam RxSlots Frames which may wait to be read, a power of two
+ * @tparam TxSlots Frames which may wait to be sent, a power of two
+ */
+template<typename Config = RingCommConfig, typename Integrity = FastCrc32Integrity, size_t RxSlots = 16, size_t TxSlots = 16>
+class BasicRingComm : public BasicComm<Config, Integrity>
+{
+public:
+    /**
+     * @brief Hands a received frame to the Comm, from the transport's receive context
+     *
+     * @return false The ring is full and the frame was dropped
+     */
+    bool receive(const uint8_t* frame) {
+        return rxRing.push(frame);
+    }
+
+    /**
+     * @brief Takes the next frame to send, from the transport's transmit context
+     *
+     * @return false There is nothing to send
+     */
+    bool transmit(uint8_t* frame) {
+        return txRing.pop(frame);
+    }
+
+    /// Frames dropped because the receive ring was full
+    uint32_t receiveDrops() const {
+        return rxRing.dropped();
+    }
+
+protected:
+    // @brief Frames received and not yet read
+    FrameRing<RxSlots> rxRing;
+    // @brief Frames written and not yet sent
+    FrameRing<TxSlots> txRing;
+
+    // Function.h interface
+    void performInitialise() {
+        this->initialised = true;
+    }
+
+    // Comms.h interface
+    bool read(uint8_t* buffer) {
+        return rxRing.pop(buffer);
+    }
+    bool write(const uint8_t* buffer) {
+        // Not push, a refused write is retried rather than dropped
+        uint8_t* slot = txRing.reserve();
+        if(slot == nullptr){
+            return false;
+        }
+        memcpy(slot, buffer, sizeof(Frame));
+        txRing.commit();
+        return true;
+    }
+};
+
+/// Ring buffered interface with the default capacities
+typedef BasicRingComm<> RingComm;
+
+} // NAMESPACE
+#endif // RING_H
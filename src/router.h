@@ -0,0 +1,140 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <Arduino.h>
+#include "frame.h"
+#include "comm.h"
+
+#include <etl/delegate.h>
+
+namespace corelib {
+
+/**
+ * @brief Counters of a Router
+ */
+struct RouterStats {
+    // @brief Frames queued on their outgoing interface
+    uint32_t forwarded = 0;
+    // @brief Frames for an address without a route, or routed back where they came from
+    uint32_t noRoute = 0;
+    // @brief Frames dropped because the outgoing interface's relay queue was full
+    uint32_t queueFull = 0;
+};
+
+/**
+ * @brief The Router connects several Comm interfaces, making this device a gateway.
+ *
+ * Frames which arrive on an interface for another address are forwarded frame by frame
+ * (cut-through) to the interface the forwarding table names for that address. Frames
+ * are not reassembled, re-encoded nor is their crc recomputed, they are copied once
+ * into the bounded relay queue of the outgoing interface and written from there.
+ *
+ *  Router<2> router;
+ *  router.attach(usb);      // interface 0
+ *  router.attach(can);      // interface 1
+ *  router.addRoute(0x10, 1);
+ *
+ * @tparam Interfaces Maximum number of attached interfaces
+ */
+template<size_t Interfaces>
+class Router
+{
+    static_assert(Interfaces > 1 && Interfaces < 0xFF, "Router requires 2 to 254 interfaces");
+
+public:
+    static constexpr uint8_t NoRoute = 0xFF;
+    static constexpr uint8_t AddressCount = 0x80;
+
+    Router() {
+        clearRoutes();
+    }
+
+    /**
+     * @brief Attaches a Comm interface, its frames for other addresses are forwarded
+     * through this router
+     *
+     * @return uint8_t The interface number used by the forwarding table, NoRoute when full
+     */
+    template<typename Config, typename Integrity>
+    uint8_t attach(BasicComm<Config, Integrity>& comm) {
+        typedef BasicComm<Config, Integrity> TComm;
+        if(count == Interfaces){
+            return NoRoute;
+        }
+        const uint8_t port = count++;
+        enqueue[port] = etl::delegate<bool(const Frame&)>::create<TComm, &TComm::enqueueRelay>(comm);
+        comm.setRelayCallback(etl::delegate<bool(const Frame&, uint8_t)>::create<Router, &Router::forward>(*this), port);
+        comm.setRouteCallback(etl::delegate<bool(uint8_t, uint8_t)>::create<Router, &Router::routesOff>(*this));
+        return port;
+    }
+
+    /**
+     * @brief Routes frames for an address to an interface
+     */
+    bool addRoute(uint8_t address, uint8_t port) {
+        if(address >= AddressCount || port >= count){
+            return false;
+        }
+        routes[address] = port;
+        return true;
+    }
+
+    void removeRoute(uint8_t address) {
+        if(address < AddressCount){
+            routes[address] = NoRoute;
+        }
+    }
+
+    void clearRoutes() {
+        memset(routes, NoRoute, sizeof(routes));
+    }
+
+    /// The interface frames for an address are forwarded to, or NoRoute
+    uint8_t route(uint8_t address) const {
+        return address < AddressCount ? routes[address] : NoRoute;
+    }
+
+    /// Whether frames for an address which arrive on an interface are forwarded
+    bool routesOff(uint8_t address, uint8_t from) const {
+        const uint8_t port = route(address);
+        return port != NoRoute && port != from;
+    }
+
+    /**
+     * @brief Forwards a frame which arrived on an interface for another address
+     *
+     * @param frame The frame as received, crc included
+     * @param from The interface the frame arrived on
+     * @return true The frame was queued on its outgoing interface
+     */
+    bool forward(const Frame& frame, uint8_t from) {
+        if(!routesOff(frame.destinationAddress, from)){
+            stats.noRoute++;
+            return false;
+        }
+        if(!enqueue[route(frame.destinationAddress)](frame)){
+            stats.queueFull++;
+            return false;
+        }
+        stats.forwarded++;
+        return true;
+    }
+
+    const RouterStats& getStats() const {
+        return stats;
+    }
+
+    void resetStats() {
+        stats = RouterStats();
+    }
+
+private:
+    // @brief Outgoing interface by destination address
+    uint8_t routes[AddressCount];
+    // @brief Relay queue of each interface
+    etl::delegate<bool(const Frame&)> enqueue[Interfaces];
+    uint8_t count = 0;
+    RouterStats stats;
+};
+} // NAMESPACE
+#endif // ROUTER_H
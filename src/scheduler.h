@@ -0,0 +1,210 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+#include "function.h"
+
+#include <etl/delegate.h>
+
+#if defined (NATIVE)
+#include <chrono>
+#endif
+
+namespace corelib {
+
+/**
+ * @brief Timing of a scheduled task, in clock ticks (microseconds by default)
+ */
+struct TaskStats {
+    uint32_t runs = 0;
+    // @brief Runs which finished after their deadline
+    uint32_t overruns = 0;
+    // @brief Periods skipped because the task fell a whole period behind
+    uint32_t missed = 0;
+    // @brief Largest delay between a task being due and starting
+    uint32_t maxJitter = 0;
+    // @brief Worst case and last execution time
+    uint32_t maxExecution = 0;
+    uint32_t lastExecution = 0;
+};
+
+/**
+ * @brief A fixed capacity cooperative scheduler, running each registered Function
+ * at its own rate rather than as fast as `loop()` spins.
+ *
+ * Every call to run() executes the tasks which are due once each, earliest due first,
+ * a higher priority (lower number) first when due at the same time. A task is next due one
+ * period after it was last due, so its rate does not drift with jitter. A task which
+ * falls a whole period behind skips the missed periods instead of running back to back,
+ * so a task running longer than its period cannot starve the others.
+ *
+ *  Scheduler<4> scheduler;
+ *  scheduler.add(engine, 1000, 0, 200);  // 1 kHz, finish within 200 us
+ *  scheduler.add(usb, 5000, 1);          // 200 Hz
+ *  void loop() { scheduler.run(); }
+ *
+ * @tparam Tasks Maximum number of tasks
+ */
+template<size_t Tasks>
+class Scheduler
+{
+public:
+    static constexpr int NoTask = -1;
+
+    typedef etl::delegate<uint32_t()> Clock;
+
+    /**
+     * @param clock Returns the time in ticks, defaults to microseconds
+     */
+    explicit Scheduler(Clock clock = Clock::template create<&Scheduler::defaultClock>()) : clock(clock) {}
+
+    /**
+     * @brief Registers a task
+     *
+     * @param function The task, iterated when due
+     * @param period Ticks between runs
+     * @param priority Orders tasks due at the same time, 0 first
+     * @param deadline Ticks after being due the run must have finished, 0 for the period
+     * @return int The task index or NoTask when full
+     */
+    int add(Function& function, uint32_t period, uint8_t priority = 0, uint32_t deadline = 0) {
+        if(count == Tasks || period == 0){
+            return NoTask;
+        }
+        Task& task = tasks[count];
+        task.function = &function;
+        task.period = period;
+        task.priority = priority;
+        task.deadline = deadline == 0 ? period : deadline;
+        task.due = clock();
+        task.stats = TaskStats();
+        return count++;
+    }
+
+    /**
+     * @brief Runs every task which is due, each at most once, so run() returns even when
+     * the tasks take longer than their periods. A task due again before the call
+     * finished runs on the next call.
+     *
+     * @return size_t The number of tasks run
+     */
+    size_t run() {
+        bool done[Tasks] = {false};
+        size_t ran = 0;
+        int next;
+        while((next = nextDue(clock(), done)) != NoTask){
+            done[next] = true;
+            execute(tasks[next]);
+            ran++;
+        }
+        return ran;
+    }
+
+    /**
+     * @brief Ticks until the next task is due, 0 when one is due now
+     */
+    uint32_t idle() const {
+        const uint32_t now = clock();
+        uint32_t wait = 0xFFFFFFFFUL;
+        for(size_t i = 0; i < count; i++){
+            const int32_t until = static_cast<int32_t>(tasks[i].due - now);
+            if(until <= 0){
+                return 0;
+            }
+            if(static_cast<uint32_t>(until) < wait){
+                wait = until;
+            }
+        }
+        return wait;
+    }
+
+    const TaskStats& getStats(int task) const {
+        return tasks[task].stats;
+    }
+
+    void resetStats() {
+        for(size_t i = 0; i < count; i++){
+            tasks[i].stats = TaskStats();
+        }
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+private:
+    struct Task {
+        Function* function = nullptr;
+        uint32_t period = 0;
+        uint32_t deadline = 0;
+        // @brief Time the task is next due
+        uint32_t due = 0;
+        uint8_t priority = 0;
+        TaskStats stats;
+    };
+
+    Task tasks[Tasks];
+    size_t count = 0;
+    Clock clock;
+
+    // The default clock, microseconds
+    static uint32_t defaultClock() {
+        #if defined (NATIVE)
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+        #else
+        return ::micros();
+        #endif
+    }
+
+    // The due task which was due first, then by priority, skipping those done
+    int nextDue(uint32_t now, const bool* done) const {
+        int next = NoTask;
+        for(size_t i = 0; i < count; i++){
+            const Task& task = tasks[i];
+            // Wrap safe comparisons of time
+            if(done[i] || static_cast<int32_t>(now - task.due) < 0){
+                continue;
+            }
+            if(next == NoTask){
+                next = i;
+                continue;
+            }
+            const int32_t earlier = static_cast<int32_t>(task.due - tasks[next].due);
+            if(earlier < 0 || (earlier == 0 && task.priority < tasks[next].priority)){
+                next = i;
+            }
+        }
+        return next;
+    }
+
+    void execute(Task& task) {
+        TaskStats& stats = task.stats;
+        const uint32_t start = clock();
+        const uint32_t jitter = start - task.due;
+        task.function->iterate();
+        const uint32_t end = clock();
+        const uint32_t execution = end - start;
+
+        stats.runs++;
+        stats.lastExecution = execution;
+        if(execution > stats.maxExecution){
+            stats.maxExecution = execution;
+        }
+        if(jitter > stats.maxJitter){
+            stats.maxJitter = jitter;
+        }
+        if(end - task.due > task.deadline){
+            stats.overruns++;
+        }
+        task.due += task.period;
+        if(static_cast<int32_t>(end - task.due) >= static_cast<int32_t>(task.period)){
+            // Skip the periods which can no longer be met, next due after this run
+            const uint32_t behind = (end - task.due) / task.period + 1;
+            stats.missed += behind;
+            task.due += behind * task.period;
+        }
+    }
+};
+} // NAMESPACE
+#endif // SCHEDULER_H
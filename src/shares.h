@@ -0,0 +1,431 @@
+#ifndef SHARES_H
+#define SHARES_H
+
+#include <Arduino.h>
+#include "comm.h"
+#include "message.h"
+#include "delta.h"
+#include "states.h"
+
+#include <pb_decode.h>
+#include <pb_encode.h>
+#include <etl/delegate.h>
+
+#include "transaction.pb.h"
+
+namespace corelib {
+
+// @brief Bytes of a TransactionMessage's data, every encoded share must fit
+static constexpr size_t ShareDataSize = sizeof(TransactionMessage::data);
+// @brief Common id of the built in Common1
+static constexpr uint32_t Common1Id = 1;
+
+/**
+ * @brief Notified with the share id and the request's action, before a share is
+ * encoded for a request (to refresh it) and after it was decoded from a publish
+ * (to apply it). A share encoded for a subscription is refreshed as for a SHARE_REQUEST.
+ */
+typedef etl::delegate<void(uint32_t, TransactionMessage_Action)> ShareHook;
+
+/**
+ * @brief Applies a SHARE_SUBSCRIBE to a share, see publisher.h. Given the requested
+ * period, fills in the subscription's counters for the answer.
+ */
+typedef etl::delegate<bool(uint32_t, Subscription1&)> SubscribeHook;
+
+/**
+ * @brief The ShareRegistry answers Programmor's transactions from the structs which
+ * hold the shares, replacing a hand written message callback.
+ *
+ * Shares are looked up by id in a flat table. A request is answered by encoding the
+ * share straight into the response's data, and a publish is decoded straight into
+ * the share, without an intermediate TransactionMessage or data buffer. Incoming
+ * messages are read in place through a MessageView when attached to a Comm.
+ * Common1 is built in, at common id 1, and answers COMMON_REQUEST. SHARE_SUBSCRIBE
+ * is passed on to the subscribe callback, normally set by Publisher::attach. Shares
+ * tracked with trackDelta are published as SHARE_DELTA, carrying only their changes.
+ *
+ *  CommStats2 traffic;
+ *  ShareRegistry<8> shares;
+ *  shares.common().registryId = 0x1000;
+ *  shares.addShare<CommStats2_size>(3, traffic, CommStats2_fields);
+ *  shares.attach(usb);
+ *
+ * A publish decodes over the share as it arrives, one which fails to decode may
+ * leave the share partly written.
+ *
+ * @tparam ShareIds Number of share ids, shares use ids 0 to ShareIds - 1
+ * @tparam CommonIds Number of common ids, commons use ids 0 to CommonIds - 1
+ */
+template<size_t ShareIds, size_t CommonIds = 2>
+class ShareRegistry
+{
+    static_assert(CommonIds > Common1Id, "ShareRegistry requires room for the built in Common1");
+    static_assert(Subscription1_size <= ShareDataSize, "A Subscription1 must fit a TransactionMessage's data");
+
+public:
+    ShareRegistry() {
+        addCommon<Common1_size>(Common1Id, common1, Common1_fields, ShareHook(), true);
+    }
+
+    /// The built in Common1, describing this device
+    Common1& common() {
+        return common1;
+    }
+
+    /**
+     * @brief Registers a share
+     *
+     * @tparam EncodedSize The largest encoding of the share, its nanopb `<Message>_size`
+     * @param shareId Id the share is requested and published by
+     * @param share The struct holding the share, which must outlive the registry
+     * @param fields The share's nanopb fields, `<Message>_fields`
+     * @param hook Optionally notified of requests and publishes
+     * @param readOnly Rejects publishes of the share
+     * @return false The id is out of range or already registered
+     */
+    template<size_t EncodedSize, typename T>
+    bool addShare(uint32_t shareId, T& share, const pb_msgdesc_t* fields, ShareHook hook = ShareHook(),
+                  bool readOnly = false) {
+        static_assert(EncodedSize <= ShareDataSize, "An encoded share must fit a TransactionMessage's data");
+        return add(shares, ShareIds, shareId, &share, fields, EncodedSize, hook, readOnly);
+    }
+
+    /**
+     * @brief Registers a common, as addShare
+     */
+    template<size_t EncodedSize, typename T>
+    bool addCommon(uint32_t commonId, T& common, const pb_msgdesc_t* fields, ShareHook hook = ShareHook(),
+                   bool readOnly = false) {
+        static_assert(EncodedSize <= ShareDataSize, "An encoded share must fit a TransactionMessage's data");
+        return add(commons, CommonIds, commonId, &common, fields, EncodedSize, hook, readOnly);
+    }
+
+    void setSubscribeCallback(SubscribeHook fn) {
+        subscribeFunction = fn;
+    }
+
+    /**
+     * @brief Publishes a share as deltas from the last publish, see delta.h. A
+     * SHARE_DELTA of the share from the host is answered with a full delta.
+     *
+     * @param shadow Holds the share as last sent, it must outlive the registry
+     * @return false The share is not registered or too large for a full delta
+     */
+    bool trackDelta(uint32_t shareId, DeltaShadow& shadow) {
+        if(shareId >= ShareIds || shares[shareId].data == nullptr || shares[shareId].size > DeltaMaxShare){
+            return false;
+        }
+        shadow = DeltaShadow();
+        shares[shareId].shadow = &shadow;
+        return true;
+    }
+
+    /// True when a share is registered at the id
+    bool contains(uint32_t shareId) const {
+        return lookup(TransactionMessage_Action_SHARE_REQUEST, shareId) != nullptr;
+    }
+
+    void removeShare(uint32_t shareId) {
+        if(shareId < ShareIds){
+            shares[shareId] = Entry();
+        }
+    }
+
+    /// Largest encoding of a registered share, 0 when not registered
+    size_t encodedSize(uint32_t shareId) const {
+        return shareId < ShareIds ? shares[shareId].size : 0;
+    }
+
+    /**
+     * @brief Encodes a SHARE_PUBLISH of a share, sent unprompted, or a SHARE_DELTA when
+     * the share is tracked
+     *
+     * @param token Identifies the publish, e.g. a sequence number
+     * @return HandleMessageState ERROR when the share is not registered
+     */
+    HandleMessageState encodePublish(uint32_t shareId, uint32_t token, uint8_t* out, size_t capacity, size_t& length) {
+        length = 0;
+        const Entry* entry = lookup(TransactionMessage_Action_SHARE_REQUEST, shareId);
+        if(entry == nullptr){
+            return HandleMessageState::ERROR;
+        }
+        if(entry->hook.is_valid()){
+            entry->hook(shareId, TransactionMessage_Action_SHARE_REQUEST);
+        }
+        if(entry->shadow != nullptr){
+            return encodeDeltaMessage(out, capacity, token, shareId, *entry, false, length);
+        }
+        return encodeResponse(out, capacity, token, TransactionMessage_Action_SHARE_PUBLISH, shareId,
+                              entry->fields, entry->data, length);
+    }
+
+    /**
+     * @brief Answers an encoded TransactionMessage
+     *
+     * @param in The encoded request
+     * @param out Receives the encoded response
+     * @param capacity Size of out, at least TransactionMessage_size
+     * @param length Set to the length of the response, 0 when there is none
+     * @return HandleMessageState ERROR for an unknown share or action
+     */
+    HandleMessageState handle(pb_istream_t& in, uint8_t* out, size_t capacity, size_t& length) {
+        length = 0;
+        uint32_t token = 0;
+        uint32_t shareId = 0;
+        uint64_t action = TransactionMessage_Action_NA;
+        bool published = false;
+        Subscription1 subscription = Subscription1_init_zero;
+        bool subscribed = false;
+        pb_wire_type_t type;
+        uint32_t tag;
+        bool eof;
+        while(pb_decode_tag(&in, &type, &tag, &eof)){
+            bool ok;
+            switch(tag){
+            case TokenTag:
+                ok = type == PB_WT_32BIT && pb_decode_fixed32(&in, &token);
+                break;
+            case ActionTag:
+                ok = type == PB_WT_VARINT && pb_decode_varint(&in, &action);
+                break;
+            case ShareIdTag:
+                ok = type == PB_WT_32BIT && pb_decode_fixed32(&in, &shareId);
+                break;
+            case DataTag:
+                if(isPublish(action)){
+                    // Fields are encoded in order, the action and share id are known by now
+                    const Entry* entry = lookup(action, shareId);
+                    if(entry == nullptr || entry->readOnly || type != PB_WT_STRING){
+                        return HandleMessageState::ERROR;
+                    }
+                    if(!decodeData(in, entry->fields, entry->data)){
+                        return HandleMessageState::FAILED_DECODE;
+                    }
+                    published = true;
+                    if(entry->hook.is_valid()){
+                        entry->hook(shareId, static_cast<TransactionMessage_Action>(action));
+                    }
+                    ok = true;
+                    break;
+                }
+                if(action == TransactionMessage_Action_SHARE_SUBSCRIBE){
+                    ok = type == PB_WT_STRING && decodeData(in, Subscription1_fields, &subscription);
+                    subscribed = ok;
+                    break;
+                }
+                ok = pb_skip_field(&in, type);
+                break;
+            default:
+                ok = pb_skip_field(&in, type);
+                break;
+            }
+            if(!ok){
+                return HandleMessageState::FAILED_DECODE;
+            }
+        }
+        if(!eof){
+            return HandleMessageState::FAILED_DECODE;
+        }
+
+        const Entry* entry = lookup(action, shareId);
+        if(entry == nullptr){
+            return HandleMessageState::ERROR;
+        }
+        if(action == TransactionMessage_Action_SHARE_SUBSCRIBE){
+            if(!subscribed){
+                return HandleMessageState::NO_DATA;
+            }
+            if(!subscribeFunction.is_valid() || !subscribeFunction(shareId, subscription)){
+                return HandleMessageState::ERROR;
+            }
+            return encodeResponse(out, capacity, token, TransactionMessage_Action_SHARE_SUBSCRIBE, shareId,
+                                  Subscription1_fields, &subscription, length);
+        }
+        if(action == TransactionMessage_Action_SHARE_DELTA){
+            // The host lost a delta, start it over from a full one
+            if(entry->shadow == nullptr){
+                return HandleMessageState::ERROR;
+            }
+            if(entry->hook.is_valid()){
+                entry->hook(shareId, TransactionMessage_Action_SHARE_REQUEST);
+            }
+            return encodeDeltaMessage(out, capacity, token, shareId, *entry, true, length);
+        }
+        const bool common = action <= TransactionMessage_Action_COMMON_RESPONSE;
+        switch(action){
+        case TransactionMessage_Action_COMMON_REQUEST:
+        case TransactionMessage_Action_SHARE_REQUEST:
+            if(entry->hook.is_valid()){
+                entry->hook(shareId, static_cast<TransactionMessage_Action>(action));
+            }
+            break;
+        case TransactionMessage_Action_COMMON_PUBLISH:
+        case TransactionMessage_Action_SHARE_PUBLISH:
+            if(!published){
+                return HandleMessageState::NO_DATA;
+            }
+            break;
+        default:
+            return HandleMessageState::ERROR;
+        }
+        // A publish is answered with the share as it now is
+        const TransactionMessage_Action response = common ? TransactionMessage_Action_COMMON_RESPONSE
+                                                          : TransactionMessage_Action_SHARE_RESPONSE;
+        return encodeResponse(out, capacity, token, response, shareId, entry->fields, entry->data, length);
+    }
+
+    /**
+     * @brief Message view callback, see attach
+     */
+    template<typename TBuffer>
+    HandleMessageState handleMessage(const MessageView& message, TBuffer* buffer) {
+        pb_istream_t in = message.istream();
+        size_t length = 0;
+        const HandleMessageState state = handle(in, buffer->outBuffer, sizeof(buffer->outBuffer), length);
+        buffer->outMessageLength = length;
+        return state;
+    }
+
+    /**
+     * @brief Buffer callback, for Comms using setHandleMessageCallback
+     */
+    template<typename TBuffer>
+    HandleMessageState handleBuffer(TBuffer* buffer) {
+        pb_istream_t in = pb_istream_from_buffer(buffer->inBuffer, buffer->inMessageLength);
+        size_t length = 0;
+        const HandleMessageState state = handle(in, buffer->outBuffer, sizeof(buffer->outBuffer), length);
+        buffer->outMessageLength = length;
+        return state;
+    }
+
+    /**
+     * @brief Answers the transactions arriving on a Comm, as its message view callback
+     */
+    template<typename Config, typename Integrity>
+    void attach(BasicComm<Config, Integrity>& comm) {
+        typedef typename BasicComm<Config, Integrity>::Buffer TBuffer;
+        comm.setHandleMessageViewCallback(
+            etl::delegate<HandleMessageState(const MessageView&, TBuffer*)>::template
+                create<ShareRegistry, &ShareRegistry::template handleMessage<TBuffer>>(*this));
+    }
+
+private:
+    // TransactionMessage field numbers
+    static constexpr uint32_t TokenTag = 1;
+    static constexpr uint32_t ActionTag = 2;
+    static constexpr uint32_t ShareIdTag = 3;
+    static constexpr uint32_t DataLengthTag = 4;
+    static constexpr uint32_t DataTag = 5;
+
+    struct Entry {
+        void* data = nullptr;
+        const pb_msgdesc_t* fields = nullptr;
+        // @brief Largest encoding, from the nanopb generated size
+        uint8_t size = 0;
+        bool readOnly = false;
+        ShareHook hook;
+        // @brief The share as last sent, when published as deltas
+        DeltaShadow* shadow = nullptr;
+    };
+
+    Entry shares[ShareIds];
+    Entry commons[CommonIds];
+    Common1 common1 = Common1_init_zero;
+    SubscribeHook subscribeFunction;
+
+    static bool add(Entry* table, size_t ids, uint32_t id, void* data, const pb_msgdesc_t* fields, size_t size,
+                    ShareHook hook, bool readOnly) {
+        if(id >= ids || table[id].data != nullptr){
+            return false;
+        }
+        Entry& entry = table[id];
+        entry.data = data;
+        entry.fields = fields;
+        entry.size = size;
+        entry.readOnly = readOnly;
+        entry.hook = hook;
+        return true;
+    }
+
+    static bool isPublish(uint64_t action) {
+        return action == TransactionMessage_Action_COMMON_PUBLISH || action == TransactionMessage_Action_SHARE_PUBLISH;
+    }
+
+    // The registered entry an action and id refer to, nullptr when there is none
+    const Entry* lookup(uint64_t action, uint32_t id) const {
+        const Entry* entry = nullptr;
+        if(action >= TransactionMessage_Action_COMMON_REQUEST && action <= TransactionMessage_Action_COMMON_RESPONSE){
+            entry = id < CommonIds ? &commons[id] : nullptr;
+        }else if(action >= TransactionMessage_Action_SHARE_REQUEST && action <= TransactionMessage_Action_SHARE_DELTA){
+            entry = id < ShareIds ? &shares[id] : nullptr;
+        }
+        return entry != nullptr && entry->data != nullptr ? entry : nullptr;
+    }
+
+    // Decodes the data field straight into a struct, any zero padding ends it
+    static bool decodeData(pb_istream_t& in, const pb_msgdesc_t* fields, void* dest) {
+        pb_istream_t data;
+        if(!pb_make_string_substream(&in, &data)){
+            return false;
+        }
+        const bool decoded = pb_decode(&data, fields, dest);
+        return pb_close_string_substream(&in, &data) && decoded;
+    }
+
+    /**
+     * Encodes the response in one pass, the share straight into the data field. As
+     * data is fixed length its size is known before the share is encoded, and
+     * dataLength follows data, fields may be in any order, so no sizing pass is needed.
+     */
+    static HandleMessageState encodeResponse(uint8_t* out, size_t capacity, uint32_t token,
+                                             TransactionMessage_Action action, uint32_t shareId,
+                                             const pb_msgdesc_t* fields, const void* data, size_t& length) {
+        static const pb_byte_t padding[ShareDataSize] = {0};
+        pb_ostream_t stream = pb_ostream_from_buffer(out, capacity);
+        if(!pb_encode_tag(&stream, PB_WT_32BIT, TokenTag) || !pb_encode_fixed32(&stream, &token) ||
+           !pb_encode_tag(&stream, PB_WT_VARINT, ActionTag) || !pb_encode_varint(&stream, action) ||
+           !pb_encode_tag(&stream, PB_WT_32BIT, ShareIdTag) || !pb_encode_fixed32(&stream, &shareId) ||
+           !pb_encode_tag(&stream, PB_WT_STRING, DataTag) || !pb_encode_varint(&stream, ShareDataSize)){
+            return HandleMessageState::FAILED_ENCODE;
+        }
+        const size_t start = stream.bytes_written;
+        if(!pb_encode(&stream, fields, data)){
+            return HandleMessageState::FAILED_ENCODE;
+        }
+        const uint32_t dataLength = stream.bytes_written - start;
+        if(dataLength > ShareDataSize || !pb_write(&stream, padding, ShareDataSize - dataLength) ||
+           !pb_encode_tag(&stream, PB_WT_32BIT, DataLengthTag) || !pb_encode_fixed32(&stream, &dataLength)){
+            return HandleMessageState::FAILED_ENCODE;
+        }
+        length = stream.bytes_written;
+        return HandleMessageState::OK;
+    }
+
+    // Encodes a SHARE_DELTA of a tracked share, its data as long as the delta
+    static HandleMessageState encodeDeltaMessage(uint8_t* out, size_t capacity, uint32_t token, uint32_t shareId,
+                                                 const Entry& entry, bool full, size_t& length) {
+        uint8_t encoded[DeltaMaxShare];
+        pb_ostream_t share = pb_ostream_from_buffer(encoded, sizeof(encoded));
+        if(!pb_encode(&share, entry.fields, entry.data)){
+            return HandleMessageState::FAILED_ENCODE;
+        }
+        uint8_t delta[DeltaMaxSize];
+        const uint32_t dataLength = full ? encodeFullDelta(*entry.shadow, encoded, share.bytes_written, delta)
+                                         : encodeDelta(*entry.shadow, encoded, share.bytes_written, delta);
+        const uint64_t action = TransactionMessage_Action_SHARE_DELTA;
+        pb_ostream_t stream = pb_ostream_from_buffer(out, capacity);
+        if(dataLength == 0 ||
+           !pb_encode_tag(&stream, PB_WT_32BIT, TokenTag) || !pb_encode_fixed32(&stream, &token) ||
+           !pb_encode_tag(&stream, PB_WT_VARINT, ActionTag) || !pb_encode_varint(&stream, action) ||
+           !pb_encode_tag(&stream, PB_WT_32BIT, ShareIdTag) || !pb_encode_fixed32(&stream, &shareId) ||
+           !pb_encode_tag(&stream, PB_WT_32BIT, DataLengthTag) || !pb_encode_fixed32(&stream, &dataLength) ||
+           !pb_encode_tag(&stream, PB_WT_STRING, DataTag) || !pb_encode_string(&stream, delta, dataLength)){
+            return HandleMessageState::FAILED_ENCODE;
+        }
+        length = stream.bytes_written;
+        return HandleMessageState::OK;
+    }
+};
+} // NAMESPACE
+#endif // SHARES_H
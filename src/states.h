@@ -0,0 +1,41 @@
+#ifndef STATES_H
+#define STATES_H
+
+#include <Arduino.h>
+
+namespace corelib {
+
+enum class HandleMessageState : uint8_t {
+    OK = 0,
+    ERROR = 1,
+    NO_DATA = 2,
+    FAILED_DECODE = 3,
+    FAILED_ENCODE = 4
+};
+
+enum class ReadState : uint8_t {
+    OK = 0,
+    ERROR = 1,
+    IN_FRAMES_FULL = 2,
+    NO_DATA = 3,
+    MISMATCH_CRC = 4
+};
+
+enum class WriteState : uint8_t {
+    OK = 0,
+    ERROR = 1,
+    OUT_FRAMES_EMPTY = 2
+};
+
+enum class ProcessState : uint8_t {
+    OK = 0,
+    ERROR = 1
+};
+
+// Number of values of each state, used to size outcome counters
+static constexpr size_t HandleMessageStateCount = static_cast<size_t>(HandleMessageState::FAILED_ENCODE) + 1;
+static constexpr size_t ReadStateCount = static_cast<size_t>(ReadState::MISMATCH_CRC) + 1;
+static constexpr size_t WriteStateCount = static_cast<size_t>(WriteState::OUT_FRAMES_EMPTY) + 1;
+
+} // NAMESPACE
+#endif // STATES_H
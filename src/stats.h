@@ -0,0 +1,398 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <Arduino.h>
+#include "states.h"
+#include "transaction.pb.h"
+
+#if defined (NATIVE)
+#include <chrono>
+#endif
+
+/**
+ * Statistics are collected by default and cost a few increments per pipeline stage.
+ *  -D CORELIB_NO_STATS      compiles the counters out, every call becomes empty
+ *  -D CORELIB_STAGE_TIMING  adds per stage timing (cpu cycles on device, ns on native)
+ */
+
+namespace corelib {
+
+/**
+ * @brief The pipeline stages of a Comm interface which may be timed
+ */
+enum class Stage : uint8_t {
+    READ = 0,
+    INCOMING = 1,
+    CALLBACK = 2,
+    OUTGOING = 3,
+    WRITE = 4
+};
+
+static constexpr size_t StageCount = static_cast<size_t>(Stage::WRITE) + 1;
+
+/**
+ * @brief Timing of a single stage in StageClock ticks
+ */
+struct StageTiming {
+    uint32_t calls = 0;
+    uint32_t totalTicks = 0;
+    uint32_t maxTicks = 0;
+};
+
+// @brief Buckets of the ping round trip histogram, bucket n counts round trips under
+// 2^(n+4) microseconds and the last one every longer round trip
+static constexpr size_t RttBucketCount = 16;
+
+/// The histogram bucket of a round trip in microseconds
+inline size_t rttBucket(uint32_t rtt) {
+    const size_t bits = rtt < 16 ? 0 : 32 - __builtin_clz(rtt) - 4;
+    return bits < RttBucketCount ? bits : RttBucketCount - 1;
+}
+
+/**
+ * @brief Counters of a Comm interface
+ */
+struct CommStats {
+    // @brief Outcomes by state value
+    uint32_t readStates[ReadStateCount] = {0};
+    uint32_t writeStates[WriteStateCount] = {0};
+    uint32_t handleStates[HandleMessageStateCount] = {0};
+    // @brief Traffic
+    uint32_t framesIn = 0;
+    uint32_t framesOut = 0;
+    uint32_t bytesIn = 0;
+    uint32_t bytesOut = 0;
+    // @brief Messages reassembled
+    uint32_t completions = 0;
+    // @brief Partial messages dropped after losing a fragment
+    uint32_t evictions = 0;
+    // @brief Frames for other devices written, or dropped by a full relay queue
+    uint32_t framesRelayed = 0;
+    uint32_t relayDrops = 0;
+    // @brief Most messages held at once
+    uint32_t inFramesHighWater = 0;
+    uint32_t outFramesHighWater = 0;
+    // @brief Messages queued for transmit now
+    uint32_t outFramesQueued = 0;
+    // @brief Most iterations a message waited to start being written
+    uint32_t txWaitMax = 0;
+    // @brief Requests with a token answered from the response cache, or handled
+    uint32_t responseCacheHits = 0;
+    uint32_t responseCacheMisses = 0;
+    // @brief Pings sent, pings of other devices answered and responses received
+    uint32_t pingsSent = 0;
+    uint32_t pingsAnswered = 0;
+    uint32_t pingResponses = 0;
+    // @brief Round trips of answered pings in microseconds, see RttBucketCount
+    uint32_t rttHistogram[RttBucketCount] = {0};
+    uint32_t rttMin = 0;
+    uint32_t rttMax = 0;
+    // @brief The clock of the device pinged, its time less ours in microseconds
+    // (wrapping) and how much faster it runs in parts per billion, see timesync.h
+    uint32_t clockOffset = 0;
+    int32_t clockDrift = 0;
+    // @brief Per stage timing, only with CORELIB_STAGE_TIMING
+    StageTiming stages[StageCount];
+};
+
+/**
+ * @brief Free running tick source for stage timing
+ */
+class StageClock
+{
+public:
+    static void begin() {
+        #if !defined (NATIVE) && defined (ARM_DWT_CYCCNT)
+        // Teensy 3.x leaves the cycle counter disabled
+        ARM_DEMCR |= ARM_DEMCR_TRCENA;
+        ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+        #endif
+    }
+
+    static uint32_t now() {
+        #if defined (NATIVE)
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+        #elif defined (ARM_DWT_CYCCNT)
+        return ARM_DWT_CYCCNT;
+        #else
+        return micros();
+        #endif
+    }
+
+    /// Ticks per second
+    static uint32_t hz() {
+        #if defined (NATIVE)
+        return 1000000000UL;
+        #elif defined (ARM_DWT_CYCCNT)
+        return F_CPU;
+        #else
+        return 1000000UL;
+        #endif
+    }
+};
+
+#if !defined (CORELIB_NO_STATS)
+
+/**
+ * @brief Collects the statistics of a Comm interface
+ */
+class CommStatistics
+{
+public:
+    CommStatistics() {
+        #if defined (CORELIB_STAGE_TIMING)
+        StageClock::begin();
+        #endif
+    }
+
+    void count(ReadState state) {
+        stats.readStates[static_cast<uint8_t>(state)]++;
+    }
+
+    void count(WriteState state) {
+        stats.writeStates[static_cast<uint8_t>(state)]++;
+    }
+
+    void count(HandleMessageState state) {
+        if(static_cast<uint8_t>(state) < HandleMessageStateCount){
+            stats.handleStates[static_cast<uint8_t>(state)]++;
+        }
+    }
+
+    void frameIn(size_t bytes) {
+        stats.framesIn++;
+        stats.bytesIn += bytes;
+    }
+
+    void frameOut(size_t bytes) {
+        stats.framesOut++;
+        stats.bytesOut += bytes;
+    }
+
+    void completion() {
+        stats.completions++;
+    }
+
+    void evicted(size_t messages) {
+        stats.evictions += messages;
+    }
+
+    void relayed() {
+        stats.framesRelayed++;
+    }
+
+    void relayDropped() {
+        stats.relayDrops++;
+    }
+
+    void responseCacheHit() {
+        stats.responseCacheHits++;
+    }
+
+    void responseCacheMiss() {
+        stats.responseCacheMisses++;
+    }
+
+    void pingSent() {
+        stats.pingsSent++;
+    }
+
+    void pingAnswered() {
+        stats.pingsAnswered++;
+    }
+
+    void pingResponse(uint32_t rtt, uint32_t offset, int32_t drift) {
+        stats.rttHistogram[rttBucket(rtt)]++;
+        if(stats.pingResponses == 0 || rtt < stats.rttMin){
+            stats.rttMin = rtt;
+        }
+        if(rtt > stats.rttMax){
+            stats.rttMax = rtt;
+        }
+        stats.pingResponses++;
+        stats.clockOffset = offset;
+        stats.clockDrift = drift;
+    }
+
+    void inFramesUsed(size_t used) {
+        if(used > stats.inFramesHighWater){
+            stats.inFramesHighWater = used;
+        }
+    }
+
+    void outFramesUsed(size_t used) {
+        stats.outFramesQueued = used;
+        if(used > stats.outFramesHighWater){
+            stats.outFramesHighWater = used;
+        }
+    }
+
+    void txWaited(uint32_t iterations) {
+        if(iterations > stats.txWaitMax){
+            stats.txWaitMax = iterations;
+        }
+    }
+
+    /// Marks the start of a stage, pass the result to endStage
+    uint32_t startStage() {
+        #if defined (CORELIB_STAGE_TIMING)
+        return StageClock::now();
+        #else
+        return 0;
+        #endif
+    }
+
+    void endStage(Stage stage, uint32_t start) {
+        #if defined (CORELIB_STAGE_TIMING)
+        const uint32_t ticks = StageClock::now() - start;
+        StageTiming& timing = stats.stages[static_cast<uint8_t>(stage)];
+        timing.calls++;
+        timing.totalTicks += ticks;
+        if(ticks > timing.maxTicks){
+            timing.maxTicks = ticks;
+        }
+        #else
+        (void) stage;
+        (void) start;
+        #endif
+    }
+
+    const CommStats& get() const {
+        return stats;
+    }
+
+    void reset() {
+        stats = CommStats();
+    }
+
+private:
+    CommStats stats;
+};
+
+#else
+
+/**
+ * @brief Statistics compiled out with CORELIB_NO_STATS
+ */
+class CommStatistics
+{
+public:
+    void count(ReadState) {}
+    void count(WriteState) {}
+    void count(HandleMessageState) {}
+    void frameIn(size_t) {}
+    void frameOut(size_t) {}
+    void completion() {}
+    void evicted(size_t) {}
+    void relayed() {}
+    void relayDropped() {}
+    void responseCacheHit() {}
+    void responseCacheMiss() {}
+    void pingSent() {}
+    void pingAnswered() {}
+    void pingResponse(uint32_t, uint32_t, int32_t) {}
+    void inFramesUsed(size_t) {}
+    void outFramesUsed(size_t) {}
+    void txWaited(uint32_t) {}
+    uint32_t startStage() { return 0; }
+    void endStage(Stage, uint32_t) {}
+    void reset() {}
+
+    const CommStats& get() const {
+        static const CommStats empty;
+        return empty;
+    }
+};
+
+#endif
+
+/**
+ * @brief Copies the outcome counters into their share message
+ */
+inline void toMessage(const CommStats& stats, CommStats1& message) {
+    message.readOk = stats.readStates[static_cast<uint8_t>(ReadState::OK)];
+    message.readError = stats.readStates[static_cast<uint8_t>(ReadState::ERROR)];
+    message.readInFramesFull = stats.readStates[static_cast<uint8_t>(ReadState::IN_FRAMES_FULL)];
+    message.readNoData = stats.readStates[static_cast<uint8_t>(ReadState::NO_DATA)];
+    message.readMismatchCrc = stats.readStates[static_cast<uint8_t>(ReadState::MISMATCH_CRC)];
+    message.writeOk = stats.writeStates[static_cast<uint8_t>(WriteState::OK)];
+    message.writeError = stats.writeStates[static_cast<uint8_t>(WriteState::ERROR)];
+    message.writeOutFramesEmpty = stats.writeStates[static_cast<uint8_t>(WriteState::OUT_FRAMES_EMPTY)];
+    message.handleOk = stats.handleStates[static_cast<uint8_t>(HandleMessageState::OK)];
+    message.handleError = stats.handleStates[static_cast<uint8_t>(HandleMessageState::ERROR)];
+    message.handleNoData = stats.handleStates[static_cast<uint8_t>(HandleMessageState::NO_DATA)];
+    message.handleFailedDecode = stats.handleStates[static_cast<uint8_t>(HandleMessageState::FAILED_DECODE)];
+    message.handleFailedEncode = stats.handleStates[static_cast<uint8_t>(HandleMessageState::FAILED_ENCODE)];
+}
+
+/**
+ * @brief Copies the traffic counters into their share message
+ */
+inline void toMessage(const CommStats& stats, CommStats2& message) {
+    message.framesIn = stats.framesIn;
+    message.framesOut = stats.framesOut;
+    message.bytesIn = stats.bytesIn;
+    message.bytesOut = stats.bytesOut;
+    message.completions = stats.completions;
+    message.evictions = stats.evictions;
+    message.inFramesHighWater = stats.inFramesHighWater;
+    message.outFramesHighWater = stats.outFramesHighWater;
+    message.framesRelayed = stats.framesRelayed;
+    message.relayDrops = stats.relayDrops;
+    message.outFramesQueued = stats.outFramesQueued;
+    message.txWaitMax = stats.txWaitMax;
+}
+
+/**
+ * @brief Copies the response cache counters into their share message
+ */
+inline void toMessage(const CommStats& stats, CommStats3& message) {
+    message.responseCacheHits = stats.responseCacheHits;
+    message.responseCacheMisses = stats.responseCacheMisses;
+}
+
+/**
+ * @brief Copies the ping counters and the clock estimate into their share message
+ */
+inline void toMessage(const CommStats& stats, CommPing1& message) {
+    message.pingsSent = stats.pingsSent;
+    message.pingsAnswered = stats.pingsAnswered;
+    message.pingResponses = stats.pingResponses;
+    message.rttMin = stats.rttMin;
+    message.rttMax = stats.rttMax;
+    message.clockOffset = stats.clockOffset;
+    message.clockDrift = stats.clockDrift;
+}
+
+/**
+ * @brief Copies the round trip histogram into its share message
+ */
+inline void toMessage(const CommStats& stats, CommPing2& message) {
+    static_assert(sizeof(message.rttHistogram) == sizeof(stats.rttHistogram),
+        "CommPing2 must hold every round trip bucket");
+    memcpy(message.rttHistogram, stats.rttHistogram, sizeof(message.rttHistogram));
+}
+
+/**
+ * @brief Copies the stage timing into its share message
+ */
+inline void toMessage(const CommStats& stats, CommTiming1& message) {
+    uint32_t mean[StageCount];
+    for(uint8_t i = 0; i < StageCount; i++){
+        mean[i] = stats.stages[i].calls ? stats.stages[i].totalTicks / stats.stages[i].calls : 0;
+    }
+    message.tickHz = StageClock::hz();
+    message.readMean = mean[static_cast<uint8_t>(Stage::READ)];
+    message.readMax = stats.stages[static_cast<uint8_t>(Stage::READ)].maxTicks;
+    message.incomingMean = mean[static_cast<uint8_t>(Stage::INCOMING)];
+    message.incomingMax = stats.stages[static_cast<uint8_t>(Stage::INCOMING)].maxTicks;
+    message.callbackMean = mean[static_cast<uint8_t>(Stage::CALLBACK)];
+    message.callbackMax = stats.stages[static_cast<uint8_t>(Stage::CALLBACK)].maxTicks;
+    message.outgoingMean = mean[static_cast<uint8_t>(Stage::OUTGOING)];
+    message.outgoingMax = stats.stages[static_cast<uint8_t>(Stage::OUTGOING)].maxTicks;
+    message.writeMean = mean[static_cast<uint8_t>(Stage::WRITE)];
+    message.writeMax = stats.stages[static_cast<uint8_t>(Stage::WRITE)].maxTicks;
+}
+} // NAMESPACE
+#endif // STATS_H
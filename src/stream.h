@@ -0,0 +1,321 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <Arduino.h>
+#include "frame.h"
+
+namespace corelib {
+
+/**
+ * Streaming transfers carry messages too large for a Comm buffer (calibration tables,
+ * logs) as a sequence of STREAM frames, without holding the whole message in memory.
+ *
+ * For STREAM frames `frameOrder` and `frameTotal` together hold a 16 bit fragment
+ * index, low byte first, and `frameID` identifies the stream. Fragment 0 is the
+ * header, its payload holds the total length (uint32) and a channel (uint16), both
+ * little endian, so the receiver knows what the data is and where it should go.
+ * Fragments 1..N carry the data, 50 bytes each, the last one padded with zeros.
+ *
+ * A stream of up to 65535 data fragments (3.2 MB) may be sent. There is no
+ * retransmission, a stream which stops receiving fragments times out and is aborted.
+ */
+
+static constexpr size_t StreamFragmentSize = sizeof(Frame::payload);
+static constexpr uint32_t StreamMaxLength = 0xFFFFUL * StreamFragmentSize;
+
+inline uint16_t streamIndex(const Frame& frame) {
+    return frame.frameOrder | (static_cast<uint16_t>(frame.frameTotal) << 8);
+}
+
+inline void setStreamIndex(Frame& frame, uint16_t index) {
+    frame.frameOrder = index & 0xFF;
+    frame.frameTotal = index >> 8;
+}
+
+/// Number of data fragments of a stream
+inline uint16_t streamFragments(uint32_t length) {
+    return (length + StreamFragmentSize - 1) / StreamFragmentSize;
+}
+
+/**
+ * @brief Describes an incoming stream, from its header fragment
+ */
+struct StreamInfo {
+    uint32_t streamID = 0;
+    uint32_t length = 0;
+    uint16_t channel = 0;
+    uint8_t sourceAddress = 0;
+};
+
+/**
+ * @brief Consumes an incoming stream as it arrives, e.g. a flash writer or RAM region.
+ * Fragments may arrive out of order and are written at their offset.
+ */
+class StreamSink
+{
+public:
+    /**
+     * @brief A new stream is starting
+     *
+     * @return true The stream is accepted, false to ignore it
+     */
+    virtual bool begin(const StreamInfo& info) = 0;
+
+    /**
+     * @brief Stores part of the stream
+     *
+     * @return true The data was stored, false aborts the stream
+     */
+    virtual bool write(uint32_t offset, const uint8_t* data, size_t length) = 0;
+
+    /**
+     * @brief The stream is over
+     *
+     * @param complete true when every byte was written, false when aborted
+     */
+    virtual void end(bool complete) = 0;
+};
+
+/**
+ * @brief Produces an outgoing stream on demand, in order
+ */
+class StreamSource
+{
+public:
+    /**
+     * @brief Reads the next part of the stream
+     *
+     * @return size_t The bytes read, less than `length` aborts the stream
+     */
+    virtual size_t read(uint32_t offset, uint8_t* data, size_t length) = 0;
+
+    /**
+     * @brief The stream is over
+     *
+     * @param complete true when every fragment was sent, false when aborted
+     */
+    virtual void end(bool complete) {
+        (void) complete;
+    }
+};
+
+/**
+ * @brief Feeds the fragments of one incoming stream at a time into a sink.
+ *
+ * Duplicates are found with a 32 fragment sliding window: `base` is the lowest data
+ * fragment not received yet and bit n of `window` marks fragment base+n received.
+ * Fragments beyond the window are dropped.
+ */
+class StreamReceiver
+{
+public:
+    static constexpr uint16_t WindowSize = 32;
+
+    void setSink(StreamSink* streamSink) {
+        abort();
+        sink = streamSink;
+    }
+
+    bool active() const {
+        return receiving;
+    }
+
+    const StreamInfo& info() const {
+        return current;
+    }
+
+    /**
+     * @brief Handles a STREAM frame
+     *
+     * @param now The current time, used to time out a stalled stream
+     * @return true The frame was accepted
+     */
+    bool receive(const Frame& frame, uint32_t now) {
+        if(sink == nullptr){
+            return false;
+        }
+        const uint16_t index = streamIndex(frame);
+        if(index == 0){
+            return open(frame, now);
+        }
+        if(!receiving || frame.frameID != current.streamID || frame.sourceAddress != current.sourceAddress ||
+           index > fragments || index < base){
+            return false;
+        }
+        if(index - base >= WindowSize){
+            return false;
+        }
+        const uint32_t bit = 1UL << (index - base);
+        if(window & bit){
+            return false;
+        }
+        const uint32_t offset = static_cast<uint32_t>(index - 1) * StreamFragmentSize;
+        const uint32_t remaining = current.length - offset;
+        if(!sink->write(offset, frame.payload, remaining < StreamFragmentSize ? remaining : StreamFragmentSize)){
+            close(false);
+            return false;
+        }
+        lastArrival = now;
+        window |= bit;
+        // Slide past every fragment received in order
+        while(window & 1){
+            window >>= 1;
+            base++;
+        }
+        if(base > fragments){
+            close(true);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Aborts the stream when no fragment arrived within the timeout
+     *
+     * @return true The stream was aborted
+     */
+    bool expire(uint32_t now, uint32_t timeout) {
+        if(receiving && now - lastArrival >= timeout){
+            close(false);
+            return true;
+        }
+        return false;
+    }
+
+    void abort() {
+        if(receiving){
+            close(false);
+        }
+    }
+
+private:
+    StreamSink* sink = nullptr;
+    StreamInfo current;
+    bool receiving = false;
+    uint16_t fragments = 0;
+    // @brief Lowest data fragment index not received yet
+    uint32_t base = 1;
+    // @brief Fragments received from base on, bit 0 is base itself
+    uint32_t window = 0;
+    uint32_t lastArrival = 0;
+
+    bool open(const Frame& frame, uint32_t now) {
+        StreamInfo info;
+        info.streamID = frame.frameID;
+        info.sourceAddress = frame.sourceAddress;
+        info.length = frame.payload[0] | (frame.payload[1] << 8) | (frame.payload[2] << 16) |
+                      (static_cast<uint32_t>(frame.payload[3]) << 24);
+        info.channel = frame.payload[4] | (frame.payload[5] << 8);
+        if(receiving){
+            // A repeated header is harmless, another stream must wait its turn
+            return info.streamID == current.streamID && info.sourceAddress == current.sourceAddress;
+        }
+        if(info.length > StreamMaxLength || !sink->begin(info)){
+            return false;
+        }
+        current = info;
+        fragments = streamFragments(info.length);
+        base = 1;
+        window = 0;
+        lastArrival = now;
+        receiving = true;
+        if(fragments == 0){
+            close(true);
+        }
+        return true;
+    }
+
+    void close(bool complete) {
+        receiving = false;
+        sink->end(complete);
+    }
+};
+
+/**
+ * @brief Produces the frames of one outgoing stream at a time, pulling each
+ * fragment from its source only when the frame is about to be written.
+ */
+class StreamSender
+{
+public:
+    /**
+     * @brief Starts sending a stream
+     *
+     * @return false Another stream is being sent or the stream is too long
+     */
+    bool begin(StreamSource* streamSource, uint32_t streamID, uint32_t length, uint16_t channel) {
+        if(source != nullptr || streamSource == nullptr || length > StreamMaxLength){
+            return false;
+        }
+        source = streamSource;
+        id = streamID;
+        total = length;
+        streamChannel = channel;
+        fragments = streamFragments(length);
+        next = 0;
+        return true;
+    }
+
+    bool active() const {
+        return source != nullptr;
+    }
+
+    /**
+     * @brief Fills the preamble, frameID, index and payload of the next frame
+     *
+     * @return false There is nothing to send, or the source failed
+     */
+    bool produce(Frame& frame) {
+        if(source == nullptr){
+            return false;
+        }
+        frame.preamble = Preamble::STREAM;
+        frame.frameID = id;
+        setStreamIndex(frame, next);
+        memset(frame.payload, 0, sizeof(frame.payload));
+        if(next == 0){
+            frame.payload[0] = total & 0xFF;
+            frame.payload[1] = (total >> 8) & 0xFF;
+            frame.payload[2] = (total >> 16) & 0xFF;
+            frame.payload[3] = total >> 24;
+            frame.payload[4] = streamChannel & 0xFF;
+            frame.payload[5] = streamChannel >> 8;
+        }else{
+            const uint32_t offset = static_cast<uint32_t>(next - 1) * StreamFragmentSize;
+            const uint32_t remaining = total - offset;
+            const size_t length = remaining < StreamFragmentSize ? remaining : StreamFragmentSize;
+            if(source->read(offset, frame.payload, length) < length){
+                finish(false);
+                return false;
+            }
+        }
+        if(next == fragments){
+            finish(true);
+        }else{
+            next++;
+        }
+        return true;
+    }
+
+    void abort() {
+        if(source != nullptr){
+            finish(false);
+        }
+    }
+
+private:
+    StreamSource* source = nullptr;
+    uint32_t id = 0;
+    uint32_t total = 0;
+    uint16_t streamChannel = 0;
+    uint16_t fragments = 0;
+    // @brief Index of the next fragment to produce, 0 is the header
+    uint16_t next = 0;
+
+    void finish(bool complete) {
+        StreamSource* finished = source;
+        source = nullptr;
+        finished->end(complete);
+    }
+};
+} // NAMESPACE
+#endif // STREAM_H
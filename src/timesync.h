@@ -0,0 +1,181 @@
+#ifndef TIMESYNC_H
+#define TIMESYNC_H
+
+#include <Arduino.h>
+#include "frame.h"
+#include "arp.h"
+
+namespace corelib {
+
+/**
+ * @brief The payload of a PING_REQUEST and its PING_RESPONSE, four little endian
+ * uint32 at the start of the payload. Times are microseconds of the clock of the device
+ * named, wrapping.
+ *
+ *  0 sequence  chosen by the pinging device, echoed
+ *  4 sent      pinging device, when the request was written
+ *  8 received  answering device, when the request was read
+ * 12 answered  answering device, when the response was written
+ */
+struct PingTimes {
+    uint32_t sequence = 0;
+    uint32_t sent = 0;
+    uint32_t received = 0;
+    uint32_t answered = 0;
+};
+
+inline void encodePingTimes(const PingTimes& times, uint8_t* payload) {
+    memset(payload, 0, sizeof(Frame::payload));
+    arpPut(payload, times.sequence);
+    arpPut(payload + 4, times.sent);
+    arpPut(payload + 8, times.received);
+    arpPut(payload + 12, times.answered);
+}
+
+inline PingTimes decodePingTimes(const uint8_t* payload) {
+    PingTimes times;
+    times.sequence = arpGet(payload);
+    times.sent = arpGet(payload + 4);
+    times.received = arpGet(payload + 8);
+    times.answered = arpGet(payload + 12);
+    return times;
+}
+
+/**
+ * @brief Estimates the clock of another device from ping round trips.
+ *
+ * Each answered ping gives the offset of the other clock as the mean of the two
+ * one-way differences. The error is half the difference between the outbound and
+ * return delays, at most half the round trip. A round trip more than twice the
+ * shortest recent one has likely waited in a queue, it is left out.
+ *
+ * Offset and drift are tracked by a second order loop. The offset moves 1/OffsetGain of
+ * the way to each sample and the drift takes 1/DriftGain of the error rate, so jitter
+ * is smoothed over a few tens of samples and a steady drift leaves no lasting error.
+ * Arithmetic wraps with the 32 bit clocks, the two clocks may be any distance apart.
+ */
+class ClockSync
+{
+public:
+    static constexpr int32_t OffsetGain = 4;
+    static constexpr int32_t DriftGain = 16;
+    // @brief Round trips up to this much over twice the shortest are always used
+    static constexpr uint32_t RttSlack = 100;
+
+    /**
+     * @brief Forgets the estimate, e.g. to follow another device
+     */
+    void reset(uint8_t peerAddress = 0x00) {
+        peerDevice = peerAddress;
+        count = 0;
+        offsetValue = 0;
+        offsetFine = 0;
+        driftValue = 0;
+        lastLocal = 0;
+        lastRtt = 0;
+        shortestRtt = 0;
+    }
+
+    /**
+     * @brief Adds the times of an answered ping
+     *
+     * @param times The times in the response
+     * @param arrived Local time the response was read
+     * @return false The round trip was too long, the estimate is unchanged
+     */
+    bool add(const PingTimes& times, uint32_t arrived) {
+        const int32_t rtt = static_cast<int32_t>((arrived - times.sent) - (times.answered - times.received));
+        lastRtt = rtt < 0 ? 0 : rtt;
+        if(count > 0 && lastRtt > 2 * shortestRtt + RttSlack){
+            // Let the shortest round trip rise slowly, the route may have changed
+            shortestRtt += (shortestRtt >> 4) + 1;
+            return false;
+        }
+        if(count == 0 || lastRtt < shortestRtt){
+            shortestRtt = lastRtt;
+        }
+        const uint32_t outbound = times.received - times.sent;
+        const uint32_t inbound = times.answered - arrived;
+        // Local time half way through the round trip
+        const uint32_t local = times.sent + (arrived - times.sent) / 2;
+        if(count == 0){
+            offsetValue = outbound + static_cast<int32_t>(inbound - outbound) / 2;
+            offsetFine = 0;
+        }else{
+            // In 1/256 us, whole microseconds would leave small errors to the drift alone
+            const uint32_t elapsed = local - lastLocal;
+            const int64_t ahead = fineAt(local);
+            const int64_t error = static_cast<int64_t>(static_cast<int32_t>(outbound - offsetValue)) * 256 +
+                                  static_cast<int64_t>(static_cast<int32_t>(inbound - outbound)) * 128 - ahead;
+            const int64_t fine = ahead + error / OffsetGain;
+            offsetValue += static_cast<int32_t>(fine >> 8);
+            offsetFine = static_cast<uint8_t>(fine & 0xFF);
+            if(elapsed > 0 && elapsed < 0x80000000UL){
+                driftValue += static_cast<int32_t>(error * (1000000000LL / 256) / elapsed / DriftGain);
+            }
+        }
+        lastLocal = local;
+        count++;
+        return true;
+    }
+
+    /// Peer time less local time, microseconds modulo 2^32, at a local time
+    uint32_t offsetAt(uint32_t local) const {
+        return offsetValue + static_cast<int32_t>(fineAt(local) >> 8);
+    }
+
+    /// Peer time less local time at the last sample
+    uint32_t offset() const {
+        return offsetValue;
+    }
+
+    /// How much faster the peer clock runs, parts per billion
+    int32_t drift() const {
+        return driftValue;
+    }
+
+    /// The peer's clock at a local time
+    uint32_t toPeer(uint32_t local) const {
+        return local + offsetAt(local);
+    }
+
+    /// The local clock at a peer time
+    uint32_t toLocal(uint32_t peer) const {
+        return peer - offsetAt(peer - offsetValue);
+    }
+
+    /// The device the estimate is of
+    uint8_t peer() const {
+        return peerDevice;
+    }
+
+    /// Samples used by the estimate
+    uint32_t samples() const {
+        return count;
+    }
+
+    /// Round trip of the last answered ping, microseconds
+    uint32_t rtt() const {
+        return lastRtt;
+    }
+
+private:
+    /// Offset at a local time beyond offsetValue, 1/256 us
+    int64_t fineAt(uint32_t local) const {
+        const int32_t elapsed = static_cast<int32_t>(local - lastLocal);
+        return offsetFine + static_cast<int64_t>(driftValue) * elapsed * 256 / 1000000000LL;
+    }
+
+    uint8_t peerDevice = 0x00;
+    uint32_t count = 0;
+    uint32_t offsetValue = 0;
+    // @brief Fraction of a microsecond to add to offsetValue, 1/256 us
+    uint8_t offsetFine = 0;
+    int32_t driftValue = 0;
+    // @brief Local time of the last sample
+    uint32_t lastLocal = 0;
+    uint32_t lastRtt = 0;
+    uint32_t shortestRtt = 0;
+};
+} // NAMESPACE
+#endif // TIMESYNC_H
@@ -0,0 +1,202 @@
+#ifndef TXQUEUE_H
+#define TXQUEUE_H
+
+#include <Arduino.h>
+#include "frame.h"
+#include "framepool.h"
+
+namespace corelib {
+
+/**
+ * @brief Transmit priority of an outgoing message
+ */
+enum class TxLane : uint8_t {
+    // @brief Handshakes and responses, written first
+    PRIORITY = 0,
+    // @brief Publishes and other unprompted traffic
+    BULK = 1
+};
+
+static constexpr size_t TxLaneCount = static_cast<size_t>(TxLane::BULK) + 1;
+
+/**
+ * @brief The outgoing messages of a Comm, written a frame at a time.
+ *
+ * The next frame is always from the oldest message of the highest priority lane, so a
+ * response queued behind a publish overtakes it between two of its frames. Each message
+ * remembers how many of its frames were written, a frame the transport did not accept
+ * is written again rather than the whole message. The last entry is kept for the
+ * PRIORITY lane, BULK traffic cannot hold up a response.
+ *
+ * Frames are taken from a FramePool as PoolOwner::TX when a message is queued and
+ * given back as soon as they are written. A message is refused when the pool cannot
+ * give all of its frames.
+ *
+ * @tparam Depth Number of messages which may be queued
+ * @tparam Fragments Maximum number of frames of a message
+ */
+template<size_t Depth, size_t Fragments>
+class TxQueue
+{
+    static_assert(Depth > 0 && Fragments > 0, "TxQueue requires room for a message");
+
+public:
+    static constexpr int NoEntry = -1;
+
+    /**
+     * @param pool The frames of the queue, it must outlive the queue
+     */
+    explicit TxQueue(FramePool& pool) : pool(pool) {}
+
+    /**
+     * @brief Queues a message, its frames are filled in through frame()
+     *
+     * @param count Frames of the message
+     * @param now The current time, the base of the head of line wait
+     * @return int The entry of the message, NoEntry when the lane or the pool is full
+     */
+    int push(TxLane lane, uint8_t count, uint32_t now) {
+        if(count == 0 || count > Fragments || full(lane) || pool.available(PoolOwner::TX) < count){
+            return NoEntry;
+        }
+        for(size_t i = 0; i < Depth; i++){
+            Entry& entry = entries[i];
+            if(entry.count == 0){
+                for(uint8_t j = 0; j < count; j++){
+                    entry.frames[j] = pool.acquire(PoolOwner::TX);
+                }
+                entry.count = count;
+                entry.next = 0;
+                entry.lane = lane;
+                entry.order = order++;
+                entry.queuedAt = now;
+                used++;
+                return i;
+            }
+        }
+        return NoEntry;
+    }
+
+    /**
+     * @brief A frame of a queued message
+     *
+     * @param entry The entry returned by push
+     * @param index The frame, 0 for the first
+     */
+    Frame& frame(int entry, uint8_t index) {
+        return pool[entries[entry].frames[index]];
+    }
+
+    /// True when no message of the lane may be queued
+    bool full(TxLane lane = TxLane::PRIORITY) const {
+        const size_t limit = lane == TxLane::PRIORITY || Depth == 1 ? Depth : Depth - 1;
+        return used >= limit;
+    }
+
+    bool empty() const {
+        return used == 0;
+    }
+
+    /// Number of messages queued
+    size_t size() const {
+        return used;
+    }
+
+    constexpr size_t max_size() const {
+        return Depth;
+    }
+
+    /**
+     * @brief The next frame to write, nullptr when empty
+     */
+    const Frame* front() const {
+        const int head = next();
+        return head == NoEntry ? nullptr : &pool[entries[head].frames[entries[head].next]];
+    }
+
+    Frame* front() {
+        const int head = next();
+        return head == NoEntry ? nullptr : &pool[entries[head].frames[entries[head].next]];
+    }
+
+    /// True when the next frame is the first of its message
+    bool starting() const {
+        const int head = next();
+        return head != NoEntry && entries[head].next == 0;
+    }
+
+    /// Time the message of the next frame was queued at
+    uint32_t queuedAt() const {
+        const int head = next();
+        return head == NoEntry ? 0 : entries[head].queuedAt;
+    }
+
+    /**
+     * @brief Marks the next frame written, releasing its message after the last frame
+     *
+     * @return true The message was released
+     */
+    bool pop() {
+        const int head = next();
+        if(head == NoEntry){
+            return false;
+        }
+        Entry& entry = entries[head];
+        pool.release(PoolOwner::TX, entry.frames[entry.next]);
+        if(++entry.next < entry.count){
+            return false;
+        }
+        entry.count = 0;
+        used--;
+        return true;
+    }
+
+    /// Drops every message, their frames go back to the pool
+    void clear() {
+        for(size_t i = 0; i < Depth; i++){
+            Entry& entry = entries[i];
+            while(entry.next < entry.count){
+                pool.release(PoolOwner::TX, entry.frames[entry.next++]);
+            }
+            entry.count = 0;
+        }
+        used = 0;
+    }
+
+private:
+    struct Entry {
+        // @brief Pool frames of the message, those before next are already written
+        FrameHandle frames[Fragments];
+        // @brief Frames of the message, 0 when the entry is free
+        uint8_t count = 0;
+        // @brief The next frame to write
+        uint8_t next = 0;
+        TxLane lane = TxLane::PRIORITY;
+        // @brief Queue order within the lanes
+        uint32_t order = 0;
+        uint32_t queuedAt = 0;
+    };
+
+    FramePool& pool;
+    Entry entries[Depth];
+    size_t used = 0;
+    uint32_t order = 0;
+
+    // The oldest message of the highest priority lane
+    int next() const {
+        int head = NoEntry;
+        for(size_t i = 0; i < Depth; i++){
+            const Entry& entry = entries[i];
+            if(entry.count == 0){
+                continue;
+            }
+            if(head == NoEntry || entry.lane < entries[head].lane ||
+               (entry.lane == entries[head].lane && static_cast<int32_t>(entry.order - entries[head].order) < 0)){
+                head = i;
+            }
+        }
+        return head;
+    }
+};
+} // NAMESPACE
+#endif // TXQUEUE_H
@@ -0,0 +1,303 @@
+#ifndef UDP_H
+#define UDP_H
+
+#include <Arduino.h>
+#include "comm.h"
+#include "wire.h"
+
+#if defined (NATIVE) && defined (__linux__)
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace corelib {
+
+/**
+ * @brief Capacities of a UDP interface. A datagram carries one frame in the V1 wire
+ * format, only the payload in use, and a batch of datagrams is moved each iteration.
+ */
+struct UdpCommConfig : CommConfig<> {
+    static constexpr size_t framesPerIteration = 16;
+    static constexpr size_t framesReadPerIteration = 16;
+    static constexpr WireFormat wireFormat = WireFormat::V1;
+};
+
+/**
+ * @brief A received or outgoing datagram, one serialized frame
+ */
+struct Datagram {
+    uint16_t size = 0;
+    uint8_t data[WireMaxSize];
+};
+
+/**
+ * @brief UDP - Comms Implementation, independent of the network stack.
+ * Frames are read from a batch of received datagrams, the next batch is received when
+ * it runs out. Written frames are serialized into a batch which is sent at the end of
+ * the iteration, or when it is full. A stack implements receiveDatagrams and
+ * sendDatagrams, taking or giving as many datagrams as it can in one call, see
+ * BasicLinuxUdpComm. Neither may block.
+ *
+ * @tparam Config The capacities of the interface, see UdpCommConfig
+ * @tparam Integrity The frame check policy, see integrity.h
+ * @tparam Batch Datagrams moved per call to the stack
+ */
+template<typename Config = UdpCommConfig, typename Integrity = FastCrc32Integrity, size_t Batch = 16>
+class BasicUdpComm : public BasicComm<Config, Integrity>
+{
+public:
+    /**
+     * @param address This device's address
+     * @param destination The address messages are sent to
+     */
+    BasicUdpComm(uint8_t address = 0x02, uint8_t destination = 0x01) {
+        this->address = address;
+        this->destinationDeviceAddress = destination;
+    }
+
+    /// Datagrams received which were not a frame
+    uint32_t malformed() const {
+        return malformedCount;
+    }
+
+    /// Calls which received datagrams
+    uint32_t receiveCalls() const {
+        return receiveCallCount;
+    }
+
+    /// Calls which sent datagrams
+    uint32_t sendCalls() const {
+        return sendCallCount;
+    }
+
+    /// Frames written and not yet sent
+    size_t pending() const {
+        return txCount;
+    }
+
+    /**
+     * @brief Sends the frames written so far, called at the end of each iteration
+     *
+     * @return false Some frames are still waiting, the stack had no room
+     */
+    bool flush() {
+        if(txCount == 0){
+            return true;
+        }
+        const size_t sent = sendDatagrams(tx, txCount);
+        if(sent > 0){
+            sendCallCount++;
+        }
+        if(sent < txCount){
+            memmove(tx, tx + sent, (txCount - sent) * sizeof(Datagram));
+        }
+        txCount -= sent;
+        return txCount == 0;
+    }
+
+protected:
+    /**
+     * @brief Receives up to count datagrams
+     *
+     * @return size_t The datagrams received, 0 when none are waiting
+     */
+    virtual size_t receiveDatagrams(Datagram* datagrams, size_t count) = 0;
+
+    /**
+     * @brief Sends up to count datagrams, in order
+     *
+     * @return size_t The datagrams sent, the rest are given again later
+     */
+    virtual size_t sendDatagrams(const Datagram* datagrams, size_t count) = 0;
+
+    // Function.h interface
+    void performIterate() {
+        BasicComm<Config, Integrity>::performIterate();
+        (void) flush();
+    }
+
+    // Comms.h interface
+    bool read(uint8_t* buffer) {
+        while(true){
+            if(rxNext == rxCount){
+                rxNext = 0;
+                rxCount = receiveDatagrams(rx, Batch);
+                if(rxCount == 0){
+                    return false;
+                }
+                receiveCallCount++;
+            }
+            const Datagram& datagram = rx[rxNext++];
+            if(decodeFrame(datagram.data, datagram.size, *reinterpret_cast<Frame*>(buffer))){
+                return true;
+            }
+            malformedCount++;
+        }
+    }
+
+    bool write(const uint8_t* buffer) {
+        if(txCount == Batch && !flush() && txCount == Batch){
+            return false;
+        }
+        Datagram& datagram = tx[txCount++];
+        datagram.size = encodeFrame(*reinterpret_cast<const Frame*>(buffer), datagram.data, Config::wireFormat);
+        return true;
+    }
+
+private:
+    // @brief Datagrams received, read from rxNext
+    Datagram rx[Batch];
+    size_t rxCount = 0;
+    size_t rxNext = 0;
+    // @brief Datagrams written, sent by flush
+    Datagram tx[Batch];
+    size_t txCount = 0;
+    uint32_t malformedCount = 0;
+    uint32_t receiveCallCount = 0;
+    uint32_t sendCallCount = 0;
+};
+
+#if defined (NATIVE) && defined (__linux__)
+/**
+ * @brief UDP over a non-blocking Linux socket, a batch per recvmmsg and sendmmsg call.
+ * Frames go to the peer set with setPeer, or else to the address the first datagram
+ * came from. Frames written before there is a peer are discarded.
+ *
+ *  LinuxUdpComm device(0x02, 0x01);
+ *  device.open(5000);
+ *  device.initialise();
+ */
+template<typename Config = UdpCommConfig, typename Integrity = FastCrc32Integrity, size_t Batch = 16>
+class BasicLinuxUdpComm : public BasicUdpComm<Config, Integrity, Batch>
+{
+public:
+    BasicLinuxUdpComm(uint8_t address = 0x02, uint8_t destination = 0x01) :
+        BasicUdpComm<Config, Integrity, Batch>(address, destination) {}
+
+    ~BasicLinuxUdpComm() {
+        close();
+    }
+
+    /**
+     * @brief Opens the socket bound to a local port
+     *
+     * @param port The port, 0 for any free port, see localPort
+     * @param host The local address to bind to
+     * @return false The socket could not be opened or bound
+     */
+    bool open(uint16_t port, const char* host = "127.0.0.1") {
+        close();
+        fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if(fd < 0){
+            return false;
+        }
+        sockaddr_in local = {};
+        local.sin_family = AF_INET;
+        local.sin_port = htons(port);
+        if(inet_pton(AF_INET, host, &local.sin_addr) != 1 ||
+           bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0){
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Sets where frames are sent
+     *
+     * @return false The host is not an IPv4 address
+     */
+    bool setPeer(const char* host, uint16_t port) {
+        peer = {};
+        peer.sin_family = AF_INET;
+        peer.sin_port = htons(port);
+        hasPeer = inet_pton(AF_INET, host, &peer.sin_addr) == 1;
+        return hasPeer;
+    }
+
+    /// The port the socket is bound to, 0 when closed
+    uint16_t localPort() const {
+        sockaddr_in local = {};
+        socklen_t length = sizeof(local);
+        if(fd < 0 || getsockname(fd, reinterpret_cast<sockaddr*>(&local), &length) != 0){
+            return 0;
+        }
+        return ntohs(local.sin_port);
+    }
+
+    void close() {
+        if(fd >= 0){
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+protected:
+    int fd = -1;
+    sockaddr_in peer = {};
+    bool hasPeer = false;
+
+    // Function.h interface
+    void performInitialise() {
+        this->initialised = fd >= 0;
+    }
+
+    size_t receiveDatagrams(Datagram* datagrams, size_t count) {
+        mmsghdr messages[Batch] = {};
+        iovec vectors[Batch];
+        sockaddr_in sources[Batch];
+        for(size_t i = 0; i < count; i++){
+            vectors[i].iov_base = datagrams[i].data;
+            vectors[i].iov_len = sizeof(datagrams[i].data);
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+            messages[i].msg_hdr.msg_name = &sources[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(sources[i]);
+        }
+        const int received = recvmmsg(fd, messages, count, MSG_DONTWAIT, nullptr);
+        if(received <= 0){
+            return 0;
+        }
+        for(int i = 0; i < received; i++){
+            // A datagram too long for a frame is cut short, decodeFrame refuses it
+            datagrams[i].size = messages[i].msg_hdr.msg_flags & MSG_TRUNC ? 0 : messages[i].msg_len;
+        }
+        if(!hasPeer){
+            peer = sources[0];
+            hasPeer = true;
+        }
+        return received;
+    }
+
+    size_t sendDatagrams(const Datagram* datagrams, size_t count) {
+        if(!hasPeer){
+            return count;
+        }
+        mmsghdr messages[Batch] = {};
+        iovec vectors[Batch];
+        for(size_t i = 0; i < count; i++){
+            vectors[i].iov_base = const_cast<uint8_t*>(datagrams[i].data);
+            vectors[i].iov_len = datagrams[i].size;
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+            messages[i].msg_hdr.msg_name = &peer;
+            messages[i].msg_hdr.msg_namelen = sizeof(peer);
+        }
+        const int sent = sendmmsg(fd, messages, count, MSG_DONTWAIT);
+        if(sent < 0){
+            // A full socket buffer is tried again, anything else loses the batch
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS ? 0 : count;
+        }
+        return sent;
+    }
+};
+
+/// UDP interface over a Linux socket with the default capacities
+typedef BasicLinuxUdpComm<> LinuxUdpComm;
+#endif
+
+} // NAMESPACE
+#endif // UDP_H
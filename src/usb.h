@@ -30,14 +30,17 @@ static int usb_rawhid_recv(void *buffer, uint32_t timeout)
 /**
  * @brief USB (RAW-HID mode) - Comms Implementation
  * 
+ * @tparam Config The capacities of the interface, see CommConfig
+ * @tparam Integrity The frame check policy, see integrity.h
  */
-class USB : public Comm {
+template<typename Config = CommConfig<>, typename Integrity = FastCrc32Integrity>
+class BasicUSB : public BasicComm<Config, Integrity> {
 public:
     
     /**
      * @brief Construct a new USB object
      */
-    USB(){
+    BasicUSB(){
         // do nothing
     }
 
@@ -49,7 +52,7 @@ protected:
         // todo: Do we need to initialise the hid interface?
         //Serial.begin(board->serialUSBSpeed); // Teensy does not require begin to be called, serial starts automatically at maximum speed.
         #endif
-        initialised = true;
+        this->initialised = true;
     }
 
     // Comms.h interface
@@ -60,5 +63,9 @@ protected:
         return (usb_rawhid_send(buffer, 1) > 0);
     }
 };
+
+/// USB interface with the default Comm capacities
+typedef BasicUSB<> USB;
+
 } // NAMESPACE
 #endif // USB_H
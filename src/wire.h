@@ -0,0 +1,124 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <Arduino.h>
+#include "frame.h"
+
+namespace corelib {
+
+/**
+ * Frames are sent in one of two wire formats.
+ *
+ * FIXED is the 64 byte USB layout of frame.h, every frame is 64 bytes whatever its
+ * payload. It is what USB and the Programmor software exchange, a Comm framing for it
+ * leaves `payloadLength` zero (see CommConfig::wireFormat).
+ *
+ * V1 is serialized field by field, little endian, and sends only the payload in use
+ *
+ *  byte  0      0x80 | version, the high bit tells it from a FIXED frame's preamble
+ *  byte  1      preamble
+ *  byte  2      destinationAddress
+ *  byte  3      sourceAddress
+ *  bytes 4-7    frameID
+ *  byte  8      frameOrder
+ *  byte  9      frameTotal
+ *  byte  10     payload length, 1 - 50
+ *  bytes 11-    the payload in use
+ *  last 4 bytes crc
+ *
+ * The crc is the one the frame was sent with, computed over its 64 byte layout (see
+ * BasicComm::frameCheck), so the payload bytes beyond its length must be zero. A whole
+ * payload is sent with the length 50 and received with `payloadLength` zero, as the
+ * Comm frames it.
+ */
+enum class WireFormat : uint8_t {
+    FIXED = 0,
+    V1 = 1
+};
+
+static constexpr uint8_t WireVersion = 1;
+// @brief The first byte of a V1 frame
+static constexpr uint8_t WireMarker = 0x80 | WireVersion;
+static constexpr size_t WireHeaderSize = 11;
+static constexpr size_t WireCrcSize = 4;
+// @brief The largest frame in either format
+static constexpr size_t WireMaxSize = WireHeaderSize + sizeof(Frame::payload) + WireCrcSize;
+
+/// The bytes a frame takes on the wire
+inline size_t wireSize(const Frame& frame, WireFormat format = WireFormat::V1) {
+    return format == WireFormat::FIXED ? sizeof(Frame) : WireHeaderSize + payloadSize(frame) + WireCrcSize;
+}
+
+/**
+ * @brief Serializes a frame
+ *
+ * @param data Room for WireMaxSize bytes
+ * @return size_t The bytes written
+ */
+inline size_t encodeFrame(const Frame& frame, uint8_t* data, WireFormat format = WireFormat::V1) {
+    if(format == WireFormat::FIXED){
+        // The layout is checked at compile time, see frame.h
+        memcpy(data, &frame, sizeof(Frame));
+        return sizeof(Frame);
+    }
+    const uint8_t length = payloadSize(frame);
+    data[0] = WireMarker;
+    data[1] = static_cast<uint8_t>(frame.preamble);
+    data[2] = frame.destinationAddress;
+    data[3] = frame.sourceAddress;
+    data[4] = frame.frameID & 0xFF;
+    data[5] = (frame.frameID >> 8) & 0xFF;
+    data[6] = (frame.frameID >> 16) & 0xFF;
+    data[7] = frame.frameID >> 24;
+    data[8] = frame.frameOrder;
+    data[9] = frame.frameTotal;
+    data[10] = length;
+    memcpy(data + WireHeaderSize, frame.payload, length);
+    uint8_t* crc = data + WireHeaderSize + length;
+    crc[0] = frame.crc & 0xFF;
+    crc[1] = (frame.crc >> 8) & 0xFF;
+    crc[2] = (frame.crc >> 16) & 0xFF;
+    crc[3] = frame.crc >> 24;
+    return WireHeaderSize + length + WireCrcSize;
+}
+
+/**
+ * @brief Deserializes a frame of either format, told apart by its first byte
+ *
+ * @param size The bytes received
+ * @return false Not a frame, a V1 frame of another version or a length which does
+ * not match the bytes received
+ */
+inline bool decodeFrame(const uint8_t* data, size_t size, Frame& frame) {
+    if(size == 0){
+        return false;
+    }
+    if((data[0] & 0x80) == 0){
+        if(size != sizeof(Frame)){
+            return false;
+        }
+        memcpy(&frame, data, sizeof(Frame));
+        return true;
+    }
+    if(data[0] != WireMarker || size < WireHeaderSize + WireCrcSize){
+        return false;
+    }
+    const uint8_t length = data[10];
+    if(length == 0 || length > sizeof(Frame::payload) || size != WireHeaderSize + length + WireCrcSize){
+        return false;
+    }
+    frame.preamble = static_cast<Preamble>(data[1]);
+    frame.payloadLength = length == sizeof(Frame::payload) ? 0 : length;
+    frame.destinationAddress = data[2];
+    frame.sourceAddress = data[3];
+    frame.frameID = data[4] | (data[5] << 8) | (data[6] << 16) | (static_cast<uint32_t>(data[7]) << 24);
+    frame.frameOrder = data[8];
+    frame.frameTotal = data[9];
+    memcpy(frame.payload, data + WireHeaderSize, length);
+    memset(frame.payload + length, 0, sizeof(Frame::payload) - length);
+    const uint8_t* crc = data + WireHeaderSize + length;
+    frame.crc = crc[0] | (crc[1] << 8) | (crc[2] << 16) | (static_cast<uint32_t>(crc[3]) << 24);
+    return true;
+}
+} // NAMESPACE
+#endif // WIRE_H
@@ -0,0 +1,168 @@
+#include "tests_arp.h"
+
+const uint8_t DeviceCount = 24;
+const uint32_t Registry = 0x1000;
+
+// Class under test, a PC and tens of devices on a shared bus
+Bus bus;
+BusComm<PcConfig> pc;
+BusComm<SmallConfig> small;
+BusComm<corelib::CommConfig<>> devices[DeviceCount];
+
+// Iterates every interface on the bus
+void run(uint32_t rounds)
+{
+  for(uint32_t r = 0; r < rounds; r++){
+    pc.iterate();
+    small.iterate();
+    for(uint8_t i = 0; i < DeviceCount; i++){
+      devices[i].iterate();
+    }
+  }
+}
+
+uint32_t serialOf(uint8_t device)
+{
+  return 0xA000 + device;
+}
+
+void setup_test()
+{
+  bus.broadcasts = 0;
+  bus.frames = 0;
+}
+
+void run_tests()
+{
+  pc.join(bus, 0x01, 0, 0);
+  small.join(bus, 0x7F, 0, 0);
+  for(uint8_t i = 0; i < DeviceCount; i++){
+    devices[i].join(bus, 0x10 + i, Registry, serialOf(i));
+  }
+
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  RUN_TEST(test_discover_every_device);
+  RUN_TEST(test_query_single_device);
+  RUN_TEST(test_resolve_from_cache);
+  RUN_TEST(test_cache_bounded_and_ageing);
+  RUN_TEST(test_identity_encoding);
+  RUN_TEST(test_broadcasts_rate_limited);
+  UNITY_END(); // stop unit testing
+}
+
+void test_discover_every_device(void)
+{
+  setup_test();
+
+  corelib::ArpQuery query;
+  query.registryId = Registry;
+  TEST_ASSERT_TRUE(pc.discover(query));
+  run(DeviceCount * 2);
+
+  // One broadcast, one answer per device
+  TEST_ASSERT_EQUAL(1, bus.broadcasts);
+  TEST_ASSERT_EQUAL(1 + DeviceCount, bus.frames);
+  TEST_ASSERT_EQUAL(DeviceCount, pc.neighbourCount());
+  TEST_ASSERT_EQUAL(serialOf(3), pc.getNeighbour(0x13)->serialNumber);
+  for(uint8_t i = 0; i < DeviceCount; i++){
+    TEST_ASSERT_EQUAL(0x10 + i, pc.resolve(serialOf(i)));
+  }
+  TEST_ASSERT_EQUAL(1, bus.broadcasts);
+}
+
+void test_query_single_device(void)
+{
+  setup_test();
+
+  corelib::ArpQuery query;
+  query.serialNumber = serialOf(5);
+  TEST_ASSERT_TRUE(pc.discover(query));
+  run(4);
+  TEST_ASSERT_EQUAL(2, bus.frames);
+}
+
+void test_resolve_from_cache(void)
+{
+  setup_test();
+
+  // Every device was refreshed by the last query, resolving needs no broadcast
+  for(uint8_t i = 0; i < DeviceCount; i++){
+    TEST_ASSERT_EQUAL(0x10 + i, pc.resolve(serialOf(i)));
+  }
+  TEST_ASSERT_EQUAL(0, bus.frames);
+  // An unknown device is looked for
+  TEST_ASSERT_EQUAL(corelib::NoAddress, pc.resolve(0xBEEF));
+  run(4);
+  TEST_ASSERT_EQUAL(1, bus.broadcasts);
+  TEST_ASSERT_EQUAL(1, bus.frames);
+}
+
+void test_cache_bounded_and_ageing(void)
+{
+  setup_test();
+
+  corelib::ArpQuery query;
+  query.registryId = Registry;
+  TEST_ASSERT_TRUE(small.discover(query));
+  run(DeviceCount * 2);
+  // Only the 8 devices heard from last are kept
+  TEST_ASSERT_EQUAL(8, small.neighbourCount());
+  TEST_ASSERT_TRUE(small.getNeighbour(0x10 + DeviceCount - 1) != nullptr);
+  TEST_ASSERT_TRUE(small.getNeighbour(0x10) == nullptr);
+  // Devices which are not heard from age out
+  run(SmallConfig::neighbourTimeout);
+  TEST_ASSERT_EQUAL(0, small.neighbourCount());
+  TEST_ASSERT_EQUAL(1, bus.broadcasts);
+}
+
+void test_identity_encoding(void)
+{
+  setup_test();
+
+  Common1 identity = Common1_init_zero;
+  identity.id = 1;
+  identity.registryId = 0x01020304;
+  identity.serialNumber = 0xA0B0C0D0;
+  identity.sharesVersion = 7;
+  identity.firmwareVersion = 0x00010002;
+  strcpy(identity.deviceName, "A device name over thirty bytes");
+  uint8_t payload[sizeof(corelib::Frame::payload)];
+  corelib::encodeArpIdentity(identity, payload);
+  TEST_ASSERT_EQUAL(0x04, payload[4]);
+  Common1 decoded = corelib::decodeArpIdentity(payload);
+  TEST_ASSERT_EQUAL(identity.registryId, decoded.registryId);
+  TEST_ASSERT_EQUAL(identity.serialNumber, decoded.serialNumber);
+  TEST_ASSERT_EQUAL(identity.firmwareVersion, decoded.firmwareVersion);
+  TEST_ASSERT_EQUAL(corelib::ArpNameSize, strlen(decoded.deviceName));
+  TEST_ASSERT_EQUAL(0, strncmp(identity.deviceName, decoded.deviceName, corelib::ArpNameSize));
+}
+
+void test_broadcasts_rate_limited(void)
+{
+  // Every rate limit recovers
+  run(corelib::CommConfig<>::arpInterval * 2);
+  setup_test();
+
+  corelib::ArpQuery query;
+  query.registryId = Registry;
+  // A burst of two, then one per interval
+  TEST_ASSERT_TRUE(pc.discover(query));
+  TEST_ASSERT_TRUE(pc.discover(query));
+  TEST_ASSERT_FALSE(pc.discover(query));
+  run(PcConfig::arpInterval);
+  TEST_ASSERT_TRUE(pc.discover(query));
+  TEST_ASSERT_FALSE(pc.discover(query));
+  run(DeviceCount * 4);
+  TEST_ASSERT_EQUAL(3, bus.broadcasts);
+  // Each device answers its burst of two, the third request goes unanswered
+  TEST_ASSERT_EQUAL(3 + 2 * DeviceCount, bus.frames);
+}
+
+void setUp (void) {}
+
+void tearDown (void) {}
+
+int main(int argc, char **argv) {
+  run_tests();
+  return 0;
+}
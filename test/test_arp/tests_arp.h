@@ -0,0 +1,115 @@
+/**
+ * @file tests_arp.h
+ *
+ * @brief Tests ARP address discovery between many devices on a shared loopback bus.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "comm.h"
+
+// Receives the frames written to the bus
+class BusPort
+{
+  public:
+    virtual void deliver(const uint8_t* frame) = 0;
+};
+
+// A shared bus, every frame written is delivered to every other port
+class Bus
+{
+  public:
+    static const uint8_t MaxPorts = 32;
+    BusPort* ports[MaxPorts];
+    uint8_t count = 0;
+    uint32_t broadcasts = 0;
+    uint32_t frames = 0;
+
+    void attach(BusPort* port){
+      ports[count++] = port;
+    }
+
+    void write(const BusPort* from, const uint8_t* frame){
+      frames++;
+      broadcasts += reinterpret_cast<const corelib::Frame*>(frame)->destinationAddress == 0x00;
+      for(uint8_t i = 0; i < count; i++){
+        if(ports[i] != from){
+          ports[i]->deliver(frame);
+        }
+      }
+    }
+};
+
+// A Comm interface attached to the bus
+template<typename Config>
+class BusComm : public corelib::BasicComm<Config>, public BusPort
+{
+  public:
+    static const uint8_t Depth = 64;
+    uint8_t rx[Depth][64];
+    uint32_t rxHead = 0;
+    uint32_t rxTail = 0;
+    Bus* bus = nullptr;
+
+    void join(Bus& b, uint8_t deviceAddress, uint32_t registryId, uint32_t serialNumber){
+      bus = &b;
+      bus->attach(this);
+      this->address = deviceAddress;
+      Common1 identity = Common1_init_zero;
+      identity.id = deviceAddress;
+      identity.registryId = registryId;
+      identity.serialNumber = serialNumber;
+      strcpy(identity.deviceName, "ECU");
+      this->setIdentity(identity);
+      this->initialise();
+    }
+
+    void deliver(const uint8_t* frame){
+      if(rxTail - rxHead < Depth){
+        memcpy(rx[rxTail++ % Depth], frame, 64);
+      }
+    }
+
+  protected:
+    // Function.h interface
+    void performInitialise(){
+      this->initialised = true;
+    }
+
+    // Comms.h interface
+    bool read(uint8_t* buffer){
+      if(rxHead == rxTail){
+        return false;
+      }
+      memcpy(buffer, rx[rxHead++ % Depth], 64);
+      return true;
+    }
+    bool write(const uint8_t* buffer){
+      bus->write(this, buffer);
+      return true;
+    }
+};
+
+// The PC caches every device on the bus
+struct PcConfig : corelib::CommConfig<> {
+  static constexpr size_t neighbours = 32;
+  static constexpr uint32_t neighbourTimeout = 200;
+  static constexpr uint32_t arpInterval = 50;
+};
+
+// A small cache which ages quickly
+struct SmallConfig : corelib::CommConfig<> {
+  static constexpr size_t neighbours = 8;
+  static constexpr uint32_t neighbourTimeout = 100;
+};
+
+void setup_test();
+void run_tests();
+void test_discover_every_device(void);
+void test_query_single_device(void);
+void test_resolve_from_cache(void);
+void test_cache_bounded_and_ageing(void);
+void test_broadcasts_rate_limited(void);
+void test_identity_encoding(void);
@@ -0,0 +1,353 @@
+#include "tests_can.h"
+
+typedef corelib::SimulatedCanBus<4, 64> Bus;
+typedef corelib::SimulatedCanComm<Bus> FdComm;
+typedef corelib::SimulatedCanComm<Bus, corelib::CommConfig<>, corelib::CanClassicSize> ClassicComm;
+
+// The message the host publishes next
+uint8_t outgoing[128];
+int outgoingLength = 0;
+// The last message the host received
+uint8_t received[150];
+int receivedLength = 0;
+uint32_t receivedCount = 0;
+
+bool publish(corelib::Buffer* b)
+{
+  if(outgoingLength == 0){
+    return false;
+  }
+  memcpy(b->outBuffer, outgoing, outgoingLength);
+  b->outMessageLength = outgoingLength;
+  outgoingLength = 0;
+  return true;
+}
+
+corelib::HandleMessageState record(corelib::Buffer* b)
+{
+  memcpy(received, b->inBuffer, b->inMessageLength);
+  receivedLength = b->inMessageLength;
+  receivedCount++;
+  return corelib::HandleMessageState::OK;
+}
+
+// Echoes every message back
+corelib::HandleMessageState echo(corelib::Buffer* b)
+{
+  memcpy(b->outBuffer, b->inBuffer, b->inMessageLength);
+  b->outMessageLength = b->inMessageLength;
+  return corelib::HandleMessageState::OK;
+}
+
+// Class under test
+Bus fdBus;
+FdComm host(fdBus, 0x01, 0x02);
+FdComm device(fdBus, 0x02, 0x01);
+Bus classicBus;
+ClassicComm classicHost(classicBus, 0x01, 0x02);
+ClassicComm classicDevice(classicBus, 0x02, 0x01);
+// Injects hand made frames onto the classic bus
+const int injector = classicBus.attach();
+// Write frames straight onto the buses, where the sniffer sees them on FD
+WriterComm<corelib::CanFdSize> writer(fdBus, 0x05);
+const int sniffer = fdBus.attach();
+WriterComm<corelib::CanClassicSize> classicWriter(classicBus, 0x05);
+
+template<typename TComm>
+void setup(TComm& hostComm, TComm& deviceComm)
+{
+  hostComm.setPublishCallback(etl::delegate<bool(corelib::Buffer*)>::create<&publish>());
+  hostComm.setHandleMessageCallback(etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::create<&record>());
+  deviceComm.setHandleMessageCallback(etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::create<&echo>());
+  hostComm.initialise();
+  deviceComm.initialise();
+}
+
+// Publishes a message of length bytes from the host and runs both ends until it is echoed
+template<typename TComm>
+void exchange(TComm& hostComm, TComm& deviceComm, int length)
+{
+  for(int i = 0; i < length; i++){
+    outgoing[i] = i + 1;
+  }
+  outgoingLength = length;
+  const uint32_t count = receivedCount;
+  for(uint8_t i = 0; i < 10 && receivedCount == count; i++){
+    hostComm.iterate();
+    deviceComm.iterate();
+  }
+  TEST_ASSERT_EQUAL(count + 1, receivedCount);
+}
+
+void setup_test()
+{
+  fdBus.reset();
+  classicBus.reset();
+  receivedLength = 0;
+  memset(received, 0, sizeof(received));
+}
+
+void run_tests()
+{
+  setup(host, device);
+  setup(classicHost, classicDevice);
+
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  RUN_TEST(test_identifier_mapping);
+  RUN_TEST(test_fd_round_trip);
+  RUN_TEST(test_classic_round_trip);
+  RUN_TEST(test_trailing_zeros_left_off);
+  RUN_TEST(test_zero_tail_keeps_frames);
+  RUN_TEST(test_interleaved_and_lost_segments);
+  RUN_TEST(test_control_frames);
+  RUN_TEST(test_tx_units);
+  RUN_TEST(test_same_frame_id_bits);
+  UNITY_END(); // stop unit testing
+}
+
+void test_identifier_mapping(void)
+{
+  setup_test();
+
+  const uint32_t id = corelib::canIdentifier(corelib::Preamble::STREAM, 0x7F, 0x02, 0x12345);
+  TEST_ASSERT_TRUE(id < (1UL << 29));
+  TEST_ASSERT_EQUAL(corelib::Preamble::STREAM, corelib::canPreamble(id));
+  TEST_ASSERT_EQUAL(0x7F, corelib::canDestination(id));
+  TEST_ASSERT_EQUAL(0x02, corelib::canSource(id));
+  TEST_ASSERT_EQUAL(0x345, id & corelib::CanTagMask);
+  // DATA wins arbitration over a stream
+  TEST_ASSERT_TRUE(corelib::canIdentifier(corelib::Preamble::DATA, 0x7F, 0x02, 0x3FF) < id);
+  // Both ping preambles fit the three bit field
+  TEST_ASSERT_EQUAL(corelib::Preamble::PING_REQUEST,
+    corelib::canPreamble(corelib::canIdentifier(corelib::Preamble::PING_REQUEST, 0x7F, 0x02, 1)));
+  TEST_ASSERT_EQUAL(corelib::Preamble::PING_RESPONSE,
+    corelib::canPreamble(corelib::canIdentifier(corelib::Preamble::PING_RESPONSE, 0x7F, 0x02, 1)));
+
+  TEST_ASSERT_EQUAL(8, corelib::canFdLength(8));
+  TEST_ASSERT_EQUAL(12, corelib::canFdLength(9));
+  TEST_ASSERT_EQUAL(48, corelib::canFdLength(37));
+  TEST_ASSERT_EQUAL(64, corelib::canFdLength(63));
+}
+
+void test_fd_round_trip(void)
+{
+  setup_test();
+
+  // An encoded TransactionMessage, two USB frames, is a segment of 63 and one of 36
+  exchange(host, device, 99);
+  TEST_ASSERT_EQUAL(4, fdBus.frames);
+  TEST_ASSERT_EQUAL(100, receivedLength);
+  for(int i = 0; i < 99; i++){
+    TEST_ASSERT_EQUAL(i + 1, received[i]);
+  }
+  TEST_ASSERT_EQUAL(0, received[99]);
+  TEST_ASSERT_EQUAL(0, device.unitDrops());
+  TEST_ASSERT_EQUAL(0, fdBus.overruns);
+}
+
+void test_classic_round_trip(void)
+{
+  setup_test();
+
+  // Seven bytes of each classic frame carry the message
+  exchange(classicHost, classicDevice, 99);
+  TEST_ASSERT_EQUAL(2 * 15, classicBus.frames);
+  for(int i = 0; i < 99; i++){
+    TEST_ASSERT_EQUAL(i + 1, received[i]);
+  }
+  TEST_ASSERT_EQUAL(0, classicDevice.unitDrops());
+}
+
+void test_trailing_zeros_left_off(void)
+{
+  setup_test();
+
+  // A short message is a short frame, where USB sends 64 bytes
+  exchange(host, device, 10);
+  TEST_ASSERT_EQUAL(2, fdBus.frames);
+  const corelib::CanBits bits = corelib::canFrameBits(12, true);
+  TEST_ASSERT_EQUAL(2 * bits.data, fdBus.bits.data);
+  TEST_ASSERT_EQUAL(50, receivedLength);
+  TEST_ASSERT_EQUAL(10, received[9]);
+  TEST_ASSERT_EQUAL(0, received[10]);
+}
+
+void test_zero_tail_keeps_frames(void)
+{
+  setup_test();
+
+  // The last frame of a message is all zeros, it is still a message of two frames
+  for(int i = 0; i < 99; i++){
+    outgoing[i] = i < 40 ? i + 1 : 0;
+  }
+  outgoingLength = 99;
+  const uint32_t count = receivedCount;
+  for(uint8_t i = 0; i < 10 && receivedCount == count; i++){
+    host.iterate();
+    device.iterate();
+  }
+  TEST_ASSERT_EQUAL(count + 1, receivedCount);
+  TEST_ASSERT_EQUAL(100, receivedLength);
+  TEST_ASSERT_EQUAL(40, received[39]);
+  TEST_ASSERT_EQUAL(0, received[40]);
+  TEST_ASSERT_EQUAL(0, device.unitDrops());
+}
+
+// A segment of a classic unit from a source to the device
+corelib::CanFrame segment(uint8_t source, uint8_t index, bool last, uint8_t value)
+{
+  corelib::CanFrame frame;
+  frame.id = corelib::canIdentifier(corelib::Preamble::DATA, 0x02, source, 0x20 + source);
+  frame.length = corelib::CanClassicSize;
+  frame.data[0] = index | (last ? corelib::CanLastSegment : 0);
+  memset(frame.data + 1, value, corelib::CanClassicSize - 1);
+  if(index == 0){
+    // A unit of one frame
+    frame.data[1] = 1;
+  }
+  return frame;
+}
+
+void test_interleaved_and_lost_segments(void)
+{
+  setup_test();
+
+  // Two sources send at once, their segments interleave on the bus
+  for(uint8_t i = 0; i < 3; i++){
+    classicBus.send(injector, segment(0x05, i, i == 2, 0x50 + i));
+    classicBus.send(injector, segment(0x06, i, i == 2, 0x60 + i));
+  }
+  // A unit which lost its middle segment
+  classicBus.send(injector, segment(0x07, 0, false, 0x70));
+  classicBus.send(injector, segment(0x07, 2, true, 0x72));
+
+  const uint32_t count = receivedCount;
+  for(uint8_t i = 0; i < 10; i++){
+    classicDevice.iterate();
+    classicHost.iterate();
+  }
+  // Both whole units are echoed, each in its own order
+  TEST_ASSERT_EQUAL(count + 2, receivedCount);
+  TEST_ASSERT_EQUAL(0x60, received[0]);
+  TEST_ASSERT_EQUAL(0x61, received[6]);
+  TEST_ASSERT_EQUAL(0x62, received[19]);
+  TEST_ASSERT_EQUAL(0, received[20]);
+  TEST_ASSERT_EQUAL(1, classicDevice.unitDrops());
+}
+
+void test_control_frames(void)
+{
+  setup_test();
+
+  // ARP crosses the bus as frames of their own
+  Common1 identity = Common1_init_zero;
+  identity.serialNumber = 0x1234;
+  device.setIdentity(identity);
+  TEST_ASSERT_TRUE(host.discover());
+  for(uint8_t i = 0; i < 3; i++){
+    host.iterate();
+    device.iterate();
+  }
+  TEST_ASSERT_EQUAL(1, host.neighbourCount());
+  TEST_ASSERT_NOT_NULL(host.getNeighbour(0x02));
+  TEST_ASSERT_EQUAL(0x1234, host.getNeighbour(0x02)->serialNumber);
+}
+
+void test_tx_units(void)
+{
+  setup_test();
+
+  // The first frames of messages to a device which is not on the bus
+  corelib::Frame frame;
+  frame.preamble = corelib::Preamble::DATA;
+  frame.destinationAddress = 0x7E;
+  frame.sourceAddress = 0x05;
+  frame.frameOrder = 1;
+  frame.frameTotal = 2;
+  memset(frame.payload, 0x11, sizeof(corelib::Frame::payload));
+  const size_t units = WriterComm<corelib::CanFdSize>::TxUnits;
+  for(size_t i = 0; i < units; i++){
+    // The frameIDs all have the bits the identifier has room for in common
+    frame.frameID = 0x1234 + (i << 10);
+    TEST_ASSERT_TRUE(writer.writeFrame(frame));
+  }
+  // Every unit waits for its second frame, another message waits for a unit
+  frame.frameID = 0x9999;
+  TEST_ASSERT_FALSE(writer.writeFrame(frame));
+  TEST_ASSERT_EQUAL(0, fdBus.frames);
+
+  frame.frameOrder = 2;
+  for(size_t i = 0; i < units; i++){
+    frame.frameID = 0x1234 + (i << 10);
+    TEST_ASSERT_TRUE(writer.writeFrame(frame));
+  }
+  frame.frameOrder = 1;
+  frame.frameID = 0x9999;
+  TEST_ASSERT_TRUE(writer.writeFrame(frame));
+
+  // Each message is two segments with an identifier of its own
+  TEST_ASSERT_EQUAL(2 * units, fdBus.frames);
+  uint32_t ids[2 * WriterComm<corelib::CanFdSize>::TxUnits];
+  for(size_t i = 0; i < 2 * units; i++){
+    corelib::CanFrame sent;
+    TEST_ASSERT_TRUE(fdBus.receive(sniffer, sent));
+    ids[i] = sent.id;
+    TEST_ASSERT_EQUAL(i % 2, sent.data[0] & ~corelib::CanLastSegment);
+  }
+  for(size_t i = 0; i < 2 * units; i += 2){
+    TEST_ASSERT_EQUAL(ids[i], ids[i + 1]);
+    for(size_t j = i + 2; j < 2 * units; j += 2){
+      TEST_ASSERT_TRUE(ids[i] != ids[j]);
+    }
+  }
+
+  // A message longer than a unit holds is dropped, and counted
+  frame.frameTotal = corelib::CommConfig<>::fragmentsPerMessage + 1;
+  TEST_ASSERT_TRUE(writer.writeFrame(frame));
+  TEST_ASSERT_EQUAL(1, writer.unitDrops());
+  TEST_ASSERT_EQUAL(2 * units, fdBus.frames);
+}
+
+void test_same_frame_id_bits(void)
+{
+  setup_test();
+
+  // Two messages whose frameIDs differ only above the bits the identifier has room for,
+  // their segments interleave on the bus
+  corelib::Frame frame;
+  frame.preamble = corelib::Preamble::DATA;
+  frame.destinationAddress = 0x02;
+  frame.sourceAddress = 0x05;
+  frame.frameTotal = 2;
+  const uint32_t drops = classicDevice.unitDrops();
+  for(uint8_t order = 1; order <= 2; order++){
+    frame.frameOrder = order;
+    frame.frameID = 0x1234;
+    memset(frame.payload, 0x10 + order, sizeof(corelib::Frame::payload));
+    TEST_ASSERT_TRUE(classicWriter.writeFrame(frame));
+    frame.frameID = 0x5234;
+    memset(frame.payload, 0x20 + order, sizeof(corelib::Frame::payload));
+    TEST_ASSERT_TRUE(classicWriter.writeFrame(frame));
+  }
+
+  // Both are echoed whole
+  const uint32_t count = receivedCount;
+  for(uint8_t i = 0; i < 20; i++){
+    classicDevice.iterate();
+    classicHost.iterate();
+  }
+  TEST_ASSERT_EQUAL(count + 2, receivedCount);
+  TEST_ASSERT_EQUAL(100, receivedLength);
+  TEST_ASSERT_EQUAL(0x21, received[0]);
+  TEST_ASSERT_EQUAL(0x22, received[99]);
+  TEST_ASSERT_EQUAL(drops, classicDevice.unitDrops());
+}
+
+void setUp (void) {}
+
+void tearDown (void) {}
+
+int main(int argc, char **argv) {
+  run_tests();
+  return 0;
+}
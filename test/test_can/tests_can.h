@@ -0,0 +1,36 @@
+/**
+ * @file tests_can.h
+ *
+ * @brief Tests the CAN and CAN FD transport over a simulated bus.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "can.h"
+
+// A CAN Comm whose frames are written by the test
+template<uint8_t DataSize>
+class WriterComm : public corelib::SimulatedCanComm<corelib::SimulatedCanBus<4, 64>, corelib::CommConfig<>, DataSize>
+{
+  public:
+    WriterComm(corelib::SimulatedCanBus<4, 64>& bus, uint8_t address)
+      : corelib::SimulatedCanComm<corelib::SimulatedCanBus<4, 64>, corelib::CommConfig<>, DataSize>(bus, address) {}
+
+    bool writeFrame(const corelib::Frame& frame){
+      return this->write(reinterpret_cast<const uint8_t*>(&frame));
+    }
+};
+
+void setup_test();
+void run_tests();
+void test_identifier_mapping(void);
+void test_fd_round_trip(void);
+void test_classic_round_trip(void);
+void test_trailing_zeros_left_off(void);
+void test_zero_tail_keeps_frames(void);
+void test_interleaved_and_lost_segments(void);
+void test_control_frames(void);
+void test_tx_units(void);
+void test_same_frame_id_bits(void);
@@ -0,0 +1,281 @@
+#include "tests_capture.h"
+
+#include <cstdio>
+
+typedef corelib::CaptureRing<16> Ring;
+
+// External interfaces
+FastCRC32 CRC32;
+
+// A clock advanced by the tests, in microseconds
+uint32_t now = 0;
+
+uint32_t fakeClock()
+{
+  return now;
+}
+
+// Echoes every message back
+corelib::HandleMessageState echo(corelib::Buffer* b)
+{
+  memcpy(b->outBuffer, b->inBuffer, b->inMessageLength);
+  b->outMessageLength = b->inMessageLength;
+  return corelib::HandleMessageState::OK;
+}
+
+// Echoes every message back with its first byte inverted
+corelib::HandleMessageState invert(corelib::Buffer* b)
+{
+  echo(b);
+  b->outBuffer[0] = ~b->outBuffer[0];
+  return corelib::HandleMessageState::OK;
+}
+
+// Class under test
+Ring ring;
+corelib::Capture<Ring> capture(ring, corelib::Capture<Ring>::Clock::create<&fakeClock>());
+CaptureComm com;
+corelib::ReplayComm replay;
+
+const char* path = "test_capture.cap";
+
+// A single frame request numbered by its id
+corelib::Frame request(uint32_t id)
+{
+  corelib::Frame frame;
+  frame.preamble = corelib::Preamble::DATA;
+  frame.destinationAddress = 0x02;
+  frame.sourceAddress = 0x01;
+  frame.frameID = id;
+  frame.frameOrder = 1;
+  frame.frameTotal = 1;
+  memset(frame.payload, id & 0xFF, sizeof(frame.payload));
+  frame.crc = CRC32.crc32((uint8_t*)&frame, sizeof(corelib::Frame)-4);
+  return frame;
+}
+
+// Captures requests 1 ms apart
+void session(uint32_t requests)
+{
+  for(uint32_t id = 0; id < requests; id++){
+    com.push(request(0x10 + id));
+    now += 1000;
+    com.iterate();
+  }
+}
+
+void setup_test()
+{
+  ring.clear();
+  replay.clear();
+  replay.setHandleMessageCallback(etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::create<&echo>());
+}
+
+void run_tests()
+{
+  com.setHandleMessageCallback(etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::create<&echo>());
+  com.initialise();
+  capture.attach(com, 3);
+  replay.initialise();
+
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  RUN_TEST(test_capture_ring);
+  RUN_TEST(test_capture_file_round_trip);
+  RUN_TEST(test_replay_matches_capture);
+  RUN_TEST(test_replay_reports_divergence);
+  RUN_TEST(test_replay_original_timing);
+  RUN_TEST(test_replay_ping_times);
+  UNITY_END(); // stop unit testing
+}
+
+void test_capture_ring(void)
+{
+  setup_test();
+
+  session(2);
+  // Each request is read and its response written in the same iteration
+  TEST_ASSERT_EQUAL(4, ring.size());
+  for(uint8_t i = 0; i < 4; i++){
+    const corelib::CaptureRecord& record = ring.at(i);
+    TEST_ASSERT_EQUAL(3, record.interface);
+    TEST_ASSERT_EQUAL((i / 2 + 1) * 1000, record.timestamp - (now - 2000));
+    TEST_ASSERT_EQUAL(i % 2 ? corelib::CaptureDirection::OUT : corelib::CaptureDirection::IN, record.direction);
+    TEST_ASSERT_EQUAL(0x10 + i / 2, record.frame.payload[0]);
+  }
+
+  // The oldest records are overwritten
+  const uint32_t start = now;
+  session(8);
+  TEST_ASSERT_EQUAL(16, ring.size());
+  TEST_ASSERT_EQUAL(4, ring.overwritten());
+  TEST_ASSERT_EQUAL(start + 1000, ring.at(0).timestamp);
+}
+
+void test_capture_file_round_trip(void)
+{
+  setup_test();
+
+  session(3);
+  corelib::CaptureFile file;
+  TEST_ASSERT_TRUE(file.open(path));
+  for(size_t i = 0; i < ring.size(); i++){
+    file.record(ring.at(i));
+  }
+  file.close();
+  TEST_ASSERT_EQUAL(0, file.failed());
+
+  // A partly written last record, as after a power loss, is ignored
+  FILE* raw = fopen(path, "ab");
+  fwrite("\x01\x02\x03", 1, 3, raw);
+  fclose(raw);
+  corelib::CaptureReader reader;
+  TEST_ASSERT_TRUE(reader.open(path));
+  corelib::CaptureRecord record;
+  for(size_t i = 0; i < ring.size(); i++){
+    TEST_ASSERT_TRUE(reader.next(record));
+    TEST_ASSERT_EQUAL(ring.at(i).timestamp, record.timestamp);
+    TEST_ASSERT_EQUAL(ring.at(i).direction, record.direction);
+    TEST_ASSERT_EQUAL(0, memcmp(&ring.at(i).frame, &record.frame, sizeof(corelib::Frame)));
+  }
+  TEST_ASSERT_FALSE(reader.next(record));
+  reader.close();
+
+  // The ring encodes the same file
+  uint8_t encoded[corelib::CaptureHeaderSize + 6 * corelib::CaptureRecordSize];
+  TEST_ASSERT_EQUAL(sizeof(encoded), ring.encode(encoded, sizeof(encoded)));
+  TEST_ASSERT_EQUAL(0, ring.encode(encoded, sizeof(encoded) - 1));
+
+  // Anything else is not a capture
+  raw = fopen(path, "wb");
+  fwrite("CLCX\x01\x00\x46\x00", 1, 8, raw);
+  fclose(raw);
+  TEST_ASSERT_FALSE(reader.open(path));
+  remove(path);
+}
+
+void test_replay_matches_capture(void)
+{
+  setup_test();
+
+  session(5);
+  corelib::CaptureFile file;
+  TEST_ASSERT_TRUE(file.open(path));
+  for(size_t i = 0; i < ring.size(); i++){
+    file.record(ring.at(i));
+  }
+  file.close();
+
+  TEST_ASSERT_TRUE(replay.load(path, 3));
+  const corelib::ReplayReport report = replay.run(false);
+  TEST_ASSERT_EQUAL(5, report.framesIn);
+  TEST_ASSERT_EQUAL(5, report.framesOut);
+  TEST_ASSERT_EQUAL(5, report.expectedOut);
+  TEST_ASSERT_EQUAL(0, report.divergent);
+  TEST_ASSERT_EQUAL(-1, report.firstDivergence);
+  TEST_ASSERT_EQUAL(0, report.missing);
+  TEST_ASSERT_EQUAL(0, report.extra);
+  remove(path);
+
+  // Records of other interfaces are not replayed
+  replay.clear();
+  for(size_t i = 0; i < ring.size(); i++){
+    replay.add(ring.at(i), 4);
+  }
+  TEST_ASSERT_EQUAL(0, replay.run(false).framesIn);
+}
+
+void test_replay_reports_divergence(void)
+{
+  setup_test();
+
+  session(4);
+  for(size_t i = 0; i < ring.size(); i++){
+    replay.add(ring.at(i), 3);
+  }
+  // A handler answering differently diverges at every response
+  replay.setHandleMessageCallback(etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::create<&invert>());
+  const corelib::ReplayReport report = replay.run(false);
+  TEST_ASSERT_EQUAL(4, report.framesOut);
+  TEST_ASSERT_EQUAL(4, report.divergent);
+  TEST_ASSERT_EQUAL(0, report.firstDivergence);
+
+  // A capture cut short of its last response reports the response as extra
+  replay.clear();
+  for(size_t i = 0; i + 1 < ring.size(); i++){
+    replay.add(ring.at(i), 3);
+  }
+  replay.setHandleMessageCallback(etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::create<&echo>());
+  const corelib::ReplayReport shorter = replay.run(false);
+  TEST_ASSERT_EQUAL(4, shorter.framesIn);
+  TEST_ASSERT_EQUAL(4, shorter.framesOut);
+  TEST_ASSERT_EQUAL(3, shorter.expectedOut);
+  TEST_ASSERT_EQUAL(1, shorter.extra);
+  TEST_ASSERT_EQUAL(0, shorter.divergent);
+  TEST_ASSERT_EQUAL(0, shorter.missing);
+}
+
+void test_replay_original_timing(void)
+{
+  setup_test();
+
+  // Requests 20 ms apart are read 20 ms apart
+  for(uint32_t id = 0; id < 3; id++){
+    com.push(request(0x20 + id));
+    now += 20000;
+    com.iterate();
+  }
+  for(size_t i = 0; i < ring.size(); i++){
+    replay.add(ring.at(i), 3);
+  }
+  const corelib::ReplayReport paced = replay.run(true);
+  TEST_ASSERT_EQUAL(3, paced.framesOut);
+  TEST_ASSERT_EQUAL(0, paced.divergent);
+  TEST_ASSERT_TRUE(paced.seconds >= 0.040);
+  const corelib::ReplayReport fast = replay.run(false);
+  TEST_ASSERT_EQUAL(0, fast.divergent);
+  TEST_ASSERT_TRUE(fast.seconds < paced.seconds);
+}
+
+void test_replay_ping_times(void)
+{
+  setup_test();
+
+  // A ping answered in the capture, its times are those of the capture's clock
+  com.setClock(corelib::Comm::Clock::create<&fakeClock>());
+  now += 0x40000000UL;
+  corelib::Frame ping = request(0x30);
+  ping.preamble = corelib::Preamble::PING_REQUEST;
+  corelib::PingTimes times;
+  times.sequence = 9;
+  times.sent = 1234;
+  corelib::encodePingTimes(times, ping.payload);
+  ping.crc = CRC32.crc32((uint8_t*)&ping, sizeof(corelib::Frame)-4);
+  com.push(ping);
+  now += 1000;
+  com.iterate();
+  session(1);
+  TEST_ASSERT_EQUAL(4, ring.size());
+  TEST_ASSERT_EQUAL(corelib::Preamble::PING_RESPONSE, ring.at(1).frame.preamble);
+
+  // Answered again at other times, the response still matches
+  for(size_t i = 0; i < ring.size(); i++){
+    replay.add(ring.at(i), 3);
+  }
+  const corelib::ReplayReport report = replay.run(false);
+  TEST_ASSERT_EQUAL(2, report.framesOut);
+  TEST_ASSERT_EQUAL(0, report.divergent);
+
+  // Another sequence is a divergence
+  corelib::Frame answer = ring.at(1).frame;
+  answer.payload[0] ^= 0x01;
+  TEST_ASSERT_FALSE(corelib::ReplayComm::sameFrame(ring.at(1).frame, answer));
+}
+
+void setUp (void) {}
+
+void tearDown (void) {}
+
+int main(int argc, char **argv) {
+  run_tests();
+  return 0;
+}
@@ -0,0 +1,57 @@
+/**
+ * @file tests_capture.h
+ *
+ * @brief Tests capturing a Comm's frames to RAM and to a file, and replaying them.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include <FastCRC.h>
+
+#include "capture.h"
+#include "replay.h"
+
+// A Comm interface over an in-memory loopback
+class CaptureComm : public corelib::Comm
+{
+  public:
+    static const uint8_t Depth = 8;
+    // Frames to be read
+    corelib::Frame rx[Depth];
+    uint8_t rxHead = 0;
+    uint8_t rxTail = 0;
+    uint32_t written = 0;
+
+    void push(const corelib::Frame& frame){
+      rx[rxTail++ % Depth] = frame;
+    }
+
+  protected:
+    // Function.h interface
+    void performInitialise(){
+      initialised = true;
+    }
+
+    // Comms.h interface
+    bool read(uint8_t* buffer){
+      if(rxHead == rxTail){
+        return false;
+      }
+      memcpy(buffer, &rx[rxHead++ % Depth], 64);
+      return true;
+    }
+    bool write(const uint8_t* buffer){
+      written++;
+      return true;
+    }
+};
+
+void setup_test();
+void run_tests();
+void test_capture_ring(void);
+void test_capture_file_round_trip(void);
+void test_replay_matches_capture(void);
+void test_replay_reports_divergence(void);
+void test_replay_original_timing(void);
+void test_replay_ping_times(void);
@@ -25,6 +25,12 @@ void run_tests()
   RUN_TEST(test_single_outgoing_single_frame);
   RUN_TEST(test_single_outgoing_multiple_frame);
   RUN_TEST(test_message_callback);
+  RUN_TEST(test_stats_counters);
+  RUN_TEST(test_lost_fragments_under_load);
+  RUN_TEST(test_stale_partial_timeout);
+  RUN_TEST(test_burst_handled_in_order);
+  RUN_TEST(test_message_view_callback);
+  RUN_TEST(test_stream_through_comm);
   UNITY_END(); // stop unit testing
 }
 
@@ -47,7 +53,7 @@ void test_single_incoming_frame(void)
   memcpy(recvBuffer, (uint8_t*)&frame1, sizeof(corelib::Frame));
   com.testProcessRead();
   com.testProcessIncomingMessage();
-  auto frames = com.getInFrames();
+  auto& frames = com.getInFrames();
   TEST_ASSERT_EQUAL(0, frames.size());
 
   auto buffer = com.getBuffer();
@@ -83,12 +89,11 @@ void test_multiple_incoming_frame(void)
   memcpy(recvBuffer, (uint8_t*)&frame1, sizeof(corelib::Frame));
   com.testProcessRead();
   com.testProcessIncomingMessage();
-  auto frames1 = com.getInFrames();
+  auto& frames1 = com.getInFrames();
   TEST_ASSERT_EQUAL(1, frames1.size()); // should only be 1 unique id
-  auto first1 = frames1.begin();
-  TEST_ASSERT_EQUAL(0xDEADBEEF,first1->first); // id should match
-  auto first1Frames = first1->second;
-  TEST_ASSERT_EQUAL(1, first1Frames.size()); // only 1 frame for the id at this time
+  auto first1 = frames1.find(0x01, 0xDEADBEEF);
+  TEST_ASSERT_TRUE(first1 != frames1.NoSlot); // id should match
+  TEST_ASSERT_EQUAL(1, frames1.fragments(first1)); // only 1 frame for the id at this time
 
   auto buffer1 = com.getBuffer();
   TEST_ASSERT_EQUAL(0, buffer1.inIndex);
@@ -96,7 +101,7 @@ void test_multiple_incoming_frame(void)
   memcpy(recvBuffer, (uint8_t*)&frame2, sizeof(corelib::Frame));
   com.testProcessRead();
   com.testProcessIncomingMessage();
-  auto frames2 = com.getInFrames();
+  auto& frames2 = com.getInFrames();
   TEST_ASSERT_EQUAL(0, frames2.size()); // should only be 0 since we had enough frames to process successfully
 
   auto buffer2 = com.getBuffer();
@@ -138,13 +143,13 @@ void test_multiple_unique_incoming_frame(void)
   memcpy(recvBuffer, (uint8_t*)&frame1, sizeof(corelib::Frame));
   com.testProcessRead();
   com.testProcessIncomingMessage();
-  auto frames1 = com.getInFrames();
+  auto& frames1 = com.getInFrames();
   TEST_ASSERT_EQUAL(1, frames1.size()); // should only be 1 unique id
 
   memcpy(recvBuffer, (uint8_t*)&frame2, sizeof(corelib::Frame));
   com.testProcessRead();
   com.testProcessIncomingMessage();
-  auto frames2 = com.getInFrames();
+  auto& frames2 = com.getInFrames();
   TEST_ASSERT_EQUAL(2, frames2.size()); // should only be 0 since we had enough frames to process successfully
 }
 
@@ -222,6 +227,305 @@ void test_message_callback(void)
   TEST_ASSERT_EQUAL(0x99, buffer.outMessageLength);
 }
 
+void test_stats_counters(void)
+{
+  setup_test();
+
+  corelib::Frame frame1;
+  frame1.preamble = corelib::Preamble::DATA;
+  frame1.destinationAddress = 0x00;
+  frame1.sourceAddress = 0x01; // pretend to be PC
+  frame1.frameTotal = 1;
+  frame1.frameOrder = 1;
+  frame1.frameID = 0xDEADBEEF;
+  memset(frame1.payload, 0x7F, sizeof(corelib::Frame::payload));
+  frame1.crc = CRC32.crc32((uint8_t*)&frame1, sizeof(corelib::Frame)-4);
+
+  // Echo the message back
+  auto fn = [](corelib::Buffer* i){
+    if(i->inIndex == 0){
+      return corelib::HandleMessageState::NO_DATA;
+    }
+    memcpy(i->outBuffer, i->inBuffer, i->inIndex);
+    i->outMessageLength = i->inIndex;
+    i->inIndex = 0;
+    return corelib::HandleMessageState::OK;
+  };
+  com.setHandleMessageCallback(fn);
+  com.initialise();
+
+  memcpy(recvBuffer, (uint8_t*)&frame1, sizeof(corelib::Frame));
+  com.testIterate();
+
+  const corelib::CommStats& stats = com.getStats();
+  TEST_ASSERT_EQUAL(1, stats.readStates[(uint8_t)corelib::ReadState::OK]);
+  TEST_ASSERT_EQUAL(1, stats.handleStates[(uint8_t)corelib::HandleMessageState::OK]);
+  TEST_ASSERT_EQUAL(1, stats.writeStates[(uint8_t)corelib::WriteState::OK]);
+  TEST_ASSERT_EQUAL(1, stats.framesIn);
+  TEST_ASSERT_EQUAL(1, stats.framesOut);
+  TEST_ASSERT_EQUAL(sizeof(corelib::Frame), stats.bytesIn);
+  TEST_ASSERT_EQUAL(1, stats.completions);
+  TEST_ASSERT_EQUAL(1, stats.inFramesHighWater);
+  TEST_ASSERT_EQUAL(1, stats.outFramesHighWater);
+
+  // A corrupted frame is counted, not handled
+  recvBuffer[20] ^= 0xFF;
+  com.testIterate();
+  TEST_ASSERT_EQUAL(1, stats.readStates[(uint8_t)corelib::ReadState::MISMATCH_CRC]);
+  TEST_ASSERT_EQUAL(1, stats.handleStates[(uint8_t)corelib::HandleMessageState::OK]);
+  TEST_ASSERT_EQUAL(1, stats.writeStates[(uint8_t)corelib::WriteState::OUT_FRAMES_EMPTY]);
+
+  CommStats1 message = CommStats1_init_zero;
+  corelib::toMessage(stats, message);
+  TEST_ASSERT_EQUAL(1, message.readOk);
+  TEST_ASSERT_EQUAL(1, message.readMismatchCrc);
+  TEST_ASSERT_EQUAL(1, message.handleOk);
+}
+
+void test_lost_fragments_under_load(void)
+{
+  setup_test();
+  com.initialise();
+
+  // Two messages are interleaved at a time and every 5th message loses its last fragment
+  const uint32_t messages = 300;
+  uint32_t lost = 0;
+  uint32_t delivered = 0;
+  for(uint32_t m = 0; m < messages; m += 2){
+    corelib::Frame frames[2][3];
+    for(uint8_t k = 0; k < 2; k++){
+      for(uint8_t order = 1; order <= 3; order++){
+        corelib::Frame& frame = frames[k][order-1];
+        frame.preamble = corelib::Preamble::DATA;
+        frame.destinationAddress = 0x02;
+        frame.sourceAddress = 0x01;
+        frame.frameTotal = 3;
+        frame.frameOrder = order;
+        frame.frameID = 0x1000 + m + k;
+        memset(frame.payload, (uint8_t)(m + k), sizeof(corelib::Frame::payload));
+        frame.crc = CRC32.crc32((uint8_t*)&frame, sizeof(corelib::Frame)-4);
+      }
+    }
+    for(uint8_t order = 0; order < 3; order++){
+      for(uint8_t k = 0; k < 2; k++){
+        if(order == 2 && (m + k) % 5 == 0){
+          continue; // dropped by the bus
+        }
+        memcpy(recvBuffer, (uint8_t*)&frames[k][order], sizeof(corelib::Frame));
+        TEST_ASSERT_TRUE(com.testProcessRead() == corelib::ReadState::OK);
+        com.testProcessIncomingMessage();
+        auto buffer = com.getBuffer();
+        if(buffer.inIndex > 0){
+          TEST_ASSERT_EQUAL(128, buffer.inIndex);
+          delivered++;
+          buffer.inIndex = 0;
+          com.setBuffer(buffer);
+        }
+      }
+    }
+    lost += ((m % 5) == 0) + (((m + 1) % 5) == 0);
+  }
+
+  // Every intact message was delivered, the lost ones were evicted to make room
+  TEST_ASSERT_EQUAL(messages - lost, delivered);
+  const corelib::CommStats& stats = com.getStats();
+  TEST_ASSERT_EQUAL(messages - lost, stats.completions);
+  TEST_ASSERT_EQUAL(0, stats.readStates[(uint8_t)corelib::ReadState::IN_FRAMES_FULL]);
+  TEST_ASSERT_GREATER_OR_EQUAL(lost - com.getInFrames().max_size(), stats.evictions);
+  TEST_ASSERT_EQUAL(lost, stats.evictions + com.getInFrames().size());
+}
+
+void test_stale_partial_timeout(void)
+{
+  setup_test();
+
+  auto fn = [](corelib::Buffer* i){
+    return corelib::HandleMessageState::NO_DATA;
+  };
+  com.setHandleMessageCallback(fn);
+  com.initialise();
+
+  corelib::Frame frame1;
+  frame1.preamble = corelib::Preamble::DATA;
+  frame1.destinationAddress = 0x02;
+  frame1.sourceAddress = 0x01;
+  frame1.frameTotal = 2;
+  frame1.frameOrder = 1;
+  frame1.frameID = 0xDEADBEEF;
+  frame1.crc = CRC32.crc32((uint8_t*)&frame1, sizeof(corelib::Frame)-4);
+  memcpy(recvBuffer, (uint8_t*)&frame1, sizeof(corelib::Frame));
+  com.testIterate();
+  TEST_ASSERT_EQUAL(1, com.getInFrames().size());
+
+  // The rest of the message never arrives, only noise
+  recvBuffer[20] ^= 0xFF;
+  for(uint32_t i = 0; i < corelib::CommConfig<>::reassemblyTimeout; i++){
+    com.testIterate();
+  }
+  TEST_ASSERT_EQUAL(0, com.getInFrames().size());
+  TEST_ASSERT_EQUAL(1, com.getStats().evictions);
+}
+
+void test_burst_handled_in_order(void)
+{
+  setup_test();
+
+  // Echo each message back, tagging it with the order it was handled in
+  static uint8_t handled;
+  handled = 0;
+  auto fn = [](corelib::Buffer* i){
+    TEST_ASSERT_EQUAL(sizeof(corelib::Frame::payload), i->inMessageLength);
+    TEST_ASSERT_EQUAL(0x10 + handled, i->inBuffer[0]);
+    memcpy(i->outBuffer, i->inBuffer, i->inMessageLength);
+    i->outBuffer[1] = handled++;
+    i->outMessageLength = i->inMessageLength;
+    return corelib::HandleMessageState::OK;
+  };
+  com.setHandleMessageCallback(fn);
+  com.initialise();
+
+  // Three single frame messages arrive before the next iteration
+  for(uint8_t m = 0; m < 3; m++){
+    corelib::Frame frame;
+    frame.preamble = corelib::Preamble::DATA;
+    frame.destinationAddress = 0x02;
+    frame.sourceAddress = 0x01;
+    frame.frameTotal = 1;
+    frame.frameOrder = 1;
+    frame.frameID = 0x100 - m; // ids do not follow arrival order
+    memset(frame.payload, 0x10 + m, sizeof(corelib::Frame::payload));
+    frame.crc = CRC32.crc32((uint8_t*)&frame, sizeof(corelib::Frame)-4);
+    memcpy(recvBuffer, (uint8_t*)&frame, sizeof(corelib::Frame));
+    com.testProcessRead();
+  }
+
+  // All of them are handled and framed in a single pass
+  TEST_ASSERT_EQUAL(3, com.testProcessMessages());
+  TEST_ASSERT_EQUAL(3, handled);
+  TEST_ASSERT_EQUAL(0, com.getInFrames().size());
+  TEST_ASSERT_EQUAL(3, com.getOutFrames().size());
+
+  for(uint8_t m = 0; m < 3; m++){
+    com.testProcessWrite();
+  }
+  TEST_ASSERT_EQUAL(3 * sizeof(corelib::Frame), sendBufferIndex);
+  uint8_t seen = 0;
+  for(uint8_t m = 0; m < 3; m++){
+    corelib::Frame frame;
+    memcpy(&frame, sendBuffer + m * sizeof(corelib::Frame), sizeof(corelib::Frame));
+    TEST_ASSERT_EQUAL(0x10 + frame.payload[1], frame.payload[0]);
+    seen |= 1 << frame.payload[1];
+  }
+  TEST_ASSERT_EQUAL(0x07, seen);
+}
+
+void test_message_view_callback(void)
+{
+  setup_test();
+
+  // Read the message in place and echo its first and last bytes
+  auto fn = [](const corelib::MessageView& message, corelib::Buffer* b){
+    TEST_ASSERT_EQUAL(3, message.fragmentCount());
+    pb_istream_t stream = message.istream();
+    uint8_t data[150];
+    if(!pb_read(&stream, data, sizeof(data))){
+      return corelib::HandleMessageState::FAILED_DECODE;
+    }
+    b->outBuffer[0] = data[0];
+    b->outBuffer[1] = data[149];
+    b->outMessageLength = 2;
+    return corelib::HandleMessageState::OK;
+  };
+  com.setHandleMessageViewCallback(fn);
+  com.initialise();
+
+  for(uint8_t order = 3; order >= 1; order--){
+    corelib::Frame frame;
+    frame.preamble = corelib::Preamble::DATA;
+    frame.destinationAddress = 0x02;
+    frame.sourceAddress = 0x01;
+    frame.frameTotal = 3;
+    frame.frameOrder = order;
+    frame.frameID = 0x200;
+    memset(frame.payload, 0x20 + order, sizeof(corelib::Frame::payload));
+    frame.crc = CRC32.crc32((uint8_t*)&frame, sizeof(corelib::Frame)-4);
+    memcpy(recvBuffer, (uint8_t*)&frame, sizeof(corelib::Frame));
+    com.testProcessRead();
+  }
+
+  // The message is handled without the Buffer copy and its frames are freed
+  TEST_ASSERT_EQUAL(1, com.testProcessMessages());
+  TEST_ASSERT_EQUAL(1, com.getStats().handleStates[(uint8_t)corelib::HandleMessageState::OK]);
+  TEST_ASSERT_EQUAL(0, com.getBuffer().inIndex);
+  TEST_ASSERT_TRUE(com.getInFrames().empty());
+
+  com.testProcessWrite();
+  corelib::Frame response;
+  memcpy(&response, sendBuffer, sizeof(corelib::Frame));
+  TEST_ASSERT_EQUAL(0x21, response.payload[0]);
+  TEST_ASSERT_EQUAL(0x23, response.payload[1]);
+}
+
+void test_stream_through_comm(void)
+{
+  setup_test();
+
+  // Records where each fragment of an incoming stream is written
+  struct Sink : public corelib::StreamSink {
+    uint32_t length = 0;
+    uint32_t written = 0;
+    uint8_t last = 0;
+    bool complete = false;
+    bool begin(const corelib::StreamInfo& info){ length = info.length; return true; }
+    bool write(uint32_t offset, const uint8_t* data, size_t size){ written += size; last = data[size - 1]; return true; }
+    void end(bool done){ complete = done; }
+  } sink;
+  // Produces a stream of 0x5A bytes
+  struct Source : public corelib::StreamSource {
+    size_t read(uint32_t offset, uint8_t* data, size_t length){ memset(data, 0x5A, length); return length; }
+  } source;
+  com.setStreamSink(&sink);
+  com.initialise();
+
+  // Incoming, a header and two data fragments
+  for(uint16_t index = 0; index < 3; index++){
+    corelib::Frame frame;
+    frame.preamble = corelib::Preamble::STREAM;
+    frame.destinationAddress = 0x02;
+    frame.sourceAddress = 0x01;
+    frame.frameID = 0x300;
+    corelib::setStreamIndex(frame, index);
+    memset(frame.payload, index, sizeof(corelib::Frame::payload));
+    if(index == 0){
+      frame.payload[0] = 80; // length
+      frame.payload[1] = frame.payload[2] = frame.payload[3] = 0;
+    }
+    frame.crc = CRC32.crc32((uint8_t*)&frame, sizeof(corelib::Frame)-4);
+    memcpy(recvBuffer, (uint8_t*)&frame, sizeof(corelib::Frame));
+    TEST_ASSERT_TRUE(com.testProcessRead() == corelib::ReadState::OK);
+  }
+  TEST_ASSERT_TRUE(sink.complete);
+  TEST_ASSERT_EQUAL(80, sink.written);
+  TEST_ASSERT_EQUAL(2, sink.last);
+  TEST_ASSERT_TRUE(com.getInFrames().empty());
+
+  // Outgoing, one frame per write until the stream is over
+  TEST_ASSERT_TRUE(com.sendStream(&source, 100, 3));
+  TEST_ASSERT_FALSE(com.sendStream(&source, 100, 3));
+  for(uint8_t i = 0; i < 3; i++){
+    TEST_ASSERT_TRUE(com.testProcessWrite() == corelib::WriteState::OK);
+  }
+  TEST_ASSERT_FALSE(com.streaming());
+  TEST_ASSERT_TRUE(com.testProcessWrite() == corelib::WriteState::OUT_FRAMES_EMPTY);
+  corelib::Frame frame;
+  memcpy(&frame, sendBuffer + 2 * sizeof(corelib::Frame), sizeof(corelib::Frame));
+  TEST_ASSERT_TRUE(frame.preamble == corelib::Preamble::STREAM);
+  TEST_ASSERT_EQUAL(2, corelib::streamIndex(frame));
+  TEST_ASSERT_EQUAL(0x5A, frame.payload[49]);
+  TEST_ASSERT_EQUAL(CRC32.crc32((uint8_t*)&frame, sizeof(corelib::Frame)-4), frame.crc);
+  com.setStreamSink(nullptr);
+}
+
 void setUp (void) {}
 
 void tearDown (void) {}
@@ -39,10 +39,18 @@ class TestComm : public corelib::Comm
       processOutgoingMessage();
     }
 
+    auto testProcessMessages(){
+      return processMessages();
+    }
+
     corelib::HandleMessageState testCallback(corelib::Buffer* b) {
       return callback(b);
     }
 
+    void testIterate(){
+      corelib::Comm::performIterate();
+    }
+
     auto getBuffer(){
       return buffer;
     }
@@ -51,16 +59,23 @@ class TestComm : public corelib::Comm
       buffer = b;
     } 
 
-    auto getInFrames(){
+    const auto& getInFrames(){
       return inFrames;
     }
 
+    const auto& getOutFrames(){
+      return outFrames;
+    }
+
     void testReset(){
       inFrames.clear();
+      outFrames.clear();
       buffer.inIndex = 0;
       buffer.inMessageLength = 0;
       buffer.outMessageLength = 0;
       sendBufferIndex = 0;
+      resetStats();
+      viewCallbackFunction = etl::delegate<corelib::HandleMessageState(const corelib::MessageView&, corelib::Buffer*)>();
     }
 
   protected:
@@ -91,4 +106,10 @@ void test_multiple_incoming_frame(void);
 void test_multiple_unique_incoming_frame(void);
 void test_single_outgoing_single_frame(void);
 void test_single_outgoing_multiple_frame(void);
-void test_message_callback(void);
\ No newline at end of file
+void test_message_callback(void);
+void test_stats_counters(void);
+void test_lost_fragments_under_load(void);
+void test_stale_partial_timeout(void);
+void test_burst_handled_in_order(void);
+void test_message_view_callback(void);
+void test_stream_through_comm(void);
\ No newline at end of file
@@ -0,0 +1,223 @@
+#include "tests_delta.h"
+
+// Class under test
+corelib::ShareRegistry<4> registry;
+CommStats1 outcomes = CommStats1_init_zero;
+corelib::DeltaShadow device;
+corelib::DeltaShadow host;
+
+uint8_t deltaBuffer[corelib::DeltaMaxSize];
+uint8_t message[128];
+
+// Encodes a share as the registry would
+size_t encodeShare(const CommStats1& share, uint8_t* out)
+{
+  pb_ostream_t stream = pb_ostream_from_buffer(out, corelib::DeltaMaxShare);
+  TEST_ASSERT_TRUE(pb_encode(&stream, CommStats1_fields, &share));
+  return stream.bytes_written;
+}
+
+// Reads a SHARE_DELTA as the host would, returning the length of the delta
+size_t readDelta(const uint8_t* in, size_t length, uint32_t& token)
+{
+  uint32_t shareId = 0;
+  size_t deltaLength = 0;
+  pb_istream_t stream = pb_istream_from_buffer(in, length);
+  TEST_ASSERT_TRUE(corelib::decodeDeltaMessage(stream, token, shareId, deltaBuffer, deltaLength));
+  TEST_ASSERT_EQUAL(1, shareId);
+  return deltaLength;
+}
+
+// Publishes the share, returning the length of the delta and its message
+size_t publish(size_t& length)
+{
+  uint32_t token = 0;
+  TEST_ASSERT_EQUAL(corelib::HandleMessageState::OK, registry.encodePublish(1, 7, message, sizeof(message), length));
+  const size_t deltaLength = readDelta(message, length, token);
+  TEST_ASSERT_EQUAL(7, token);
+  return deltaLength;
+}
+
+void setup_test()
+{
+  outcomes = CommStats1_init_zero;
+  for(uint8_t i = 0; i < 13; i++){
+    (&outcomes.readOk)[i] = 0x01010101 * (i + 1);
+  }
+  device = corelib::DeltaShadow();
+  host = corelib::DeltaShadow();
+}
+
+void run_tests()
+{
+  registry.addShare<CommStats1_size>(1, outcomes, CommStats1_fields);
+
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  RUN_TEST(test_delta_round_trip);
+  RUN_TEST(test_delta_merges_ranges);
+  RUN_TEST(test_delta_full_fallback);
+  RUN_TEST(test_delta_version_mismatch);
+  RUN_TEST(test_publish_as_delta);
+  RUN_TEST(test_resync_request);
+  UNITY_END(); // stop unit testing
+}
+
+void test_delta_round_trip(void)
+{
+  setup_test();
+
+  uint8_t share[corelib::DeltaMaxShare];
+  size_t length = encodeShare(outcomes, share);
+  // The first delta replaces the share
+  size_t deltaLength = corelib::encodeDelta(device, share, length, deltaBuffer);
+  TEST_ASSERT_EQUAL(corelib::DeltaHeaderSize + corelib::DeltaRangeHeaderSize + length, deltaLength);
+  TEST_ASSERT_TRUE(corelib::applyDelta(host, deltaBuffer, deltaLength));
+
+  // Then only what changes is sent
+  for(uint32_t update = 0; update < 200; update++){
+    (&outcomes.readOk)[(update * 7) % 13] += update;
+    length = encodeShare(outcomes, share);
+    deltaLength = corelib::encodeDelta(device, share, length, deltaBuffer);
+    TEST_ASSERT_TRUE(deltaLength > 0);
+    TEST_ASSERT_TRUE(corelib::applyDelta(host, deltaBuffer, deltaLength));
+    TEST_ASSERT_EQUAL(device.version, host.version);
+    TEST_ASSERT_EQUAL(length, host.length);
+    TEST_ASSERT_EQUAL_MEMORY(share, host.data, length);
+  }
+}
+
+void test_delta_merges_ranges(void)
+{
+  setup_test();
+
+  uint8_t share[corelib::DeltaMaxShare];
+  size_t length = encodeShare(outcomes, share);
+  corelib::encodeDelta(device, share, length, deltaBuffer);
+  const uint16_t version = device.version;
+
+  // Nothing changed, an empty delta at the same version
+  TEST_ASSERT_EQUAL(corelib::DeltaHeaderSize, corelib::encodeDelta(device, share, length, deltaBuffer));
+  TEST_ASSERT_EQUAL(version, device.version);
+
+  // Bytes 1 apart are one range, 4 apart are two
+  share[10] ^= 0xFF;
+  share[12] ^= 0xFF;
+  share[20] ^= 0xFF;
+  TEST_ASSERT_EQUAL(corelib::DeltaHeaderSize + 2 * corelib::DeltaRangeHeaderSize + 4,
+    corelib::encodeDelta(device, share, length, deltaBuffer));
+  TEST_ASSERT_EQUAL(version, deltaBuffer[0] | (deltaBuffer[1] << 8));
+  TEST_ASSERT_EQUAL(version + 1, device.version);
+  TEST_ASSERT_EQUAL(10, deltaBuffer[5]);
+  TEST_ASSERT_EQUAL(3, deltaBuffer[6]);
+  TEST_ASSERT_EQUAL(20, deltaBuffer[10]);
+  TEST_ASSERT_EQUAL(1, deltaBuffer[11]);
+}
+
+void test_delta_full_fallback(void)
+{
+  setup_test();
+
+  uint8_t share[corelib::DeltaMaxShare];
+  size_t length = encodeShare(outcomes, share);
+  corelib::encodeDelta(device, share, length, deltaBuffer);
+  // Everything changed, a full delta is no larger
+  for(size_t i = 0; i < length; i++){
+    share[i] ^= 0x5A;
+  }
+  TEST_ASSERT_EQUAL(corelib::DeltaHeaderSize + corelib::DeltaRangeHeaderSize + length,
+    corelib::encodeDelta(device, share, length, deltaBuffer));
+  TEST_ASSERT_EQUAL(0, deltaBuffer[0] | (deltaBuffer[1] << 8));
+  // A share too large for a full delta is not tracked
+  uint8_t large[corelib::DeltaMaxSize] = {0};
+  TEST_ASSERT_EQUAL(0, corelib::encodeDelta(device, large, sizeof(large), deltaBuffer));
+}
+
+void test_delta_version_mismatch(void)
+{
+  setup_test();
+
+  uint8_t share[corelib::DeltaMaxShare];
+  size_t length = encodeShare(outcomes, share);
+  size_t deltaLength = corelib::encodeDelta(device, share, length, deltaBuffer);
+  TEST_ASSERT_TRUE(corelib::applyDelta(host, deltaBuffer, deltaLength));
+
+  // The host misses a delta, the next does not apply and leaves its shadow alone
+  share[3] ^= 1;
+  corelib::encodeDelta(device, share, length, deltaBuffer);
+  share[8] ^= 1;
+  deltaLength = corelib::encodeDelta(device, share, length, deltaBuffer);
+  const uint16_t version = host.version;
+  TEST_ASSERT_FALSE(corelib::applyDelta(host, deltaBuffer, deltaLength));
+  TEST_ASSERT_EQUAL(version, host.version);
+  // A full delta brings it back
+  deltaLength = corelib::encodeFullDelta(device, share, length, deltaBuffer);
+  TEST_ASSERT_TRUE(corelib::applyDelta(host, deltaBuffer, deltaLength));
+  TEST_ASSERT_EQUAL_MEMORY(share, host.data, length);
+  // Malformed deltas are rejected
+  deltaBuffer[6] = 0xFF;
+  TEST_ASSERT_FALSE(corelib::applyDelta(host, deltaBuffer, deltaLength));
+  TEST_ASSERT_FALSE(corelib::applyDelta(host, deltaBuffer, 3));
+}
+
+void test_publish_as_delta(void)
+{
+  setup_test();
+
+  TEST_ASSERT_TRUE(registry.trackDelta(1, device));
+  TEST_ASSERT_FALSE(registry.trackDelta(2, device));
+  size_t length = 0;
+  size_t deltaLength = publish(length);
+  TEST_ASSERT_TRUE(corelib::applyDelta(host, deltaBuffer, deltaLength));
+
+  // One changed counter fits a single frame
+  outcomes.writeOk += 1;
+  deltaLength = publish(length);
+  TEST_ASSERT_TRUE(length <= sizeof(corelib::Frame::payload));
+  TEST_ASSERT_TRUE(corelib::applyDelta(host, deltaBuffer, deltaLength));
+
+  CommStats1 received = CommStats1_init_zero;
+  pb_istream_t share = pb_istream_from_buffer(host.data, host.length);
+  TEST_ASSERT_TRUE(pb_decode(&share, CommStats1_fields, &received));
+  TEST_ASSERT_EQUAL(outcomes.writeOk, received.writeOk);
+  TEST_ASSERT_EQUAL(outcomes.handleFailedEncode, received.handleFailedEncode);
+}
+
+void test_resync_request(void)
+{
+  setup_test();
+
+  TEST_ASSERT_TRUE(registry.trackDelta(1, device));
+  size_t length = 0;
+  publish(length);
+  outcomes.readError = 5;
+  publish(length);
+  // The host missed both, and asks for a full delta
+  TransactionMessage request = TransactionMessage_init_zero;
+  request.token = 0x42;
+  request.action = TransactionMessage_Action_SHARE_DELTA;
+  request.shareId = 1;
+  corelib::Buffer buffer;
+  pb_ostream_t out = pb_ostream_from_buffer(buffer.inBuffer, sizeof(buffer.inBuffer));
+  pb_encode(&out, TransactionMessage_fields, &request);
+  buffer.inMessageLength = out.bytes_written;
+  TEST_ASSERT_EQUAL(corelib::HandleMessageState::OK, registry.handleBuffer(&buffer));
+
+  uint32_t token = 0;
+  size_t deltaLength = readDelta(buffer.outBuffer, buffer.outMessageLength, token);
+  TEST_ASSERT_EQUAL(0x42, token);
+  TEST_ASSERT_TRUE(corelib::applyDelta(host, deltaBuffer, deltaLength));
+  TEST_ASSERT_EQUAL(device.version, host.version);
+  // Deltas apply again
+  outcomes.readError = 6;
+  deltaLength = publish(length);
+  TEST_ASSERT_TRUE(corelib::applyDelta(host, deltaBuffer, deltaLength));
+}
+
+void setUp (void) {}
+
+void tearDown (void) {}
+
+int main(int argc, char **argv) {
+  run_tests();
+  return 0;
+}
@@ -0,0 +1,21 @@
+/**
+ * @file tests_delta.h
+ *
+ * @brief Tests the delta encoding of share updates, and publishing shares as deltas.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "delta.h"
+#include "shares.h"
+
+void setup_test();
+void run_tests();
+void test_delta_round_trip(void);
+void test_delta_merges_ranges(void);
+void test_delta_full_fallback(void);
+void test_delta_version_mismatch(void);
+void test_publish_as_delta(void);
+void test_resync_request(void);
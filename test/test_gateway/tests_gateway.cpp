@@ -0,0 +1,170 @@
+#include "tests_gateway.h"
+
+typedef corelib::SimulatedCanBus<4, 64> Bus;
+typedef corelib::SimulatedCanComm<Bus> CanComm;
+
+// External interfaces
+FastCRC32 CRC32;
+
+// Class under test, a gateway between the PC (0x01) on USB and nodes on CAN
+corelib::Router<2> router;
+Bus bus;
+UsbComm usb(0x02);
+CanComm can(bus, 0x02);
+// The nodes on the bus, only the first answers
+CanComm node(bus, 0x03, 0x01);
+CanComm other(bus, 0x04, 0x01);
+
+// The last message a node handled
+uint8_t received[150];
+int receivedLength = 0;
+uint32_t handled = 0;
+
+// Echoes every message back
+corelib::HandleMessageState echo(corelib::Buffer* b)
+{
+  memcpy(received, b->inBuffer, b->inMessageLength);
+  receivedLength = b->inMessageLength;
+  handled++;
+  memcpy(b->outBuffer, b->inBuffer, b->inMessageLength);
+  b->outMessageLength = b->inMessageLength;
+  return corelib::HandleMessageState::OK;
+}
+
+// A request of two frames from the PC to a node, as it arrives over USB
+void sendRequest(uint8_t destination)
+{
+  for(uint8_t order = 1; order <= 2; order++){
+    corelib::Frame frame;
+    frame.preamble = corelib::Preamble::DATA;
+    frame.destinationAddress = destination;
+    frame.sourceAddress = 0x01;
+    frame.frameID = 0x1234;
+    frame.frameOrder = order;
+    frame.frameTotal = 2;
+    for(uint8_t i = 0; i < sizeof(frame.payload); i++){
+      frame.payload[i] = order * 0x10 + i;
+    }
+    frame.crc = CRC32.crc32((uint8_t*)&frame, sizeof(corelib::Frame)-4);
+    usb.push(frame);
+  }
+}
+
+// Runs the gateway and the nodes
+void run()
+{
+  for(uint8_t i = 0; i < 10; i++){
+    usb.iterate();
+    can.iterate();
+    node.iterate();
+    other.iterate();
+  }
+}
+
+void setup_test()
+{
+  bus.reset();
+  usb.reset();
+  can.resetStats();
+  node.resetStats();
+  other.resetStats();
+  router.resetStats();
+  memset(received, 0, sizeof(received));
+  receivedLength = 0;
+  handled = 0;
+}
+
+void run_tests()
+{
+  usb.initialise();
+  can.initialise();
+  node.initialise();
+  other.initialise();
+  node.setHandleMessageCallback(etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::create<&echo>());
+  other.setHandleMessageCallback(etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::create<&echo>());
+  router.attach(usb); // interface 0
+  router.attach(can); // interface 1
+  router.addRoute(0x01, 0);
+  router.addRoute(0x03, 1);
+  router.addRoute(0x04, 1);
+
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  RUN_TEST(test_request_forwarded_to_can);
+  RUN_TEST(test_reply_forwarded_to_usb);
+  RUN_TEST(test_other_nodes_filter);
+  RUN_TEST(test_bus_traffic_left);
+  UNITY_END(); // stop unit testing
+}
+
+void test_request_forwarded_to_can(void)
+{
+  setup_test();
+
+  sendRequest(0x03);
+  run();
+  TEST_ASSERT_EQUAL(1, handled);
+  TEST_ASSERT_EQUAL(2 * sizeof(corelib::Frame::payload), receivedLength);
+  TEST_ASSERT_EQUAL(0x10, received[0]);
+  TEST_ASSERT_EQUAL(0x20 + 3, received[sizeof(corelib::Frame::payload) + 3]);
+  TEST_ASSERT_EQUAL(0, node.unitDrops());
+}
+
+void test_reply_forwarded_to_usb(void)
+{
+  setup_test();
+
+  sendRequest(0x03);
+  run();
+  // The reply from the bus is written to the PC with a check it accepts
+  TEST_ASSERT_EQUAL(2, usb.txCount);
+  for(uint8_t order = 1; order <= 2; order++){
+    const corelib::Frame& frame = usb.tx[order - 1];
+    TEST_ASSERT_EQUAL(corelib::Preamble::DATA, frame.preamble);
+    TEST_ASSERT_EQUAL(0x01, frame.destinationAddress);
+    TEST_ASSERT_EQUAL(0x03, frame.sourceAddress);
+    TEST_ASSERT_EQUAL(order, frame.frameOrder);
+    TEST_ASSERT_EQUAL(2, frame.frameTotal);
+    TEST_ASSERT_EQUAL(order * 0x10, frame.payload[0]);
+    TEST_ASSERT_EQUAL(CRC32.crc32((uint8_t*)&frame, sizeof(corelib::Frame)-4), frame.crc);
+  }
+  TEST_ASSERT_EQUAL(4, router.getStats().forwarded);
+  TEST_ASSERT_EQUAL(2, can.getStats().framesIn);
+  TEST_ASSERT_EQUAL(2, usb.getStats().framesOut);
+}
+
+void test_other_nodes_filter(void)
+{
+  setup_test();
+
+  // A node without a router only takes frames for itself from the bus
+  sendRequest(0x04);
+  run();
+  TEST_ASSERT_EQUAL(1, handled);
+  TEST_ASSERT_EQUAL(0, node.unitDrops());
+  TEST_ASSERT_EQUAL(0, node.getStats().framesIn);
+  TEST_ASSERT_EQUAL(2, usb.txCount);
+  TEST_ASSERT_EQUAL(0x04, usb.tx[0].sourceAddress);
+}
+
+void test_bus_traffic_left(void)
+{
+  setup_test();
+
+  // Traffic between two nodes is not taken from the bus by the gateway
+  TEST_ASSERT_TRUE(node.ping(0x04));
+  run();
+  TEST_ASSERT_EQUAL(1, other.getStats().pingsAnswered);
+  TEST_ASSERT_EQUAL(1, node.getStats().pingResponses);
+  TEST_ASSERT_EQUAL(0, can.getStats().framesIn);
+  TEST_ASSERT_EQUAL(0, router.getStats().noRoute);
+  TEST_ASSERT_EQUAL(0, usb.txCount);
+}
+
+void setUp (void) {}
+
+void tearDown (void) {}
+
+int main(int argc, char **argv) {
+  run_tests();
+  return 0;
+}
@@ -0,0 +1,66 @@
+/**
+ * @file tests_gateway.h
+ *
+ * @brief Tests a Router forwarding between a USB like Comm and a simulated CAN bus.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include <FastCRC.h>
+
+#include "router.h"
+#include "can.h"
+
+// The USB side of the gateway, over an in-memory loopback
+class UsbComm : public corelib::Comm
+{
+  public:
+    static const uint8_t Depth = 16;
+    // Frames to be read
+    corelib::Frame rx[Depth];
+    uint8_t rxHead = 0;
+    uint8_t rxTail = 0;
+    // Frames written
+    corelib::Frame tx[Depth];
+    uint8_t txCount = 0;
+
+    UsbComm(uint8_t deviceAddress) : corelib::Comm() {
+      address = deviceAddress;
+    }
+
+    void push(const corelib::Frame& frame){
+      rx[rxTail++ % Depth] = frame;
+    }
+
+    void reset(){
+      rxHead = rxTail = txCount = 0;
+      resetStats();
+    }
+
+  protected:
+    // Function.h interface
+    void performInitialise(){
+      initialised = true;
+    }
+
+    // Comms.h interface
+    bool read(uint8_t* buffer){
+      if(rxHead == rxTail){
+        return false;
+      }
+      memcpy(buffer, &rx[rxHead++ % Depth], 64);
+      return true;
+    }
+    bool write(const uint8_t* buffer){
+      memcpy(&tx[txCount++ % Depth], buffer, 64);
+      return true;
+    }
+};
+
+void setup_test();
+void run_tests();
+void test_request_forwarded_to_can(void);
+void test_reply_forwarded_to_usb(void);
+void test_other_nodes_filter(void);
+void test_bus_traffic_left(void);
@@ -0,0 +1,89 @@
+#include "tests_integrity.h"
+
+// External interfaces
+FastCRC32 CRC32;
+
+// Classes under test
+corelib::FastCrc32Integrity fastCrc;
+corelib::Crc32SliceBy8 sliceBy8;
+corelib::Crc32Nibble nibble;
+
+uint8_t data[256] = {0};
+
+void setup_test()
+{
+  srand(1234);
+  for(uint16_t i = 0; i < sizeof(data); i++){
+    data[i] = rand() & 0xFF;
+  }
+}
+
+void run_tests()
+{
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  RUN_TEST(test_known_check_value);
+  RUN_TEST(test_policies_match_fastcrc);
+  RUN_TEST(test_policies_match_fastcrc_on_frames);
+  RUN_TEST(test_no_integrity);
+  UNITY_END(); // stop unit testing
+}
+
+void test_known_check_value(void)
+{
+  const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+  TEST_ASSERT_EQUAL_HEX32(0xCBF43926, fastCrc.compute(check, sizeof(check)));
+  TEST_ASSERT_EQUAL_HEX32(0xCBF43926, sliceBy8.compute(check, sizeof(check)));
+  TEST_ASSERT_EQUAL_HEX32(0xCBF43926, nibble.compute(check, sizeof(check)));
+}
+
+void test_policies_match_fastcrc(void)
+{
+  setup_test();
+
+  // Every length exercises the 8 byte steps and each possible tail, at odd offsets too
+  for(uint16_t offset = 0; offset < 8; offset++){
+    for(uint16_t length = 0; length <= sizeof(data) - offset; length++){
+      uint32_t expected = CRC32.crc32(data + offset, length);
+      TEST_ASSERT_EQUAL_HEX32(expected, sliceBy8.compute(data + offset, length));
+      TEST_ASSERT_EQUAL_HEX32(expected, nibble.compute(data + offset, length));
+    }
+  }
+}
+
+void test_policies_match_fastcrc_on_frames(void)
+{
+  setup_test();
+
+  corelib::Frame frame;
+  frame.preamble = corelib::Preamble::DATA;
+  frame.destinationAddress = 0x02;
+  frame.sourceAddress = 0x01;
+  frame.frameTotal = 1;
+  frame.frameOrder = 1;
+  for(uint32_t id = 0; id < 100; id++){
+    frame.frameID = id * 2654435761UL;
+    memcpy(frame.payload, data + id, sizeof(corelib::Frame::payload));
+    uint32_t expected = CRC32.crc32((uint8_t*)&frame, sizeof(corelib::Frame)-4);
+    TEST_ASSERT_EQUAL_HEX32(expected, sliceBy8.compute((uint8_t*)&frame, sizeof(corelib::Frame)-4));
+    TEST_ASSERT_EQUAL_HEX32(expected, nibble.compute((uint8_t*)&frame, sizeof(corelib::Frame)-4));
+  }
+}
+
+void test_no_integrity(void)
+{
+  setup_test();
+
+  corelib::NoIntegrity none;
+  TEST_ASSERT_FALSE(corelib::NoIntegrity::enabled);
+  TEST_ASSERT_TRUE(corelib::Crc32SliceBy8::enabled);
+  TEST_ASSERT_EQUAL(0, none.compute(data, sizeof(data)));
+}
+
+void setUp (void) {}
+
+void tearDown (void) {}
+
+int main(int argc, char **argv) {
+  run_tests();
+  return 0;
+}
@@ -0,0 +1,19 @@
+/**
+ * @file tests_integrity.h
+ *
+ * @brief Tests that every frame check policy matches the CRC-32 of the frame wire format.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "integrity.h"
+#include "frame.h"
+
+void setup_test();
+void run_tests();
+void test_known_check_value(void);
+void test_policies_match_fastcrc(void);
+void test_policies_match_fastcrc_on_frames(void);
+void test_no_integrity(void);
@@ -0,0 +1,218 @@
+#include "tests_persist.h"
+
+// Class under test
+TestStorage storage;
+
+// The persistence of a device after it starts, with a tuning share at id 1 and stats at id 2
+struct Device {
+  Subscription1 tuning = Subscription1_init_zero;
+  CommStats2 stats = CommStats2_init_zero;
+  Persist persist;
+
+  Device() : persist(storage, 0, TestStorage::Size) {
+    persist.addShare<Subscription1_size>(1, tuning, Subscription1_fields);
+    persist.addShare<CommStats2_size>(2, stats, CommStats2_fields);
+    persist.setPacing(16, 2);
+    persist.initialise();
+  }
+
+  void iterate(uint32_t iterations) {
+    for(uint32_t i = 0; i < iterations; i++){
+      persist.iterate();
+    }
+  }
+};
+
+uint32_t totalWrites()
+{
+  uint32_t total = 0;
+  for(size_t i = 0; i < TestStorage::Size; i++){
+    total += storage.writes[i];
+  }
+  return total;
+}
+
+void setup_test()
+{
+  storage.erase();
+}
+
+void run_tests()
+{
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  RUN_TEST(test_save_and_load);
+  RUN_TEST(test_coalesced_and_paced);
+  RUN_TEST(test_wear_levelling);
+  RUN_TEST(test_power_loss);
+  UNITY_END(); // stop unit testing
+}
+
+void test_save_and_load(void)
+{
+  setup_test();
+
+  Device first;
+  TEST_ASSERT_EQUAL(13, first.persist.slotCount());
+  TEST_ASSERT_FALSE(first.persist.loaded(1));
+  first.tuning.period = 250;
+  first.tuning.rate = 7;
+  first.persist.markDirty(1);
+  TEST_ASSERT_TRUE(first.persist.busy());
+  first.iterate(10);
+  TEST_ASSERT_FALSE(first.persist.busy());
+  TEST_ASSERT_EQUAL(1, first.persist.recordsWritten());
+
+  // The next start loads it
+  Device second;
+  TEST_ASSERT_TRUE(second.persist.loaded(1));
+  TEST_ASSERT_FALSE(second.persist.loaded(2));
+  TEST_ASSERT_EQUAL(250, second.tuning.period);
+  TEST_ASSERT_EQUAL(7, second.tuning.rate);
+
+  // Publishes from the host mark the share through the registry's hook
+  corelib::ShareHook hook = second.persist.hook();
+  second.tuning.period = 500;
+  hook(1, TransactionMessage_Action_SHARE_REQUEST);
+  TEST_ASSERT_FALSE(second.persist.dirty(1));
+  hook(1, TransactionMessage_Action_SHARE_PUBLISH);
+  TEST_ASSERT_TRUE(second.persist.dirty(1));
+  second.persist.flush();
+  TEST_ASSERT_EQUAL(500, Device().tuning.period);
+
+  // Before initialise, and in a region without a slot, a flush writes nothing
+  Subscription1 tuning = Subscription1_init_zero;
+  Persist early(storage, 0, TestStorage::Size);
+  Persist tiny(storage, 0, 8);
+  early.addShare<Subscription1_size>(1, tuning, Subscription1_fields);
+  tiny.addShare<Subscription1_size>(1, tuning, Subscription1_fields);
+  early.markDirty(1);
+  tiny.markDirty(1);
+  tiny.initialise();
+  const uint32_t writes = totalWrites();
+  early.flush();
+  tiny.flush();
+  TEST_ASSERT_EQUAL(writes, totalWrites());
+}
+
+void test_coalesced_and_paced(void)
+{
+  setup_test();
+
+  Device device;
+  device.persist.setPacing(4, 10);
+  // A burst of changes is one record, once the holdoff passed
+  for(uint32_t i = 1; i <= 9; i++){
+    device.stats.framesIn = i * 1000;
+    device.persist.markDirty(2);
+    device.iterate(1);
+  }
+  TEST_ASSERT_EQUAL(0, totalWrites());
+  // Then at most 4 bytes an iteration
+  uint32_t iterations = 0;
+  while(device.persist.busy()){
+    const uint32_t before = totalWrites();
+    device.iterate(1);
+    TEST_ASSERT_TRUE(totalWrites() - before <= 4);
+    iterations++;
+  }
+  TEST_ASSERT_EQUAL(1, device.persist.recordsWritten());
+  // 7 header, 5 data and 4 crc bytes
+  TEST_ASSERT_EQUAL(16, totalWrites());
+  TEST_ASSERT_EQUAL(4, iterations);
+  TEST_ASSERT_EQUAL(9000, Device().stats.framesIn);
+
+  // A change which was undone is not written
+  device.stats.framesIn = 1;
+  device.persist.markDirty(2);
+  device.stats.framesIn = 9000;
+  device.iterate(20);
+  TEST_ASSERT_FALSE(device.persist.busy());
+  TEST_ASSERT_EQUAL(1, device.persist.recordsWritten());
+}
+
+void test_wear_levelling(void)
+{
+  setup_test();
+
+  Device device;
+  device.stats.evictions = 42;
+  device.persist.markDirty(2);
+  device.persist.flush();
+  // A share saved over and over moves around the region
+  const uint32_t saves = 220;
+  for(uint32_t i = 0; i < saves; i++){
+    device.tuning.period = i + 1;
+    device.persist.markDirty(1);
+    device.persist.flush();
+  }
+  TEST_ASSERT_EQUAL(saves + 1, device.persist.recordsWritten());
+  uint32_t most = 0;
+  for(size_t i = 0; i < TestStorage::Size; i++){
+    most = storage.writes[i] > most ? storage.writes[i] : most;
+  }
+  // Eleven slots take turns, the stats and the latest tuning hold two
+  TEST_ASSERT_TRUE(most <= saves / 11 + 1);
+
+  // The share saved once is still there
+  Device restarted;
+  TEST_ASSERT_EQUAL(saves, restarted.tuning.period);
+  TEST_ASSERT_EQUAL(42, restarted.stats.evictions);
+}
+
+void test_power_loss(void)
+{
+  setup_test();
+
+  Device device;
+  device.tuning.period = 111;
+  device.persist.markDirty(1);
+  device.persist.flush();
+  uint8_t saved[TestStorage::Size];
+  for(size_t i = 0; i < TestStorage::Size; i++){
+    saved[i] = storage.read(i);
+  }
+
+  // Power is lost after each byte of the next record in turn
+  int32_t complete = -1;
+  for(int32_t cut = 0; cut <= 20; cut++){
+    for(size_t i = 0; i < TestStorage::Size; i++){
+      storage.eeprom.write(i, saved[i]);
+    }
+    Device before;
+    TEST_ASSERT_EQUAL(111, before.tuning.period);
+    before.tuning.period = 222;
+    before.persist.markDirty(1);
+    storage.powerLeft = cut;
+    before.persist.flush();
+    storage.powerLeft = -1;
+
+    // The share is what was saved before, or what was being saved, never anything else
+    Device after;
+    TEST_ASSERT_TRUE(after.persist.loaded(1));
+    if(after.tuning.period == 222){
+      if(complete < 0){
+        complete = cut;
+      }
+    }else{
+      TEST_ASSERT_EQUAL(111, after.tuning.period);
+      TEST_ASSERT_EQUAL(-1, complete);
+    }
+
+    // Saving carries on after the lost record
+    after.tuning.period = 333;
+    after.persist.markDirty(1);
+    after.persist.flush();
+    TEST_ASSERT_EQUAL(333, Device().tuning.period);
+  }
+  // 7 header, 5 data and 4 crc bytes
+  TEST_ASSERT_EQUAL(16, complete);
+}
+
+void setUp (void) {}
+
+void tearDown (void) {}
+
+int main(int argc, char **argv) {
+  run_tests();
+  return 0;
+}
@@ -0,0 +1,56 @@
+/**
+ * @file tests_persist.h
+ *
+ * @brief Tests saving shares to EEPROM, wear levelling and power loss while saving.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "persist.h"
+
+// EEPROM which counts the writes to each byte and can lose power
+class TestStorage
+{
+  public:
+    static const size_t Size = 1024;
+    corelib::EepromStorage eeprom;
+    uint32_t writes[Size];
+    // Bytes written before the power is lost, -1 while it is not
+    int32_t powerLeft = -1;
+
+    void erase(){
+      for(size_t i = 0; i < Size; i++){
+        eeprom.write(i, 0xFF);
+      }
+      memset(writes, 0, sizeof(writes));
+      powerLeft = -1;
+    }
+
+    uint8_t read(size_t address){
+      return eeprom.read(address);
+    }
+    void write(size_t address, uint8_t value){
+      if(powerLeft == 0){
+        return;
+      }
+      if(powerLeft > 0){
+        powerLeft--;
+      }
+      writes[address]++;
+      eeprom.write(address, value);
+    }
+    size_t size(){
+      return Size;
+    }
+};
+
+typedef corelib::SharePersistence<4, 64, TestStorage> Persist;
+
+void setup_test();
+void run_tests();
+void test_save_and_load(void);
+void test_coalesced_and_paced(void);
+void test_wear_levelling(void);
+void test_power_loss(void);
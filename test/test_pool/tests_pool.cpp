@@ -0,0 +1,223 @@
+#include "tests_pool.h"
+
+typedef corelib::CommConfig<> Config;
+
+// External interfaces
+FastCRC32 CRC32;
+
+// Class under test
+PoolComm com;
+
+// A data frame for this device, order of total, from the host
+corelib::Frame makeFrame(uint32_t frameId, uint8_t order, uint8_t total)
+{
+  corelib::Frame frame;
+  frame.preamble = corelib::Preamble::DATA;
+  frame.destinationAddress = 0x02;
+  frame.sourceAddress = 0x01;
+  frame.frameID = frameId;
+  frame.frameOrder = order;
+  frame.frameTotal = total;
+  memset(frame.payload, order, sizeof(frame.payload));
+  frame.crc = CRC32.crc32((uint8_t*)&frame, sizeof(corelib::Frame)-4);
+  return frame;
+}
+
+// Reads the frames waiting for the Comm
+void readAll()
+{
+  while(com.rxHead != com.rxTail){
+    com.testProcessRead();
+  }
+}
+
+void setup_test()
+{
+  com.reset();
+}
+
+void run_tests()
+{
+  com.setHandleMessageCallback(
+    etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::create<PoolComm, &PoolComm::count>(com));
+  com.initialise();
+
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  RUN_TEST(test_reservations);
+  RUN_TEST(test_high_water);
+  RUN_TEST(test_transmit_burst_leaves_receive);
+  RUN_TEST(test_receive_burst_leaves_transmit);
+  RUN_TEST(test_footprint);
+  UNITY_END(); // stop unit testing
+}
+
+void test_reservations(void)
+{
+  setup_test();
+
+  corelib::StaticFramePool<8> pool;
+  TEST_ASSERT_TRUE(pool.reserve(corelib::PoolOwner::RX, 3));
+  TEST_ASSERT_TRUE(pool.reserve(corelib::PoolOwner::TX, 2));
+  TEST_ASSERT_FALSE(pool.reserve(corelib::PoolOwner::RELAY, 4));
+  TEST_ASSERT_EQUAL(5, pool.available(corelib::PoolOwner::TX));
+  TEST_ASSERT_EQUAL(3, pool.available(corelib::PoolOwner::RELAY));
+
+  // Transmit takes its own frames and every shared one
+  corelib::FrameHandle tx[8];
+  for(uint8_t i = 0; i < 5; i++){
+    tx[i] = pool.acquire(corelib::PoolOwner::TX);
+    TEST_ASSERT_TRUE(tx[i] != corelib::NoFrame);
+  }
+  TEST_ASSERT_EQUAL(corelib::NoFrame, pool.acquire(corelib::PoolOwner::TX));
+  TEST_ASSERT_EQUAL(corelib::NoFrame, pool.acquire(corelib::PoolOwner::RELAY));
+
+  // But not those kept for receive
+  TEST_ASSERT_EQUAL(3, pool.available(corelib::PoolOwner::RX));
+  corelib::FrameHandle rx[3];
+  for(uint8_t i = 0; i < 3; i++){
+    rx[i] = pool.acquire(corelib::PoolOwner::RX);
+    TEST_ASSERT_TRUE(rx[i] != corelib::NoFrame);
+    for(uint8_t j = 0; j < 5; j++){
+      TEST_ASSERT_TRUE(rx[i] != tx[j]);
+    }
+  }
+  TEST_ASSERT_EQUAL(corelib::NoFrame, pool.acquire(corelib::PoolOwner::RX));
+  TEST_ASSERT_EQUAL(8, pool.size());
+
+  // A released frame is shared again
+  pool.release(corelib::PoolOwner::TX, tx[0]);
+  TEST_ASSERT_EQUAL(1, pool.available(corelib::PoolOwner::RX));
+  TEST_ASSERT_EQUAL(tx[0], pool.acquire(corelib::PoolOwner::RELAY));
+  TEST_ASSERT_EQUAL(1, pool.size(corelib::PoolOwner::RELAY));
+  TEST_ASSERT_EQUAL(4, pool.size(corelib::PoolOwner::TX));
+}
+
+void test_high_water(void)
+{
+  setup_test();
+
+  corelib::StaticFramePool<4> pool;
+  const corelib::FrameHandle a = pool.acquire(corelib::PoolOwner::RX);
+  const corelib::FrameHandle b = pool.acquire(corelib::PoolOwner::RX);
+  pool.release(corelib::PoolOwner::RX, a);
+  const corelib::FrameHandle c = pool.acquire(corelib::PoolOwner::TX);
+  TEST_ASSERT_EQUAL(2, pool.highWater(corelib::PoolOwner::RX));
+  TEST_ASSERT_EQUAL(1, pool.highWater(corelib::PoolOwner::TX));
+  TEST_ASSERT_EQUAL(0, pool.highWater(corelib::PoolOwner::RELAY));
+  TEST_ASSERT_EQUAL(2, pool.highWater());
+
+  // Restarts from what is held now
+  pool.release(corelib::PoolOwner::RX, b);
+  pool.resetHighWater();
+  TEST_ASSERT_EQUAL(0, pool.highWater(corelib::PoolOwner::RX));
+  TEST_ASSERT_EQUAL(1, pool.highWater(corelib::PoolOwner::TX));
+  TEST_ASSERT_EQUAL(1, pool.highWater());
+  pool.release(corelib::PoolOwner::TX, c);
+  TEST_ASSERT_EQUAL(0, pool.size());
+}
+
+void test_transmit_burst_leaves_receive(void)
+{
+  setup_test();
+
+  // The transport stalls, transmit and relay take every shared frame
+  com.writable = false;
+  for(uint8_t m = 0; m < 2; m++){
+    TEST_ASSERT_EQUAL(corelib::ProcessState::OK, com.testProcessOutgoingMessage(corelib::TxLane::PRIORITY, 120));
+  }
+  const size_t shared = Config::poolFrames - Config::rxReservedFrames - Config::txReservedFrames;
+  const size_t relayed = shared - (2 * Config::fragmentsPerMessage - Config::txReservedFrames);
+  for(uint8_t i = 0; i < relayed; i++){
+    TEST_ASSERT_TRUE(com.enqueueRelay(makeFrame(1, 1, 1)));
+  }
+  TEST_ASSERT_FALSE(com.enqueueRelay(makeFrame(1, 1, 1)));
+  // A message is refused with an entry free in the queue
+  TEST_ASSERT_EQUAL(corelib::ProcessState::ERROR, com.testProcessOutgoingMessage(corelib::TxLane::PRIORITY, 1));
+  const corelib::FramePool& pool = com.getFramePool();
+  TEST_ASSERT_EQUAL(2 * Config::fragmentsPerMessage, pool.size(corelib::PoolOwner::TX));
+  TEST_ASSERT_EQUAL(relayed, pool.size(corelib::PoolOwner::RELAY));
+
+  // A whole message is still received
+  for(uint8_t i = 1; i <= 3; i++){
+    com.push(makeFrame(0x10, i, 3));
+  }
+  readAll();
+  TEST_ASSERT_EQUAL(1, com.getStats().completions);
+  com.iterate();
+  TEST_ASSERT_EQUAL(1, com.handled);
+
+  // Two partial messages, the first gives its frames up when the second needs them
+  com.push(makeFrame(0x20, 1, 3));
+  com.push(makeFrame(0x20, 2, 3));
+  com.push(makeFrame(0x21, 1, 3));
+  com.push(makeFrame(0x21, 2, 3));
+  com.push(makeFrame(0x21, 3, 3));
+  readAll();
+  TEST_ASSERT_EQUAL(2, com.getStats().completions);
+  TEST_ASSERT_EQUAL(1, com.getStats().evictions);
+  TEST_ASSERT_EQUAL(Config::rxReservedFrames, pool.highWater(corelib::PoolOwner::RX));
+  TEST_ASSERT_EQUAL(Config::poolFrames, pool.highWater());
+
+  // Written frames go back to the pool
+  com.writable = true;
+  for(uint8_t i = 0; i < 4 && com.txQueueDepth() > 0; i++){
+    com.iterate();
+  }
+  TEST_ASSERT_EQUAL(2 * Config::fragmentsPerMessage + relayed, com.written);
+  TEST_ASSERT_EQUAL(0, pool.size(corelib::PoolOwner::TX));
+  TEST_ASSERT_EQUAL(0, pool.size(corelib::PoolOwner::RELAY));
+  TEST_ASSERT_EQUAL(relayed, pool.highWater(corelib::PoolOwner::RELAY));
+}
+
+void test_receive_burst_leaves_transmit(void)
+{
+  setup_test();
+
+  // Every slot holds a complete message, receive holds the shared frames
+  for(uint8_t m = 0; m < Config::concurrentMessages; m++){
+    for(uint8_t i = 1; i <= 3; i++){
+      com.push(makeFrame(0x30 + m, i, 3));
+    }
+  }
+  readAll();
+  const corelib::FramePool& pool = com.getFramePool();
+  TEST_ASSERT_EQUAL(Config::concurrentMessages, com.getStats().completions);
+  TEST_ASSERT_EQUAL(Config::concurrentMessages * Config::fragmentsPerMessage + 1, pool.size(corelib::PoolOwner::RX));
+
+  // A whole response can still be queued, one more cannot
+  com.writable = false;
+  TEST_ASSERT_EQUAL(corelib::ProcessState::OK, com.testProcessOutgoingMessage(corelib::TxLane::PRIORITY, 120));
+  TEST_ASSERT_EQUAL(corelib::ProcessState::ERROR, com.testProcessOutgoingMessage(corelib::TxLane::PRIORITY, 1));
+  TEST_ASSERT_EQUAL(Config::txReservedFrames, pool.highWater(corelib::PoolOwner::TX));
+  TEST_ASSERT_EQUAL(Config::poolFrames, pool.highWater());
+}
+
+void test_footprint(void)
+{
+  // Frames of separate stores, a full reassembler, transmit queue and relay queue
+  const size_t separate = corelib::Reassembler<Config::concurrentMessages, Config::fragmentsPerMessage>::FrameCount +
+    Config::concurrentMessages * Config::fragmentsPerMessage + Config::relayDepth;
+  TEST_ASSERT_LESS_THAN(separate, Config::poolFrames);
+  TEST_ASSERT_LESS_THAN(separate * sizeof(corelib::Frame), sizeof(corelib::StaticFramePool<Config::poolFrames>));
+
+  char message[120];
+  snprintf(message, sizeof(message), "sizeof(Comm) %u bytes, frames %u pooled against %u separate, %u bytes saved",
+    (unsigned)sizeof(corelib::Comm), (unsigned)Config::poolFrames, (unsigned)separate,
+    (unsigned)((separate - Config::poolFrames) * sizeof(corelib::Frame)));
+  TEST_MESSAGE(message);
+  // Occupancy of the receive burst above
+  const corelib::FramePool& pool = com.getFramePool();
+  snprintf(message, sizeof(message), "pool high water rx %u tx %u relay %u of %u",
+    (unsigned)pool.highWater(corelib::PoolOwner::RX), (unsigned)pool.highWater(corelib::PoolOwner::TX),
+    (unsigned)pool.highWater(corelib::PoolOwner::RELAY), (unsigned)pool.max_size());
+  TEST_MESSAGE(message);
+}
+
+void setUp (void) {}
+
+void tearDown (void) {}
+
+int main(int argc, char **argv) {
+  run_tests();
+  return 0;
+}
@@ -0,0 +1,87 @@
+/**
+ * @file tests_pool.h
+ *
+ * @brief Tests the FramePool and the Comm sharing it between receive, transmit and relay.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include <FastCRC.h>
+
+#include "comm.h"
+#include "framepool.h"
+
+// A Comm interface over in-memory frame queues, writing only while it is allowed to
+class PoolComm : public corelib::Comm
+{
+  public:
+    static const uint8_t Depth = 16;
+    // Frames to be read
+    corelib::Frame rx[Depth];
+    uint8_t rxHead = 0;
+    uint8_t rxTail = 0;
+    // Frames written
+    uint8_t written = 0;
+    bool writable = true;
+    // Messages handled
+    uint8_t handled = 0;
+
+    void push(const corelib::Frame& frame){
+      rx[rxTail++ % Depth] = frame;
+    }
+
+    void reset(){
+      inFrames.clear();
+      outFrames.clear();
+      rxHead = rxTail = written = handled = 0;
+      writable = true;
+      framePool.resetHighWater();
+      resetStats();
+    }
+
+    corelib::HandleMessageState count(corelib::Buffer* b){
+      handled++;
+      return corelib::HandleMessageState::OK;
+    }
+
+    auto testProcessOutgoingMessage(corelib::TxLane lane, int length){
+      memset(buffer.outBuffer, 0xC0, length);
+      buffer.outMessageLength = length;
+      return processOutgoingMessage(lane);
+    }
+
+    auto testProcessRead(){
+      return processRead();
+    }
+
+  protected:
+    // Function.h interface
+    void performInitialise(){
+      initialised = true;
+    }
+
+    // Comms.h interface
+    bool read(uint8_t* buffer){
+      if(rxHead == rxTail){
+        return false;
+      }
+      memcpy(buffer, &rx[rxHead++ % Depth], 64);
+      return true;
+    }
+    bool write(const uint8_t* buffer){
+      if(!writable){
+        return false;
+      }
+      written++;
+      return true;
+    }
+};
+
+void setup_test();
+void run_tests();
+void test_reservations(void);
+void test_high_water(void);
+void test_transmit_burst_leaves_receive(void);
+void test_receive_burst_leaves_transmit(void);
+void test_footprint(void);
@@ -0,0 +1,216 @@
+#include "tests_publisher.h"
+
+typedef corelib::ShareRegistry<4> Registry;
+
+// External interfaces
+FastCRC32 CRC32;
+
+// A clock advanced by the tests, in milliseconds
+uint32_t now = 0;
+
+uint32_t fakeClock()
+{
+  return now;
+}
+
+// Class under test
+Registry registry;
+corelib::Publisher<Registry> publisher(registry, 100000, corelib::Publisher<Registry>::Clock::create<&fakeClock>());
+CommStats1 outcomes = CommStats1_init_zero;
+CommStats2 traffic = CommStats2_init_zero;
+PublishComm com;
+
+// Advances the clock a millisecond per iteration
+void run(uint32_t milliseconds)
+{
+  for(uint32_t i = 0; i < milliseconds; i++){
+    now++;
+    traffic.framesIn = now;
+    com.iterate();
+  }
+}
+
+// Sends a SHARE_SUBSCRIBE from the host
+void sendSubscribe(uint32_t shareId, uint32_t period, uint32_t token = 0x99)
+{
+  TransactionMessage request = TransactionMessage_init_zero;
+  request.token = token;
+  request.action = TransactionMessage_Action_SHARE_SUBSCRIBE;
+  request.shareId = shareId;
+  Subscription1 subscription = Subscription1_init_zero;
+  subscription.period = period;
+  pb_ostream_t data = pb_ostream_from_buffer(request.data, sizeof(request.data));
+  pb_encode(&data, Subscription1_fields, &subscription);
+  request.dataLength = data.bytes_written;
+
+  uint8_t message[100] = {0};
+  pb_ostream_t stream = pb_ostream_from_buffer(message, sizeof(message));
+  pb_encode(&stream, TransactionMessage_fields, &request);
+  for(uint8_t i = 0; i < 2; i++){
+    corelib::Frame frame;
+    frame.preamble = corelib::Preamble::DATA;
+    frame.destinationAddress = 0x02;
+    frame.sourceAddress = 0x01;
+    frame.frameID = 0x20 + period;
+    frame.frameOrder = i + 1;
+    frame.frameTotal = 2;
+    memcpy(frame.payload, message + i * sizeof(frame.payload), sizeof(frame.payload));
+    frame.crc = CRC32.crc32((uint8_t*)&frame, sizeof(corelib::Frame)-4);
+    com.push(frame);
+  }
+}
+
+CommStats2 decodeTraffic(const TransactionMessage& message)
+{
+  CommStats2 decoded = CommStats2_init_zero;
+  pb_istream_t data = pb_istream_from_buffer(message.data, message.dataLength);
+  TEST_ASSERT_TRUE(pb_decode(&data, CommStats2_fields, &decoded));
+  return decoded;
+}
+
+void setup_test()
+{
+  publisher.clear();
+  publisher.setBudget(100000);
+  com.reset();
+}
+
+void run_tests()
+{
+  registry.addShare<CommStats1_size>(1, outcomes, CommStats1_fields);
+  registry.addShare<CommStats2_size>(3, traffic, CommStats2_fields);
+  com.initialise();
+  registry.attach(com);
+  publisher.attach(com);
+
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  RUN_TEST(test_subscribe_transaction);
+  RUN_TEST(test_periodic_publishes);
+  RUN_TEST(test_budget_sends_latest_value);
+  RUN_TEST(test_cancel_subscription);
+  RUN_TEST(test_unregistered_share);
+  RUN_TEST(test_failed_publish_skipped);
+  UNITY_END(); // stop unit testing
+}
+
+void test_subscribe_transaction(void)
+{
+  setup_test();
+
+  sendSubscribe(3, 100);
+  run(3);
+  TEST_ASSERT_EQUAL(1, publisher.size());
+  TEST_ASSERT_EQUAL(1, com.responses);
+  TEST_ASSERT_EQUAL(0x99, com.lastResponse.token);
+  TEST_ASSERT_EQUAL(TransactionMessage_Action_SHARE_SUBSCRIBE, com.lastResponse.action);
+  TEST_ASSERT_EQUAL(3, com.lastResponse.shareId);
+  // The first publish is due straight away
+  run(200);
+  TEST_ASSERT_EQUAL(3, com.publishes);
+  TEST_ASSERT_EQUAL(3, com.lastPublish.shareId);
+
+  // Subscribing again, a new request, reports the subscription's counters
+  sendSubscribe(3, 100, 0x9A);
+  run(2);
+  Subscription1 reported = Subscription1_init_zero;
+  pb_istream_t data = pb_istream_from_buffer(com.lastResponse.data, com.lastResponse.dataLength);
+  TEST_ASSERT_TRUE(pb_decode(&data, Subscription1_fields, &reported));
+  TEST_ASSERT_EQUAL(3, reported.published);
+  TEST_ASSERT_EQUAL(0, reported.dropped);
+}
+
+void test_periodic_publishes(void)
+{
+  setup_test();
+
+  // Due when subscribed, then every 20 ms
+  TEST_ASSERT_TRUE(publisher.subscribe(3, 20));
+  run(1000);
+  TEST_ASSERT_EQUAL(51, com.publishes);
+  corelib::PublishStats stats;
+  TEST_ASSERT_TRUE(publisher.getStats(3, stats));
+  TEST_ASSERT_EQUAL(51, stats.published);
+  TEST_ASSERT_EQUAL(0, stats.dropped);
+  TEST_ASSERT_EQUAL(51000, stats.rate);
+  // Publishes are numbered in sequence
+  const uint32_t token = com.lastPublish.token;
+  run(20);
+  TEST_ASSERT_EQUAL(token + 1, com.lastPublish.token);
+}
+
+void test_budget_sends_latest_value(void)
+{
+  setup_test();
+
+  // 10 publishes a second for a share due 100 times a second
+  publisher.setBudget(10 * corelib::Publisher<Registry>::PublishCost);
+  TEST_ASSERT_TRUE(publisher.subscribe(3, 10));
+  run(1000);
+  corelib::PublishStats stats;
+  TEST_ASSERT_TRUE(publisher.getStats(3, stats));
+  TEST_ASSERT_TRUE(com.publishes >= 10 && com.publishes <= 11);
+  TEST_ASSERT_EQUAL(com.publishes, stats.published);
+  TEST_ASSERT_EQUAL(100, stats.published + stats.dropped);
+  // The publish holds the value when it was sent, not when it was due
+  TEST_ASSERT_TRUE(decodeTraffic(com.lastPublish).framesIn > now - 100);
+}
+
+void test_cancel_subscription(void)
+{
+  setup_test();
+
+  TEST_ASSERT_TRUE(publisher.subscribe(1, 10));
+  TEST_ASSERT_TRUE(publisher.subscribe(3, 10));
+  sendSubscribe(3, 0);
+  run(2);
+  TEST_ASSERT_EQUAL(1, publisher.size());
+  TEST_ASSERT_TRUE(publisher.unsubscribe(1));
+  TEST_ASSERT_FALSE(publisher.unsubscribe(1));
+  com.reset();
+  run(100);
+  TEST_ASSERT_EQUAL(0, com.publishes);
+}
+
+void test_unregistered_share(void)
+{
+  setup_test();
+
+  TEST_ASSERT_FALSE(publisher.subscribe(2, 10));
+  TEST_ASSERT_TRUE(publisher.subscribe(1, 10));
+  registry.removeShare(1);
+  run(10);
+  TEST_ASSERT_EQUAL(0, com.publishes);
+  TEST_ASSERT_EQUAL(0, publisher.size());
+}
+
+void test_failed_publish_skipped(void)
+{
+  setup_test();
+
+  // A share which does not fit the data of a publish, subscribed before another
+  TransactionMessage oversized = TransactionMessage_init_zero;
+  oversized.token = 1;
+  TEST_ASSERT_TRUE(registry.addShare<CommStats1_size>(2, oversized, TransactionMessage_fields));
+  TEST_ASSERT_TRUE(publisher.subscribe(2, 10));
+  TEST_ASSERT_TRUE(publisher.subscribe(3, 10));
+  run(100);
+  corelib::PublishStats stats;
+  TEST_ASSERT_TRUE(publisher.getStats(2, stats));
+  TEST_ASSERT_EQUAL(0, stats.published);
+  TEST_ASSERT_EQUAL(11, stats.failed);
+  TEST_ASSERT_EQUAL(0, stats.dropped);
+  // The other subscription is published every period, the first at once
+  TEST_ASSERT_TRUE(publisher.getStats(3, stats));
+  TEST_ASSERT_EQUAL(11, stats.published);
+  TEST_ASSERT_EQUAL(11, com.publishes);
+  registry.removeShare(2);
+}
+
+void setUp (void) {}
+
+void tearDown (void) {}
+
+int main(int argc, char **argv) {
+  run_tests();
+  return 0;
+}
@@ -0,0 +1,82 @@
+/**
+ * @file tests_publisher.h
+ *
+ * @brief Tests the Publisher sending subscribed shares within a bandwidth budget.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include <FastCRC.h>
+
+#include "publisher.h"
+
+// A Comm interface over an in-memory loopback, decoding the messages it writes
+class PublishComm : public corelib::Comm
+{
+  public:
+    static const uint8_t Depth = 8;
+    // Frames to be read
+    corelib::Frame rx[Depth];
+    uint8_t rxHead = 0;
+    uint8_t rxTail = 0;
+    // Messages written, and the last of them
+    uint8_t message[150];
+    uint32_t publishes = 0;
+    uint32_t responses = 0;
+    TransactionMessage lastPublish = TransactionMessage_init_zero;
+    TransactionMessage lastResponse = TransactionMessage_init_zero;
+
+    void push(const corelib::Frame& frame){
+      rx[rxTail++ % Depth] = frame;
+    }
+
+    void reset(){
+      outFrames.clear();
+      buffer.outMessageLength = 0;
+      publishes = 0;
+      responses = 0;
+    }
+
+  protected:
+    // Function.h interface
+    void performInitialise(){
+      initialised = true;
+    }
+
+    // Comms.h interface
+    bool read(uint8_t* buffer){
+      if(rxHead == rxTail){
+        return false;
+      }
+      memcpy(buffer, &rx[rxHead++ % Depth], 64);
+      return true;
+    }
+    bool write(const uint8_t* buffer){
+      const corelib::Frame* frame = reinterpret_cast<const corelib::Frame*>(buffer);
+      memcpy(message + (frame->frameOrder - 1) * sizeof(frame->payload), frame->payload, sizeof(frame->payload));
+      if(frame->frameOrder == frame->frameTotal){
+        TransactionMessage decoded = TransactionMessage_init_zero;
+        pb_istream_t stream = pb_istream_from_buffer(message, frame->frameTotal * sizeof(frame->payload));
+        if(pb_decode(&stream, TransactionMessage_fields, &decoded)){
+          if(decoded.action == TransactionMessage_Action_SHARE_PUBLISH){
+            lastPublish = decoded;
+            publishes++;
+          }else{
+            lastResponse = decoded;
+            responses++;
+          }
+        }
+      }
+      return true;
+    }
+};
+
+void setup_test();
+void run_tests();
+void test_subscribe_transaction(void);
+void test_periodic_publishes(void);
+void test_budget_sends_latest_value(void);
+void test_cancel_subscription(void);
+void test_unregistered_share(void);
+void test_failed_publish_skipped(void);
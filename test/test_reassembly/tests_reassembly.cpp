@@ -0,0 +1,371 @@
+#include "tests_reassembly.h"
+
+// Class under test
+corelib::StaticFramePool<TestReassembler::FrameCount> pool;
+TestReassembler reassembler(pool);
+
+corelib::Frame makeFrame(uint8_t source, uint32_t frameId, uint8_t order, uint8_t total, uint8_t fill)
+{
+  corelib::Frame frame;
+  frame.preamble = corelib::Preamble::DATA;
+  frame.destinationAddress = 0x02;
+  frame.sourceAddress = source;
+  frame.frameID = frameId;
+  frame.frameOrder = order;
+  frame.frameTotal = total;
+  memset(frame.payload, fill, sizeof(corelib::Frame::payload));
+  return frame;
+}
+
+void setup_test()
+{
+  reassembler.clear();
+}
+
+void run_tests()
+{
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  RUN_TEST(test_single_frame_message);
+  RUN_TEST(test_in_order_message);
+  RUN_TEST(test_out_of_order_message);
+  RUN_TEST(test_duplicate_fragment);
+  RUN_TEST(test_interleaved_messages);
+  RUN_TEST(test_same_frame_id_different_source);
+  RUN_TEST(test_invalid_fragment);
+  RUN_TEST(test_full_table);
+  RUN_TEST(test_release_reuses_slot);
+  RUN_TEST(test_churn_keeps_index_consistent);
+  RUN_TEST(test_evict_oldest_partial);
+  RUN_TEST(test_evict_stale_partial);
+  RUN_TEST(test_completion_order);
+  RUN_TEST(test_view_stream_across_fragments);
+  RUN_TEST(test_receive_in_place);
+  UNITY_END(); // stop unit testing
+}
+
+void test_single_frame_message(void)
+{
+  setup_test();
+
+  TEST_ASSERT_EQUAL(TestReassembler::NoSlot, reassembler.nextComplete());
+  auto state = reassembler.insert(makeFrame(0x01, 0xDEADBEEF, 1, 1, 0x7F));
+  TEST_ASSERT_TRUE(state == corelib::ReassemblyState::COMPLETE);
+
+  int slot = reassembler.nextComplete();
+  TEST_ASSERT_TRUE(slot != TestReassembler::NoSlot);
+  TEST_ASSERT_EQUAL(sizeof(corelib::Frame::payload), reassembler.length(slot));
+  TEST_ASSERT_EQUAL(0x7F, reassembler.view(slot).at(0));
+
+  reassembler.release(slot);
+  TEST_ASSERT_TRUE(reassembler.empty());
+}
+
+void test_in_order_message(void)
+{
+  setup_test();
+
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0x1000, 1, 3, 0x11)) == corelib::ReassemblyState::OK);
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0x1000, 2, 3, 0x22)) == corelib::ReassemblyState::OK);
+  TEST_ASSERT_EQUAL(TestReassembler::NoSlot, reassembler.nextComplete());
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0x1000, 3, 3, 0x33)) == corelib::ReassemblyState::COMPLETE);
+
+  int slot = reassembler.nextComplete();
+  TEST_ASSERT_EQUAL(3, reassembler.fragments(slot));
+  TEST_ASSERT_EQUAL(150, reassembler.length(slot));
+  corelib::MessageView payload = reassembler.view(slot);
+  TEST_ASSERT_EQUAL(0x11, payload.at(0));
+  TEST_ASSERT_EQUAL(0x22, payload.at(50));
+  TEST_ASSERT_EQUAL(0x33, payload.at(149));
+}
+
+void test_out_of_order_message(void)
+{
+  setup_test();
+
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0x2000, 3, 3, 0x33)) == corelib::ReassemblyState::OK);
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0x2000, 1, 3, 0x11)) == corelib::ReassemblyState::OK);
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0x2000, 2, 3, 0x22)) == corelib::ReassemblyState::COMPLETE);
+
+  int slot = reassembler.nextComplete();
+  corelib::MessageView payload = reassembler.view(slot);
+  for(uint8_t i = 0; i < 50; i++){
+    TEST_ASSERT_EQUAL(0x11, payload.at(i));
+    TEST_ASSERT_EQUAL(0x22, payload.at(50+i));
+    TEST_ASSERT_EQUAL(0x33, payload.at(100+i));
+  }
+}
+
+void test_duplicate_fragment(void)
+{
+  setup_test();
+
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0x3000, 1, 2, 0x11)) == corelib::ReassemblyState::OK);
+  // A retransmitted fragment must not overwrite or complete the message
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0x3000, 1, 2, 0x99)) == corelib::ReassemblyState::DUPLICATE);
+  TEST_ASSERT_EQUAL(TestReassembler::NoSlot, reassembler.nextComplete());
+  TEST_ASSERT_EQUAL(1, reassembler.size());
+
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0x3000, 2, 2, 0x22)) == corelib::ReassemblyState::COMPLETE);
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0x3000, 2, 2, 0x22)) == corelib::ReassemblyState::DUPLICATE);
+  int slot = reassembler.nextComplete();
+  TEST_ASSERT_EQUAL(0x11, reassembler.view(slot).at(0));
+}
+
+void test_interleaved_messages(void)
+{
+  setup_test();
+
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0xA, 2, 2, 0xA2)) == corelib::ReassemblyState::OK);
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0xB, 1, 3, 0xB1)) == corelib::ReassemblyState::OK);
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0xC, 1, 1, 0xC1)) == corelib::ReassemblyState::COMPLETE);
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0xB, 3, 3, 0xB3)) == corelib::ReassemblyState::OK);
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0xA, 1, 2, 0xA1)) == corelib::ReassemblyState::COMPLETE);
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0xB, 2, 3, 0xB2)) == corelib::ReassemblyState::COMPLETE);
+  TEST_ASSERT_EQUAL(3, reassembler.size());
+
+  int slotA = reassembler.find(0x01, 0xA);
+  int slotB = reassembler.find(0x01, 0xB);
+  int slotC = reassembler.find(0x01, 0xC);
+  TEST_ASSERT_EQUAL(0xA1, reassembler.view(slotA).at(0));
+  TEST_ASSERT_EQUAL(0xA2, reassembler.view(slotA).at(50));
+  TEST_ASSERT_EQUAL(0xB1, reassembler.view(slotB).at(0));
+  TEST_ASSERT_EQUAL(0xB2, reassembler.view(slotB).at(50));
+  TEST_ASSERT_EQUAL(0xB3, reassembler.view(slotB).at(100));
+  TEST_ASSERT_EQUAL(0xC1, reassembler.view(slotC).at(0));
+
+  // Every message is delivered exactly once
+  int delivered = 0;
+  while(reassembler.nextComplete() != TestReassembler::NoSlot){
+    reassembler.release(reassembler.nextComplete());
+    delivered++;
+  }
+  TEST_ASSERT_EQUAL(3, delivered);
+  TEST_ASSERT_TRUE(reassembler.empty());
+}
+
+void test_same_frame_id_different_source(void)
+{
+  setup_test();
+
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0x5000, 1, 2, 0x11)) == corelib::ReassemblyState::OK);
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x03, 0x5000, 1, 2, 0x33)) == corelib::ReassemblyState::OK);
+  TEST_ASSERT_EQUAL(2, reassembler.size());
+  TEST_ASSERT_TRUE(reassembler.find(0x01, 0x5000) != reassembler.find(0x03, 0x5000));
+}
+
+void test_invalid_fragment(void)
+{
+  setup_test();
+
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0x6000, 0, 2, 0x00)) == corelib::ReassemblyState::INVALID);
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0x6000, 3, 2, 0x00)) == corelib::ReassemblyState::INVALID);
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0x6000, 1, 4, 0x00)) == corelib::ReassemblyState::INVALID);
+  TEST_ASSERT_TRUE(reassembler.empty());
+
+  // A fragment disagreeing on the total is rejected
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0x6000, 1, 2, 0x00)) == corelib::ReassemblyState::OK);
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 0x6000, 2, 3, 0x00)) == corelib::ReassemblyState::INVALID);
+  TEST_ASSERT_EQUAL(1, reassembler.fragments(reassembler.find(0x01, 0x6000)));
+}
+
+void test_full_table(void)
+{
+  setup_test();
+
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 1, 1, 2, 0x00)) == corelib::ReassemblyState::OK);
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 2, 1, 2, 0x00)) == corelib::ReassemblyState::OK);
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 3, 1, 2, 0x00)) == corelib::ReassemblyState::OK);
+  TEST_ASSERT_TRUE(reassembler.full());
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 4, 1, 2, 0x00)) == corelib::ReassemblyState::FULL);
+  // Fragments of messages already in the table are still accepted
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 2, 2, 2, 0x00)) == corelib::ReassemblyState::COMPLETE);
+}
+
+void test_release_reuses_slot(void)
+{
+  setup_test();
+
+  for(uint32_t id = 0; id < 100; id++){
+    TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, id, 1, 1, (uint8_t)id)) == corelib::ReassemblyState::COMPLETE);
+    int slot = reassembler.nextComplete();
+    TEST_ASSERT_EQUAL((uint8_t)id, reassembler.view(slot).at(0));
+    reassembler.release(slot);
+  }
+  TEST_ASSERT_TRUE(reassembler.empty());
+}
+
+void test_churn_keeps_index_consistent(void)
+{
+  setup_test();
+
+  // Keep the table full of partial messages while rotating keys through it, so
+  // colliding probe chains are repeatedly shifted by release()
+  uint32_t live[3] = {0, 1, 2};
+  for(uint8_t i = 0; i < 3; i++){
+    reassembler.insert(makeFrame(0x01, live[i], 1, 2, 0x00));
+  }
+  uint32_t next = 3;
+  for(uint32_t round = 0; round < 1000; round++){
+    uint8_t victim = round % 3;
+    int slot = reassembler.find(0x01, live[victim]);
+    TEST_ASSERT_TRUE(slot != TestReassembler::NoSlot);
+    reassembler.release(slot);
+    live[victim] = next * 2654435761UL;
+    next++;
+    TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, live[victim], 1, 2, 0x00)) == corelib::ReassemblyState::OK);
+    for(uint8_t i = 0; i < 3; i++){
+      TEST_ASSERT_TRUE(reassembler.find(0x01, live[i]) != TestReassembler::NoSlot);
+    }
+    TEST_ASSERT_EQUAL(3, reassembler.size());
+  }
+}
+
+void test_evict_oldest_partial(void)
+{
+  setup_test();
+
+  reassembler.insert(makeFrame(0x01, 1, 1, 2, 0x00), 10);
+  reassembler.insert(makeFrame(0x01, 2, 1, 1, 0x00), 5); // complete, never evicted
+  reassembler.insert(makeFrame(0x01, 3, 1, 2, 0x00), 20);
+  // Message 3 made progress most recently, message 1 is the oldest partial
+  reassembler.insert(makeFrame(0x01, 1, 1, 2, 0x00), 30); // duplicate, does not refresh
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 4, 1, 2, 0x00), 40) == corelib::ReassemblyState::FULL);
+
+  TEST_ASSERT_TRUE(reassembler.evictOldest());
+  TEST_ASSERT_EQUAL(TestReassembler::NoSlot, reassembler.find(0x01, 1));
+  TEST_ASSERT_TRUE(reassembler.find(0x01, 2) != TestReassembler::NoSlot);
+  TEST_ASSERT_TRUE(reassembler.insert(makeFrame(0x01, 4, 1, 2, 0x00), 40) == corelib::ReassemblyState::OK);
+
+  TEST_ASSERT_TRUE(reassembler.evictOldest()); // message 3
+  TEST_ASSERT_TRUE(reassembler.evictOldest()); // message 4
+  TEST_ASSERT_FALSE(reassembler.evictOldest()); // only the complete message is left
+  TEST_ASSERT_EQUAL(1, reassembler.size());
+}
+
+void test_evict_stale_partial(void)
+{
+  setup_test();
+
+  // Arrival times close to wrapping around
+  reassembler.insert(makeFrame(0x01, 1, 1, 2, 0x00), 0xFFFFFFF0UL);
+  reassembler.insert(makeFrame(0x01, 2, 1, 2, 0x00), 0xFFFFFFFAUL);
+  reassembler.insert(makeFrame(0x01, 3, 1, 1, 0x00), 0xFFFFFFF0UL);
+
+  TEST_ASSERT_EQUAL(0, reassembler.evictStale(0xFFFFFFFFUL, 20));
+  TEST_ASSERT_EQUAL(1, reassembler.evictStale(0x00000004UL, 20));
+  TEST_ASSERT_EQUAL(TestReassembler::NoSlot, reassembler.find(0x01, 1));
+  TEST_ASSERT_EQUAL(1, reassembler.evictStale(0x0000000EUL, 20));
+  // The complete message waits for processing regardless of age
+  TEST_ASSERT_EQUAL(1, reassembler.size());
+  TEST_ASSERT_EQUAL(1, reassembler.completeCount());
+}
+
+void test_completion_order(void)
+{
+  setup_test();
+
+  reassembler.insert(makeFrame(0x01, 0xA, 1, 2, 0xA1));
+  reassembler.insert(makeFrame(0x01, 0xB, 1, 2, 0xB1));
+  reassembler.insert(makeFrame(0x01, 0xC, 1, 1, 0xC1));
+  reassembler.insert(makeFrame(0x01, 0xB, 2, 2, 0xB2));
+  reassembler.insert(makeFrame(0x01, 0xA, 2, 2, 0xA2));
+  TEST_ASSERT_EQUAL(3, reassembler.completeCount());
+
+  // Delivered in the order the messages completed, not the order they started
+  TEST_ASSERT_EQUAL(reassembler.find(0x01, 0xC), reassembler.nextComplete());
+  reassembler.release(reassembler.nextComplete());
+  // Releasing a message out of turn keeps the order of the others
+  reassembler.insert(makeFrame(0x01, 0xD, 1, 1, 0xD1));
+  reassembler.release(reassembler.find(0x01, 0xA));
+  TEST_ASSERT_EQUAL(reassembler.find(0x01, 0xB), reassembler.nextComplete());
+  reassembler.release(reassembler.nextComplete());
+  TEST_ASSERT_EQUAL(reassembler.find(0x01, 0xD), reassembler.nextComplete());
+  reassembler.release(reassembler.nextComplete());
+  TEST_ASSERT_EQUAL(TestReassembler::NoSlot, reassembler.nextComplete());
+  TEST_ASSERT_TRUE(reassembler.empty());
+}
+
+void test_view_stream_across_fragments(void)
+{
+  setup_test();
+
+  corelib::Frame frames[3];
+  for(uint8_t i = 0; i < 3; i++){
+    frames[i] = makeFrame(0x01, 0x77, i + 1, 3, 0);
+    for(uint8_t b = 0; b < sizeof(corelib::Frame::payload); b++){
+      frames[i].payload[b] = i * 50 + b;
+    }
+  }
+  reassembler.insert(frames[2]);
+  reassembler.insert(frames[0]);
+  reassembler.insert(frames[1]);
+
+  corelib::MessageView view = reassembler.view(reassembler.nextComplete());
+  TEST_ASSERT_EQUAL(3, view.fragmentCount());
+  TEST_ASSERT_EQUAL(150, view.size());
+
+  // Reads which straddle fragment boundaries, and a skip
+  pb_istream_t stream = view.istream();
+  uint8_t data[60];
+  TEST_ASSERT_TRUE(pb_read(&stream, data, 45));
+  TEST_ASSERT_TRUE(pb_read(&stream, data, 10));
+  TEST_ASSERT_EQUAL(45, data[0]);
+  TEST_ASSERT_EQUAL(54, data[9]);
+  TEST_ASSERT_TRUE(pb_read(&stream, NULL, 50));
+  TEST_ASSERT_TRUE(pb_read(&stream, data, 45));
+  TEST_ASSERT_EQUAL(105, data[0]);
+  TEST_ASSERT_EQUAL(149, data[44]);
+  TEST_ASSERT_FALSE(pb_read(&stream, data, 1));
+
+  uint8_t copy[128];
+  TEST_ASSERT_EQUAL(128, view.copyTo(copy, sizeof(copy)));
+  TEST_ASSERT_EQUAL(127, copy[127]);
+}
+
+void test_receive_in_place(void)
+{
+  setup_test();
+
+  // A frame read into the receive buffer is kept, and the next read gets a fresh frame
+  uint8_t* first = reassembler.receiveBuffer();
+  corelib::Frame frame = makeFrame(0x01, 0x88, 1, 2, 0x5A);
+  memcpy(first, &frame, sizeof(frame));
+  TEST_ASSERT_TRUE(reassembler.insert() == corelib::ReassemblyState::OK);
+  TEST_ASSERT_TRUE(reassembler.receiveBuffer() != first);
+
+  // A rejected frame leaves the receive buffer to be reused
+  uint8_t* second = reassembler.receiveBuffer();
+  memcpy(second, &frame, sizeof(frame));
+  TEST_ASSERT_TRUE(reassembler.insert() == corelib::ReassemblyState::DUPLICATE);
+  TEST_ASSERT_TRUE(reassembler.receiveBuffer() == second);
+
+  frame.frameOrder = 2;
+  memcpy(second, &frame, sizeof(frame));
+  TEST_ASSERT_TRUE(reassembler.insert() == corelib::ReassemblyState::COMPLETE);
+  corelib::MessageView view = reassembler.view(reassembler.nextComplete());
+  TEST_ASSERT_TRUE(view.fragment(0) == reinterpret_cast<corelib::Frame*>(first)->payload);
+
+  // Every frame returns to the pool, fill all slots to completion twice over
+  reassembler.release(reassembler.nextComplete());
+  for(uint8_t round = 0; round < 2; round++){
+    for(uint8_t slot = 0; slot < 3; slot++){
+      for(uint8_t order = 1; order <= 3; order++){
+        reassembler.insert(makeFrame(0x01, round * 3 + slot, order, 3, order));
+      }
+    }
+    TEST_ASSERT_EQUAL(3, reassembler.completeCount());
+    while(reassembler.nextComplete() != TestReassembler::NoSlot){
+      TEST_ASSERT_EQUAL(3, reassembler.view(reassembler.nextComplete()).at(149));
+      reassembler.release(reassembler.nextComplete());
+    }
+  }
+}
+
+void setUp (void) {}
+
+void tearDown (void) {}
+
+int main(int argc, char **argv) {
+  run_tests();
+  return 0;
+}
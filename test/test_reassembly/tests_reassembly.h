@@ -0,0 +1,33 @@
+/**
+ * @file tests_reassembly.h
+ *
+ * @brief Tests the Reassembler which collects incoming frames into complete messages.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "reassembler.h"
+
+typedef corelib::Reassembler<3, 3> TestReassembler;
+
+corelib::Frame makeFrame(uint8_t source, uint32_t frameId, uint8_t order, uint8_t total, uint8_t fill);
+
+void setup_test();
+void run_tests();
+void test_single_frame_message(void);
+void test_in_order_message(void);
+void test_out_of_order_message(void);
+void test_duplicate_fragment(void);
+void test_interleaved_messages(void);
+void test_same_frame_id_different_source(void);
+void test_invalid_fragment(void);
+void test_full_table(void);
+void test_release_reuses_slot(void);
+void test_churn_keeps_index_consistent(void);
+void test_evict_oldest_partial(void);
+void test_evict_stale_partial(void);
+void test_completion_order(void);
+void test_view_stream_across_fragments(void);
+void test_receive_in_place(void);
@@ -0,0 +1,159 @@
+#include "tests_responsecache.h"
+
+// External interfaces
+FastCRC32 CRC32;
+
+// Class under test
+CacheComm com;
+
+// Sends a SHARE_REQUEST to the device
+void sendRequest(uint32_t token, uint32_t shareId, uint8_t source = 0x01)
+{
+  TransactionMessage request = TransactionMessage_init_zero;
+  request.token = token;
+  request.action = TransactionMessage_Action_SHARE_REQUEST;
+  request.shareId = shareId;
+
+  uint8_t message[100] = {0};
+  pb_ostream_t stream = pb_ostream_from_buffer(message, sizeof(message));
+  TEST_ASSERT_TRUE(pb_encode(&stream, TransactionMessage_fields, &request));
+  const uint32_t frameId = 0x40 + com.rxTail;
+  for(uint8_t i = 0; i < 2; i++){
+    corelib::Frame frame;
+    frame.preamble = corelib::Preamble::DATA;
+    frame.destinationAddress = 0x02;
+    frame.sourceAddress = source;
+    frame.frameID = frameId;
+    frame.frameOrder = i + 1;
+    frame.frameTotal = 2;
+    memcpy(frame.payload, message + i * sizeof(frame.payload), sizeof(frame.payload));
+    frame.crc = CRC32.crc32((uint8_t*)&frame, sizeof(corelib::Frame)-4);
+    com.push(frame);
+  }
+  // A frame is read each iteration
+  com.iterate();
+  com.iterate();
+}
+
+// The count the last response carried
+uint8_t lastAnswer()
+{
+  TEST_ASSERT_TRUE(com.written > 0);
+  const corelib::Frame& frame = com.tx[(com.written - 1) % CacheComm::Depth];
+  TEST_ASSERT_EQUAL(0xA0, frame.payload[0]);
+  return frame.payload[1];
+}
+
+void setup_test()
+{
+  com.reset();
+}
+
+void run_tests()
+{
+  com.setHandleMessageCallback(
+    etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::create<CacheComm, &CacheComm::respond>(com));
+  com.initialise();
+
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  RUN_TEST(test_retry_answered_from_cache);
+  RUN_TEST(test_other_requests_handled);
+  RUN_TEST(test_requests_without_token);
+  RUN_TEST(test_response_expires);
+  RUN_TEST(test_oldest_response_replaced);
+  UNITY_END(); // stop unit testing
+}
+
+void test_retry_answered_from_cache(void)
+{
+  setup_test();
+
+  sendRequest(0x10, 1);
+  TEST_ASSERT_EQUAL(1, com.handled);
+  TEST_ASSERT_EQUAL(1, lastAnswer());
+
+  // The host timed out and sends it again, it gets the first answer
+  sendRequest(0x10, 1);
+  TEST_ASSERT_EQUAL(1, com.handled);
+  TEST_ASSERT_EQUAL(2, com.written);
+  TEST_ASSERT_EQUAL(1, lastAnswer());
+  // In frames of its own
+  TEST_ASSERT_TRUE(com.tx[0].frameID != com.tx[1].frameID);
+  TEST_ASSERT_EQUAL(1, com.getStats().responseCacheHits);
+  TEST_ASSERT_EQUAL(1, com.getStats().responseCacheMisses);
+
+  CommStats3 message = CommStats3_init_zero;
+  corelib::toMessage(com.getStats(), message);
+  TEST_ASSERT_EQUAL(1, message.responseCacheHits);
+  TEST_ASSERT_EQUAL(1, message.responseCacheMisses);
+}
+
+void test_other_requests_handled(void)
+{
+  setup_test();
+
+  sendRequest(0x20, 1);
+  // The same token for another share, and from another device
+  sendRequest(0x20, 2);
+  sendRequest(0x20, 1, 0x03);
+  TEST_ASSERT_EQUAL(3, com.handled);
+  TEST_ASSERT_EQUAL(3, lastAnswer());
+  TEST_ASSERT_EQUAL(0, com.getStats().responseCacheHits);
+  TEST_ASSERT_EQUAL(3, com.getStats().responseCacheMisses);
+}
+
+void test_requests_without_token(void)
+{
+  setup_test();
+
+  sendRequest(0, 1);
+  sendRequest(0, 1);
+  TEST_ASSERT_EQUAL(2, com.handled);
+  TEST_ASSERT_EQUAL(2, lastAnswer());
+  TEST_ASSERT_EQUAL(0, com.getStats().responseCacheHits);
+  TEST_ASSERT_EQUAL(0, com.getStats().responseCacheMisses);
+}
+
+void test_response_expires(void)
+{
+  setup_test();
+
+  sendRequest(0x30, 1);
+  // The repeat is handled on the last iteration before expiry, two after this loop
+  for(uint32_t i = 0; i < CacheConfig::responseCacheExpiry - 3; i++){
+    com.iterate();
+  }
+  sendRequest(0x30, 1);
+  TEST_ASSERT_EQUAL(1, com.handled);
+
+  // Past its expiry the request is handled again
+  com.iterate();
+  sendRequest(0x30, 1);
+  TEST_ASSERT_EQUAL(2, com.handled);
+  TEST_ASSERT_EQUAL(2, lastAnswer());
+}
+
+void test_oldest_response_replaced(void)
+{
+  setup_test();
+
+  for(uint32_t token = 1; token <= CacheConfig::responseCacheEntries + 1; token++){
+    sendRequest(token, 1);
+  }
+  const uint8_t handled = com.handled;
+
+  // The newest answers are kept, the first one made room
+  sendRequest(CacheConfig::responseCacheEntries + 1, 1);
+  TEST_ASSERT_EQUAL(handled, com.handled);
+  sendRequest(1, 1);
+  TEST_ASSERT_EQUAL(handled + 1, com.handled);
+}
+
+void setUp (void) {}
+
+void tearDown (void) {}
+
+int main(int argc, char **argv) {
+  run_tests();
+  return 0;
+}
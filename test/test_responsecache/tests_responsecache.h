@@ -0,0 +1,80 @@
+/**
+ * @file tests_responsecache.h
+ *
+ * @brief Tests the Comm answering repeated requests from its response cache.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include <FastCRC.h>
+
+#include "comm.h"
+#include "responsecache.h"
+
+// Responses expire quickly
+struct CacheConfig : corelib::CommConfig<> {
+  static constexpr uint32_t responseCacheExpiry = 50;
+};
+
+// A Comm interface over in-memory frame queues, counting the requests it handles
+class CacheComm : public corelib::BasicComm<CacheConfig>
+{
+  public:
+    static const uint8_t Depth = 8;
+    // Frames to be read
+    corelib::Frame rx[Depth];
+    uint8_t rxHead = 0;
+    uint8_t rxTail = 0;
+    // Frames written
+    corelib::Frame tx[Depth];
+    uint8_t written = 0;
+    // Requests handled
+    uint8_t handled = 0;
+
+    void push(const corelib::Frame& frame){
+      rx[rxTail++ % Depth] = frame;
+    }
+
+    void reset(){
+      responseCache.clear();
+      rxHead = rxTail = written = handled = 0;
+      resetStats();
+    }
+
+    // Answers with the number of requests handled so far
+    corelib::HandleMessageState respond(corelib::Buffer* b){
+      handled++;
+      b->outBuffer[0] = 0xA0;
+      b->outBuffer[1] = handled;
+      b->outMessageLength = 2;
+      return corelib::HandleMessageState::OK;
+    }
+
+  protected:
+    // Function.h interface
+    void performInitialise(){
+      initialised = true;
+    }
+
+    // Comms.h interface
+    bool read(uint8_t* buffer){
+      if(rxHead == rxTail){
+        return false;
+      }
+      memcpy(buffer, &rx[rxHead++ % Depth], 64);
+      return true;
+    }
+    bool write(const uint8_t* buffer){
+      memcpy(&tx[written++ % Depth], buffer, sizeof(corelib::Frame));
+      return true;
+    }
+};
+
+void setup_test();
+void run_tests();
+void test_retry_answered_from_cache(void);
+void test_other_requests_handled(void);
+void test_requests_without_token(void);
+void test_response_expires(void);
+void test_oldest_response_replaced(void);
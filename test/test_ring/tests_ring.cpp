@@ -0,0 +1,217 @@
+#include "tests_ring.h"
+
+#include <chrono>
+#include <thread>
+
+// External interfaces
+FastCRC32 CRC32;
+
+// Echoes every message back
+corelib::HandleMessageState echo(corelib::Buffer* b)
+{
+  memcpy(b->outBuffer, b->inBuffer, b->inMessageLength);
+  b->outMessageLength = b->inMessageLength;
+  return corelib::HandleMessageState::OK;
+}
+
+// Class under test
+corelib::RingComm com;
+
+// A frame numbered by its id
+corelib::Frame numbered(uint32_t id)
+{
+  corelib::Frame frame;
+  frame.preamble = corelib::Preamble::DATA;
+  frame.destinationAddress = 0x02;
+  frame.sourceAddress = 0x01;
+  frame.frameID = id;
+  frame.frameOrder = 1;
+  frame.frameTotal = 1;
+  memset(frame.payload, id & 0xFF, sizeof(frame.payload));
+  frame.crc = CRC32.crc32((uint8_t*)&frame, sizeof(corelib::Frame)-4);
+  return frame;
+}
+
+void setup_test()
+{
+}
+
+void run_tests()
+{
+  com.setHandleMessageCallback(etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::create<&echo>());
+  com.initialise();
+
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  RUN_TEST(test_ring_order_and_wrap);
+  RUN_TEST(test_ring_full);
+  RUN_TEST(test_ring_between_threads);
+  RUN_TEST(test_ring_comm_batches);
+  RUN_TEST(test_ring_comm_between_threads);
+  UNITY_END(); // stop unit testing
+}
+
+void test_ring_order_and_wrap(void)
+{
+  setup_test();
+
+  corelib::FrameRing<4> ring;
+  TEST_ASSERT_TRUE(ring.empty());
+  TEST_ASSERT_NULL(ring.peek());
+  // Ten laps of the slots, frames come out in the order they went in
+  uint32_t next = 0;
+  for(uint32_t id = 0; id < 40; id++){
+    const corelib::Frame frame = numbered(id);
+    TEST_ASSERT_TRUE(ring.push((const uint8_t*)&frame));
+    if(id % 2 == 1){
+      for(uint8_t i = 0; i < 2; i++){
+        corelib::Frame out;
+        TEST_ASSERT_TRUE(ring.pop((uint8_t*)&out));
+        TEST_ASSERT_EQUAL(next++, out.frameID);
+      }
+    }
+  }
+  TEST_ASSERT_TRUE(ring.empty());
+  TEST_ASSERT_EQUAL(0, ring.dropped());
+}
+
+void test_ring_full(void)
+{
+  setup_test();
+
+  corelib::FrameRing<4> ring;
+  for(uint32_t id = 0; id < 4; id++){
+    const corelib::Frame frame = numbered(id);
+    TEST_ASSERT_TRUE(ring.push((const uint8_t*)&frame));
+  }
+  TEST_ASSERT_EQUAL(4, ring.size());
+  const corelib::Frame frame = numbered(4);
+  TEST_ASSERT_FALSE(ring.push((const uint8_t*)&frame));
+  TEST_ASSERT_NULL(ring.reserve());
+  TEST_ASSERT_EQUAL(1, ring.dropped());
+
+  // A freed slot is taken again, in place
+  const corelib::Frame* oldest = (const corelib::Frame*)ring.peek();
+  TEST_ASSERT_EQUAL(0, oldest->frameID);
+  ring.pop();
+  uint8_t* slot = ring.reserve();
+  TEST_ASSERT_NOT_NULL(slot);
+  memcpy(slot, &frame, sizeof(frame));
+  ring.commit();
+  corelib::Frame out;
+  for(uint32_t id = 1; id < 5; id++){
+    TEST_ASSERT_TRUE(ring.pop((uint8_t*)&out));
+    TEST_ASSERT_EQUAL(id, out.frameID);
+  }
+  TEST_ASSERT_FALSE(ring.pop((uint8_t*)&out));
+}
+
+void test_ring_between_threads(void)
+{
+  setup_test();
+
+  // Every frame crosses in order, a full ring makes the producer wait rather than drop
+  static corelib::FrameRing<64> ring;
+  const uint32_t count = 4000000;
+  const auto start = std::chrono::steady_clock::now();
+  std::thread producer([&](){
+    corelib::Frame frame = numbered(0);
+    for(uint32_t id = 0; id < count; ){
+      uint8_t* slot = ring.reserve();
+      if(slot == nullptr){
+        // Lets the consumer run when there is a single core
+        std::this_thread::yield();
+        continue;
+      }
+      frame.frameID = id;
+      frame.payload[0] = id & 0xFF;
+      frame.crc = id ^ 0xA5A5A5A5;
+      memcpy(slot, &frame, sizeof(frame));
+      ring.commit();
+      id++;
+    }
+  });
+  uint32_t received = 0;
+  uint32_t misordered = 0;
+  uint32_t corrupt = 0;
+  while(received < count){
+    const corelib::Frame* frame = (const corelib::Frame*)ring.peek();
+    if(frame == nullptr){
+      std::this_thread::yield();
+      continue;
+    }
+    misordered += frame->frameID != received;
+    corrupt += frame->payload[0] != (received & 0xFF) || frame->crc != (received ^ 0xA5A5A5A5);
+    ring.pop();
+    received++;
+  }
+  producer.join();
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  TEST_ASSERT_EQUAL(0, misordered);
+  TEST_ASSERT_EQUAL(0, corrupt);
+  TEST_ASSERT_TRUE(ring.empty());
+  char rate[64];
+  snprintf(rate, sizeof(rate), "%.1f million frames per second", count / seconds / 1e6);
+  TEST_MESSAGE(rate);
+}
+
+void test_ring_comm_batches(void)
+{
+  setup_test();
+
+  // Frames arrive while the loop is busy, the next iteration reads them all
+  for(uint32_t id = 0; id < 3; id++){
+    const corelib::Frame frame = numbered(0x40 + id);
+    TEST_ASSERT_TRUE(com.receive((const uint8_t*)&frame));
+  }
+  com.iterate();
+  corelib::Frame out;
+  for(uint32_t id = 0; id < 3; id++){
+    TEST_ASSERT_TRUE(com.transmit((uint8_t*)&out));
+    TEST_ASSERT_EQUAL(0x40 + id, out.payload[0]);
+  }
+  TEST_ASSERT_FALSE(com.transmit((uint8_t*)&out));
+  TEST_ASSERT_EQUAL(0, com.receiveDrops());
+}
+
+void test_ring_comm_between_threads(void)
+{
+  setup_test();
+
+  // An interrupt-like thread delivers frames as the loop handles them
+  const uint32_t count = 20000;
+  std::atomic<bool> stop{false};
+  std::thread transport([&](){
+    for(uint32_t id = 0; id < count && !stop; id++){
+      const corelib::Frame frame = numbered(id);
+      while(!com.receive((const uint8_t*)&frame) && !stop){
+        std::this_thread::yield();
+      }
+    }
+  });
+  uint32_t echoed = 0;
+  uint32_t misordered = 0;
+  corelib::Frame out;
+  for(uint32_t spins = 0; echoed < count && spins < 100 * count; spins++){
+    com.iterate();
+    while(com.transmit((uint8_t*)&out)){
+      misordered += out.payload[0] != (echoed & 0xFF);
+      echoed++;
+    }
+    std::this_thread::yield();
+  }
+  stop = true;
+  transport.join();
+
+  TEST_ASSERT_EQUAL(count, echoed);
+  TEST_ASSERT_EQUAL(0, misordered);
+}
+
+void setUp (void) {}
+
+void tearDown (void) {}
+
+int main(int argc, char **argv) {
+  run_tests();
+  return 0;
+}
@@ -0,0 +1,21 @@
+/**
+ * @file tests_ring.h
+ *
+ * @brief Tests the lock free frame ring, from one thread and between two, and the Comm
+ * reading and writing through a pair of them.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include <FastCRC.h>
+
+#include "ring.h"
+
+void setup_test();
+void run_tests();
+void test_ring_order_and_wrap(void);
+void test_ring_full(void);
+void test_ring_between_threads(void);
+void test_ring_comm_batches(void);
+void test_ring_comm_between_threads(void);
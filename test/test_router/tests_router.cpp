@@ -0,0 +1,181 @@
+#include "tests_router.h"
+
+// External interfaces
+FastCRC32 CRC32;
+
+// Class under test, a gateway between USB (A) and a network of nodes (B)
+corelib::Router<2> router;
+LoopComm a(0x02);
+LoopComm b(0x02);
+
+corelib::Frame makeFrame(uint8_t destination, uint8_t order, uint8_t total, uint8_t fill)
+{
+  corelib::Frame frame;
+  frame.preamble = corelib::Preamble::DATA;
+  frame.destinationAddress = destination;
+  frame.sourceAddress = 0x01;
+  frame.frameID = 0x1234;
+  frame.frameOrder = order;
+  frame.frameTotal = total;
+  memset(frame.payload, fill, sizeof(corelib::Frame::payload));
+  frame.crc = CRC32.crc32((uint8_t*)&frame, sizeof(corelib::Frame)-4);
+  return frame;
+}
+
+void setup_test()
+{
+  a.reset();
+  b.reset();
+  router.resetStats();
+}
+
+void run_tests()
+{
+  a.initialise();
+  b.initialise();
+  router.attach(a); // interface 0
+  router.attach(b); // interface 1
+  router.addRoute(0x10, 1);
+  router.addRoute(0x01, 0);
+
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  RUN_TEST(test_forward_unchanged);
+  RUN_TEST(test_forward_cut_through);
+  RUN_TEST(test_forward_queue_bound);
+  RUN_TEST(test_forward_no_route);
+  RUN_TEST(test_forward_corrupt_frame);
+  RUN_TEST(test_forward_clears_length);
+  UNITY_END(); // stop unit testing
+}
+
+void test_forward_unchanged(void)
+{
+  setup_test();
+
+  corelib::Frame frame = makeFrame(0x10, 1, 1, 0x42);
+  a.push(frame);
+  a.iterate();
+  b.iterate();
+
+  // Written byte for byte as received, without being handled by this device
+  TEST_ASSERT_EQUAL(1, b.txCount);
+  TEST_ASSERT_EQUAL_MEMORY(&frame, &b.tx[0], sizeof(corelib::Frame));
+  TEST_ASSERT_TRUE(a.getStats().handleStates[(uint8_t)corelib::HandleMessageState::OK] == 0);
+  TEST_ASSERT_EQUAL(0, a.txCount);
+  TEST_ASSERT_EQUAL(1, router.getStats().forwarded);
+  TEST_ASSERT_EQUAL(1, b.getStats().framesRelayed);
+  // Counted as traffic of the interface it was written on
+  TEST_ASSERT_EQUAL(1, b.getStats().framesOut);
+  TEST_ASSERT_EQUAL(sizeof(corelib::Frame), b.getStats().bytesOut);
+  TEST_ASSERT_EQUAL(1, b.getStats().writeStates[(uint8_t)corelib::WriteState::OK]);
+
+  // And back the other way
+  corelib::Frame reply = makeFrame(0x01, 1, 1, 0x24);
+  b.push(reply);
+  b.iterate();
+  a.iterate();
+  TEST_ASSERT_EQUAL(1, a.txCount);
+  TEST_ASSERT_EQUAL_MEMORY(&reply, &a.tx[0], sizeof(corelib::Frame));
+}
+
+void test_forward_cut_through(void)
+{
+  setup_test();
+
+  // Each fragment is forwarded as it arrives, the message is never reassembled
+  for(uint8_t order = 1; order <= 3; order++){
+    a.push(makeFrame(0x10, order, 3, order));
+    a.iterate();
+    b.iterate();
+    TEST_ASSERT_EQUAL(order, b.txCount);
+    TEST_ASSERT_EQUAL(order, b.tx[order - 1].frameOrder);
+    // Latency of a single iteration of each interface
+    TEST_ASSERT_EQUAL(b.iterations(), b.txIteration[order - 1]);
+  }
+  TEST_ASSERT_EQUAL(0, a.getStats().completions);
+}
+
+void test_forward_queue_bound(void)
+{
+  setup_test();
+
+  // B does not get to write, its relay queue holds 4 frames
+  for(uint8_t i = 0; i < 6; i++){
+    a.push(makeFrame(0x10, 1, 1, i));
+    a.iterate();
+  }
+  TEST_ASSERT_EQUAL(4, router.getStats().forwarded);
+  TEST_ASSERT_EQUAL(2, router.getStats().queueFull);
+  TEST_ASSERT_EQUAL(2, a.getStats().relayDrops);
+
+  b.iterate();
+  TEST_ASSERT_EQUAL(4, b.txCount);
+  for(uint8_t i = 0; i < 4; i++){
+    TEST_ASSERT_EQUAL(i, b.tx[i].payload[0]);
+  }
+}
+
+void test_forward_no_route(void)
+{
+  setup_test();
+
+  // An unknown address, and an address routed back to where the frame came from
+  a.push(makeFrame(0x33, 1, 1, 0));
+  a.iterate();
+  a.push(makeFrame(0x01, 1, 1, 0));
+  a.iterate();
+  b.iterate();
+  TEST_ASSERT_EQUAL(2, router.getStats().noRoute);
+  TEST_ASSERT_EQUAL(0, router.getStats().forwarded);
+  TEST_ASSERT_EQUAL(0, b.txCount);
+  TEST_ASSERT_EQUAL(0, a.txCount);
+
+  router.removeRoute(0x10);
+  a.push(makeFrame(0x10, 1, 1, 0));
+  a.iterate();
+  TEST_ASSERT_EQUAL(3, router.getStats().noRoute);
+  router.addRoute(0x10, 1);
+}
+
+void test_forward_corrupt_frame(void)
+{
+  setup_test();
+
+  corelib::Frame frame = makeFrame(0x10, 1, 1, 0x42);
+  frame.payload[3] ^= 0x01;
+  a.push(frame);
+  a.iterate();
+  b.iterate();
+  TEST_ASSERT_EQUAL(0, b.txCount);
+  TEST_ASSERT_EQUAL(1, a.getStats().readStates[(uint8_t)corelib::ReadState::MISMATCH_CRC]);
+}
+
+void test_forward_clears_length(void)
+{
+  setup_test();
+
+  // The last frame of a message as read from a V1 interface, carrying its length
+  corelib::Frame frame = makeFrame(0x10, 1, 1, 0);
+  memset(frame.payload, 0x42, 20);
+  frame.payloadLength = 20;
+  frame.crc = CRC32.crc32((uint8_t*)&frame, sizeof(corelib::Frame)-4);
+  a.push(frame);
+  a.iterate();
+  b.iterate();
+
+  // Written in the FIXED layout, without the length and with the check to match
+  TEST_ASSERT_EQUAL(1, b.txCount);
+  TEST_ASSERT_EQUAL(0, b.tx[0].payloadLength);
+  TEST_ASSERT_EQUAL_MEMORY(frame.payload, b.tx[0].payload, sizeof(corelib::Frame::payload));
+  TEST_ASSERT_EQUAL(CRC32.crc32((uint8_t*)&b.tx[0], sizeof(corelib::Frame)-4), b.tx[0].crc);
+  TEST_ASSERT_NOT_EQUAL(frame.crc, b.tx[0].crc);
+}
+
+void setUp (void) {}
+
+void tearDown (void) {}
+
+int main(int argc, char **argv) {
+  run_tests();
+  return 0;
+}
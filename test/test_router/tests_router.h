@@ -0,0 +1,82 @@
+/**
+ * @file tests_router.h
+ *
+ * @brief Tests the Router forwarding frames between two loopback Comm interfaces.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include <FastCRC.h>
+
+#include "router.h"
+
+// A Comm interface over an in-memory loopback
+class LoopComm : public corelib::Comm
+{
+  public:
+    static const uint8_t Depth = 16;
+    // Frames to be read
+    corelib::Frame rx[Depth];
+    uint8_t rxHead = 0;
+    uint8_t rxTail = 0;
+    // Frames written and the iteration they were written in
+    corelib::Frame tx[Depth];
+    uint32_t txIteration[Depth];
+    uint8_t txCount = 0;
+
+    LoopComm(uint8_t deviceAddress) : corelib::Comm() {
+      address = deviceAddress;
+    }
+
+    void push(const corelib::Frame& frame){
+      rx[rxTail++ % Depth] = frame;
+    }
+
+    uint32_t iterations() const {
+      return iteration;
+    }
+
+    void reset(){
+      inFrames.clear();
+      outFrames.clear();
+      while(!relayFrames.empty()){
+        framePool.release(corelib::PoolOwner::RELAY, relayFrames.front());
+        relayFrames.pop();
+      }
+      rxHead = rxTail = txCount = 0;
+      resetStats();
+    }
+
+  protected:
+    // Function.h interface
+    void performInitialise(){
+      initialised = true;
+    }
+
+    // Comms.h interface
+    bool read(uint8_t* buffer){
+      if(rxHead == rxTail){
+        return false;
+      }
+      memcpy(buffer, &rx[rxHead++ % Depth], 64);
+      return true;
+    }
+    bool write(const uint8_t* buffer){
+      memcpy(&tx[txCount % Depth], buffer, 64);
+      txIteration[txCount % Depth] = iteration;
+      txCount++;
+      return true;
+    }
+};
+
+corelib::Frame makeFrame(uint8_t destination, uint8_t order, uint8_t total, uint8_t fill);
+
+void setup_test();
+void run_tests();
+void test_forward_unchanged(void);
+void test_forward_cut_through(void);
+void test_forward_queue_bound(void);
+void test_forward_no_route(void);
+void test_forward_clears_length(void);
+void test_forward_corrupt_frame(void);
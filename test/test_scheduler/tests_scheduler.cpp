@@ -0,0 +1,190 @@
+#include "tests_scheduler.h"
+
+uint32_t fakeNow = 0;
+char runOrder[64] = {0};
+uint8_t runCount = 0;
+
+uint32_t fakeClock()
+{
+  return fakeNow;
+}
+
+// Steps the clock one tick at a time, running the scheduler at every tick
+void runUntil(TestScheduler& scheduler, uint32_t end)
+{
+  while(static_cast<int32_t>(fakeNow - end) < 0){
+    scheduler.run();
+    fakeNow++;
+  }
+}
+
+void setup_test()
+{
+  fakeNow = 0xFFFFF000UL; // wraps during the tests
+  memset(runOrder, 0, sizeof(runOrder));
+  runCount = 0;
+}
+
+void run_tests()
+{
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  RUN_TEST(test_tasks_run_at_their_rate);
+  RUN_TEST(test_due_order_and_priority);
+  RUN_TEST(test_jitter_and_execution_time);
+  RUN_TEST(test_overrun_and_missed_periods);
+  RUN_TEST(test_capacity);
+  RUN_TEST(test_idle_time);
+  RUN_TEST(test_run_returns_behind_long_task);
+  UNITY_END(); // stop unit testing
+}
+
+void test_tasks_run_at_their_rate(void)
+{
+  setup_test();
+
+  TestScheduler scheduler(TestScheduler::Clock::create<&fakeClock>());
+  TestTask fast('f', 0);
+  TestTask slow('s', 0);
+  int f = scheduler.add(fast, 250);
+  int s = scheduler.add(slow, 1000);
+
+  runUntil(scheduler, fakeNow + 10000);
+  TEST_ASSERT_EQUAL(40, scheduler.getStats(f).runs);
+  TEST_ASSERT_EQUAL(10, scheduler.getStats(s).runs);
+  TEST_ASSERT_EQUAL(0, scheduler.getStats(f).maxJitter);
+}
+
+void test_due_order_and_priority(void)
+{
+  setup_test();
+
+  TestScheduler scheduler(TestScheduler::Clock::create<&fakeClock>());
+  TestTask comms('c', 0);
+  TestTask engine('e', 0);
+  TestTask logger('l', 0);
+  scheduler.add(comms, 100, 2);
+  scheduler.add(engine, 100, 0);
+  scheduler.add(logger, 50, 1);
+
+  // All due at once, by priority
+  TEST_ASSERT_EQUAL(3, scheduler.run());
+  TEST_ASSERT_EQUAL_STRING("elc", runOrder);
+
+  // The logger was due first, then all three are due again, the logger next call
+  fakeNow += 120;
+  TEST_ASSERT_EQUAL(3, scheduler.run());
+  TEST_ASSERT_EQUAL_STRING("elclec", runOrder);
+  TEST_ASSERT_EQUAL(1, scheduler.run());
+  TEST_ASSERT_EQUAL_STRING("elclecl", runOrder);
+}
+
+void test_jitter_and_execution_time(void)
+{
+  setup_test();
+
+  TestScheduler scheduler(TestScheduler::Clock::create<&fakeClock>());
+  TestTask engine('e', 30);
+  TestTask comms('c', 80);
+  int e = scheduler.add(engine, 100, 0);
+  int c = scheduler.add(comms, 200, 1);
+
+  runUntil(scheduler, fakeNow + 1000);
+  // The engine waits behind the comms run which started before it was due, then for
+  // the next call a tick later as it already ran in that one
+  const corelib::TaskStats& stats = scheduler.getStats(e);
+  TEST_ASSERT_EQUAL(10, stats.runs);
+  TEST_ASSERT_EQUAL(30, stats.maxExecution);
+  TEST_ASSERT_EQUAL(11, stats.maxJitter);
+  TEST_ASSERT_EQUAL(0, stats.overruns);
+  TEST_ASSERT_EQUAL(80, scheduler.getStats(c).maxExecution);
+  TEST_ASSERT_EQUAL(30, scheduler.getStats(c).maxJitter);
+}
+
+void test_overrun_and_missed_periods(void)
+{
+  setup_test();
+
+  TestScheduler scheduler(TestScheduler::Clock::create<&fakeClock>());
+  TestTask engine('e', 10);
+  int e = scheduler.add(engine, 100, 0, 20);
+
+  scheduler.run();
+  engine.cost = 25;
+  fakeNow += 90;
+  scheduler.run();
+  TEST_ASSERT_EQUAL(1, scheduler.getStats(e).overruns);
+
+  // A run far longer than its period skips the periods it missed
+  engine.cost = 350;
+  fakeNow += 75;
+  scheduler.run();
+  TEST_ASSERT_EQUAL(2, scheduler.getStats(e).overruns);
+  TEST_ASSERT_EQUAL(3, scheduler.getStats(e).missed);
+  TEST_ASSERT_EQUAL(350, scheduler.getStats(e).maxExecution);
+
+  engine.cost = 0;
+  scheduler.resetStats();
+  runUntil(scheduler, fakeNow + 1000);
+  TEST_ASSERT_EQUAL(10, scheduler.getStats(e).runs);
+  TEST_ASSERT_EQUAL(0, scheduler.getStats(e).missed);
+}
+
+void test_capacity(void)
+{
+  setup_test();
+
+  TestScheduler scheduler(TestScheduler::Clock::create<&fakeClock>());
+  TestTask task('t', 0);
+  for(uint8_t i = 0; i < 4; i++){
+    TEST_ASSERT_EQUAL(i, scheduler.add(task, 100));
+  }
+  TEST_ASSERT_EQUAL(TestScheduler::NoTask, scheduler.add(task, 100));
+  TEST_ASSERT_EQUAL(4, scheduler.size());
+}
+
+void test_idle_time(void)
+{
+  setup_test();
+
+  TestScheduler scheduler(TestScheduler::Clock::create<&fakeClock>());
+  TestTask task('t', 0);
+  scheduler.add(task, 100);
+  TEST_ASSERT_EQUAL(0, scheduler.idle());
+  scheduler.run();
+  TEST_ASSERT_EQUAL(100, scheduler.idle());
+  fakeNow += 60;
+  TEST_ASSERT_EQUAL(40, scheduler.idle());
+}
+
+void test_run_returns_behind_long_task(void)
+{
+  setup_test();
+
+  TestScheduler scheduler(TestScheduler::Clock::create<&fakeClock>());
+  TestTask engine('e', 150);
+  TestTask logger('l', 0);
+  int e = scheduler.add(engine, 100, 0);
+  int l = scheduler.add(logger, 100, 1);
+
+  // The engine takes longer than its period, each call runs both once and returns
+  TEST_ASSERT_EQUAL(2, scheduler.run());
+  TEST_ASSERT_EQUAL(2, scheduler.run());
+  TEST_ASSERT_EQUAL_STRING("elel", runOrder);
+  TEST_ASSERT_EQUAL(2, scheduler.getStats(e).runs);
+  TEST_ASSERT_EQUAL(2, scheduler.getStats(l).runs);
+  TEST_ASSERT_EQUAL(2, scheduler.getStats(e).missed);
+
+  // Neither is due again until after the runs
+  TEST_ASSERT_EQUAL(0, scheduler.run());
+  runUntil(scheduler, fakeNow + 1000);
+  TEST_ASSERT_TRUE(scheduler.getStats(l).runs > 5);
+}
+
+void setUp (void) {}
+
+void tearDown (void) {}
+
+int main(int argc, char **argv) {
+  run_tests();
+  return 0;
+}
@@ -0,0 +1,52 @@
+/**
+ * @file tests_scheduler.h
+ *
+ * @brief Tests the Scheduler against an injected clock.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "scheduler.h"
+
+// The injected clock
+extern uint32_t fakeNow;
+uint32_t fakeClock();
+
+// Records the order tasks ran in
+extern char runOrder[64];
+extern uint8_t runCount;
+
+// A task which takes `cost` ticks to run
+class TestTask : public corelib::Function
+{
+  public:
+    char name;
+    uint32_t cost;
+
+    TestTask(char name, uint32_t cost) : name(name), cost(cost) {}
+
+  protected:
+    void performInitialise(){
+      // do nothing
+    }
+    void performIterate(){
+      if(runCount < sizeof(runOrder) - 1){
+        runOrder[runCount++] = name;
+      }
+      fakeNow += cost;
+    }
+};
+
+typedef corelib::Scheduler<4> TestScheduler;
+
+void setup_test();
+void run_tests();
+void test_tasks_run_at_their_rate(void);
+void test_due_order_and_priority(void);
+void test_jitter_and_execution_time(void);
+void test_overrun_and_missed_periods(void);
+void test_capacity(void);
+void test_idle_time(void);
+void test_run_returns_behind_long_task(void);
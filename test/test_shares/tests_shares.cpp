@@ -0,0 +1,228 @@
+#include "tests_shares.h"
+
+// External interfaces
+FastCRC32 CRC32;
+
+// Class under test
+corelib::ShareRegistry<4> registry;
+CommStats2 traffic = CommStats2_init_zero;
+ShareComm com;
+
+// Hook notifications
+uint32_t hookShareId = 0;
+TransactionMessage_Action hookAction = TransactionMessage_Action_NA;
+uint8_t hookCount = 0;
+
+void onShare(uint32_t shareId, TransactionMessage_Action action)
+{
+  hookShareId = shareId;
+  hookAction = action;
+  hookCount++;
+}
+
+// Encodes a transaction as Programmor would
+size_t encodeRequest(uint8_t* out, size_t size, uint32_t token, TransactionMessage_Action action, uint32_t shareId)
+{
+  TransactionMessage request = TransactionMessage_init_zero;
+  request.token = token;
+  request.action = action;
+  request.shareId = shareId;
+  if(action == TransactionMessage_Action_SHARE_PUBLISH){
+    pb_ostream_t data = pb_ostream_from_buffer(request.data, sizeof(request.data));
+    pb_encode(&data, CommStats2_fields, &traffic);
+    request.dataLength = data.bytes_written;
+  }
+  pb_ostream_t stream = pb_ostream_from_buffer(out, size);
+  pb_encode(&stream, TransactionMessage_fields, &request);
+  return stream.bytes_written;
+}
+
+TransactionMessage decodeResponse(const uint8_t* in, size_t size)
+{
+  TransactionMessage response = TransactionMessage_init_zero;
+  pb_istream_t stream = pb_istream_from_buffer(in, size);
+  TEST_ASSERT_TRUE(pb_decode(&stream, TransactionMessage_fields, &response));
+  return response;
+}
+
+void setup_test()
+{
+  hookShareId = 0;
+  hookAction = TransactionMessage_Action_NA;
+  hookCount = 0;
+}
+
+void run_tests()
+{
+  registry.common().id = 1;
+  registry.common().registryId = 0x1000;
+  registry.common().serialNumber = 0xA0B0C0D0;
+  strcpy(registry.common().deviceName, "Test device");
+  registry.addShare<CommStats2_size>(3, traffic, CommStats2_fields,
+    corelib::ShareHook::create<&onShare>());
+  com.initialise();
+  registry.attach(com);
+
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  RUN_TEST(test_common_request);
+  RUN_TEST(test_share_request);
+  RUN_TEST(test_share_publish);
+  RUN_TEST(test_rejected_transactions);
+  RUN_TEST(test_registry_through_comm);
+  UNITY_END(); // stop unit testing
+}
+
+void test_common_request(void)
+{
+  setup_test();
+
+  corelib::Buffer buffer;
+  buffer.inMessageLength = encodeRequest(buffer.inBuffer, sizeof(buffer.inBuffer), 0x1234,
+    TransactionMessage_Action_COMMON_REQUEST, corelib::Common1Id);
+  TEST_ASSERT_EQUAL(corelib::HandleMessageState::OK, registry.handleBuffer(&buffer));
+  TEST_ASSERT_TRUE(buffer.outMessageLength <= TransactionMessage_size);
+
+  TransactionMessage response = decodeResponse(buffer.outBuffer, buffer.outMessageLength);
+  TEST_ASSERT_EQUAL(0x1234, response.token);
+  TEST_ASSERT_EQUAL(TransactionMessage_Action_COMMON_RESPONSE, response.action);
+  TEST_ASSERT_EQUAL(corelib::Common1Id, response.shareId);
+
+  Common1 common = Common1_init_zero;
+  pb_istream_t data = pb_istream_from_buffer(response.data, response.dataLength);
+  TEST_ASSERT_TRUE(pb_decode(&data, Common1_fields, &common));
+  TEST_ASSERT_EQUAL(0x1000, common.registryId);
+  TEST_ASSERT_EQUAL(0xA0B0C0D0, common.serialNumber);
+  TEST_ASSERT_EQUAL_STRING("Test device", common.deviceName);
+}
+
+void test_share_request(void)
+{
+  setup_test();
+
+  traffic.framesIn = 42;
+  traffic.evictions = 7;
+  corelib::Buffer buffer;
+  buffer.inMessageLength = encodeRequest(buffer.inBuffer, sizeof(buffer.inBuffer), 0x55,
+    TransactionMessage_Action_SHARE_REQUEST, 3);
+  TEST_ASSERT_EQUAL(corelib::HandleMessageState::OK, registry.handleBuffer(&buffer));
+  // The hook may refresh the share before it is encoded
+  TEST_ASSERT_EQUAL(1, hookCount);
+  TEST_ASSERT_EQUAL(3, hookShareId);
+  TEST_ASSERT_EQUAL(TransactionMessage_Action_SHARE_REQUEST, hookAction);
+
+  TransactionMessage response = decodeResponse(buffer.outBuffer, buffer.outMessageLength);
+  TEST_ASSERT_EQUAL(TransactionMessage_Action_SHARE_RESPONSE, response.action);
+  TEST_ASSERT_TRUE(response.dataLength <= registry.encodedSize(3));
+  CommStats2 decoded = CommStats2_init_zero;
+  pb_istream_t data = pb_istream_from_buffer(response.data, response.dataLength);
+  TEST_ASSERT_TRUE(pb_decode(&data, CommStats2_fields, &decoded));
+  TEST_ASSERT_EQUAL(42, decoded.framesIn);
+  TEST_ASSERT_EQUAL(7, decoded.evictions);
+}
+
+void test_share_publish(void)
+{
+  setup_test();
+
+  // Programmor publishes new values, decoded straight into the share
+  corelib::Buffer buffer;
+  traffic = CommStats2_init_zero;
+  traffic.bytesIn = 1000;
+  traffic.relayDrops = 3;
+  buffer.inMessageLength = encodeRequest(buffer.inBuffer, sizeof(buffer.inBuffer), 0x66,
+    TransactionMessage_Action_SHARE_PUBLISH, 3);
+  traffic = CommStats2_init_zero;
+  traffic.framesOut = 9;
+  TEST_ASSERT_EQUAL(corelib::HandleMessageState::OK, registry.handleBuffer(&buffer));
+  TEST_ASSERT_EQUAL(1000, traffic.bytesIn);
+  TEST_ASSERT_EQUAL(3, traffic.relayDrops);
+  TEST_ASSERT_EQUAL(0, traffic.framesOut);
+  TEST_ASSERT_EQUAL(1, hookCount);
+  TEST_ASSERT_EQUAL(TransactionMessage_Action_SHARE_PUBLISH, hookAction);
+
+  // Answered with the share as it now is
+  TransactionMessage response = decodeResponse(buffer.outBuffer, buffer.outMessageLength);
+  TEST_ASSERT_EQUAL(0x66, response.token);
+  TEST_ASSERT_EQUAL(TransactionMessage_Action_SHARE_RESPONSE, response.action);
+  CommStats2 decoded = CommStats2_init_zero;
+  pb_istream_t data = pb_istream_from_buffer(response.data, response.dataLength);
+  TEST_ASSERT_TRUE(pb_decode(&data, CommStats2_fields, &decoded));
+  TEST_ASSERT_EQUAL(1000, decoded.bytesIn);
+}
+
+void test_rejected_transactions(void)
+{
+  setup_test();
+
+  corelib::Buffer buffer;
+  // Unknown and out of range shares
+  buffer.inMessageLength = encodeRequest(buffer.inBuffer, sizeof(buffer.inBuffer), 1,
+    TransactionMessage_Action_SHARE_REQUEST, 2);
+  TEST_ASSERT_EQUAL(corelib::HandleMessageState::ERROR, registry.handleBuffer(&buffer));
+  TEST_ASSERT_EQUAL(0, buffer.outMessageLength);
+  buffer.inMessageLength = encodeRequest(buffer.inBuffer, sizeof(buffer.inBuffer), 1,
+    TransactionMessage_Action_SHARE_REQUEST, 100);
+  TEST_ASSERT_EQUAL(corelib::HandleMessageState::ERROR, registry.handleBuffer(&buffer));
+  // Common1 is read only
+  buffer.inMessageLength = encodeRequest(buffer.inBuffer, sizeof(buffer.inBuffer), 1,
+    TransactionMessage_Action_COMMON_PUBLISH, corelib::Common1Id);
+  TEST_ASSERT_EQUAL(corelib::HandleMessageState::ERROR, registry.handleBuffer(&buffer));
+  // A publish without data
+  buffer.inMessageLength = encodeRequest(buffer.inBuffer, sizeof(buffer.inBuffer), 1,
+    TransactionMessage_Action_SHARE_REQUEST, 3);
+  buffer.inBuffer[6] = TransactionMessage_Action_SHARE_PUBLISH;
+  buffer.inMessageLength = 12;
+  TEST_ASSERT_EQUAL(corelib::HandleMessageState::NO_DATA, registry.handleBuffer(&buffer));
+  // A truncated message, data of 80 bytes without the bytes
+  buffer.inBuffer[0] = 0x2A;
+  buffer.inBuffer[1] = 0x50;
+  buffer.inMessageLength = 2;
+  TEST_ASSERT_EQUAL(corelib::HandleMessageState::FAILED_DECODE, registry.handleBuffer(&buffer));
+  // Ids are registered once, in range
+  CommStats2 other = CommStats2_init_zero;
+  TEST_ASSERT_FALSE(registry.addShare<CommStats2_size>(3, other, CommStats2_fields));
+  TEST_ASSERT_FALSE(registry.addShare<CommStats2_size>(4, other, CommStats2_fields));
+  TEST_ASSERT_EQUAL(0, hookCount);
+}
+
+void test_registry_through_comm(void)
+{
+  setup_test();
+
+  // A request arriving in frames is answered in frames
+  uint8_t request[150] = {0};
+  encodeRequest(request, sizeof(request), 0x77, TransactionMessage_Action_COMMON_REQUEST, corelib::Common1Id);
+  for(uint8_t i = 0; i < 2; i++){
+    corelib::Frame frame;
+    frame.preamble = corelib::Preamble::DATA;
+    frame.destinationAddress = 0x02;
+    frame.sourceAddress = 0x01;
+    frame.frameID = 0x10;
+    frame.frameOrder = i + 1;
+    frame.frameTotal = 2;
+    memcpy(frame.payload, request + i * sizeof(frame.payload), sizeof(frame.payload));
+    frame.crc = CRC32.crc32((uint8_t*)&frame, sizeof(corelib::Frame)-4);
+    com.push(frame);
+  }
+  for(uint8_t i = 0; i < 4; i++){
+    com.iterate();
+  }
+
+  TEST_ASSERT_EQUAL(2, com.txCount);
+  uint8_t response[100];
+  memcpy(response, com.tx[0].payload, sizeof(corelib::Frame::payload));
+  memcpy(response + 50, com.tx[1].payload, sizeof(corelib::Frame::payload));
+  TransactionMessage decoded = decodeResponse(response, sizeof(response));
+  TEST_ASSERT_EQUAL(0x77, decoded.token);
+  TEST_ASSERT_EQUAL(TransactionMessage_Action_COMMON_RESPONSE, decoded.action);
+  TEST_ASSERT_EQUAL(1, com.getStats().handleStates[static_cast<uint8_t>(corelib::HandleMessageState::OK)]);
+}
+
+void setUp (void) {}
+
+void tearDown (void) {}
+
+int main(int argc, char **argv) {
+  run_tests();
+  return 0;
+}
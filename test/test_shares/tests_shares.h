@@ -0,0 +1,58 @@
+/**
+ * @file tests_shares.h
+ *
+ * @brief Tests the ShareRegistry answering requests and publishes from registered shares.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include <FastCRC.h>
+
+#include "shares.h"
+
+// A Comm interface over an in-memory loopback
+class ShareComm : public corelib::Comm
+{
+  public:
+    static const uint8_t Depth = 8;
+    // Frames to be read
+    corelib::Frame rx[Depth];
+    uint8_t rxHead = 0;
+    uint8_t rxTail = 0;
+    // Frames written
+    corelib::Frame tx[Depth];
+    uint8_t txCount = 0;
+
+    void push(const corelib::Frame& frame){
+      rx[rxTail++ % Depth] = frame;
+    }
+
+  protected:
+    // Function.h interface
+    void performInitialise(){
+      initialised = true;
+    }
+
+    // Comms.h interface
+    bool read(uint8_t* buffer){
+      if(rxHead == rxTail){
+        return false;
+      }
+      memcpy(buffer, &rx[rxHead++ % Depth], 64);
+      return true;
+    }
+    bool write(const uint8_t* buffer){
+      memcpy(&tx[txCount % Depth], buffer, 64);
+      txCount++;
+      return true;
+    }
+};
+
+void setup_test();
+void run_tests();
+void test_common_request(void);
+void test_share_request(void);
+void test_share_publish(void);
+void test_rejected_transactions(void);
+void test_registry_through_comm(void);
@@ -0,0 +1,186 @@
+#include "tests_stream.h"
+
+// Class under test
+corelib::StreamReceiver receiver;
+corelib::StreamSender sender;
+TestSink sink;
+TestSource source;
+
+// Produces every frame of the current stream
+size_t produceAll(corelib::Frame* frames, size_t max)
+{
+  size_t count = 0;
+  while(count < max && sender.produce(frames[count])){
+    frames[count].sourceAddress = 0x01;
+    count++;
+  }
+  return count;
+}
+
+void setup_test()
+{
+  sender.abort();
+  receiver.abort();
+  sink = TestSink();
+  source = TestSource();
+  receiver.setSink(&sink);
+}
+
+void run_tests()
+{
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  RUN_TEST(test_stream_round_trip);
+  RUN_TEST(test_stream_out_of_order_and_duplicates);
+  RUN_TEST(test_stream_window);
+  RUN_TEST(test_stream_timeout);
+  RUN_TEST(test_stream_rejected);
+  RUN_TEST(test_stream_source_failure);
+  RUN_TEST(test_stream_empty);
+  UNITY_END(); // stop unit testing
+}
+
+void test_stream_round_trip(void)
+{
+  setup_test();
+
+  // 3000 bytes is 60 data fragments, far beyond a 128 byte Comm buffer
+  TEST_ASSERT_TRUE(sender.begin(&source, 0xABCD, 3000, 7));
+  TEST_ASSERT_FALSE(sender.begin(&source, 0x1234, 10, 0));
+  corelib::Frame frame;
+  uint16_t frames = 0;
+  while(sender.produce(frame)){
+    TEST_ASSERT_TRUE(frame.preamble == corelib::Preamble::STREAM);
+    TEST_ASSERT_EQUAL(frames, corelib::streamIndex(frame));
+    frame.sourceAddress = 0x01;
+    TEST_ASSERT_TRUE(receiver.receive(frame, 0));
+    frames++;
+  }
+  TEST_ASSERT_EQUAL(61, frames);
+  TEST_ASSERT_EQUAL(1, source.ended);
+  TEST_ASSERT_FALSE(sender.active());
+
+  TEST_ASSERT_EQUAL(1, sink.ended);
+  TEST_ASSERT_EQUAL(0xABCD, sink.info.streamID);
+  TEST_ASSERT_EQUAL(3000, sink.info.length);
+  TEST_ASSERT_EQUAL(7, sink.info.channel);
+  TEST_ASSERT_EQUAL(3000, sink.written);
+  for(uint32_t i = 0; i < 3000; i++){
+    TEST_ASSERT_EQUAL((uint8_t)(i * 7), sink.data[i]);
+  }
+  TEST_ASSERT_FALSE(receiver.active());
+}
+
+void test_stream_out_of_order_and_duplicates(void)
+{
+  setup_test();
+
+  static corelib::Frame frames[8];
+  sender.begin(&source, 0x10, 320, 0);
+  TEST_ASSERT_EQUAL(8, produceAll(frames, 8));
+
+  TEST_ASSERT_TRUE(receiver.receive(frames[0], 0));
+  const uint8_t order[] = {3, 1, 7, 2, 5, 4};
+  for(uint8_t i = 0; i < sizeof(order); i++){
+    TEST_ASSERT_TRUE(receiver.receive(frames[order[i]], 0));
+  }
+  // Duplicates before and within the window
+  TEST_ASSERT_FALSE(receiver.receive(frames[1], 0));
+  TEST_ASSERT_FALSE(receiver.receive(frames[7], 0));
+  TEST_ASSERT_EQUAL(-1, sink.ended);
+  // A repeated header is accepted but does not restart the stream
+  TEST_ASSERT_TRUE(receiver.receive(frames[0], 0));
+  TEST_ASSERT_TRUE(receiver.receive(frames[6], 0));
+  TEST_ASSERT_EQUAL(1, sink.ended);
+  TEST_ASSERT_EQUAL(320, sink.written);
+  TEST_ASSERT_EQUAL((uint8_t)(319 * 7), sink.data[319]);
+}
+
+void test_stream_window(void)
+{
+  setup_test();
+
+  static corelib::Frame frames[40];
+  sender.begin(&source, 0x20, 39 * 50, 0);
+  TEST_ASSERT_EQUAL(40, produceAll(frames, 40));
+  receiver.receive(frames[0], 0);
+
+  // Fragment 1 is missing so fragment 33 lies beyond the window
+  TEST_ASSERT_TRUE(receiver.receive(frames[32], 0));
+  TEST_ASSERT_FALSE(receiver.receive(frames[33], 0));
+  TEST_ASSERT_TRUE(receiver.receive(frames[1], 0));
+  TEST_ASSERT_TRUE(receiver.receive(frames[33], 0));
+}
+
+void test_stream_timeout(void)
+{
+  setup_test();
+
+  static corelib::Frame frames[4];
+  sender.begin(&source, 0x30, 150, 0);
+  produceAll(frames, 4);
+  receiver.receive(frames[0], 10);
+  receiver.receive(frames[1], 12);
+
+  TEST_ASSERT_FALSE(receiver.expire(20, 10));
+  TEST_ASSERT_TRUE(receiver.expire(22, 10));
+  TEST_ASSERT_EQUAL(0, sink.ended);
+  // The remaining fragments are ignored
+  TEST_ASSERT_FALSE(receiver.receive(frames[2], 23));
+}
+
+void test_stream_rejected(void)
+{
+  setup_test();
+
+  static corelib::Frame frames[3];
+  sender.begin(&source, 0x40, 100, 0);
+  produceAll(frames, 3);
+
+  sink.accept = false;
+  TEST_ASSERT_FALSE(receiver.receive(frames[0], 0));
+  TEST_ASSERT_FALSE(receiver.receive(frames[1], 0));
+  TEST_ASSERT_EQUAL(-1, sink.ended);
+
+  // Another stream waits until the current one is over
+  sink.accept = true;
+  TEST_ASSERT_TRUE(receiver.receive(frames[0], 0));
+  corelib::Frame other = frames[0];
+  other.frameID = 0x41;
+  TEST_ASSERT_FALSE(receiver.receive(other, 0));
+}
+
+void test_stream_source_failure(void)
+{
+  setup_test();
+
+  source.failAt = 120;
+  sender.begin(&source, 0x50, 500, 0);
+  static corelib::Frame frames[11];
+  // Header and two full fragments, then the source fails
+  TEST_ASSERT_EQUAL(3, produceAll(frames, 11));
+  TEST_ASSERT_EQUAL(0, source.ended);
+  TEST_ASSERT_FALSE(sender.active());
+}
+
+void test_stream_empty(void)
+{
+  setup_test();
+
+  corelib::Frame frame;
+  TEST_ASSERT_TRUE(sender.begin(&source, 0x60, 0, 0));
+  TEST_ASSERT_TRUE(sender.produce(frame));
+  TEST_ASSERT_FALSE(sender.active());
+  TEST_ASSERT_EQUAL(1, source.ended);
+  TEST_ASSERT_TRUE(receiver.receive(frame, 0));
+  TEST_ASSERT_EQUAL(1, sink.ended);
+  TEST_ASSERT_FALSE(sender.begin(&source, 0x61, corelib::StreamMaxLength + 1, 0));
+}
+
+void setUp (void) {}
+
+void tearDown (void) {}
+
+int main(int argc, char **argv) {
+  run_tests();
+  return 0;
+}
@@ -0,0 +1,71 @@
+/**
+ * @file tests_stream.h
+ *
+ * @brief Tests the streaming transfer of messages larger than a Comm buffer.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "stream.h"
+
+// Collects a stream into RAM
+class TestSink : public corelib::StreamSink
+{
+  public:
+    uint8_t data[4096];
+    corelib::StreamInfo info;
+    uint32_t written = 0;
+    int ended = -1; // -1 open, 0 aborted, 1 complete
+    bool accept = true;
+
+    bool begin(const corelib::StreamInfo& i){
+      if(!accept){
+        return false;
+      }
+      info = i;
+      written = 0;
+      ended = -1;
+      return true;
+    }
+    bool write(uint32_t offset, const uint8_t* d, size_t length){
+      memcpy(data + offset, d, length);
+      written += length;
+      return true;
+    }
+    void end(bool complete){
+      ended = complete;
+    }
+};
+
+// Produces a counting pattern, failing at `failAt` bytes when set
+class TestSource : public corelib::StreamSource
+{
+  public:
+    uint32_t failAt = 0xFFFFFFFF;
+    int ended = -1;
+
+    size_t read(uint32_t offset, uint8_t* d, size_t length){
+      if(offset + length > failAt){
+        return 0;
+      }
+      for(size_t i = 0; i < length; i++){
+        d[i] = (offset + i) * 7;
+      }
+      return length;
+    }
+    void end(bool complete){
+      ended = complete;
+    }
+};
+
+void setup_test();
+void run_tests();
+void test_stream_round_trip(void);
+void test_stream_out_of_order_and_duplicates(void);
+void test_stream_window(void);
+void test_stream_timeout(void);
+void test_stream_rejected(void);
+void test_stream_source_failure(void);
+void test_stream_empty(void);
@@ -0,0 +1,212 @@
+#include "tests_timesync.h"
+
+// External interfaces
+FastCRC32 CRC32;
+
+// Simulated time, host microseconds
+uint32_t now = 0;
+// The device clock, ahead of the host and running faster by driftPpm
+uint32_t deviceBase = 0;
+int32_t driftPpm = 0;
+
+uint32_t hostClock()
+{
+  return now;
+}
+
+uint32_t deviceClock()
+{
+  return deviceBase + now + static_cast<int32_t>(static_cast<int64_t>(now) * driftPpm / 1000000);
+}
+
+// Class under test
+LinkComm host(0x01, 0x02);
+LinkComm device(0x02, 0x01);
+
+// Runs both ends, a frame takes 50 us to cross
+void step()
+{
+  now += 50;
+  host.iterate();
+  now += 50;
+  device.iterate();
+}
+
+// Pings the device and waits for the answer
+void exchange()
+{
+  TEST_ASSERT_TRUE(host.ping());
+  step();
+  step();
+}
+
+void setup_test()
+{
+  host.reset();
+  device.reset();
+  now = 0;
+  deviceBase = 0;
+  driftPpm = 0;
+}
+
+void run_tests()
+{
+  host.peer = &device;
+  device.peer = &host;
+  host.setClock(etl::delegate<uint32_t()>::create<&hostClock>());
+  device.setClock(etl::delegate<uint32_t()>::create<&deviceClock>());
+  device.setHandleMessageCallback(
+    etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::create<LinkComm, &LinkComm::count>(device));
+  host.initialise();
+  device.initialise();
+
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  RUN_TEST(test_ping_times);
+  RUN_TEST(test_ping_answered_without_handler);
+  RUN_TEST(test_offset_across_wrap);
+  RUN_TEST(test_drift_tracked);
+  RUN_TEST(test_superseded_ping_ignored);
+  RUN_TEST(test_refused_ping_keeps_estimate);
+  UNITY_END(); // stop unit testing
+}
+
+void test_ping_times(void)
+{
+  setup_test();
+
+  corelib::PingTimes times;
+  times.sequence = 7;
+  times.sent = 0x01020304;
+  times.received = 0xA0B0C0D0;
+  times.answered = 0xFFFFFFFF;
+  uint8_t payload[sizeof(corelib::Frame::payload)];
+  corelib::encodePingTimes(times, payload);
+  TEST_ASSERT_EQUAL(0x04, payload[4]);
+  TEST_ASSERT_EQUAL(0xA0, payload[11]);
+  TEST_ASSERT_EQUAL(0, payload[16]);
+  const corelib::PingTimes decoded = corelib::decodePingTimes(payload);
+  TEST_ASSERT_EQUAL(7, decoded.sequence);
+  TEST_ASSERT_EQUAL(0xA0B0C0D0, decoded.received);
+  TEST_ASSERT_EQUAL(0xFFFFFFFF, decoded.answered);
+
+  // Histogram buckets double in width
+  TEST_ASSERT_EQUAL(0, corelib::rttBucket(0));
+  TEST_ASSERT_EQUAL(0, corelib::rttBucket(15));
+  TEST_ASSERT_EQUAL(1, corelib::rttBucket(16));
+  TEST_ASSERT_EQUAL(3, corelib::rttBucket(100));
+  TEST_ASSERT_EQUAL(corelib::RttBucketCount - 1, corelib::rttBucket(0xFFFFFFFF));
+}
+
+void test_ping_answered_without_handler(void)
+{
+  setup_test();
+
+  exchange();
+  TEST_ASSERT_EQUAL(0, device.handled);
+  TEST_ASSERT_EQUAL(1, device.getStats().pingsAnswered);
+  const corelib::CommStats& stats = host.getStats();
+  TEST_ASSERT_EQUAL(1, stats.pingsSent);
+  TEST_ASSERT_EQUAL(1, stats.pingResponses);
+  // Written at 50 us, read by the device at 100 us and answered, read back at 150 us
+  TEST_ASSERT_EQUAL(100, stats.rttMin);
+  TEST_ASSERT_EQUAL(100, stats.rttMax);
+  TEST_ASSERT_EQUAL(1, stats.rttHistogram[corelib::rttBucket(100)]);
+  TEST_ASSERT_EQUAL(0x02, host.getClockSync().peer());
+
+  CommPing1 ping = CommPing1_init_zero;
+  corelib::toMessage(stats, ping);
+  TEST_ASSERT_EQUAL(1, ping.pingsSent);
+  TEST_ASSERT_EQUAL(1, ping.pingResponses);
+  TEST_ASSERT_EQUAL(100, ping.rttMax);
+  CommPing2 histogram = CommPing2_init_zero;
+  corelib::toMessage(stats, histogram);
+  TEST_ASSERT_EQUAL(1, histogram.rttHistogram[corelib::rttBucket(100)]);
+  TEST_ASSERT_EQUAL(0, histogram.rttHistogram[0]);
+  // Both fit the data of a share message
+  TEST_ASSERT_TRUE(CommPing1_size <= sizeof(TransactionMessage::data));
+  TEST_ASSERT_TRUE(CommPing2_size <= sizeof(TransactionMessage::data));
+}
+
+void test_offset_across_wrap(void)
+{
+  setup_test();
+
+  // The device clock is half a wrap and a bit ahead
+  deviceBase = 0x80000000UL + 12345;
+  exchange();
+  const corelib::ClockSync& sync = host.getClockSync();
+  TEST_ASSERT_EQUAL(1, sync.samples());
+  TEST_ASSERT_EQUAL(deviceBase, sync.offset());
+  TEST_ASSERT_EQUAL(deviceBase, host.getStats().clockOffset);
+  TEST_ASSERT_EQUAL(deviceClock(), sync.toPeer(now));
+  TEST_ASSERT_EQUAL(now, sync.toLocal(deviceClock()));
+}
+
+void test_drift_tracked(void)
+{
+  setup_test();
+
+  // A device crystal 200 ppm fast, pinged every 10 ms for three seconds
+  deviceBase = 5000;
+  driftPpm = 200;
+  for(uint16_t i = 0; i < 300; i++){
+    exchange();
+    now += 10000;
+  }
+  const corelib::ClockSync& sync = host.getClockSync();
+  TEST_ASSERT_EQUAL(300, sync.samples());
+  TEST_ASSERT_INT32_WITHIN(20000, 200000, sync.drift());
+  TEST_ASSERT_INT32_WITHIN(20000, 200000, host.getStats().clockDrift);
+  CommPing1 ping = CommPing1_init_zero;
+  corelib::toMessage(host.getStats(), ping);
+  TEST_ASSERT_EQUAL(sync.drift(), ping.clockDrift);
+  // Device times are known to within a few microseconds
+  TEST_ASSERT_INT32_WITHIN(3, 0, static_cast<int32_t>(sync.toPeer(now) - deviceClock()));
+  now += 50000;
+  TEST_ASSERT_INT32_WITHIN(3, 0, static_cast<int32_t>(sync.toPeer(now) - deviceClock()));
+}
+
+void test_superseded_ping_ignored(void)
+{
+  setup_test();
+
+  // Two pings before an answer, the answer to the first is not matched
+  TEST_ASSERT_TRUE(host.ping());
+  TEST_ASSERT_TRUE(host.ping());
+  step();
+  step();
+  step();
+  TEST_ASSERT_EQUAL(2, device.getStats().pingsAnswered);
+  TEST_ASSERT_EQUAL(1, host.getStats().pingResponses);
+  TEST_ASSERT_EQUAL(1, host.getClockSync().samples());
+}
+
+void test_refused_ping_keeps_estimate(void)
+{
+  setup_test();
+
+  exchange();
+  // The catch all address has no single clock to estimate
+  TEST_ASSERT_FALSE(host.ping(0x00));
+  // Nor is the estimate restarted for a ping which could not be queued
+  while(host.ping()){}
+  TEST_ASSERT_FALSE(host.ping(0x03));
+  const corelib::ClockSync& sync = host.getClockSync();
+  TEST_ASSERT_EQUAL(0x02, sync.peer());
+  TEST_ASSERT_EQUAL(1, sync.samples());
+
+  // The last queued ping is still matched
+  for(uint8_t i = 0; i < 64; i++){
+    step();
+  }
+  TEST_ASSERT_EQUAL(2, sync.samples());
+}
+
+void setUp (void) {}
+
+void tearDown (void) {}
+
+int main(int argc, char **argv) {
+  run_tests();
+  return 0;
+}
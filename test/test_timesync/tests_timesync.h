@@ -0,0 +1,71 @@
+/**
+ * @file tests_timesync.h
+ *
+ * @brief Tests pings between two Comm interfaces, their round trips and clock estimate.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include <FastCRC.h>
+
+#include "comm.h"
+#include "timesync.h"
+
+// A Comm interface writing its frames straight to another one
+class LinkComm : public corelib::Comm
+{
+  public:
+    static const uint8_t Depth = 16;
+    // Frames to be read
+    corelib::Frame rx[Depth];
+    uint8_t rxHead = 0;
+    uint8_t rxTail = 0;
+    LinkComm* peer = nullptr;
+    // Messages handled
+    uint8_t handled = 0;
+
+    LinkComm(uint8_t deviceAddress, uint8_t destination) : corelib::Comm() {
+      address = deviceAddress;
+      destinationDeviceAddress = destination;
+    }
+
+    void reset(){
+      rxHead = rxTail = handled = 0;
+      clockSync.reset();
+      resetStats();
+    }
+
+    corelib::HandleMessageState count(corelib::Buffer* b){
+      handled++;
+      return corelib::HandleMessageState::OK;
+    }
+
+  protected:
+    // Function.h interface
+    void performInitialise(){
+      initialised = true;
+    }
+
+    // Comms.h interface
+    bool read(uint8_t* buffer){
+      if(rxHead == rxTail){
+        return false;
+      }
+      memcpy(buffer, &rx[rxHead++ % Depth], 64);
+      return true;
+    }
+    bool write(const uint8_t* buffer){
+      memcpy(&peer->rx[peer->rxTail++ % Depth], buffer, sizeof(corelib::Frame));
+      return true;
+    }
+};
+
+void setup_test();
+void run_tests();
+void test_ping_times(void);
+void test_ping_answered_without_handler(void);
+void test_offset_across_wrap(void);
+void test_drift_tracked(void);
+void test_superseded_ping_ignored(void);
+void test_refused_ping_keeps_estimate(void);
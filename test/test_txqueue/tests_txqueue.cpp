@@ -0,0 +1,201 @@
+#include "tests_txqueue.h"
+
+typedef corelib::TxQueue<3, 3> Queue;
+
+// External interfaces
+FastCRC32 CRC32;
+
+// Class under test
+TxComm com;
+
+void setup_test()
+{
+  com.reset();
+}
+
+void run_tests()
+{
+  com.setHandleMessageCallback(
+    etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::create<TxComm, &TxComm::respond>(com));
+  com.setPublishCallback(etl::delegate<bool(corelib::Buffer*)>::create<TxComm, &TxComm::publishMessage>(com));
+  com.initialise();
+
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  RUN_TEST(test_lanes_order);
+  RUN_TEST(test_bulk_leaves_room);
+  RUN_TEST(test_resume_after_failed_write);
+  RUN_TEST(test_frames_per_iteration);
+  RUN_TEST(test_response_overtakes_publish);
+  UNITY_END(); // stop unit testing
+}
+
+// Queues a message whose frames are numbered by id and order
+void enqueue(Queue& queue, corelib::TxLane lane, uint8_t count, uint32_t id)
+{
+  const int entry = queue.push(lane, count, id);
+  TEST_ASSERT_TRUE(entry != Queue::NoEntry);
+  for(uint8_t i = 0; i < count; i++){
+    queue.frame(entry, i).frameID = id;
+    queue.frame(entry, i).frameOrder = i + 1;
+  }
+}
+
+void assertFront(Queue& queue, uint32_t id, uint8_t order)
+{
+  TEST_ASSERT_NOT_NULL(queue.front());
+  TEST_ASSERT_EQUAL(id, queue.front()->frameID);
+  TEST_ASSERT_EQUAL(order, queue.front()->frameOrder);
+}
+
+void test_lanes_order(void)
+{
+  setup_test();
+
+  corelib::StaticFramePool<9> pool;
+  Queue queue(pool);
+  enqueue(queue, corelib::TxLane::BULK, 3, 1);
+  enqueue(queue, corelib::TxLane::BULK, 1, 2);
+  enqueue(queue, corelib::TxLane::PRIORITY, 1, 3);
+
+  // The response goes before the publishes queued ahead of it
+  assertFront(queue, 3, 1);
+  TEST_ASSERT_TRUE(queue.starting());
+  TEST_ASSERT_EQUAL(3, queue.queuedAt());
+  TEST_ASSERT_TRUE(queue.pop());
+  assertFront(queue, 1, 1);
+  TEST_ASSERT_FALSE(queue.pop());
+
+  // And overtakes a publish between two of its frames
+  enqueue(queue, corelib::TxLane::PRIORITY, 1, 4);
+  assertFront(queue, 4, 1);
+  TEST_ASSERT_TRUE(queue.pop());
+  assertFront(queue, 1, 2);
+  TEST_ASSERT_FALSE(queue.starting());
+  TEST_ASSERT_FALSE(queue.pop());
+  TEST_ASSERT_TRUE(queue.pop());
+  // Publishes leave in the order they were queued
+  assertFront(queue, 2, 1);
+  TEST_ASSERT_TRUE(queue.pop());
+  TEST_ASSERT_TRUE(queue.empty());
+  TEST_ASSERT_NULL(queue.front());
+  TEST_ASSERT_FALSE(queue.pop());
+}
+
+void test_bulk_leaves_room(void)
+{
+  setup_test();
+
+  corelib::StaticFramePool<9> pool;
+  Queue queue(pool);
+  enqueue(queue, corelib::TxLane::BULK, 1, 1);
+  enqueue(queue, corelib::TxLane::BULK, 1, 2);
+  // The last entry is kept for a response
+  TEST_ASSERT_TRUE(queue.full(corelib::TxLane::BULK));
+  TEST_ASSERT_FALSE(queue.full(corelib::TxLane::PRIORITY));
+  TEST_ASSERT_EQUAL(Queue::NoEntry, queue.push(corelib::TxLane::BULK, 1, 3));
+  enqueue(queue, corelib::TxLane::PRIORITY, 1, 3);
+  TEST_ASSERT_TRUE(queue.full(corelib::TxLane::PRIORITY));
+  TEST_ASSERT_EQUAL(Queue::NoEntry, queue.push(corelib::TxLane::PRIORITY, 1, 4));
+  TEST_ASSERT_EQUAL(3, queue.size());
+
+  queue.clear();
+  TEST_ASSERT_TRUE(queue.empty());
+  // Messages which do not fit an entry are refused
+  TEST_ASSERT_EQUAL(Queue::NoEntry, queue.push(corelib::TxLane::PRIORITY, 0, 1));
+  TEST_ASSERT_EQUAL(Queue::NoEntry, queue.push(corelib::TxLane::PRIORITY, 4, 1));
+}
+
+void test_resume_after_failed_write(void)
+{
+  setup_test();
+
+  TEST_ASSERT_EQUAL(corelib::ProcessState::OK, com.testProcessOutgoingMessage(corelib::TxLane::PRIORITY, 120));
+  // The transport takes the first frame only
+  com.accept = 1;
+  TEST_ASSERT_EQUAL(corelib::WriteState::ERROR, com.testProcessWrite());
+  TEST_ASSERT_EQUAL(1, com.written);
+  TEST_ASSERT_EQUAL(1, com.txQueueDepth());
+
+  // The message carries on from the refused frame
+  com.accept = -1;
+  TEST_ASSERT_EQUAL(corelib::WriteState::OK, com.testProcessWrite());
+  TEST_ASSERT_EQUAL(3, com.written);
+  for(uint8_t i = 0; i < 3; i++){
+    TEST_ASSERT_EQUAL(i + 1, com.tx[i].frameOrder);
+    TEST_ASSERT_EQUAL(com.tx[0].frameID, com.tx[i].frameID);
+  }
+  TEST_ASSERT_EQUAL(0, com.txQueueDepth());
+  TEST_ASSERT_EQUAL(3, com.getStats().framesOut);
+}
+
+void test_frames_per_iteration(void)
+{
+  setup_test();
+
+  for(uint8_t m = 0; m < 3; m++){
+    TEST_ASSERT_EQUAL(corelib::ProcessState::OK, com.testProcessOutgoingMessage(corelib::TxLane::PRIORITY, 120));
+  }
+  TEST_ASSERT_EQUAL(3, com.getStats().outFramesQueued);
+
+  // Nine frames are written over three calls
+  TEST_ASSERT_EQUAL(corelib::WriteState::OK, com.testProcessWrite());
+  TEST_ASSERT_EQUAL(corelib::CommConfig<>::framesPerIteration, com.written);
+  TEST_ASSERT_EQUAL(2, com.txQueueDepth());
+  TEST_ASSERT_EQUAL(corelib::WriteState::OK, com.testProcessWrite());
+  TEST_ASSERT_EQUAL(2 * corelib::CommConfig<>::framesPerIteration, com.written);
+  TEST_ASSERT_EQUAL(1, com.txQueueDepth());
+  TEST_ASSERT_EQUAL(corelib::WriteState::OK, com.testProcessWrite());
+  TEST_ASSERT_EQUAL(9, com.written);
+  TEST_ASSERT_EQUAL(0, com.getStats().outFramesQueued);
+  TEST_ASSERT_EQUAL(corelib::WriteState::OUT_FRAMES_EMPTY, com.testProcessWrite());
+}
+
+void test_response_overtakes_publish(void)
+{
+  setup_test();
+
+  // A publish is queued, the transport refuses it for two iterations
+  com.publishLength = 120;
+  com.accept = 0;
+  com.iterate();
+  com.iterate();
+  TEST_ASSERT_EQUAL(0, com.written);
+  TEST_ASSERT_EQUAL(1, com.txQueueDepth());
+
+  // A request arrives as the transport recovers
+  corelib::Frame frame;
+  frame.preamble = corelib::Preamble::DATA;
+  frame.destinationAddress = 0x02;
+  frame.sourceAddress = 0x01;
+  frame.frameID = 0x30;
+  frame.frameOrder = 1;
+  frame.frameTotal = 1;
+  memset(frame.payload, 0, sizeof(frame.payload));
+  frame.crc = CRC32.crc32((uint8_t*)&frame, sizeof(corelib::Frame)-4);
+  com.push(frame);
+  com.accept = -1;
+  com.iterate();
+
+  // The response is written first, then the whole publish
+  TEST_ASSERT_EQUAL(4, com.written);
+  TEST_ASSERT_EQUAL(1, com.tx[0].frameTotal);
+  TEST_ASSERT_EQUAL(0xA0, com.tx[0].payload[0]);
+  for(uint8_t i = 1; i < 4; i++){
+    TEST_ASSERT_EQUAL(3, com.tx[i].frameTotal);
+    TEST_ASSERT_EQUAL(i, com.tx[i].frameOrder);
+    TEST_ASSERT_EQUAL(0xB0, com.tx[i].payload[0]);
+  }
+  const corelib::CommStats& stats = com.getStats();
+  TEST_ASSERT_EQUAL(2, stats.outFramesHighWater);
+  TEST_ASSERT_EQUAL(0, stats.outFramesQueued);
+  TEST_ASSERT_EQUAL(2, stats.txWaitMax);
+}
+
+void setUp (void) {}
+
+void tearDown (void) {}
+
+int main(int argc, char **argv) {
+  run_tests();
+  return 0;
+}
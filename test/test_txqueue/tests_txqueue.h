@@ -0,0 +1,103 @@
+/**
+ * @file tests_txqueue.h
+ *
+ * @brief Tests the transmit queue, its priority lanes and the Comm writing from it.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <unity.h>
+#include <FastCRC.h>
+
+#include "comm.h"
+#include "txqueue.h"
+
+// A Comm interface recording the frames it writes, whose transport may refuse them
+class TxComm : public corelib::Comm
+{
+  public:
+    static const uint8_t Depth = 8;
+    // Frames to be read
+    corelib::Frame rx[Depth];
+    uint8_t rxHead = 0;
+    uint8_t rxTail = 0;
+    // Frames written
+    corelib::Frame tx[32];
+    uint8_t written = 0;
+    // Writes accepted before the transport refuses them, -1 accepts every write
+    int accept = -1;
+    // A message of this many bytes is published each iteration
+    int publishLength = 0;
+
+    void push(const corelib::Frame& frame){
+      rx[rxTail++ % Depth] = frame;
+    }
+
+    void reset(){
+      outFrames.clear();
+      buffer.outMessageLength = 0;
+      written = 0;
+      accept = -1;
+      publishLength = 0;
+      resetStats();
+    }
+
+    bool publishMessage(corelib::Buffer* b){
+      if(publishLength == 0){
+        return false;
+      }
+      memset(b->outBuffer, 0xB0, publishLength);
+      b->outMessageLength = publishLength;
+      publishLength = 0;
+      return true;
+    }
+
+    corelib::HandleMessageState respond(corelib::Buffer* b){
+      b->outBuffer[0] = 0xA0;
+      b->outMessageLength = 1;
+      return corelib::HandleMessageState::OK;
+    }
+
+    auto testProcessWrite(){
+      return processWrite();
+    }
+
+    auto testProcessOutgoingMessage(corelib::TxLane lane, int length){
+      memset(buffer.outBuffer, 0xC0, length);
+      buffer.outMessageLength = length;
+      return processOutgoingMessage(lane);
+    }
+
+  protected:
+    // Function.h interface
+    void performInitialise(){
+      initialised = true;
+    }
+
+    // Comms.h interface
+    bool read(uint8_t* buffer){
+      if(rxHead == rxTail){
+        return false;
+      }
+      memcpy(buffer, &rx[rxHead++ % Depth], 64);
+      return true;
+    }
+    bool write(const uint8_t* buffer){
+      if(accept == 0){
+        return false;
+      }
+      if(accept > 0){
+        accept--;
+      }
+      memcpy(&tx[written++], buffer, sizeof(corelib::Frame));
+      return true;
+    }
+};
+
+void setup_test();
+void run_tests();
+void test_lanes_order(void);
+void test_bulk_leaves_room(void);
+void test_resume_after_failed_write(void);
+void test_frames_per_iteration(void);
+void test_response_overtakes_publish(void);
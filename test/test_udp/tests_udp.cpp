@@ -0,0 +1,165 @@
+#include "tests_udp.h"
+
+#if defined (__linux__)
+// The messages the host publishes
+uint8_t outgoing[128];
+int outgoingLength = 0;
+uint8_t outgoingCount = 0;
+// The last message the host received
+uint8_t received[150];
+int receivedLength = 0;
+uint32_t receivedCount = 0;
+
+bool publish(corelib::Buffer* b)
+{
+  if(outgoingCount == 0){
+    return false;
+  }
+  memcpy(b->outBuffer, outgoing, outgoingLength);
+  b->outMessageLength = outgoingLength;
+  outgoingCount--;
+  return true;
+}
+
+corelib::HandleMessageState record(corelib::Buffer* b)
+{
+  memcpy(received, b->inBuffer, b->inMessageLength);
+  receivedLength = b->inMessageLength;
+  receivedCount++;
+  return corelib::HandleMessageState::OK;
+}
+
+// Echoes every message back
+corelib::HandleMessageState echo(corelib::Buffer* b)
+{
+  memcpy(b->outBuffer, b->inBuffer, b->inMessageLength);
+  b->outMessageLength = b->inMessageLength;
+  return corelib::HandleMessageState::OK;
+}
+
+// Class under test
+corelib::LinuxUdpComm host(0x01, 0x02);
+corelib::LinuxUdpComm device(0x02, 0x01);
+
+// Sets the messages the host publishes, one an iteration
+void queue(uint8_t count, int length)
+{
+  for(int i = 0; i < length; i++){
+    outgoing[i] = i + 1;
+  }
+  outgoingLength = length;
+  outgoingCount = count;
+}
+
+// Runs both ends until the host received count more messages
+void run(uint32_t count)
+{
+  const uint32_t expected = receivedCount + count;
+  for(uint8_t i = 0; i < 20 && receivedCount < expected; i++){
+    host.iterate();
+    device.iterate();
+  }
+}
+
+void setup_test()
+{
+  receivedLength = 0;
+  memset(received, 0, sizeof(received));
+}
+
+void run_tests()
+{
+  host.setPublishCallback(etl::delegate<bool(corelib::Buffer*)>::create<&publish>());
+  host.setHandleMessageCallback(etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::create<&record>());
+  device.setHandleMessageCallback(etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::create<&echo>());
+
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_batched_calls);
+  RUN_TEST(test_malformed_datagrams);
+  UNITY_END(); // stop unit testing
+}
+
+void test_round_trip(void)
+{
+  setup_test();
+
+  TEST_ASSERT_TRUE(device.open(0));
+  TEST_ASSERT_TRUE(host.open(0));
+  TEST_ASSERT_TRUE(device.localPort() != 0);
+  TEST_ASSERT_TRUE(host.setPeer("127.0.0.1", device.localPort()));
+  host.initialise();
+  device.initialise();
+
+  // The device answers the address the host sent from
+  queue(1, 99);
+  run(1);
+  TEST_ASSERT_EQUAL(1, receivedCount);
+  TEST_ASSERT_EQUAL(99, receivedLength);
+  for(int i = 0; i < 99; i++){
+    TEST_ASSERT_EQUAL(i + 1, received[i]);
+  }
+  TEST_ASSERT_EQUAL(0, host.pending());
+  TEST_ASSERT_EQUAL(0, device.malformed());
+}
+
+void test_batched_calls(void)
+{
+  setup_test();
+
+  // Three messages of three frames wait for the device
+  queue(3, 120);
+  for(uint8_t i = 0; i < 3; i++){
+    host.iterate();
+  }
+  TEST_ASSERT_EQUAL(0, outgoingCount);
+  const uint32_t receiveCalls = device.receiveCalls();
+  const uint32_t sendCalls = device.sendCalls();
+  device.iterate();
+  // Nine frames in, nine frames out, a call each way
+  TEST_ASSERT_EQUAL(receiveCalls + 1, device.receiveCalls());
+  TEST_ASSERT_EQUAL(sendCalls + 1, device.sendCalls());
+  const uint32_t count = receivedCount;
+  host.iterate();
+  TEST_ASSERT_EQUAL(count + 3, receivedCount);
+  TEST_ASSERT_EQUAL(120, receivedLength);
+}
+
+void test_malformed_datagrams(void)
+{
+  setup_test();
+
+  // Datagrams which are not frames are counted and skipped
+  const int raw = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in to = {};
+  to.sin_family = AF_INET;
+  to.sin_port = htons(device.localPort());
+  inet_pton(AF_INET, "127.0.0.1", &to.sin_addr);
+  const uint8_t garbage[20] = {corelib::WireMarker, 0x01};
+  sendto(raw, garbage, sizeof(garbage), 0, reinterpret_cast<sockaddr*>(&to), sizeof(to));
+  sendto(raw, garbage, 3, 0, reinterpret_cast<sockaddr*>(&to), sizeof(to));
+  close(raw);
+
+  queue(1, 10);
+  run(1);
+  TEST_ASSERT_EQUAL(2, device.malformed());
+  TEST_ASSERT_EQUAL(10, receivedLength);
+}
+#else
+void setup_test() {}
+
+void run_tests()
+{
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  UNITY_END(); // stop unit testing
+}
+#endif
+
+void setUp (void) {}
+
+void tearDown (void) {}
+
+int main(int argc, char **argv) {
+  run_tests();
+  return 0;
+}
@@ -0,0 +1,17 @@
+/**
+ * @file tests_udp.h
+ *
+ * @brief Tests the UDP transport over the loopback interface.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "udp.h"
+
+void setup_test();
+void run_tests();
+void test_round_trip(void);
+void test_batched_calls(void);
+void test_malformed_datagrams(void);
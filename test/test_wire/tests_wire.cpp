@@ -0,0 +1,251 @@
+#include "tests_wire.h"
+
+// The last message each side handled
+int deviceLength = 0;
+int hostLength = 0;
+uint8_t hostMessage[150];
+
+// The message the host publishes next
+uint8_t outgoing[128];
+int outgoingLength = 0;
+
+bool publish(corelib::Buffer* b)
+{
+  if(outgoingLength == 0){
+    return false;
+  }
+  memcpy(b->outBuffer, outgoing, outgoingLength);
+  b->outMessageLength = outgoingLength;
+  outgoingLength = 0;
+  return true;
+}
+
+corelib::HandleMessageState record(corelib::Buffer* b)
+{
+  memcpy(hostMessage, b->inBuffer, b->inMessageLength);
+  hostLength = b->inMessageLength;
+  return corelib::HandleMessageState::OK;
+}
+
+// Echoes every message back
+corelib::HandleMessageState echo(corelib::Buffer* b)
+{
+  deviceLength = b->inMessageLength;
+  memcpy(b->outBuffer, b->inBuffer, b->inMessageLength);
+  b->outMessageLength = b->inMessageLength;
+  return corelib::HandleMessageState::OK;
+}
+
+// Class under test
+Link toDevice;
+Link toHost;
+WireComm<V1Config> host(toHost, toDevice, 0x01, 0x02);
+WireComm<V1Config> device(toDevice, toHost, 0x02, 0x01);
+Link fixedToDevice;
+Link fixedToHost;
+WireComm<corelib::CommConfig<>> fixedHost(fixedToHost, fixedToDevice, 0x01, 0x02);
+WireComm<corelib::CommConfig<>> fixedDevice(fixedToDevice, fixedToHost, 0x02, 0x01);
+
+template<typename TComm>
+void setup(TComm& hostComm, TComm& deviceComm)
+{
+  hostComm.setPublishCallback(etl::delegate<bool(corelib::Buffer*)>::create<&publish>());
+  hostComm.setHandleMessageCallback(etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::create<&record>());
+  deviceComm.setHandleMessageCallback(etl::delegate<corelib::HandleMessageState(corelib::Buffer*)>::create<&echo>());
+  hostComm.initialise();
+  deviceComm.initialise();
+}
+
+// Publishes a message of length bytes from the host and runs both ends until it is echoed
+template<typename TComm>
+void exchange(TComm& hostComm, TComm& deviceComm, int length)
+{
+  for(int i = 0; i < length; i++){
+    outgoing[i] = i + 1;
+  }
+  outgoingLength = length;
+  hostLength = 0;
+  for(uint8_t i = 0; i < 10 && hostLength == 0; i++){
+    hostComm.iterate();
+    deviceComm.iterate();
+  }
+}
+
+// Frames whose crc did not match
+template<typename TComm>
+uint32_t mismatches(const TComm& comm)
+{
+  return comm.getStats().readStates[static_cast<uint8_t>(corelib::ReadState::MISMATCH_CRC)];
+}
+
+corelib::Frame sample(uint8_t length)
+{
+  corelib::Frame frame;
+  frame.preamble = corelib::Preamble::DATA;
+  frame.payloadLength = length;
+  frame.destinationAddress = 0x02;
+  frame.sourceAddress = 0x01;
+  frame.frameID = 0x12345678;
+  frame.frameOrder = 2;
+  frame.frameTotal = 2;
+  for(uint8_t i = 0; i < corelib::payloadSize(frame); i++){
+    frame.payload[i] = 0xA0 + i;
+  }
+  frame.crc = 0xCAFEF00D;
+  return frame;
+}
+
+void setup_test()
+{
+  toDevice.bytes = toHost.bytes = 0;
+  fixedToDevice.bytes = fixedToHost.bytes = 0;
+  deviceLength = 0;
+}
+
+void run_tests()
+{
+  setup(host, device);
+  setup(fixedHost, fixedDevice);
+
+  UNITY_BEGIN(); // IMPORTANT LINE!
+  RUN_TEST(test_fixed_layout);
+  RUN_TEST(test_v1_round_trip);
+  RUN_TEST(test_v1_rejects_malformed);
+  RUN_TEST(test_exact_message_lengths);
+  RUN_TEST(test_fixed_compatibility);
+  UNITY_END(); // stop unit testing
+}
+
+void test_fixed_layout(void)
+{
+  setup_test();
+
+  // The fields sit at their USB offsets, little endian
+  const corelib::Frame frame = sample(0);
+  uint8_t data[corelib::WireMaxSize];
+  TEST_ASSERT_EQUAL(64, corelib::encodeFrame(frame, data, corelib::WireFormat::FIXED));
+  TEST_ASSERT_EQUAL(0x01, data[0]);
+  TEST_ASSERT_EQUAL(0x00, data[1]);
+  TEST_ASSERT_EQUAL(0x02, data[2]);
+  TEST_ASSERT_EQUAL(0x78, data[4]);
+  TEST_ASSERT_EQUAL(0x12, data[7]);
+  TEST_ASSERT_EQUAL(0xA0, data[10]);
+  TEST_ASSERT_EQUAL(0x0D, data[60]);
+  TEST_ASSERT_EQUAL(0xCA, data[63]);
+
+  corelib::Frame decoded;
+  TEST_ASSERT_TRUE(corelib::decodeFrame(data, 64, decoded));
+  TEST_ASSERT_EQUAL(0, memcmp(&frame, &decoded, sizeof(frame)));
+  TEST_ASSERT_EQUAL(50, corelib::payloadSize(decoded));
+  TEST_ASSERT_FALSE(corelib::decodeFrame(data, 63, decoded));
+}
+
+void test_v1_round_trip(void)
+{
+  setup_test();
+
+  uint8_t data[corelib::WireMaxSize];
+  const corelib::Frame frame = sample(6);
+  TEST_ASSERT_EQUAL(21, corelib::wireSize(frame));
+  TEST_ASSERT_EQUAL(21, corelib::encodeFrame(frame, data));
+  TEST_ASSERT_EQUAL(corelib::WireMarker, data[0]);
+  TEST_ASSERT_EQUAL(0x01, data[1]);
+  TEST_ASSERT_EQUAL(0x78, data[4]);
+  TEST_ASSERT_EQUAL(6, data[10]);
+  TEST_ASSERT_EQUAL(0xA5, data[16]);
+  TEST_ASSERT_EQUAL(0x0D, data[17]);
+  corelib::Frame decoded;
+  memset(decoded.payload, 0xFF, sizeof(decoded.payload));
+  TEST_ASSERT_TRUE(corelib::decodeFrame(data, 21, decoded));
+  // Decodes to the frame as it was sent, zero padded
+  TEST_ASSERT_EQUAL(0, memcmp(&frame, &decoded, sizeof(frame)));
+
+  // A whole payload is 50 on the wire and zero in the frame
+  const corelib::Frame whole = sample(0);
+  TEST_ASSERT_EQUAL(65, corelib::encodeFrame(whole, data));
+  TEST_ASSERT_EQUAL(50, data[10]);
+  TEST_ASSERT_TRUE(corelib::decodeFrame(data, 65, decoded));
+  TEST_ASSERT_EQUAL(0, decoded.payloadLength);
+  TEST_ASSERT_EQUAL(0, memcmp(&whole, &decoded, sizeof(whole)));
+}
+
+void test_v1_rejects_malformed(void)
+{
+  setup_test();
+
+  uint8_t data[corelib::WireMaxSize];
+  corelib::Frame decoded;
+  const size_t size = corelib::encodeFrame(sample(6), data);
+  TEST_ASSERT_FALSE(corelib::decodeFrame(data, 0, decoded));
+  // Truncated or with bytes to spare
+  TEST_ASSERT_FALSE(corelib::decodeFrame(data, size - 1, decoded));
+  TEST_ASSERT_FALSE(corelib::decodeFrame(data, size + 1, decoded));
+  // A later version
+  data[0] = 0x80 | (corelib::WireVersion + 1);
+  TEST_ASSERT_FALSE(corelib::decodeFrame(data, size, decoded));
+  data[0] = corelib::WireMarker;
+  // Lengths out of range
+  data[10] = 0;
+  TEST_ASSERT_FALSE(corelib::decodeFrame(data, size, decoded));
+  data[10] = 51;
+  TEST_ASSERT_FALSE(corelib::decodeFrame(data, size, decoded));
+  data[10] = 6;
+  TEST_ASSERT_TRUE(corelib::decodeFrame(data, size, decoded));
+}
+
+void test_exact_message_lengths(void)
+{
+  setup_test();
+
+  // A short request is one short frame, its length arrives with it
+  exchange(host, device, 6);
+  TEST_ASSERT_EQUAL(6, deviceLength);
+  TEST_ASSERT_EQUAL(6, hostLength);
+  TEST_ASSERT_EQUAL(21, toDevice.bytes);
+  TEST_ASSERT_EQUAL(21, toHost.bytes);
+  TEST_ASSERT_EQUAL(0, mismatches(host));
+  TEST_ASSERT_EQUAL(0, mismatches(device));
+
+  // A whole frame and a part of one
+  setup_test();
+  exchange(host, device, 99);
+  TEST_ASSERT_EQUAL(99, deviceLength);
+  TEST_ASSERT_EQUAL(99, hostLength);
+  TEST_ASSERT_EQUAL(65 + 64, toDevice.bytes);
+  for(int i = 0; i < 99; i++){
+    TEST_ASSERT_EQUAL(i + 1, hostMessage[i]);
+  }
+
+  // A message filling its last frame
+  setup_test();
+  exchange(host, device, 100);
+  TEST_ASSERT_EQUAL(100, hostLength);
+  TEST_ASSERT_EQUAL(2 * 65, toDevice.bytes);
+}
+
+void test_fixed_compatibility(void)
+{
+  setup_test();
+
+  // Every frame is 64 bytes without a length, the message is whole frames
+  exchange(fixedHost, fixedDevice, 6);
+  TEST_ASSERT_EQUAL(50, deviceLength);
+  TEST_ASSERT_EQUAL(50, hostLength);
+  TEST_ASSERT_EQUAL(64, fixedToDevice.bytes);
+  const uint8_t* packet = fixedToDevice.packets[(fixedToDevice.tail - 1) % Link::Depth];
+  TEST_ASSERT_EQUAL(0x01, packet[0]);
+  TEST_ASSERT_EQUAL(0x00, packet[1]);
+  // Padded with zeros past the message
+  TEST_ASSERT_EQUAL(6, packet[15]);
+  TEST_ASSERT_EQUAL(0, packet[16]);
+  TEST_ASSERT_EQUAL(0, mismatches(fixedHost));
+}
+
+void setUp (void) {}
+
+void tearDown (void) {}
+
+int main(int argc, char **argv) {
+  run_tests();
+  return 0;
+}
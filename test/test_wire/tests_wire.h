@@ -0,0 +1,70 @@
+/**
+ * @file tests_wire.h
+ *
+ * @brief Tests the frame wire formats and exact message lengths.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "comm.h"
+#include "wire.h"
+
+/// Frames carry the length of their payload in use
+struct V1Config : public corelib::CommConfig<> {
+  static constexpr corelib::WireFormat wireFormat = corelib::WireFormat::V1;
+};
+
+/// Packets between two Comms, one way
+struct Link {
+  static const uint8_t Depth = 8;
+  uint8_t packets[Depth][corelib::WireMaxSize];
+  size_t sizes[Depth];
+  uint8_t head = 0;
+  uint8_t tail = 0;
+  size_t bytes = 0;
+};
+
+// A Comm which serializes its frames onto a link in the configured wire format
+template<typename Config>
+class WireComm : public corelib::BasicComm<Config>
+{
+  public:
+    WireComm(Link& in, Link& out, uint8_t address, uint8_t destination) : in(in), out(out) {
+      this->address = address;
+      this->destinationDeviceAddress = destination;
+    }
+
+  protected:
+    Link& in;
+    Link& out;
+
+    // Function.h interface
+    void performInitialise(){
+      this->initialised = true;
+    }
+
+    // Comms.h interface
+    bool read(uint8_t* buffer){
+      if(in.head == in.tail){
+        return false;
+      }
+      const uint8_t slot = in.head++ % Link::Depth;
+      return corelib::decodeFrame(in.packets[slot], in.sizes[slot], *reinterpret_cast<corelib::Frame*>(buffer));
+    }
+    bool write(const uint8_t* buffer){
+      const uint8_t slot = out.tail++ % Link::Depth;
+      out.sizes[slot] = corelib::encodeFrame(*reinterpret_cast<const corelib::Frame*>(buffer), out.packets[slot], Config::wireFormat);
+      out.bytes += out.sizes[slot];
+      return true;
+    }
+};
+
+void setup_test();
+void run_tests();
+void test_fixed_layout(void);
+void test_v1_round_trip(void);
+void test_v1_rejects_malformed(void);
+void test_exact_message_lengths(void);
+void test_fixed_compatibility(void);
@@ -0,0 +1,87 @@
+/**
+ * @file main.cpp
+ *
+ * @brief Replays a capture (see capture.h) through a Comm answering with a share
+ * registry, and reports the throughput and any divergence from the captured responses.
+ * Results are printed as CSV rows of `suite,case,metric,value,unit`, as the benchmarks.
+ *
+ *  replay <capture> [--realtime] [--interface N]
+ *
+ * A stock build registers no shares, so only the control traffic (ARP, ping) answered by
+ * the Comm itself is checked and every share request diverges. To replay a unit, build
+ * with `-D REPLAY_SHARES=\"unit_shares.h\"`, a header defining
+ *
+ *  void registerReplayShares(corelib::ShareRegistry<8>& shares);
+ *
+ * which registers the unit's shares as its firmware does.
+ *
+ * @author David Cedar - david@epicecu.com
+ */
+#include <Arduino.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "replay.h"
+#include "shares.h"
+
+#if defined (REPLAY_SHARES)
+#include REPLAY_SHARES
+#endif
+
+namespace {
+
+void report(const char* mode, const char* metric, double value, const char* unit)
+{
+    printf("replay,%s,%s,%.3f,%s\n", mode, metric, value, unit);
+}
+
+} // NAMESPACE
+
+int main(int argc, char **argv) {
+    const char* path = nullptr;
+    bool realtime = false;
+    uint8_t interface = 0;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--realtime") == 0){
+            realtime = true;
+        }else if(strcmp(argv[i], "--interface") == 0 && i + 1 < argc){
+            interface = atoi(argv[++i]);
+        }else{
+            path = argv[i];
+        }
+    }
+    if(path == nullptr){
+        fprintf(stderr, "usage: replay <capture> [--realtime] [--interface N]\n");
+        return 2;
+    }
+
+    // The unit's shares answer the replayed requests
+    static corelib::ShareRegistry<8> shares;
+    static corelib::ReplayComm comm;
+    #if defined (REPLAY_SHARES)
+    registerReplayShares(shares);
+    #else
+    fprintf(stderr, "replay: built without REPLAY_SHARES, only control traffic is checked\n");
+    #endif
+    shares.attach(comm);
+    if(!comm.load(path, interface)){
+        fprintf(stderr, "replay: %s is not a capture\n", path);
+        return 2;
+    }
+    comm.initialise();
+    const corelib::ReplayReport result = comm.run(realtime);
+
+    const char* mode = realtime ? "realtime" : "fast";
+    printf("suite,case,metric,value,unit\n");
+    report(mode, "frames_in", result.framesIn, "frames");
+    report(mode, "frames_out", result.framesOut, "frames");
+    report(mode, "expected_out", result.expectedOut, "frames");
+    report(mode, "divergent", result.divergent, "frames");
+    report(mode, "first_divergence", result.firstDivergence, "index");
+    report(mode, "missing", result.missing, "frames");
+    report(mode, "extra", result.extra, "frames");
+    report(mode, "duration", result.seconds, "s");
+    report(mode, "throughput", result.seconds > 0 ? result.framesIn / result.seconds : 0, "frames/s");
+    return result.divergent == 0 && result.missing == 0 && result.extra == 0 ? 0 : 1;
+}